@@ -0,0 +1,172 @@
+#include "alias.hpp"
+#include "ir.hpp"
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+// The bytes a load or store accesses, and the size of the values in them
+int extent(const IRInstr &i) {
+    return i.is_vector() ? i.width : i.size;
+}
+
+// The two packed together, as part of a query
+int shape(const IRInstr &i) {
+    return i.width * 16 + i.size;
+}
+
+}
+
+AliasAnalysis::AliasAnalysis(const IRFunction &f, bool strict)
+    : f(f), strict(strict) {
+    index();
+    // Follow the addresses of the slots through whatever is computed from
+    // them. They escape when stored, passed or returned; an address that
+    // might be that of either of two slots lets both escape. Registers may
+    // be used above their definition in loops, so this runs to a fixed
+    // point.
+    escaped.assign(f.slots.size(), false);
+    std::vector<int> origin(f.nregs, -1);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &b: f.blocks) {
+            for (auto &i: b->instrs) {
+                int o = i.op == IR_LOCAL ? i.imm : -1;
+                for (size_t k = 0; k < i.args.size(); k++) {
+                    int s = origin[i.args[k]];
+                    if (s < 0) continue;
+                    switch (i.op) {
+                    case IR_LOAD:
+                    case IR_VLOAD:
+                    case IR_BR:
+                    case IR_SWITCH:
+                        break;
+                    case IR_STORE:
+                    case IR_VSTORE:
+                        if (k == 1) escaped[s] = true;
+                        break;
+                    case IR_CALL:
+                    case IR_RET:
+                        escaped[s] = true;
+                        break;
+                    default:
+                        if (o >= 0 && o != s) escaped[o] = escaped[s] = true;
+                        o = s;
+                    }
+                }
+                if (o < 0 || i.dst < 0 || origin[i.dst] == o) continue;
+                if (origin[i.dst] >= 0) {
+                    escaped[origin[i.dst]] = escaped[o] = true;
+                    continue;
+                }
+                origin[i.dst] = o;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Find the instruction defining each register, again when the passes
+// asking have added registers since
+void AliasAnalysis::index() {
+    def.assign(f.nregs, NULL);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.dst >= 0) def[i.dst] = &i;
+        }
+    }
+    locations.resize(f.nregs);
+    located.resize(f.nregs);
+}
+
+AliasAnalysis::Location AliasAnalysis::locate(int r) {
+    if ((size_t)r >= def.size()) index();
+    if (located[r]) return locations[r];
+    Location l;
+    l.base = r;
+    // What defines nothing we know of, like a phi, is a parameter for us
+    auto d = def[r];
+    IROp op = d ? d->op : IR_PARAM;
+    auto is_const = [&](int a, long &v) {
+        if (!def[a] || def[a]->op != IR_CONST) return false;
+        v = def[a]->imm;
+        return true;
+    };
+    long c;
+    if (op == IR_LOCAL) {
+        l.kind = Location::SLOT;
+        l.base = d->imm;
+    } else if (op == IR_GLOBAL) {
+        l.kind = Location::GLOBAL;
+        l.base = globals.emplace(d->sym, globals.size()).first->second;
+    } else if (op == IR_COPY) {
+        l = locate(d->args[0]);
+    } else if ((op == IR_ADD || op == IR_SUB) && is_const(d->args[1], c)) {
+        l = locate(d->args[0]);
+        l.offset += op == IR_ADD ? c : -c;
+    } else if (op == IR_ADD && is_const(d->args[0], c)) {
+        l = locate(d->args[1]);
+        l.offset += c;
+    } else if (op == IR_ADD || op == IR_SUB) {
+        // An index added to the address of a slot or a global stays
+        // within it; which side is the pointer isn't known otherwise
+        Location x = locate(d->args[0]), y;
+        if (op == IR_ADD) y = locate(d->args[1]);
+        if (x.kind != Location::UNKNOWN && y.kind == Location::UNKNOWN) {
+            l = x;
+            l.exact = false;
+        } else if (x.kind == Location::UNKNOWN &&
+                   y.kind != Location::UNKNOWN) {
+            l = y;
+            l.exact = false;
+        }
+    }
+    located[r] = true;
+    locations[r] = l;
+    return l;
+}
+
+bool AliasAnalysis::disjoint(const Location &a, long extent_a, int size_a,
+                             const Location &b, long extent_b,
+                             int size_b) const {
+    typedef Location L;
+    if (a.kind != L::UNKNOWN && b.kind != L::UNKNOWN) {
+        if (a.kind != b.kind || a.base != b.base) return true;
+        return a.exact && b.exact &&
+               (a.offset + extent_a <= b.offset ||
+                b.offset + extent_b <= a.offset);
+    }
+    if (a.kind == L::SLOT) return !escaped[a.base];
+    if (b.kind == L::SLOT) return !escaped[b.base];
+    if (a.kind != L::UNKNOWN || b.kind != L::UNKNOWN) return false;
+    if (a.base == b.base && a.exact && b.exact)
+        return a.offset + extent_a <= b.offset ||
+               b.offset + extent_b <= a.offset;
+    return strict && size_a != size_b && size_a != 1 && size_b != 1;
+}
+
+bool AliasAnalysis::may_alias(const IRInstr &a, const IRInstr &b) {
+    stats.queries++;
+    Query q = {a.args[0], b.args[0], shape(a), shape(b)};
+    if (q.a > q.b || (q.a == q.b && q.size_a > q.size_b)) {
+        std::swap(q.a, q.b);
+        std::swap(q.size_a, q.size_b);
+    }
+    auto it = cache.find(q);
+    if (it != cache.end()) {
+        stats.cached++;
+        return it->second;
+    }
+    bool alias = !disjoint(locate(a.args[0]), extent(a), a.size,
+                           locate(b.args[0]), extent(b), b.size);
+    stats.disjoint += !alias;
+    cache.emplace(q, alias);
+    return alias;
+}
+
+bool AliasAnalysis::call_may_access(const IRInstr &a) {
+    Location l = locate(a.args[0]);
+    return l.kind != Location::SLOT || escaped[l.base];
+}
@@ -0,0 +1,76 @@
+#ifndef ALIAS_HPP
+#define ALIAS_HPP
+#include "ir.hpp"
+#include "opt.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// May-alias queries between the memory accesses of an IRFunction. Each
+// address is taken apart into a base and an offset by following the
+// additions of constants back to where it comes from: a frame slot, a
+// global, or a register the analysis knows nothing about, like a pointer
+// loaded or passed in. Indexing by a register that isn't a constant keeps
+// the base but loses the offset. Two accesses may alias unless
+//
+// - their bases are different slots or globals, or a slot and a global,
+// - one is to a slot whose address doesn't escape, as it only ever serves
+//   to load and store, and the other is through an unknown pointer,
+// - they are at constant offsets from the same base and don't overlap,
+// - with @strict, they are both through unknown pointers, of different
+//   sizes and neither of them one byte: an int can't be reached through a
+//   long pointer, while a char pointer may read anything. The lowering
+//   only stores to slots in pieces of other sizes than their type, which
+//   is why the rule isn't applied to them.
+//
+// Registers are assigned once, so what an address is taken apart into is
+// found once, and so is the answer to each query. The cache makes the
+// passes asking about every pair of accesses in a block, or in a loop,
+// linear in the number of distinct pairs.
+class AliasAnalysis {
+public:
+    AliasAnalysis(const IRFunction &f, bool strict);
+    // Whether the loads and stores @a and @b, scalar or vector, may access
+    // the same bytes
+    bool may_alias(const IRInstr &a, const IRInstr &b);
+    // Whether a call may access what the load or store @a does
+    bool call_may_access(const IRInstr &a);
+    AliasStats stats;
+private:
+    struct Location {
+        enum Kind { SLOT, GLOBAL, UNKNOWN };
+        Kind kind = UNKNOWN;
+        int base = -1;     // slot, global or register
+        long offset = 0;
+        bool exact = true;  // whether @offset is all there is
+    };
+    struct Query {
+        int a, b;
+        int size_a, size_b;
+        bool operator==(const Query &o) const {
+            return a == o.a && b == o.b && size_a == o.size_a &&
+                   size_b == o.size_b;
+        }
+    };
+    struct QueryHash {
+        size_t operator()(const Query &q) const {
+            return ((size_t)q.a * 1000003 ^ q.b) * 1000003 ^
+                   (q.size_a << 8 | q.size_b);
+        }
+    };
+
+    const IRFunction &f;
+    bool strict;
+    std::vector<const IRInstr *> def;
+    std::vector<Location> locations;
+    std::vector<char> located;
+    std::vector<char> escaped;  // for each slot
+    std::unordered_map<std::string, int> globals;
+    std::unordered_map<Query, bool, QueryHash> cache;
+
+    void index();
+    Location locate(int r);
+    bool disjoint(const Location &a, long extent_a, int size_a,
+                  const Location &b, long extent_b, int size_b) const;
+};
+#endif
@@ -0,0 +1,271 @@
+#include "codegen.hpp"
+#include "ir.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+
+namespace
+{
+
+const char *const mnemonics[] = {
+    "mov", "movs", "movz", "lea", "add", "sub", "imul", "and", "or", "xor",
+    "shl", "shr", "sar", "neg", "not", "cmp", "test", "cqto", "idiv", "div",
+    "set", "cmov", "jmp", "j", "call", "ret", "jmp", "push", "pop", "movdq",
+    "padd", "psub", "pmull", "pand", "por", "pxor", "movq", "punpcklqdq",
+    "vzeroupper",
+};
+
+const char *const cc_names[] = {
+    "e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae",
+};
+
+char suffix(int size) {
+    switch (size) {
+    case 1:  return 'b';
+    case 2:  return 'w';
+    case 4:  return 'l';
+    default: return 'q';
+    }
+}
+
+void appendf(std::string &out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void appendf(std::string &out, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof buf, fmt, ap);
+    va_end(ap);
+    if (n < (int)sizeof buf) {
+        out.append(buf, n);
+    } else {
+        std::string big(n + 1, '\0');
+        va_start(ap, fmt);
+        vsnprintf(&big[0], n + 1, fmt, ap);
+        va_end(ap);
+        out.append(big, 0, n);
+    }
+}
+
+std::string block_label(const MFunction &mf, const MBlock *b) {
+    return ".L." + mf.name + "." + std::to_string(b->id);
+}
+
+void print_operand(const MFunction &mf, const MOperand &o, int size,
+                   std::string &out) {
+    switch (o.kind) {
+    case MOperand::REG:
+        appendf(out, "%%%s", reg_name(o.reg, size));
+        break;
+    case MOperand::IMM:
+        appendf(out, "$%ld", o.imm);
+        break;
+    case MOperand::MEM:
+        if (o.imm) appendf(out, "%ld", o.imm);
+        appendf(out, "(%%%s)", reg_name(o.reg, 8));
+        break;
+    case MOperand::RIP:
+        out += o.sym;
+        if (o.imm) appendf(out, "%+ld", o.imm);
+        out += "(%rip)";
+        break;
+    case MOperand::SYM:
+        out += o.sym;
+        break;
+    case MOperand::BLOCK:
+        out += block_label(mf, o.block);
+        break;
+    default:
+        out += "?";
+    }
+}
+
+// AVX2 instructions are the SSE2 ones with a "v" in front, and take the
+// destination twice, as the first source
+void print_vector(const MFunction &mf, const MInstr &i, std::string &out) {
+    std::string op = mnemonics[i.op];
+    auto &src = i.ops[0], &dst = i.ops.back();
+    bool avx = i.size == 32;
+    int src_size = i.size, dst_size = i.size;
+    switch (i.op) {
+    case M_VMOV:
+        op += src.is_mem() || dst.is_mem() ? 'u' : 'a';
+        break;
+    case M_VADD:
+    case M_VSUB:
+    case M_VMUL:
+        op += " bwxdxxxq"[i.src_size];
+        break;
+    case M_MOVQ:
+        src_size = 8;
+        dst_size = 16;
+        break;
+    case M_VBCAST:
+        if (avx) op = "pbroadcastq";
+        src_size = 16;
+        break;
+    default:
+        break;
+    }
+    if (i.op == M_VZEROUPPER) avx = false;
+    out += avx ? "\tv" : "\t";
+    out += op;
+    if (i.op == M_VZEROUPPER) {
+        out += "\n";
+        return;
+    }
+    out += " ";
+    print_operand(mf, src, src_size, out);
+    bool three = avx && i.op >= M_VADD && i.op <= M_VXOR;
+    if (three || i.ops.size() > 1 || i.op == M_VBCAST) {
+        out += ", ";
+        print_operand(mf, dst, dst_size, out);
+    }
+    if (three) {
+        out += ", ";
+        print_operand(mf, dst, i.size, out);
+    }
+    out += "\n";
+}
+
+void print_instr(const MFunction &mf, const MInstr &i, std::string &out) {
+    if (i.op >= M_VMOV) {
+        print_vector(mf, i, out);
+        return;
+    }
+    std::string op = mnemonics[i.op];
+    // Size of the source register operand, if different from the operation's
+    int src_size = i.size;
+    switch (i.op) {
+    case M_MOV:
+        if (i.ops[0].kind == MOperand::IMM && i.size == 8 &&
+            !fits_int(i.ops[0].imm))
+            op = "movabs";
+        op += suffix(i.size);
+        break;
+    case M_MOVSX:
+    case M_MOVZX:
+        // movzlq doesn't exist, a 32-bit mov zero extends
+        op += suffix(i.src_size);
+        op += suffix(i.size);
+        src_size = i.src_size;
+        break;
+    case M_SHL:
+    case M_SHR:
+    case M_SAR:
+        op += suffix(i.size);
+        src_size = 1;  // the count is in %cl
+        break;
+    case M_SETCC:
+    case M_JCC:
+        op += cc_names[i.cc];
+        break;
+    case M_CMOV:
+        op += cc_names[i.cc];
+        op += suffix(i.size);
+        break;
+    case M_CQO:
+    case M_JMP:
+    case M_RET:
+    case M_TAILCALL:
+        break;
+    case M_CALL:
+        if (i.ops[0].kind != MOperand::SYM) op += " *";
+        break;
+    default:
+        op += suffix(i.size);
+    }
+    out += "\t";
+    out += op;
+    for (size_t k = 0; k < i.ops.size(); k++) {
+        if (k) out += ", ";
+        else if (op.back() != '*') out += " ";
+        print_operand(mf, i.ops[k], k + 1 < i.ops.size() ? src_size : i.size,
+                      out);
+    }
+    out += "\n";
+}
+
+void print_string(const std::string &s, std::string &out) {
+    out += "\"";
+    for (unsigned char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c >= 32 && c < 127) {
+            out += c;
+        } else {
+            appendf(out, "\\%03o", c);
+        }
+    }
+    out += "\"";
+}
+
+}
+
+void print_global(const IRGlobal &g, std::string &out) {
+    if (!g.is_static) appendf(out, "\t.globl %s\n", g.name.c_str());
+    if (g.is_string) out += "\t.section .rodata\n";
+    else if (g.is_zero) out += "\t.bss\n";
+    else out += "\t.data\n";
+    if (g.align > 1) appendf(out, "\t.align %d\n", g.align);
+    if (!g.is_static) {
+        appendf(out, "\t.type %s, @object\n", g.name.c_str());
+        appendf(out, "\t.size %s, %ld\n", g.name.c_str(), g.size);
+    }
+    appendf(out, "%s:\n", g.name.c_str());
+    if (g.is_zero) {
+        appendf(out, "\t.zero %ld\n", g.size);
+        return;
+    }
+    if (g.is_string) {
+        out += "\t.string ";
+        print_string(g.data.substr(0, g.data.size() - 1), out);
+        out += "\n";
+        return;
+    }
+    long off = 0;
+    auto reloc = g.relocs.begin();
+    while (off < g.size) {
+        if (reloc != g.relocs.end() && reloc->offset == off) {
+            appendf(out, "\t.quad %s", reloc->sym.c_str());
+            if (reloc->addend) appendf(out, "%+ld", reloc->addend);
+            out += "\n";
+            off += 8;
+            ++reloc;
+            continue;
+        }
+        long end = reloc != g.relocs.end() ? reloc->offset : g.size;
+        long v = 0;
+        int n = end - off;
+        if (n == 8 || n == 4 || n == 2 || n == 1) {
+            for (int i = n - 1; i >= 0; i--)
+                v = v << 8 | (unsigned char)g.data[off + i];
+            const char *dir = n == 8 ? "quad" : n == 4 ? "long"
+                            : n == 2 ? "short" : "byte";
+            appendf(out, "\t.%s %ld\n", dir, v);
+        } else {
+            out += "\t.ascii ";
+            print_string(g.data.substr(off, n), out);
+            out += "\n";
+        }
+        off = end;
+    }
+}
+
+void print_function(const MFunction &mf, std::string &out) {
+    const char *name = mf.name.c_str();
+    out += "\t.text\n";
+    if (mf.is_global) appendf(out, "\t.globl %s\n", name);
+    appendf(out, "\t.type %s, @function\n", name);
+    appendf(out, "%s:\n", name);
+    for (auto &b: mf.blocks) {
+        if (b.get() != mf.blocks[0].get())
+            appendf(out, "%s:\n", block_label(mf, b.get()).c_str());
+        for (auto &i: b->instrs) print_instr(mf, i, out);
+    }
+    appendf(out, "\t.size %s, .-%s\n", name, name);
+}
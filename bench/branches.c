@@ -0,0 +1,46 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int data[8192];
+
+int main(int argc, char **argv) {
+    int i;
+    int k;
+    int rounds;
+    int lo;
+    int hi;
+    int inside;
+    int edges;
+    long sum;
+    unsigned h;
+    rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    h = 2166136261;
+    for (i = 0; i < 8192; i++) {
+        h = (h ^ i) * 16777619;
+        data[i] = (h >> 7) % 2001 - 1000;
+    }
+    lo = 0;
+    hi = 0;
+    inside = 0;
+    edges = 0;
+    sum = 0;
+    for (k = 0; k < rounds; k++) {
+        for (i = 1; i < 8192; i++) {
+            int x;
+            int p;
+            int c;
+            x = data[i];
+            p = data[i - 1];
+            lo = x < lo ? x : lo;
+            hi = x > hi ? x : hi;
+            c = x < -k ? -k : x > k ? k : x;
+            sum = sum + c + (x < 0 ? -x : x);
+            inside = inside + (x > -500 && x < 500);
+            edges = edges + ((x < 0) != (p < 0) || x == p);
+            if (x > 0 && p > 0 || x < -900)
+                sum = sum + 1;
+        }
+    }
+    printf("%d %d %d %d %ld\n", lo, hi, inside, edges, sum);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Count the conditional jumps, cmovs and setccs in the code generated for
+# each benchmark, with and without -fno-if-conversion, and time the native
+# runs of both. Conditions made selects and setcc leave fewer jumps for
+# the branch predictor to get wrong; branches.c is the one made of them.
+# The counts are given as jcc/cmov/set.
+#
+# Usage: bench/branches.sh [files...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- bench/*.c
+
+now() {
+    date +%s.%N
+}
+
+# Print the numbers of jcc, cmov and setcc instructions in the assembly
+count() {
+    "$LUCC" -S -o /dev/stdout "$@" | awk '
+        $1 ~ /^j/ && $1 != "jmp" { jcc++ }
+        $1 ~ /^cmov/ { cmov++ }
+        $1 ~ /^set/ { set++ }
+        END { printf "%d %d %d\n", jcc, cmov, set }'
+}
+
+status=0
+printf '%-8s %17s %17s %9s %9s %8s\n' name jcc/cmov/set no-ifcvt default \
+    no-ifcvt speedup
+for f in "$@"; do
+    name=$(basename "$f" .c)
+    on=$(count "$f")
+    off=$(count -fno-if-conversion "$f")
+    start=$(now)
+    expected=$("$LUCC" --run "$f")
+    mid=$(now)
+    out=$("$LUCC" -fno-if-conversion --run "$f")
+    end=$(now)
+    if [ "$out" != "$expected" ]; then
+        echo "$name: -fno-if-conversion printed '$out'," \
+             "expected '$expected'" >&2
+        status=1
+    fi
+    echo "$on $off $start $mid $end" | awk -v name="$name" '{
+        d = $8 - $7; o = $9 - $8
+        printf "%-8s %17s %17s %9.3f %9.3f %8.2f\n", name,
+            $1 "/" $2 "/" $3, $4 "/" $5 "/" $6, d, o, o / d
+    }'
+done
+exit $status
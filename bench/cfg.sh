@@ -0,0 +1,62 @@
+#!/bin/sh
+# Report how the control flow analyses of --print-cfg scale with the size of
+# a function: a state machine of N states, a switch in a loop with gotos
+# between the states, for N doubling from 1000 up to MAX (default 64000).
+# The time per block should stay about the same. Build lucc with
+# optimization to get meaningful numbers:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/cfg.sh [MAX]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+MAX=${1:-64000}
+tmp=$(mktemp -d /tmp/lucc-cfg.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+gen() {
+    awk -v n="$1" 'BEGIN {
+        print "int run(int state, int steps) {"
+        print "    int acc;"
+        print "    acc = 0;"
+        print "    while (steps-- > 0) {"
+        print "        switch (state) {"
+        for (i = 0; i < n; i++) {
+            printf "        case %d:\n", i
+            printf "        s%d:\n", i
+            printf "            acc = acc * 3 + %d;\n", i
+            printf "            if (acc & 1) {\n"
+            printf "                state = %d;\n", (i * 7 + 1) % n
+            printf "                break;\n"
+            printf "            }\n"
+            printf "            if (acc & 2) goto s%d;\n", (i * 13 + 5) % n
+            printf "            state = %d;\n", (i + 1) % n
+            printf "            continue;\n"
+        }
+        print "        }"
+        print "        if (acc > 1000000) return acc;"
+        print "    }"
+        print "    return acc;"
+        print "}"
+    }'
+}
+
+status=0
+printf '%8s %8s %9s %11s %10s %8s %12s\n' \
+    states blocks loops "dom ms" "df ms" "loop ms" "ns/block"
+n=1000
+while [ "$n" -le "$MAX" ]; do
+    gen "$n" > "$tmp/sm.c"
+    "$LUCC" --print-cfg --stats -o /dev/null "$tmp/sm.c" \
+        2> "$tmp/stats" || status=1
+    grep '^run: .* loops,' "$tmp/stats" | awk -v n="$n" '{
+        # run: B blocks, L loops, cfg T ms, dominators T ms, frontiers T ms,
+        # loops T ms
+        total = $7 + $10 + $13 + $16
+        printf "%8d %8d %9d %11.3f %10.3f %8.3f %12.1f\n", n, $2, $4,
+            $10, $13, $16, total * 1e6 / $2
+    }'
+    n=$((n * 2))
+done
+exit $status
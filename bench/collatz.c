@@ -0,0 +1,33 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int steps(long n) {
+    int count;
+    count = 0;
+    while (n != 1) {
+        if (n % 2 == 0) n = n / 2;
+        else n = 3 * n + 1;
+        count++;
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    int limit;
+    int i;
+    int best;
+    int best_steps;
+    int s;
+    limit = argc > 1 ? atoi(argv[1]) : 200000;
+    best = 1;
+    best_steps = 0;
+    for (i = 1; i < limit; i++) {
+        s = steps(i);
+        if (s > best_steps) {
+            best = i;
+            best_steps = s;
+        }
+    }
+    printf("%d %d\n", best, best_steps);
+    return 0;
+}
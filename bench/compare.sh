@@ -0,0 +1,34 @@
+#!/bin/sh
+# Run each benchmark natively with --run, with the default optimizations
+# and with the given flags, e.g. -fno-gvn, check that both print the same,
+# and report the times in seconds and the speedup of the default.
+#
+# Usage: bench/compare.sh <flags...>
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || { echo "usage: $0 <flags...>" >&2; exit 1; }
+
+now() {
+    date +%s.%N
+}
+
+status=0
+printf '%-8s %9s %9s %8s\n' name default "$*" speedup
+for f in bench/*.c; do
+    name=$(basename "$f" .c)
+    start=$(now)
+    expected=$("$LUCC" --run "$f")
+    mid=$(now)
+    out=$("$LUCC" "$@" --run "$f")
+    end=$(now)
+    if [ "$out" != "$expected" ]; then
+        echo "$name: $* printed '$out', expected '$expected'" >&2
+        status=1
+    fi
+    echo "$start $mid $end" | awk -v name="$name" '{
+        d = $2 - $1; o = $3 - $2
+        printf "%-8s %9.3f %9.3f %8.2f\n", name, d, o, o / d
+    }'
+done
+exit $status
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare compile speed with and without -O0-fast on a program of N
+# functions (default 2000) made by bench/genfuncs.sh, and check that both
+# builds print the same. Build lucc with optimization to
+# get meaningful numbers:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/compile.sh [N]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+N=${1:-2000}
+src=$(mktemp /tmp/lucc-compile.XXXXXX.c)
+trap 'rm -f "$src"' EXIT
+
+bench/genfuncs.sh "$N" > "$src"
+lines=$(wc -l < "$src")
+
+now() {
+    date +%s.%N
+}
+
+status=0
+expected=
+printf '%-10s %8s %9s %12s\n' mode lines seconds lines/sec
+for mode in -O0-fast ""; do
+    start=$(now)
+    "$LUCC" -S $mode -o /dev/null "$src" || status=1
+    end=$(now)
+    out=$("$LUCC" --run $mode "$src")
+    if [ -z "$expected" ]; then
+        expected=$out
+    elif [ "$out" != "$expected" ]; then
+        echo "${mode:-default}: printed '$out', expected '$expected'" >&2
+        status=1
+    fi
+    echo "$start $end" | awk -v mode="${mode:-default}" -v lines="$lines" '{
+        t = $2 - $1
+        printf "%-10s %8d %9.3f %12.0f\n", mode, lines, t, lines / t
+    }'
+done
+exit $status
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Report how solving liveness and reaching definitions scales with the
+# number of local variables: a function of N locals, each updated under a
+# condition inside one loop, for N doubling from 500 up to MAX (default
+# 8000). The visits per block should stay about the same. Liveness only
+# has the few registers live across blocks to track, and stays linear; the
+# sets of reaching definitions take a bit for each block and definition,
+# so their time and memory grow with the square of the size. Build lucc
+# with optimization to get meaningful numbers:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/dataflow.sh [MAX]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+MAX=${1:-8000}
+tmp=$(mktemp -d /tmp/lucc-dataflow.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+gen() {
+    awk -v n="$1" 'BEGIN {
+        print "int run(int steps) {"
+        for (i = 0; i < n; i++)
+            printf "    int v%d;\n", i
+        print "    int t;"
+        print "    v0 = steps;"
+        print "    for (t = 0; t < steps; t++) {"
+        for (i = 1; i < n; i++) {
+            printf "        if ((t + %d) %% 3)\n", i
+            printf "            v%d = v%d + t;\n", i, i - 1
+        }
+        print "    }"
+        printf "    return v%d;\n", n - 1
+        print "}"
+    }'
+}
+
+status=0
+printf '%8s %8s %8s %12s %9s %9s %10s\n' \
+    locals blocks defs visits/block "live ms" "reach ms" KiB
+n=500
+while [ "$n" -le "$MAX" ]; do
+    gen "$n" > "$tmp/locals.c"
+    "$LUCC" --print-dataflow --stats -o /dev/null "$tmp/locals.c" \
+        2> "$tmp/stats" || status=1
+    grep '^run: .* visits' "$tmp/stats" | awk -v n="$n" '{
+        # run: B blocks, X of R registers, D definitions, liveness V visits
+        # T ms, reaching definitions V visits T ms, M bytes
+        printf "%8d %8d %8d %12.2f %9.3f %9.3f %10.0f\n", n, $2, $8,
+            $17 / $2, $13, $19, $21 / 1024
+    }'
+    n=$((n * 2))
+done
+exit $status
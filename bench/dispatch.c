@@ -0,0 +1,120 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int code[32];
+long stack[64];
+
+long mix(long h, long v) {
+    h = h ^ v;
+    h = h * 1099511628211;
+    h = h ^ (h >> 29);
+    if (h < 0)
+        h = -h;
+    h = h % 1000000007;
+    if (v & 1)
+        h = h + (v & 255);
+    else
+        h = h - (v & 127);
+    if (h > 999999999)
+        h = h - 999999999;
+    return h;
+}
+
+long run(int *pc, long n) {
+    int *start;
+    long *sp;
+    long acc;
+    start = pc;
+    sp = stack;
+    acc = 0;
+    *sp++ = n;
+    for (;;) {
+        switch (*pc++) {
+        case 0:
+            printf("%ld\n", sp[-1]);
+            break;
+        case 1:
+            if (sp[-1] == 0) {
+                printf("division by zero\n");
+                return -1;
+            }
+            sp--;
+            sp[-1] = sp[-1] / sp[0];
+            break;
+        case 2:
+            if (sp[-1] == 0) {
+                printf("division by zero\n");
+                return -1;
+            }
+            sp--;
+            sp[-1] = sp[-1] % sp[0];
+            break;
+        case 3:
+            sp--;
+            break;
+        case 4:
+            acc = sp[-1];
+            sp[-1] = sp[-2];
+            sp[-2] = acc;
+            break;
+        case 5:
+            sp[0] = sp[-1];
+            sp++;
+            break;
+        case 6:
+            sp[-1] = -sp[-1];
+            break;
+        case 7:
+            sp--;
+            sp[-1] = sp[-1] * sp[0];
+            break;
+        case 8:
+            sp--;
+            sp[-1] = sp[-1] - sp[0];
+            break;
+        case 9:
+            return acc;
+        case 10:
+            *sp++ = *pc++;
+            break;
+        case 11:
+            sp--;
+            sp[-1] = sp[-1] + sp[0];
+            break;
+        case 12:
+            acc = mix(acc, sp[-1]);
+            break;
+        case 13:
+            sp[-1] = sp[-1] - 1;
+            if (sp[-1])
+                pc = start + *pc;
+            else
+                pc++;
+            break;
+        default:
+            printf("bad opcode %d\n", pc[-1]);
+            return -1;
+        }
+        if (sp < stack || sp >= stack + 64) {
+            printf("stack overflow\n");
+            return -1;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long n;
+    int *p;
+    n = argc > 1 ? atoi(argv[1]) : 2000000;
+    p = code;
+    *p++ = 12;
+    *p++ = 10; *p++ = 5;
+    *p++ = 11;
+    *p++ = 12;
+    *p++ = 10; *p++ = -5;
+    *p++ = 11;
+    *p++ = 13; *p++ = 0;
+    *p++ = 9;
+    printf("%ld\n", run(code, n));
+    return 0;
+}
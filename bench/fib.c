@@ -0,0 +1,14 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int fib(int n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main(int argc, char **argv) {
+    int n;
+    n = argc > 1 ? atoi(argv[1]) : 32;
+    printf("%d\n", fib(n));
+    return 0;
+}
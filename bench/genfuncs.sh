@@ -0,0 +1,38 @@
+#!/bin/sh
+# Print a program of N functions (default 2000), each a few loops,
+# conditions and calls, for the compile time benchmarks.
+#
+# Usage: bench/genfuncs.sh [N]
+
+awk -v n="${1:-2000}" 'BEGIN {
+    print "int printf(char *fmt, ...);"
+    print "long table[64];"
+    for (i = 0; i < n; i++) {
+        printf "long f%d(long a, long b, int c) {\n", i
+        print "    long s;"
+        print "    int i;"
+        print "    s = a * 3 + b;"
+        print "    for (i = 0; i < c; i++) {"
+        print "        if (i % 3 == 0 && s > b)"
+        print "            s = s - (a << 2) + i;"
+        print "        else"
+        print "            s = s + table[i & 63] * 7 - b / (c + 1);"
+        print "        table[(i + s) & 63] = s ^ a;"
+        print "    }"
+        print "    while (s > 100000 || s < -100000)"
+        print "        s = s / 2;"
+        if (i > 0)
+            printf "    return s + f%d(b, s & 15, c - 1 > 0 ? c - 1 : 0) %% 5;\n", i - 1
+        else
+            print "    return s;"
+        print "}"
+    }
+    print "int main() {"
+    print "    long s;"
+    print "    s = 0;"
+    for (i = 0; i < n; i += 10)
+        printf "    s = s ^ f%d(%d, %d, 8);\n", i, i, i * 3
+    print "    printf(\"%ld\\n\", s);"
+    print "    return 0;"
+    print "}"
+}'
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Time builds with --cache-dir of a program of N functions from
+# genfuncs.sh (default 2000): without the cache, with it empty, with it
+# full and nothing changed, and after changing one function, the first,
+# the one in the middle or the last. Every function but the first calls
+# the one before it, so changing the first changes the dependencies of
+# all the others. Each output is checked against a build without the
+# cache.
+#
+# Usage: bench/incremental.sh [N] [-S|-c]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+n=${1:-2000}
+mode=${2:--S}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# Build $dir/$1.c with the flags that follow, and print the time taken
+build() {
+    src=$dir/$1.c
+    shift
+    start=$(now)
+    "$LUCC" "$mode" "$@" "$src" -o "$src.out" || exit 1
+    end=$(now)
+    echo "$start $end" | awk '{ printf "%9.3f", $2 - $1 }'
+}
+
+bench/genfuncs.sh "$n" > "$dir/base.c"
+for f in 0 $((n / 2)) $((n - 1)); do
+    # The line "s = a * 3 + b;" of f$f becomes "s = a * 5 + b;"
+    awk -v f="$f" '/^long f/ { cur = $2 }
+        cur == "f" f "(long" && /a \* 3/ { sub(/a \* 3/, "a * 5") }
+        { print }' "$dir/base.c" > "$dir/f$f.c"
+done
+
+status=0
+printf '%-10s %9s %9s\n' build clean cached
+for name in base base f0 f$((n / 2)) f$((n - 1)); do
+    label=$name
+    [ "$name" = base ] && label=${warm:+unchanged}
+    [ -n "$label" ] || label=empty
+    warm=1
+    printf '%-10s ' "$label"
+    build "$name"
+    cp "$dir/$name.c.out" "$dir/expected"
+    build "$name" --cache-dir "$dir/cache"
+    echo
+    if ! cmp -s "$dir/$name.c.out" "$dir/expected"; then
+        echo "$label: the output differs from that without the cache" >&2
+        status=1
+    fi
+done
+exit $status
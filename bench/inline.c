@@ -0,0 +1,56 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int grid[4096];
+
+int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+int min(int a, int b) {
+    return a < b ? a : b;
+}
+
+int abs(int a) {
+    return a < 0 ? -a : a;
+}
+
+int clamp(int x, int lo, int hi) {
+    return min(max(x, lo), hi);
+}
+
+int at(int x, int y) {
+    return grid[(y & 63) * 64 + (x & 63)];
+}
+
+unsigned mix(unsigned h, unsigned v) {
+    h = h ^ v;
+    h = h * 16777619;
+    return h ^ (h >> 13);
+}
+
+int main(int argc, char **argv) {
+    int i;
+    int x;
+    int y;
+    int rounds;
+    int best;
+    unsigned h;
+    rounds = argc > 1 ? atoi(argv[1]) : 300;
+    for (i = 0; i < 4096; i++) grid[i] = i * 7919 % 1000 - 500;
+    h = 2166136261;
+    best = 0;
+    for (i = 0; i < rounds; i++) {
+        for (y = 0; y < 64; y++) {
+            for (x = 0; x < 64; x++) {
+                int d;
+                d = abs(at(x + 1, y) - at(x - 1, y)) +
+                    abs(at(x, y + 1) - at(x, y - 1));
+                best = max(best, clamp(d + i, 0, 1500));
+                h = mix(h, d);
+            }
+        }
+    }
+    printf("%d %u\n", best, h);
+    return 0;
+}
@@ -0,0 +1,63 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+long x[256];
+long y[256];
+long mat[64][64];
+long vec[64];
+int hist[16];
+
+long dot(long *a, long *b) {
+    int i;
+    long s;
+    s = 0;
+    for (i = 0; i < 256; i++) s = s + a[i] * b[i];
+    return s;
+}
+
+void axpy(long k, long *a, long *b, int n) {
+    int i;
+    for (i = 0; i < n; i++) b[i] = (b[i] + k * a[i]) % 100003;
+}
+
+void matvec(long *out) {
+    int i;
+    int j;
+    long s;
+    for (i = 0; i < 64; i++) {
+        s = 0;
+        for (j = 0; j < 64; j++) s = s + mat[i][j] * vec[j];
+        out[i] = s % 1009;
+    }
+}
+
+void count(long *a, int n) {
+    int i;
+    for (i = 0; i < 16; i++) hist[i] = 0;
+    for (i = 0; i < n; i++) hist[a[i] & 15]++;
+}
+
+int main(int argc, char **argv) {
+    int i;
+    int j;
+    int rounds;
+    long check;
+    rounds = argc > 1 ? atoi(argv[1]) : 4000;
+    for (i = 0; i < 256; i++) {
+        x[i] = (i * 7919) % 1000;
+        y[i] = (i * 104729) % 997;
+    }
+    for (i = 0; i < 64; i++)
+        for (j = 0; j < 64; j++) mat[i][j] = (i * 31 + j * 17) % 101;
+    check = 0;
+    for (i = 0; i < rounds; i++) {
+        axpy(i % 7 + 1, x, y, 256);
+        check = (check * 31 + dot(x, y)) % 1000000007;
+        vec[i % 64] = y[i % 256];
+        matvec(x + 64);
+        count(y, 256);
+        check = check + hist[i % 16];
+    }
+    printf("%ld\n", check);
+    return 0;
+}
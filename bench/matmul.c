@@ -0,0 +1,41 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+long a[10000];
+long b[10000];
+long c[10000];
+
+void matmul(long *x, long *y, long *z, int n) {
+    int i;
+    int j;
+    int k;
+    long sum;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            sum = 0;
+            for (k = 0; k < n; k++) sum = sum + x[i * n + k] * y[k * n + j];
+            z[i * n + j] = sum;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int n;
+    int i;
+    int rounds;
+    long check;
+    n = 100;
+    rounds = argc > 1 ? atoi(argv[1]) : 3;
+    for (i = 0; i < n * n; i++) {
+        a[i] = i % 17 - 8;
+        b[i] = i % 13 - 6;
+    }
+    check = 0;
+    for (i = 0; i < rounds; i++) {
+        matmul(a, b, c, n);
+        matmul(c, b, a, n);
+        check = check + a[i * 7 % (n * n)];
+    }
+    printf("%ld\n", check);
+    return 0;
+}
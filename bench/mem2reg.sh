@@ -0,0 +1,27 @@
+#!/bin/sh
+# Report the loads and stores left in the IR of each program in test/ and
+# bench/ with and without promoting locals to registers, the locals
+# promoted, and the totals. Programs that don't compile are skipped.
+#
+# Usage: bench/mem2reg.sh [files...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- test/*.c bench/*.c
+
+printf '%-24s %8s %8s %8s %8s %8s %8s\n' program locals promoted loads \
+    after stores after
+for f in "$@"; do
+    "$LUCC" --print-ir --stats -o /dev/null "$f" 2>&1 >/dev/null |
+    awk -v f="$f" '
+        # mem2reg: promoted P of L locals with N phis; loads A -> B, stores
+        # C -> D
+        /^mem2reg:/ {
+            sub(",", "", $13)
+            printf "%-24s %8d %8d %8d %8d %8d %8d\n", f, $5, $3, $11, $13,
+                $15, $17
+        }'
+done | awk '{ print; for (k = 2; k <= 7; k++) t[k] += $k } END {
+    printf "%-24s %8d %8d %8d %8d %8d %8d\n", "total", t[2], t[3], t[4],
+        t[5], t[6], t[7]
+}'
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Report the IR instructions of each program in test/ and bench/ as lowered
+# and after the optimizations, with the constants folded, and the totals.
+# Programs that don't compile, or have no functions, are skipped.
+#
+# Usage: bench/opt.sh [files...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- test/*.c bench/*.c
+
+printf '%-24s %8s %8s %8s %8s\n' program lowered after removed folded
+for f in "$@"; do
+    "$LUCC" --print-ir --stats -o /dev/null "$f" 2>&1 >/dev/null |
+    awk -v f="$f" '
+        # constant propagation: folded N constants, ...
+        /^constant propagation:/ { folded = $4 }
+        # ir: B blocks, I instructions lowered; B blocks, I instructions ...
+        /^ir:/ { lowered = $4; after = $9 }
+        END {
+            if (lowered)
+                printf "%-24s %8d %8d %7.1f%% %8d\n", f, lowered, after,
+                    100 * (lowered - after) / lowered, folded
+        }'
+done | awk '{ print; lowered += $2; after += $3; folded += $5 } END {
+    printf "%-24s %8d %8d %7.1f%% %8d\n", "total", lowered, after,
+        100 * (lowered - after) / lowered, folded
+}'
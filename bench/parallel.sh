@@ -0,0 +1,45 @@
+#!/bin/sh
+# Report how compiling to assembly scales with -j on a program of N
+# functions (default 5000) made by bench/genfuncs.sh, and check that the
+# output is the same for every number of threads. Build lucc with
+# optimization to get meaningful numbers:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/parallel.sh [N [max threads]]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+N=${1:-5000}
+MAX=${2:-$(nproc)}
+tmp=$(mktemp -d /tmp/lucc-parallel.XXXXXX)
+trap 'rm -rf "$tmp"' EXIT
+
+bench/genfuncs.sh "$N" > "$tmp/prog.c"
+
+now() {
+    date +%s.%N
+}
+
+status=0
+base=
+printf '%-8s %9s %8s\n' threads seconds speedup
+j=1
+while [ "$j" -le "$MAX" ]; do
+    start=$(now)
+    "$LUCC" -S -j "$j" -o "$tmp/$j.s" "$tmp/prog.c" || status=1
+    end=$(now)
+    if ! cmp -s "$tmp/1.s" "$tmp/$j.s"; then
+        echo "-j $j: output differs from -j 1" >&2
+        status=1
+    fi
+    t=$(echo "$start $end" | awk '{ print $2 - $1 }')
+    base=${base:-$t}
+    echo "$j $t $base" | awk '{ printf "%-8d %9.3f %8.2f\n", $1, $2, $3 / $2 }'
+    if [ "$j" -lt "$MAX" ] && [ $((j * 2)) -gt "$MAX" ]; then
+        j=$MAX
+    else
+        j=$((j * 2))
+    fi
+done
+exit $status
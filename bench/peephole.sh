@@ -0,0 +1,28 @@
+#!/bin/sh
+# Report the machine instructions and bytes of code of each program in test/
+# and bench/ before and after the peephole pass, and the totals. Programs
+# that don't compile are skipped.
+#
+# Usage: bench/peephole.sh [files...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- test/*.c bench/*.c
+
+printf '%-24s %8s %8s %8s %8s %8s %8s\n' program instrs after removed \
+    bytes after saved
+for f in "$@"; do
+    "$LUCC" -S --stats -o /dev/null "$f" 2>&1 |
+    awk -v f="$f" '
+        # f: peephole: R rewrites, B blocks removed, I -> I instructions,
+        # N -> N bytes
+        / peephole: / { i += $8; ia += $10; n += $12; na += $14 }
+        END {
+            if (i)
+                printf "%-24s %8d %8d %7.1f%% %8d %8d %7.1f%%\n", f, i, ia,
+                    100 * (i - ia) / i, n, na, 100 * (n - na) / n
+        }'
+done | awk '{ print; i += $2; ia += $3; n += $5; na += $6 } END {
+    printf "%-24s %8d %8d %7.1f%% %8d %8d %7.1f%%\n", "total", i, ia,
+        100 * (i - ia) / i, n, na, 100 * (n - na) / n
+}'
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Run each benchmark built with -fprofile-generate to take its profile,
+# then time the native runs built without it and with -fprofile-use. The
+# profile lays out the blocks, orders the cases of switches and guides the
+# inliner; dispatch.c, an interpreter with its busiest opcodes last and
+# checks that never fail in its loop, is the one made for it.
+#
+# Usage: bench/profile.sh [files...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- bench/*.c
+profile=$(mktemp) || exit 1
+trap 'rm -f "$profile"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+status=0
+printf '%-8s %9s %9s %8s\n' name default profiled speedup
+for f in "$@"; do
+    name=$(basename "$f" .c)
+    rm -f "$profile"
+    "$LUCC" -fprofile-generate="$profile" --run "$f" > /dev/null
+    start=$(now)
+    expected=$("$LUCC" --run "$f")
+    mid=$(now)
+    out=$("$LUCC" -fprofile-use="$profile" --run "$f")
+    end=$(now)
+    if [ "$out" != "$expected" ]; then
+        echo "$name: -fprofile-use printed '$out', expected '$expected'" >&2
+        status=1
+    fi
+    echo "$start $mid $end" | awk -v name="$name" '{
+        d = $2 - $1; p = $3 - $2
+        printf "%-8s %9.3f %9.3f %8.2f\n", name, d, p, d / p
+    }'
+done
+exit $status
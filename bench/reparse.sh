@@ -0,0 +1,38 @@
+#!/bin/sh
+# Time edits of a program of N functions from genfuncs.sh (default 2000)
+# applied with --edits, against parsing all of it: typing a statement
+# into the function in the middle a byte at a time, then deleting it the
+# same way, as an editor would send them. Most of the edits don't parse,
+# the statement being unfinished. The syntax tree after them is checked
+# against that of the program without the edits, as it is the same again.
+#
+# Usage: bench/reparse.sh [N]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+n=${1:-2000}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+bench/genfuncs.sh "$n" > "$dir/prog.c"
+# The start of the line after the one opening the function in the middle
+at=$(awk -v f="f$((n / 2))(long" '
+    { at += length($0) + 1 }
+    $2 == f { print at; exit }' "$dir/prog.c")
+awk -v at="$at" -v text="    s = s + 1;" 'BEGIN {
+    for (i = 1; i <= length(text); i++)
+        printf "%d 0 %s\n", at + i - 1, substr(text, i, 1)
+    printf "%d 0 \\n\n", at + length(text)
+    for (i = length(text); i >= 0; i--)
+        printf "%d 1\n", at + i
+}' > "$dir/edits"
+
+"$LUCC" --stats --edits "$dir/edits" "$dir/prog.c" > "$dir/edited" \
+    2> "$dir/log"
+status=$?
+grep '^edits:' "$dir/log"
+"$LUCC" "$dir/prog.c" > "$dir/expected"
+if [ $status -ne 0 ] || ! cmp -s "$dir/edited" "$dir/expected"; then
+    echo "the syntax tree after the edits differs from that without them" >&2
+    exit 1
+fi
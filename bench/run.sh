@@ -0,0 +1,54 @@
+#!/bin/sh
+# Run each benchmark natively with --run, with the bytecode interpreter and
+# with the AST evaluator, check that all three print the same, and report
+# the times in seconds. Build lucc with optimization to get meaningful
+# numbers for the interpreters:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# sieve    the sieve of Eratosthenes on a char array
+# fib      naive recursive Fibonacci, mostly calls and returns
+# matmul   multiplication of long matrices stored in flat arrays
+# collatz  the longest Collatz sequence, long division and arithmetic
+# sort     insertion sort of unsigned pseudo-random numbers
+# stencil  a 5-point stencil on a flat array, repeating index computations
+# loops    dot products, axpy, matrix-vector and a histogram, fixed trip counts
+# vm       a stack machine dispatching with switch and function pointers
+# inline   small helpers called in the inner loop of a grid scan
+# vector   element-wise and reduction loops over char, short and int arrays
+# branches minimums, clamps and ranges of pseudo-random numbers, conditions
+#          no predictor guesses right
+# dispatch a bytecode interpreter with its busiest opcodes last in the
+#          switch, for profile-guided optimization
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+
+now() {
+    date +%s.%N
+}
+
+status=0
+printf '%-8s %9s %9s %9s %8s %8s\n' name native bytecode ast bc/nat ast/bc
+for f in bench/*.c; do
+    name=$(basename "$f" .c)
+    times=
+    expected=
+    for mode in --run --interp --interp=ast; do
+        start=$(now)
+        out=$("$LUCC" "$mode" "$f" "$@")
+        end=$(now)
+        if [ -z "$expected" ]; then
+            expected=$out
+        elif [ "$out" != "$expected" ]; then
+            echo "$name: $mode printed '$out', expected '$expected'" >&2
+            status=1
+        fi
+        times="$times $start $end"
+    done
+    echo "$times" | awk -v name="$name" '{
+        n = $2 - $1; b = $4 - $3; a = $6 - $5
+        printf "%-8s %9.3f %9.3f %9.3f %8.1f %8.1f\n", name, n, b, a, b / n, a / b
+    }'
+done
+exit $status
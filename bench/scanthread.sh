@@ -0,0 +1,53 @@
+#!/bin/sh
+# Time printing the syntax tree of programs of N functions from
+# genfuncs.sh, for each N given (default 4000 16000 64000), with the
+# scanner on the parser's thread and with --scan-thread, the best of three
+# runs each, and check that both print the same. Scanning only overlaps
+# parsing with a CPU free for it, so the number of CPUs is printed too.
+# Build lucc with optimization to get meaningful numbers:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/scanthread.sh [N...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- 4000 16000 64000
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# The least time taken printing $dir/prog.c to $dir/$1 with the flags
+# that follow, in three runs
+best() {
+    out=$dir/$1
+    shift
+    for run in 1 2 3; do
+        start=$(now)
+        "$LUCC" "$@" "$dir/prog.c" > "$out" || exit 1
+        end=$(now)
+        echo "$start $end"
+    done | awk '{ t = $2 - $1; if (NR == 1 || t < min) min = t }
+        END { printf "%.3f", min }'
+}
+
+echo "$(nproc) CPUs"
+status=0
+printf '%-9s %9s %9s %8s %8s\n' functions MB serial thread speedup
+for n in "$@"; do
+    bench/genfuncs.sh "$n" > "$dir/prog.c"
+    serial=$(best serial)
+    thread=$(best thread --scan-thread)
+    awk -v n="$n" -v s="$serial" -v t="$thread" \
+        -v mb="$(wc -c < "$dir/prog.c")" 'BEGIN {
+        printf "%-9s %9.1f %9.3f %8.3f %7.2fx\n", n, mb / 1e6, s, t, s / t
+    }'
+    if ! cmp -s "$dir/serial" "$dir/thread"; then
+        echo "$n: the syntax tree differs with --scan-thread" >&2
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,29 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+char flags[1000000];
+
+int sieve(int n) {
+    int i;
+    int j;
+    int count;
+    count = 0;
+    for (i = 2; i < n; i++) flags[i] = 1;
+    for (i = 2; i < n; i++) {
+        if (flags[i]) {
+            count++;
+            for (j = i + i; j < n; j = j + i) flags[j] = 0;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    int rounds;
+    int i;
+    int count;
+    rounds = argc > 1 ? atoi(argv[1]) : 5;
+    for (i = 0; i < rounds; i++) count = sieve(1000000);
+    printf("%d\n", count);
+    return 0;
+}
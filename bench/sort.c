@@ -0,0 +1,39 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+unsigned data[20000];
+unsigned seed;
+
+unsigned next() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+void sort(unsigned *p, int n) {
+    int i;
+    int j;
+    unsigned v;
+    for (i = 1; i < n; i++) {
+        v = p[i];
+        j = i - 1;
+        while (j >= 0 && p[j] > v) {
+            p[j + 1] = p[j];
+            j--;
+        }
+        p[j + 1] = v;
+    }
+}
+
+int main(int argc, char **argv) {
+    int n;
+    int i;
+    unsigned check;
+    n = argc > 1 ? atoi(argv[1]) : 6000;
+    seed = 1;
+    for (i = 0; i < n; i++) data[i] = next();
+    sort(data, n);
+    check = 0;
+    for (i = 0; i < n; i++) check = check * 31 + data[i];
+    printf("%u %u %u\n", data[0], data[n - 1], check);
+    return 0;
+}
@@ -0,0 +1,36 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+long grid[90000];
+long next[90000];
+
+void smooth(long *from, long *to, int n) {
+    int i;
+    int j;
+    for (i = 1; i < n - 1; i++) {
+        for (j = 1; j < n - 1; j++) {
+            to[i * n + j] = (from[i * n + j] * 4 + from[i * n + j - 1] +
+                             from[i * n + j + 1] + from[(i - 1) * n + j] +
+                             from[(i + 1) * n + j]) / 8 +
+                            from[i * n + j] % 3 - (from[i * n + j] & 1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int n;
+    int i;
+    int rounds;
+    long check;
+    n = 300;
+    rounds = argc > 1 ? atoi(argv[1]) : 20;
+    for (i = 0; i < n * n; i++) grid[i] = (i * 7919) % 1000;
+    for (i = 0; i < rounds; i++) {
+        smooth(grid, next, n);
+        smooth(next, grid, n);
+    }
+    check = 0;
+    for (i = 0; i < n * n; i++) check = check * 31 + grid[i];
+    printf("%ld\n", check);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Report the most memory and the time taken compiling programs of N
+# functions from genfuncs.sh to assembly, all at once and with --stream,
+# for each N given (default 1000 4000 16000). With --stream, what memory
+# grows by is mostly the source, and main, which calls every tenth
+# function. The outputs are checked to have the same lines, as only the
+# globals move to the end. Build lucc with optimization to get meaningful
+# times:
+#
+#   make clean && make CXXFLAGS='-O2 -MMD'
+#
+# Usage: bench/stream.sh [N...]
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+[ $# -gt 0 ] || set -- 1000 4000 16000
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# Compile $dir/prog.c to $dir/$1.s with the flags that follow, and print
+# the memory used in KB and the time taken
+build() {
+    out=$dir/$1.s
+    shift
+    start=$(now)
+    "$LUCC" -S --stats "$@" "$dir/prog.c" -o "$out" 2> "$dir/log" || exit 1
+    end=$(now)
+    kb=$(awk '/^memory:/ { print $2 }' "$dir/log")
+    echo "$start $end" |
+        awk -v kb="$kb" '{ printf " %9d %7.2f", kb, $2 - $1 }'
+}
+
+status=0
+printf '%-9s %9s %7s %9s %7s\n' functions KB seconds 'KB stream' seconds
+for n in "$@"; do
+    bench/genfuncs.sh "$n" > "$dir/prog.c"
+    printf '%-9s' "$n"
+    build whole
+    build stream --stream
+    echo
+    sort "$dir/whole.s" > "$dir/whole.sorted"
+    sort "$dir/stream.s" > "$dir/stream.sorted"
+    if ! cmp -s "$dir/whole.sorted" "$dir/stream.sorted"; then
+        echo "$n: the output with --stream differs" >&2
+        status=1
+    fi
+done
+exit $status
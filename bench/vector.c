@@ -0,0 +1,71 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int a[1024];
+int b[1024];
+int c[1024];
+short p[1024];
+short q[1024];
+char s[4096];
+char t[4096];
+
+void blend(int *x, int *y, int *z, int n, int k) {
+    int i;
+    for (i = 0; i < n; i++) x[i] = (y[i] + z[i] - k) & 65535;
+}
+
+int dot(short *x, short *y, int n) {
+    int i;
+    short d;
+    d = 0;
+    for (i = 0; i < n; i++) d = d + x[i] * y[i];
+    return d;
+}
+
+int mix(char *x, char *y, int n) {
+    int i;
+    char h;
+    char u;
+    h = 0;
+    for (i = 0; i < n; i++) {
+        u = x[i] ^ y[i];
+        y[i] = u + 3;
+        h = h ^ u;
+    }
+    return h;
+}
+
+long total(int *x, int n) {
+    int i;
+    int sum;
+    sum = 0;
+    for (i = 0; i < n; i++) sum = sum + x[i];
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    int i;
+    int rounds;
+    long check;
+    rounds = argc > 1 ? atoi(argv[1]) : 300;
+    for (i = 0; i < 1024; i++) {
+        b[i] = i * 7919 % 1000;
+        c[i] = i * 104729 % 997;
+        p[i] = i * 31 % 211;
+        q[i] = 50 - i % 101;
+    }
+    for (i = 0; i < 4096; i++) {
+        s[i] = i * 13;
+        t[i] = i * 7 + 1;
+    }
+    check = 0;
+    for (i = 0; i < rounds; i++) {
+        blend(a, b, c, 1021, i);
+        blend(c, a, b, 1024, 3);
+        check = check * 7 + dot(p, q, 1000 + i % 24);
+        check = check + mix(s, t, 4093) + total(a, 1024);
+        check = check % 1000000007;
+    }
+    printf("%ld\n", check);
+    return 0;
+}
@@ -0,0 +1,55 @@
+int printf(char *fmt, ...);
+int atoi(char *s);
+
+int code[32];
+long stack[64];
+
+long add(long a, long b) { return a + b; }
+long sub(long a, long b) { return a - b; }
+
+long run(int *pc, long n) {
+    long *sp;
+    long (*op)(long, long);
+    long acc;
+    sp = stack;
+    acc = 0;
+    *sp++ = n;
+    for (;;) {
+        switch (*pc++) {
+        case 0:
+            *sp++ = *pc++;
+            break;
+        case 1:
+            op = *pc++ ? sub : add;
+            sp--;
+            sp[-1] = op(sp[-1], sp[0]);
+            break;
+        case 2:
+            acc = acc + (sp[-1] ^ acc) % 1000;
+            break;
+        case 3:
+            if (sp[-1]) pc = pc - *pc;
+            else pc++;
+            break;
+        default:
+            return acc;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long n;
+    int *p;
+    n = argc > 1 ? atoi(argv[1]) : 1000000;
+    p = code;
+    *p++ = 2;
+    *p++ = 0; *p++ = 3;
+    *p++ = 1; *p++ = 0;
+    *p++ = 2;
+    *p++ = 0; *p++ = 4;
+    *p++ = 1; *p++ = 1;
+    *p++ = 3; *p++ = 11;
+    *p++ = 4;
+    printf("%ld\n", run(code, n));
+    return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef BITVEC_HPP
+#define BITVEC_HPP
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A fixed size set of small integers, stored a word at a time so that the
+// set operations of dataflow analyses are cheap.
+class BitVector {
+public:
+    BitVector(int n = 0) : nbits(n), words((n + 63) / 64) {}
+    int size() const { return nbits; }
+    bool test(int i) const { return words[i / 64] >> (i % 64) & 1; }
+    void set(int i) { words[i / 64] |= (uint64_t)1 << (i % 64); }
+    void reset(int i) { words[i / 64] &= ~((uint64_t)1 << (i % 64)); }
+    void clear() {
+        for (auto &w: words) w = 0;
+    }
+    // Add all of 0..size()-1, keeping the bits past the end clear
+    void set_all() {
+        for (auto &w: words) w = ~(uint64_t)0;
+        if (nbits % 64) words.back() = ((uint64_t)1 << nbits % 64) - 1;
+    }
+    // Each returns whether the set changed
+    bool operator|=(const BitVector &o) {
+        uint64_t changed = 0;
+        for (size_t k = 0; k < words.size(); k++) {
+            uint64_t w = words[k] | o.words[k];
+            changed |= w ^ words[k];
+            words[k] = w;
+        }
+        return changed;
+    }
+    bool operator&=(const BitVector &o) {
+        uint64_t changed = 0;
+        for (size_t k = 0; k < words.size(); k++) {
+            uint64_t w = words[k] & o.words[k];
+            changed |= w ^ words[k];
+            words[k] = w;
+        }
+        return changed;
+    }
+    // Remove the elements of @o
+    bool subtract(const BitVector &o) {
+        uint64_t changed = 0;
+        for (size_t k = 0; k < words.size(); k++) {
+            uint64_t w = words[k] & ~o.words[k];
+            changed |= w ^ words[k];
+            words[k] = w;
+        }
+        return changed;
+    }
+    // Set to @gen | (@in & ~@kill), the transfer function of a block in a
+    // dataflow analysis, in one pass
+    bool transfer(const BitVector &gen, const BitVector &in,
+                  const BitVector &kill) {
+        uint64_t changed = 0;
+        for (size_t k = 0; k < words.size(); k++) {
+            uint64_t w = gen.words[k] | (in.words[k] & ~kill.words[k]);
+            changed |= w ^ words[k];
+            words[k] = w;
+        }
+        return changed;
+    }
+    int count() const {
+        int n = 0;
+        for (auto w: words) n += __builtin_popcountll(w);
+        return n;
+    }
+    // The first element not less than @i, or -1 if there's none
+    int find_next(int i) const {
+        size_t k = i / 64;
+        if (k >= words.size()) return -1;
+        uint64_t w = words[k] & (~(uint64_t)0 << (i % 64));
+        while (!w) {
+            if (++k == words.size()) return -1;
+            w = words[k];
+        }
+        return k * 64 + __builtin_ctzll(w);
+    }
+    size_t bytes() const { return words.size() * sizeof(uint64_t); }
+    bool operator==(const BitVector &o) const { return words == o.words; }
+    bool operator!=(const BitVector &o) const { return words != o.words; }
+    // Call @f with each element, in increasing order
+    template <typename F>
+    void for_each(F f) const {
+        for (size_t k = 0; k < words.size(); k++) {
+            for (uint64_t w = words[k]; w; w &= w - 1)
+                f(k * 64 + __builtin_ctzll(w));
+        }
+    }
+private:
+    int nbits;
+    std::vector<uint64_t> words;
+};
+#endif
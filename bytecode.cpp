@@ -0,0 +1,804 @@
+#include "interp.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The bytecode is register based: every IR register is a slot in the frame
+// of its function, and instructions name their operands directly instead of
+// shuffling them through a stack. An instruction is a sequence of 32-bit
+// words, the opcode followed by its operands. The interpreter jumps to the
+// handler of each opcode through a table of label addresses (computed
+// goto), with the dispatch repeated at the end of every handler so that
+// each one has an indirect branch of its own to predict.
+//
+// Superinstructions are formed by folding an instruction with a single use
+// into the instruction using it. Only instructions without side effects
+// are folded, and only within a block, where their operands can't change
+// in between, so this doesn't need any further checks:
+//
+// - constant operands become immediates (ADDI, LTI, ...)
+// - the address of a local goes into the load or store using it (LDL, STL)
+// - an addition goes into the load using it as address (LDX)
+// - a comparison goes into the branch on its result (BLT, BLTI, ...)
+// - an addition, subtraction or multiplication goes into the sign extension
+//   from 32 bits normalizing its result, as is done for int (ADDW, ...)
+
+namespace
+{
+
+// Operands are d, the destination register, a and b, source registers, i,
+// a 32-bit immediate, k, an index into the constant pool, o, an offset into
+// the locals of the frame, t, the position of a jump target in the code,
+// and n, the number of arguments following.
+#define BYTECODES(X) \
+    X(MOV)  /* d a */ \
+    X(LI)   /* d i */ \
+    X(LK)   /* d k */ \
+    X(LEA)  /* d o */ \
+    /* d a b, in the order of the IR */ \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(UDIV) X(MOD) X(UMOD) \
+    X(AND) X(OR) X(XOR) X(SHL) X(SHR) X(SAR) \
+    X(EQ) X(NE) X(LT) X(LE) X(GT) X(GE) X(ULT) X(ULE) X(UGT) X(UGE) \
+    /* d a i */ \
+    X(ADDI) X(MULI) X(ANDI) X(ORI) X(XORI) X(SHLI) X(SHRI) X(SARI) \
+    X(EQI) X(NEI) X(LTI) X(LEI) X(GTI) X(GEI) \
+    /* d a b and d a i, sign extending the result from 32 bits */ \
+    X(ADDW) X(SUBW) X(MULW) X(ADDIW) \
+    /* d a */ \
+    X(NEG) X(NOT) X(SEXT1) X(SEXT2) X(SEXT4) X(ZEXT1) X(ZEXT2) X(ZEXT4) \
+    X(SEL)  /* d a b c, b if a is nonzero, else c */ \
+    /* d a, d o and d a b, loading from a + b */ \
+    X(LD1) X(LD1U) X(LD2) X(LD2U) X(LD4) X(LD4U) X(LD8) \
+    X(LDL1) X(LDL1U) X(LDL2) X(LDL2U) X(LDL4) X(LDL4U) X(LDL8) \
+    X(LDX1) X(LDX1U) X(LDX2) X(LDX2U) X(LDX4) X(LDX4U) X(LDX8) \
+    /* a b and o b, storing b */ \
+    X(ST1) X(ST2) X(ST4) X(ST8) \
+    X(STL1) X(STL2) X(STL4) X(STL8) \
+    X(JMP)  /* t */ \
+    X(BR)   /* a t t, to the first target if a is nonzero */ \
+    /* a b t t and a i t t */ \
+    X(BEQ) X(BNE) X(BLT) X(BLE) X(BGT) X(BGE) \
+    X(BULT) X(BULE) X(BUGT) X(BUGE) \
+    X(BEQI) X(BNEI) X(BLTI) X(BLEI) X(BGTI) X(BGEI) \
+    X(SWITCH)  /* a k, k indexing the switch tables */ \
+    X(CALL)    /* d n k a..., k indexing the functions of the program */ \
+    X(CALLN)   /* d n k a..., k holding the address of a native function */ \
+    X(CALLR)   /* d n a a..., through a function pointer */ \
+    /* n k a..., a CALL returning its result, made in place of the frame */ \
+    X(TAILCALL) \
+    X(RET)     /* a */ \
+    X(RETV)
+
+enum Opcode {
+#define OPCODE(name) OP_##name,
+    BYTECODES(OPCODE)
+#undef OPCODE
+};
+
+struct SwitchTable {
+    std::vector<std::pair<long, uint32_t>> cases;  // sorted by value
+    uint32_t default_target;
+};
+
+struct BcFunction {
+    std::string name;
+    std::vector<uint32_t> code;
+    std::vector<long> consts;
+    std::vector<SwitchTable> switches;
+    // The register of each parameter, -1 if it's unused
+    std::vector<int> params;
+    // The frame holds the registers, followed by the locals. The last
+    // register receives the results nobody uses.
+    int nregs = 0;
+    long frame_words = 0;
+};
+
+struct Program {
+    std::vector<BcFunction> funcs;
+    std::unordered_map<std::string, int> index;
+    // The functions by their address in the program
+    std::unordered_map<long, const BcFunction *> by_addr;
+};
+
+// The opcode taking the second operand of @op as an immediate, -1 if there
+// is none. Subtraction becomes an addition of the negated immediate.
+int imm_opcode(IROp op) {
+    switch (op) {
+    case IR_ADD:
+    case IR_SUB: return OP_ADDI;
+    case IR_MUL: return OP_MULI;
+    case IR_AND: return OP_ANDI;
+    case IR_OR:  return OP_ORI;
+    case IR_XOR: return OP_XORI;
+    case IR_SHL: return OP_SHLI;
+    case IR_SHR: return OP_SHRI;
+    case IR_SAR: return OP_SARI;
+    case IR_EQ:  return OP_EQI;
+    case IR_NE:  return OP_NEI;
+    case IR_LT:  return OP_LTI;
+    case IR_LE:  return OP_LEI;
+    case IR_GT:  return OP_GTI;
+    case IR_GE:  return OP_GEI;
+    default:     return -1;
+    }
+}
+
+// Whether a constant first operand of @op can be swapped into the second
+bool commutes(IROp op) {
+    switch (op) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+        return true;
+    default:
+        return is_comparison(op);
+    }
+}
+
+// Index of the load of @size bytes in each of the LD, LDL and LDX groups
+int load_kind(int size, bool is_signed) {
+    switch (size) {
+    case 1:  return is_signed ? 0 : 1;
+    case 2:  return is_signed ? 2 : 3;
+    case 4:  return is_signed ? 4 : 5;
+    default: return 6;
+    }
+}
+
+int store_kind(int size) {
+    return size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3;
+}
+
+class Compiler {
+public:
+    Compiler(IRFunction &f, BcFunction &bf, Program &prog, Runtime &rt)
+        : f(f), bf(bf), prog(prog), rt(rt) {}
+    // Returns false if a symbol is undefined
+    bool run();
+    // Number of instructions folded into superinstructions
+    int nfolded = 0;
+private:
+    IRFunction &f;
+    BcFunction &bf;
+    Program &prog;
+    Runtime &rt;
+    // The instruction defining each register, its block and its uses
+    std::vector<const IRInstr *> defs;
+    std::vector<const IRBlock *> def_blocks;
+    std::vector<int> uses;
+    // Whether the definition of a register is folded into its use
+    std::vector<bool> folded;
+    std::vector<long> slot_offsets;
+    std::vector<uint32_t> block_offsets;
+    std::vector<std::pair<size_t, const IRBlock *>> fixups;
+    // The IR_SWITCH of each switch table
+    std::vector<const IRInstr *> switches;
+    bool ok = true;
+
+    void plan(const IRBlock *b, const IRInstr &i);
+    bool folded_const(int r, long &v);
+    void emit(const IRInstr &i);
+    void binary(const IRInstr &i, int dst, bool wrap);
+    void branch(const IRInstr &i);
+    void call(const IRInstr &i);
+    void word(uint32_t w) { bf.code.push_back(w); }
+    void reg(int r) { word(r < 0 ? f.nregs : r); }
+    void imm(long v) { word((uint32_t)v); }
+    void target(const IRBlock *b) {
+        fixups.emplace_back(bf.code.size(), b);
+        word(0);
+    }
+    int constant(long v) {
+        bf.consts.push_back(v);
+        return bf.consts.size() - 1;
+    }
+};
+
+// Decide which of the operands of @i to fold into it
+void Compiler::plan(const IRBlock *b, const IRInstr &i) {
+    auto single_use = [&](int r) {
+        return r >= 0 && uses[r] == 1 && def_blocks[r] == b;
+    };
+    auto fold_const = [&](int r, bool negate) {
+        if (!single_use(r) || defs[r]->op != IR_CONST) return false;
+        long v = defs[r]->imm;
+        if (!fits_int(v) || (negate && !fits_int(-v))) return false;
+        folded[r] = true;
+        return true;
+    };
+    if (i.args.size() == 2 && i.op >= IR_ADD && i.op <= IR_UGE &&
+        imm_opcode(i.op) >= 0) {
+        if (!fold_const(i.args[1], i.op == IR_SUB) && commutes(i.op))
+            fold_const(i.args[0], false);
+        return;
+    }
+    int a = i.args.empty() ? -1 : i.args[0];
+    if (!single_use(a)) return;
+    auto def = defs[a];
+    switch (i.op) {
+    case IR_LOAD:
+        if (def->op == IR_LOCAL ||
+            (def->op == IR_ADD && !folded[def->args[0]] &&
+             !folded[def->args[1]]))
+            folded[a] = true;
+        break;
+    case IR_STORE:
+        if (def->op == IR_LOCAL) folded[a] = true;
+        break;
+    case IR_BR:
+        if (is_comparison(def->op)) folded[a] = true;
+        break;
+    case IR_SEXT:
+        // A multiplication by an immediate has no 32-bit form
+        if (i.size == 4 &&
+            (def->op == IR_ADD || def->op == IR_SUB ||
+             (def->op == IR_MUL && !folded[def->args[0]] &&
+              !folded[def->args[1]])))
+            folded[a] = true;
+        break;
+    default:
+        break;
+    }
+}
+
+// Whether register @r is a constant folded into its use, and its value
+bool Compiler::folded_const(int r, long &v) {
+    if (r < 0 || !folded[r] || defs[r]->op != IR_CONST) return false;
+    v = defs[r]->imm;
+    return true;
+}
+
+// Emit the arithmetic or comparison @i, with its result in @dst. @wrap
+// sign extends the result from 32 bits.
+void Compiler::binary(const IRInstr &i, int dst, bool wrap) {
+    IROp op = i.op;
+    int a = i.args[0], b = i.args[1];
+    long v;
+    if (folded_const(a, v)) {
+        std::swap(a, b);
+        op = swap_comparison(op);
+    }
+    if (folded_const(b, v)) {
+        if (op == IR_SUB) v = -v;
+        word(wrap ? OP_ADDIW : imm_opcode(op));
+        reg(dst);
+        reg(a);
+        imm(v);
+    } else {
+        word(wrap ? OP_ADDW + (op - IR_ADD) : OP_ADD + (op - IR_ADD));
+        reg(dst);
+        reg(a);
+        reg(b);
+    }
+}
+
+void Compiler::branch(const IRInstr &i) {
+    int c = i.args[0];
+    if (!folded[c]) {
+        word(OP_BR);
+        reg(c);
+    } else {
+        auto &cmp = *defs[c];
+        IROp op = cmp.op;
+        int a = cmp.args[0], b = cmp.args[1];
+        long v;
+        if (folded_const(a, v)) {
+            std::swap(a, b);
+            op = swap_comparison(op);
+        }
+        if (folded_const(b, v)) {
+            word(OP_BEQI + (op - IR_EQ));
+            reg(a);
+            imm(v);
+        } else {
+            word(OP_BEQ + (op - IR_EQ));
+            reg(a);
+            reg(b);
+        }
+    }
+    target(i.targets[0]);
+    target(i.targets[1]);
+}
+
+void Compiler::call(const IRInstr &i) {
+    auto args = i.args.begin();
+    if (i.sym.empty()) {
+        word(OP_CALLR);
+        reg(i.dst);
+        word(i.args.size() - 1);
+        reg(*args++);
+    } else if (prog.index.count(i.sym) && i.is_tail) {
+        word(OP_TAILCALL);
+        word(i.args.size());
+        word(prog.index[i.sym]);
+    } else if (prog.index.count(i.sym)) {
+        word(OP_CALL);
+        reg(i.dst);
+        word(i.args.size());
+        word(prog.index[i.sym]);
+    } else {
+        void *addr = rt.address(i.sym);
+        if (!addr) ok = false;
+        if (i.args.size() > MAX_NATIVE_ARGS) {
+            fprintf(stderr, "mycc: too many arguments to native function "
+                    "'%s'\n", i.sym.c_str());
+            ok = false;
+        }
+        word(OP_CALLN);
+        reg(i.dst);
+        word(i.args.size());
+        word(constant((long)addr));
+    }
+    for (; args != i.args.end(); ++args) reg(*args);
+}
+
+void Compiler::emit(const IRInstr &i) {
+    if (i.dst >= 0 && (folded[i.dst] ||
+                       (uses[i.dst] == 0 && !i.has_side_effects())))
+        return;
+    switch (i.op) {
+    case IR_CONST:
+        if (fits_int(i.imm)) {
+            word(OP_LI);
+            reg(i.dst);
+            imm(i.imm);
+        } else {
+            word(OP_LK);
+            reg(i.dst);
+            word(constant(i.imm));
+        }
+        break;
+    case IR_COPY:
+        word(OP_MOV);
+        reg(i.dst);
+        reg(i.args[0]);
+        break;
+    case IR_PARAM:
+        if (bf.params.size() <= (size_t)i.imm)
+            bf.params.resize(i.imm + 1, -1);
+        bf.params[i.imm] = i.dst;
+        break;
+    case IR_NEG:
+    case IR_NOT:
+        word(i.op == IR_NEG ? OP_NEG : OP_NOT);
+        reg(i.dst);
+        reg(i.args[0]);
+        break;
+    case IR_SEXT:
+    case IR_ZEXT:
+        if (folded[i.args[0]]) {
+            binary(*defs[i.args[0]], i.dst, true);
+            break;
+        }
+        if (i.size == 8) {
+            word(OP_MOV);
+        } else {
+            int k = i.size == 1 ? 0 : i.size == 2 ? 1 : 2;
+            word((i.op == IR_SEXT ? OP_SEXT1 : OP_ZEXT1) + k);
+        }
+        reg(i.dst);
+        reg(i.args[0]);
+        break;
+    case IR_SELECT:
+        word(OP_SEL);
+        reg(i.dst);
+        for (int a: i.args) reg(a);
+        break;
+    case IR_LOCAL:
+        word(OP_LEA);
+        reg(i.dst);
+        imm(slot_offsets[i.imm]);
+        break;
+    case IR_GLOBAL: {
+        void *addr = rt.address(i.sym);
+        if (!addr) ok = false;
+        word(OP_LK);
+        reg(i.dst);
+        word(constant((long)addr));
+        break;
+    }
+    case IR_LOAD: {
+        int kind = load_kind(i.size, i.is_signed);
+        int a = i.args[0];
+        if (!folded[a]) {
+            word(OP_LD1 + kind);
+            reg(i.dst);
+            reg(a);
+        } else if (defs[a]->op == IR_LOCAL) {
+            word(OP_LDL1 + kind);
+            reg(i.dst);
+            imm(slot_offsets[defs[a]->imm]);
+        } else {
+            word(OP_LDX1 + kind);
+            reg(i.dst);
+            reg(defs[a]->args[0]);
+            reg(defs[a]->args[1]);
+        }
+        break;
+    }
+    case IR_STORE: {
+        int kind = store_kind(i.size);
+        int a = i.args[0];
+        if (folded[a]) {
+            word(OP_STL1 + kind);
+            imm(slot_offsets[defs[a]->imm]);
+        } else {
+            word(OP_ST1 + kind);
+            reg(a);
+        }
+        reg(i.args[1]);
+        break;
+    }
+    case IR_CALL:
+        call(i);
+        break;
+    case IR_JMP:
+        word(OP_JMP);
+        target(i.targets[0]);
+        break;
+    case IR_BR:
+        branch(i);
+        break;
+    case IR_SWITCH:
+        word(OP_SWITCH);
+        reg(i.args[0]);
+        word(switches.size());
+        switches.push_back(&i);
+        break;
+    case IR_RET:
+        if (i.args.empty()) {
+            word(OP_RETV);
+        } else {
+            word(OP_RET);
+            reg(i.args[0]);
+        }
+        break;
+    default:
+        binary(i, i.dst, false);
+        break;
+    }
+}
+
+bool Compiler::run() {
+    defs.assign(f.nregs, NULL);
+    def_blocks.assign(f.nregs, NULL);
+    uses.assign(f.nregs, 0);
+    folded.assign(f.nregs, false);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.dst >= 0) {
+                defs[i.dst] = &i;
+                def_blocks[i.dst] = b.get();
+            }
+            for (int a: i.args) uses[a]++;
+        }
+    }
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) plan(b.get(), i);
+    }
+    nfolded = std::count(folded.begin(), folded.end(), true);
+
+    long size = 0;
+    for (auto &s: f.slots) {
+        size = align_to(size, s.align);
+        slot_offsets.push_back(size);
+        size += s.size;
+    }
+    bf.nregs = f.nregs + 1;
+    bf.frame_words = bf.nregs + (size + 7) / 8;
+
+    block_offsets.resize(f.blocks.size());
+    for (auto &b: f.blocks) {
+        block_offsets[b->id] = bf.code.size();
+        for (auto &i: b->instrs) emit(i);
+    }
+    for (auto &fx: fixups)
+        bf.code[fx.first] = block_offsets[fx.second->id];
+    for (auto i: switches) {
+        SwitchTable t;
+        for (size_t k = 0; k < i->cases.size(); k++)
+            t.cases.emplace_back(i->cases[k],
+                                 block_offsets[i->targets[k + 1]->id]);
+        std::sort(t.cases.begin(), t.cases.end());
+        t.default_target = block_offsets[i->targets[0]->id];
+        bf.switches.push_back(std::move(t));
+    }
+    return ok;
+}
+
+template <typename T>
+long load(long addr) {
+    T v;
+    memcpy(&v, (const void *)addr, sizeof v);
+    return v;
+}
+
+template <typename T>
+void store(long addr, long v) {
+    T t = v;
+    memcpy((void *)addr, &t, sizeof t);
+}
+
+// Arithmetic on registers wraps around like the machine's
+long add(long a, long b) { return (unsigned long)a + (unsigned long)b; }
+long sub(long a, long b) { return (unsigned long)a - (unsigned long)b; }
+long mul(long a, long b) { return (unsigned long)a * (unsigned long)b; }
+
+class Interpreter {
+public:
+    Interpreter(Program &prog) : prog(prog), stack(STACK_WORDS) {}
+    // Call @f with the @nargs values in @args
+    long call(const BcFunction *f, const long *args, int nargs);
+private:
+    static const size_t STACK_WORDS = 1 << 20;
+    Program &prog;
+    std::vector<long> stack;
+    size_t sp = 0;
+
+    // The arguments of a tail call, copied out of the frame it replaces
+    std::vector<long> tail_args;
+
+    long *push_frame(const BcFunction *f);
+    // Pop the frame at @r, of whichever function tail called last in it
+    void pop_frame(long *r) { sp = r - stack.data(); }
+    // Call @f with the arguments in the registers @args of @r
+    long call(const BcFunction *f, const long *r, const uint32_t *args,
+              int nargs);
+    long run(const BcFunction *f, long *r);
+};
+
+long *Interpreter::push_frame(const BcFunction *f) {
+    if (sp + f->frame_words > stack.size()) {
+        fprintf(stderr, "mycc: stack overflow in '%s'\n", f->name.c_str());
+        exit(1);
+    }
+    long *r = &stack[sp];
+    sp += f->frame_words;
+    return r;
+}
+
+long Interpreter::call(const BcFunction *f, const long *args, int nargs) {
+    long *r = push_frame(f);
+    for (int k = 0; k < nargs && (size_t)k < f->params.size(); k++) {
+        if (f->params[k] >= 0) r[f->params[k]] = args[k];
+    }
+    long v = run(f, r);
+    pop_frame(r);
+    return v;
+}
+
+long Interpreter::call(const BcFunction *f, const long *r,
+                       const uint32_t *args, int nargs) {
+    long *callee = push_frame(f);
+    for (int k = 0; k < nargs && (size_t)k < f->params.size(); k++) {
+        if (f->params[k] >= 0) callee[f->params[k]] = r[args[k]];
+    }
+    long v = run(f, callee);
+    pop_frame(callee);
+    return v;
+}
+
+long call_native(void *fn, const long *r, const uint32_t *args, int nargs) {
+    long a[MAX_NATIVE_ARGS];
+    if (nargs > MAX_NATIVE_ARGS) {
+        fprintf(stderr, "mycc: too many arguments to native function\n");
+        exit(1);
+    }
+    for (int k = 0; k < nargs; k++) a[k] = r[args[k]];
+    return ::call_native(fn, a, nargs);
+}
+
+long Interpreter::run(const BcFunction *f, long *r) {
+    static void *const labels[] = {
+#define LABEL(name) &&L_##name,
+        BYTECODES(LABEL)
+#undef LABEL
+    };
+    const uint32_t *code = f->code.data();
+    const uint32_t *pc = code;
+    char *locals = (char *)(r + f->nregs);
+
+#define R(k) r[pc[k]]
+#define IMM(k) ((long)(int32_t)pc[k])
+#define DISPATCH() goto *labels[*pc]
+#define NEXT(n) do { pc += n; DISPATCH(); } while (0)
+#define JUMP(t) do { pc = code + (t); DISPATCH(); } while (0)
+#define BINARY(op, expr) L_##op: R(1) = (expr); NEXT(4);
+#define UNARY(op, expr) L_##op: R(1) = (expr); NEXT(3);
+#define LOADS(kind, T) \
+    L_LD##kind: R(1) = load<T>(R(2)); NEXT(3); \
+    L_LDL##kind: R(1) = load<T>((long)(locals + pc[2])); NEXT(3); \
+    L_LDX##kind: R(1) = load<T>(R(2) + R(3)); NEXT(4);
+#define STORES(size, T) \
+    L_ST##size: store<T>(R(1), R(2)); NEXT(3); \
+    L_STL##size: store<T>((long)(locals + pc[1]), R(2)); NEXT(3);
+#define BRANCH(op, cond) \
+    L_##op: JUMP((cond) ? pc[3] : pc[4]);
+
+    DISPATCH();
+L_MOV: R(1) = R(2); NEXT(3);
+L_LI: R(1) = IMM(2); NEXT(3);
+L_LK: R(1) = f->consts[pc[2]]; NEXT(3);
+L_LEA: R(1) = (long)(locals + pc[2]); NEXT(3);
+    BINARY(ADD, add(R(2), R(3)))
+    BINARY(SUB, sub(R(2), R(3)))
+    BINARY(MUL, mul(R(2), R(3)))
+    BINARY(DIV, R(2) / R(3))
+    BINARY(UDIV, (unsigned long)R(2) / (unsigned long)R(3))
+    BINARY(MOD, R(2) % R(3))
+    BINARY(UMOD, (unsigned long)R(2) % (unsigned long)R(3))
+    BINARY(AND, R(2) & R(3))
+    BINARY(OR, R(2) | R(3))
+    BINARY(XOR, R(2) ^ R(3))
+    BINARY(SHL, (unsigned long)R(2) << (R(3) & 63))
+    BINARY(SHR, (unsigned long)R(2) >> (R(3) & 63))
+    BINARY(SAR, R(2) >> (R(3) & 63))
+    BINARY(EQ, R(2) == R(3))
+    BINARY(NE, R(2) != R(3))
+    BINARY(LT, R(2) < R(3))
+    BINARY(LE, R(2) <= R(3))
+    BINARY(GT, R(2) > R(3))
+    BINARY(GE, R(2) >= R(3))
+    BINARY(ULT, (unsigned long)R(2) < (unsigned long)R(3))
+    BINARY(ULE, (unsigned long)R(2) <= (unsigned long)R(3))
+    BINARY(UGT, (unsigned long)R(2) > (unsigned long)R(3))
+    BINARY(UGE, (unsigned long)R(2) >= (unsigned long)R(3))
+    BINARY(ADDI, add(R(2), IMM(3)))
+    BINARY(MULI, mul(R(2), IMM(3)))
+    BINARY(ANDI, R(2) & IMM(3))
+    BINARY(ORI, R(2) | IMM(3))
+    BINARY(XORI, R(2) ^ IMM(3))
+    BINARY(SHLI, (unsigned long)R(2) << (IMM(3) & 63))
+    BINARY(SHRI, (unsigned long)R(2) >> (IMM(3) & 63))
+    BINARY(SARI, R(2) >> (IMM(3) & 63))
+    BINARY(EQI, R(2) == IMM(3))
+    BINARY(NEI, R(2) != IMM(3))
+    BINARY(LTI, R(2) < IMM(3))
+    BINARY(LEI, R(2) <= IMM(3))
+    BINARY(GTI, R(2) > IMM(3))
+    BINARY(GEI, R(2) >= IMM(3))
+    BINARY(ADDW, (int)add(R(2), R(3)))
+    BINARY(SUBW, (int)sub(R(2), R(3)))
+    BINARY(MULW, (int)mul(R(2), R(3)))
+    BINARY(ADDIW, (int)add(R(2), IMM(3)))
+    UNARY(NEG, sub(0, R(2)))
+    UNARY(NOT, ~R(2))
+    UNARY(SEXT1, (signed char)R(2))
+    UNARY(SEXT2, (short)R(2))
+    UNARY(SEXT4, (int)R(2))
+    UNARY(ZEXT1, (unsigned char)R(2))
+    UNARY(ZEXT2, (unsigned short)R(2))
+    UNARY(ZEXT4, (unsigned)R(2))
+L_SEL: R(1) = R(2) ? R(3) : R(4); NEXT(5);
+    LOADS(1, int8_t)
+    LOADS(1U, uint8_t)
+    LOADS(2, int16_t)
+    LOADS(2U, uint16_t)
+    LOADS(4, int32_t)
+    LOADS(4U, uint32_t)
+    LOADS(8, int64_t)
+    STORES(1, int8_t)
+    STORES(2, int16_t)
+    STORES(4, int32_t)
+    STORES(8, int64_t)
+L_JMP: JUMP(pc[1]);
+L_BR: JUMP(R(1) ? pc[2] : pc[3]);
+    BRANCH(BEQ, R(1) == R(2))
+    BRANCH(BNE, R(1) != R(2))
+    BRANCH(BLT, R(1) < R(2))
+    BRANCH(BLE, R(1) <= R(2))
+    BRANCH(BGT, R(1) > R(2))
+    BRANCH(BGE, R(1) >= R(2))
+    BRANCH(BULT, (unsigned long)R(1) < (unsigned long)R(2))
+    BRANCH(BULE, (unsigned long)R(1) <= (unsigned long)R(2))
+    BRANCH(BUGT, (unsigned long)R(1) > (unsigned long)R(2))
+    BRANCH(BUGE, (unsigned long)R(1) >= (unsigned long)R(2))
+    BRANCH(BEQI, R(1) == IMM(2))
+    BRANCH(BNEI, R(1) != IMM(2))
+    BRANCH(BLTI, R(1) < IMM(2))
+    BRANCH(BLEI, R(1) <= IMM(2))
+    BRANCH(BGTI, R(1) > IMM(2))
+    BRANCH(BGEI, R(1) >= IMM(2))
+L_SWITCH: {
+    auto &t = f->switches[pc[2]];
+    long v = R(1);
+    auto it = std::lower_bound(
+        t.cases.begin(), t.cases.end(), v,
+        [](const std::pair<long, uint32_t> &c, long v) { return c.first < v; });
+    JUMP(it != t.cases.end() && it->first == v ? it->second
+                                               : t.default_target);
+}
+L_CALL:
+    R(1) = call(&prog.funcs[pc[3]], r, pc + 4, pc[2]);
+    NEXT(4 + pc[2]);
+L_CALLN:
+    R(1) = call_native((void *)f->consts[pc[3]], r, pc + 4, pc[2]);
+    NEXT(4 + pc[2]);
+L_CALLR: {
+    auto it = prog.by_addr.find(R(3));
+    if (it != prog.by_addr.end())
+        R(1) = call(it->second, r, pc + 4, pc[2]);
+    else
+        R(1) = call_native((void *)R(3), r, pc + 4, pc[2]);
+    NEXT(4 + pc[2]);
+}
+L_TAILCALL: {
+    int nargs = pc[1];
+    tail_args.resize(nargs);
+    for (int k = 0; k < nargs; k++) tail_args[k] = R(3 + k);
+    f = &prog.funcs[pc[2]];
+    pop_frame(r);
+    r = push_frame(f);
+    for (int k = 0; k < nargs && (size_t)k < f->params.size(); k++) {
+        if (f->params[k] >= 0) r[f->params[k]] = tail_args[k];
+    }
+    code = pc = f->code.data();
+    locals = (char *)(r + f->nregs);
+    DISPATCH();
+}
+L_RET:
+    return R(1);
+L_RETV:
+    return 0;
+
+#undef R
+#undef IMM
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BINARY
+#undef UNARY
+#undef LOADS
+#undef STORES
+#undef BRANCH
+}
+
+}
+
+int run_bytecode(IRModule &m, bool stats, int argc, char **argv) {
+    Runtime rt(m);
+    Program prog;
+    // Functions are defined up front, so that calls can refer to them and
+    // their addresses can be taken
+    prog.funcs.resize(m.funcs.size());
+    for (size_t k = 0; k < m.funcs.size(); k++) {
+        auto &bf = prog.funcs[k];
+        bf.name = m.funcs[k]->name;
+        prog.index[bf.name] = k;
+        prog.by_addr[(long)&bf] = &bf;
+        rt.define_function(bf.name, &bf);
+    }
+    if (!rt.link()) return 1;
+    bool ok = true;
+    long words = 0;
+    int nfolded = 0;
+    for (size_t k = 0; k < m.funcs.size(); k++) {
+        Compiler c(*m.funcs[k], prog.funcs[k], prog, rt);
+        ok &= c.run();
+        words += prog.funcs[k].code.size();
+        nfolded += c.nfolded;
+    }
+    if (!ok) return 1;
+    if (stats) {
+        fprintf(stderr, "bytecode: %zu functions, %ld words of code, %d "
+                "instructions folded into superinstructions\n",
+                m.funcs.size(), words, nfolded);
+    }
+    auto main_fn = prog.index.find("main");
+    if (main_fn == prog.index.end()) {
+        fprintf(stderr, "mycc: no main function\n");
+        return 1;
+    }
+    Interpreter interp(prog);
+    long args[] = {argc, (long)argv};
+    return interp.call(&prog.funcs[main_fn->second], args, 2);
+}
@@ -0,0 +1,422 @@
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "decl.hpp"
+#include "ir.hpp"
+#include "lower.hpp"
+#include "opt.hpp"
+#include "parse.hpp"
+#include "scan.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+
+// FNV-1a
+struct Hash {
+    unsigned long h = 14695981039346656037ul;
+    void add(const void *data, size_t n) {
+        auto p = (const unsigned char *)data;
+        for (size_t k = 0; k < n; k++) {
+            h ^= p[k];
+            h *= 1099511628211ul;
+        }
+    }
+    void add(long v) { add(&v, sizeof v); }
+    void add(const std::string &s) {
+        add((long)s.size());
+        add(s.data(), s.size());
+    }
+};
+
+bool read_file(const std::string &path, std::string &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::ostringstream buf;
+    buf << file.rdbuf();
+    data = buf.str();
+    return true;
+}
+
+// The function as inlined into, everything the passes after that look at
+void hash_function(Hash &h, const IRFunction &f) {
+    h.add(f.name);
+    h.add(f.type->str());
+    h.add((long)f.nregs);
+    for (auto &s: f.slots) {
+        h.add(s.size);
+        h.add((long)s.align);
+    }
+    for (auto &s: f.strings) {
+        h.add(s.name);
+        h.add(s.data);
+    }
+    for (auto &b: f.blocks) {
+        h.add((long)b->instrs.size());
+        h.add((long)b->loop_depth);
+        h.add(b->count);
+        for (auto &i: b->instrs) {
+            h.add((long)i.op);
+            h.add((long)i.dst);
+            h.add((long)i.args.size());
+            for (int a: i.args) h.add((long)a);
+            h.add(i.imm);
+            h.add((long)i.size);
+            h.add((long)(i.is_signed | i.is_variadic << 1 | i.is_tail << 2));
+            h.add((long)i.width);
+            h.add(i.sym);
+            h.add((long)i.targets.size());
+            for (auto t: i.targets) h.add((long)t->id);
+            for (long c: i.cases) h.add(c);
+        }
+    }
+}
+
+// The entries are files named by their keys, holding a FunctionCode
+class Cache {
+public:
+    Cache(const std::string &dir) : dir(dir) {}
+    bool load(char kind, unsigned long key, const std::string &name,
+              FunctionCode &code);
+    void store(char kind, unsigned long key, const FunctionCode &code);
+private:
+    std::string dir;
+    std::string path(char kind, unsigned long key) const {
+        char name[32];
+        snprintf(name, sizeof name, "/%c%016lx", kind, key);
+        return dir + name;
+    }
+};
+
+const long magic = 0x6c75636363616368;  // "luccach"
+
+struct Writer {
+    std::string data;
+    void put(long v) { data.append((const char *)&v, sizeof v); }
+    void put(const std::string &s) {
+        put((long)s.size());
+        data += s;
+    }
+};
+
+struct Reader {
+    const std::string &data;
+    size_t at = 0;
+    bool ok = true;
+    Reader(const std::string &data) : data(data) {}
+    long get() {
+        long v = 0;
+        if (at + sizeof v > data.size()) {
+            ok = false;
+            return 0;
+        }
+        memcpy(&v, data.data() + at, sizeof v);
+        at += sizeof v;
+        return v;
+    }
+    std::string get_string() {
+        size_t n = get();
+        if (!ok || n > data.size() - at) {
+            ok = false;
+            return "";
+        }
+        at += n;
+        return data.substr(at - n, n);
+    }
+};
+
+bool Cache::load(char kind, unsigned long key, const std::string &name,
+                 FunctionCode &code) {
+    std::string data;
+    if (!read_file(path(kind, key), data)) return false;
+    Reader r(data);
+    if (r.get() != magic || r.get_string() != name) return false;
+    code.name = name;
+    code.is_global = r.get();
+    code.strings.resize(r.get() & 0xffff);
+    for (auto &g: code.strings) {
+        g.name = r.get_string();
+        g.size = r.get();
+        g.align = r.get();
+        long flags = r.get();
+        g.is_static = flags & 1;
+        g.is_string = flags & 2;
+        g.is_zero = flags & 4;
+        g.data = r.get_string();
+        g.relocs.resize(r.get() & 0xffff);
+        for (auto &rel: g.relocs) {
+            rel.offset = r.get();
+            rel.sym = r.get_string();
+            rel.addend = r.get();
+        }
+    }
+    code.text = r.get_string();
+    code.relocs.resize(r.get() & 0xffffff);
+    for (auto &rel: code.relocs) {
+        rel.kind = (CodeReloc::Kind)r.get();
+        rel.offset = r.get();
+        rel.sym = r.get_string();
+        rel.addend = r.get();
+    }
+    return r.ok && r.at == data.size();
+}
+
+// Written to a file of its own first, so a build reading the entry at the
+// same time never sees half of it
+void Cache::store(char kind, unsigned long key, const FunctionCode &code) {
+    Writer w;
+    w.put(magic);
+    w.put(code.name);
+    w.put(code.is_global);
+    w.put((long)code.strings.size());
+    for (auto &g: code.strings) {
+        w.put(g.name);
+        w.put(g.size);
+        w.put((long)g.align);
+        w.put((long)(g.is_static | g.is_string << 1 | g.is_zero << 2));
+        w.put(g.data);
+        w.put((long)g.relocs.size());
+        for (auto &rel: g.relocs) {
+            w.put(rel.offset);
+            w.put(rel.sym);
+            w.put(rel.addend);
+        }
+    }
+    w.put(code.text);
+    w.put((long)code.relocs.size());
+    for (auto &rel: code.relocs) {
+        w.put((long)rel.kind);
+        w.put(rel.offset);
+        w.put(rel.sym);
+        w.put(rel.addend);
+    }
+    auto name = path(kind, key);
+    auto temp = name + "." + std::to_string(getpid());
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (!file) return;
+    bool written = fwrite(w.data.data(), 1, w.data.size(), file) ==
+                   w.data.size();
+    if (fclose(file) == 0 && written)
+        rename(temp.c_str(), name.c_str());
+    else
+        remove(temp.c_str());
+}
+
+// What the keys by source are made of, for each declaration
+struct Decl {
+    unsigned long tokens;             // hash of its tokens
+    std::vector<std::string> idents;  // the names it uses, once each
+    std::vector<std::string> names;   // the names it declares
+    std::vector<size_t> uses;         // the declarations of @idents
+};
+
+Decl describe(const char *src, SourceRange range, const ExtDeclAST &decl) {
+    Decl d;
+    std::string text(src + range.begin, src + range.end);
+    Scanner scanner(text.c_str());
+    std::unordered_set<std::string> seen;
+    Hash h;
+    for (;;) {
+        auto token = scanner.scan();
+        if (token.type == TOK_EOF) break;
+        h.add((long)token.type);
+        h.add(token.lexeme);
+        if (token.type == TOK_IDENT && seen.insert(token.lexeme).second)
+            d.idents.push_back(token.lexeme);
+    }
+    d.tokens = h.h;
+    decl.names(d.names);
+    return d;
+}
+
+}
+
+bool compile_cached(const std::string &dir, const std::string &settings,
+                    const char *src,
+                    const std::vector<SourceRange> &ranges,
+                    const Parser::ExtDeclList &decls,
+                    const OptOptions &opt_opts, const CodegenOptions &opts,
+                    std::string &out) {
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "mycc: %s: %s\n", dir.c_str(), strerror(errno));
+        return false;
+    }
+    Cache cache(dir);
+    Hash base;
+    std::string data;
+    base.add(settings);
+    base.add((long)opts.object);
+    if (read_file("/proc/self/exe", data)) base.add(data);
+    if (opt_opts.profile_use && read_file(opt_opts.profile_path, data))
+        base.add(data);
+
+    size_t n = decls.size();
+    std::vector<Decl> info;
+    std::unordered_map<std::string, std::vector<size_t>> declared_by;
+    for (size_t k = 0; k < n; k++) {
+        info.push_back(describe(src, ranges[k], *decls[k]));
+        for (auto &name: info[k].names) declared_by[name].push_back(k);
+    }
+    for (size_t k = 0; k < n; k++) {
+        auto &uses = info[k].uses;
+        for (auto &name: info[k].idents) {
+            auto it = declared_by.find(name);
+            if (it == declared_by.end()) continue;
+            for (size_t j: it->second) {
+                if (j != k) uses.push_back(j);
+            }
+        }
+        std::sort(uses.begin(), uses.end());
+        uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+    }
+
+    // Hash what each declaration depends on with Tarjan's algorithm, which
+    // finishes the strongly connected components of the uses, like
+    // mutually recursive functions, after those they use. The hash of a
+    // component covers the tokens of its members, in source order, and
+    // the hashes of the components they use, with whether they come
+    // before them. It's kept at the member it was found from.
+    std::vector<unsigned long> deep(n);
+    std::vector<int> index(n, -1), low(n);
+    std::vector<size_t> component(n, n), stack;
+    std::vector<char> on_stack(n);
+    int counter = 0;
+    std::function<void(size_t)> visit = [&](size_t k) {
+        index[k] = low[k] = counter++;
+        stack.push_back(k);
+        on_stack[k] = true;
+        for (size_t j: info[k].uses) {
+            if (index[j] < 0) {
+                visit(j);
+                low[k] = std::min(low[k], low[j]);
+            } else if (on_stack[j]) {
+                low[k] = std::min(low[k], index[j]);
+            }
+        }
+        if (low[k] != index[k]) return;
+        std::vector<size_t> members;
+        size_t j;
+        do {
+            j = stack.back();
+            stack.pop_back();
+            on_stack[j] = false;
+            component[j] = k;
+            members.push_back(j);
+        } while (j != k);
+        std::sort(members.begin(), members.end());
+        Hash h;
+        for (size_t m: members) {
+            h.add((long)info[m].tokens);
+            for (size_t u: info[m].uses) {
+                if (component[u] == k) continue;
+                h.add((long)(u < m));
+                h.add((long)deep[component[u]]);
+            }
+        }
+        deep[k] = h.h;
+    };
+    for (size_t k = 0; k < n; k++) {
+        if (index[k] < 0) visit(k);
+    }
+
+    // Look up the functions by source, and lower those not found, with
+    // whatever they depend on, which has all they may inline
+    int functions = 0, by_source = 0, by_ir = 0;
+    std::vector<FunctionCode> code(n);
+    std::vector<char> found(n), needed(n);
+    std::vector<size_t> work;
+    std::vector<unsigned long> source_key(n);
+    std::unordered_map<std::string, size_t> function_of;
+    for (size_t k = 0; k < n; k++) {
+        if (!decls[k]->is_function()) continue;
+        auto &name = info[k].names[0];
+        Hash h = base;
+        h.add(name);
+        h.add((long)deep[component[k]]);
+        source_key[k] = h.h;
+        function_of[name] = k;
+        functions++;
+        found[k] = cache.load('s', h.h, name, code[k]);
+        by_source += found[k];
+        if (!found[k] && !needed[k]) {
+            needed[k] = true;
+            work.push_back(k);
+        }
+    }
+    while (!work.empty()) {
+        size_t k = work.back();
+        work.pop_back();
+        for (size_t j: info[k].uses) {
+            if (needed[j]) continue;
+            needed[j] = true;
+            work.push_back(j);
+        }
+    }
+    // What the inliner finds hot is relative to the hottest block in the
+    // module, so with a profile all of it is needed
+    if (opt_opts.profile_use) needed.assign(n, true);
+    IRModule module;
+    Lowering lowering(module);
+    lowering.if_conversion = opt_opts.if_conversion;
+    for (size_t k = 0; k < n; k++) {
+        if (decls[k]->is_function() && !needed[k])
+            static_cast<FuncDeclAST &>(*decls[k]).declare(lowering);
+        else
+            decls[k]->lower(lowering);
+    }
+    if (lowering.failed) return false;
+    if (opt_opts.profile_use) read_profile(module, opt_opts.profile_path);
+
+    // Once inlined into, the functions found by source are done with, and
+    // the others are looked up by IR
+    std::vector<unsigned long> ir_key(n);
+    optimize_module(module, opt_opts, [&](IRModule &m) {
+        size_t kept = 0;
+        for (size_t j = 0; j < m.funcs.size(); j++) {
+            auto &f = m.funcs[j];
+            size_t k = function_of.at(f->name);
+            if (!found[k]) {
+                Hash h = base;
+                hash_function(h, *f);
+                ir_key[k] = h.h;
+                found[k] = cache.load('i', h.h, f->name, code[k]);
+                if (found[k]) {
+                    by_ir++;
+                    cache.store('s', source_key[k], code[k]);
+                }
+            }
+            if (!found[k]) m.funcs[kept++] = std::move(f);
+        }
+        m.funcs.resize(kept);
+    });
+    auto compiled = compile_module(module, opts);
+    for (auto &c: compiled) {
+        size_t k = function_of.at(c.name);
+        cache.store('s', source_key[k], c);
+        cache.store('i', ir_key[k], c);
+        code[k] = std::move(c);
+    }
+    std::vector<FunctionCode> funcs;
+    for (size_t k = 0; k < n; k++) {
+        if (decls[k]->is_function()) funcs.push_back(std::move(code[k]));
+    }
+    out = emit_module(module.globals, funcs, opts);
+    if (opts.stats) {
+        fprintf(stderr, "cache: %d functions, %d found by source, %d by "
+                "IR, %d compiled\n", functions, by_source, by_ir,
+                functions - by_source - by_ir);
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+#include "codegen.hpp"
+#include "opt.hpp"
+#include "parse.hpp"
+#include <string>
+#include <vector>
+
+// Incremental builds. The code of each function, as it goes into the
+// output, is kept in a directory under two keys:
+//
+// - by source: the tokens of its definition, and those of the
+//   declarations of the names it uses, and of the names those use in
+//   turn, with which of them come before the others that use them.
+//   Whatever the function may inline is in there, and so is anything that
+//   changes how it's lowered.
+// - by IR: the function as lowered and inlined into.
+//
+// Functions found by source aren't lowered at all, unless a function that
+// isn't may inline them. The others are looked up by IR after inlining,
+// which finds those whose changed dependencies made no difference to
+// them, like a caller that didn't inline the function edited. The rest
+// are optimized and compiled as usual, and kept for the next build.
+//
+// Both keys also cover @settings, the options given that change the code,
+// the compiler itself and the profile used, if any. Nothing is ever
+// removed from the directory.
+
+// Compile the translation unit @decls, parsed from @ranges of @src, to
+// assembly or an object file in @out, as optimize_module() and
+// codegen_module() would, with the cache in @dir. Returns false on
+// errors, which have been reported. With opts.stats, print how many
+// functions were found to stderr.
+bool compile_cached(const std::string &dir, const std::string &settings,
+                    const char *src,
+                    const std::vector<SourceRange> &ranges,
+                    const Parser::ExtDeclList &decls,
+                    const OptOptions &opt_opts, const CodegenOptions &opts,
+                    std::string &out);
+#endif
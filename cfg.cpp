@@ -0,0 +1,255 @@
+#include "cfg.hpp"
+#include "ir.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+std::vector<std::vector<int>> successors(const IRFunction &f) {
+    std::vector<std::vector<int>> succs(f.blocks.size());
+    for (auto &b: f.blocks) {
+        if (!b->is_terminated()) continue;
+        for (auto t: b->instrs.back().targets) succs[b->id].push_back(t->id);
+    }
+    return succs;
+}
+
+}
+
+CFG::CFG(const IRFunction &f) : CFG(successors(f)) {}
+
+CFG::CFG(std::vector<std::vector<int>> edges)
+    : succs(std::move(edges)), preds(succs.size()),
+      pred_index(succs.size()), rpo_index(succs.size(), -1) {
+    // A switch may have many cases going to the same block, but each edge
+    // is only recorded once
+    std::vector<int> seen(size(), -1);
+    for (int b = 0; b < size(); b++) {
+        size_t n = 0;
+        for (int t: succs[b]) {
+            if (seen[t] == b) continue;
+            seen[t] = b;
+            succs[b][n++] = t;
+            pred_index[b].push_back(preds[t].size());
+            preds[t].push_back(b);
+        }
+        succs[b].resize(n);
+    }
+
+    // Depth first, without recursion since functions may have many
+    // thousands of blocks
+    std::vector<int> postorder;
+    std::vector<char> visited(size());
+    std::vector<std::pair<int, size_t>> stack{{0, 0}};
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        int b = top.first;
+        if (top.second < succs[b].size()) {
+            int s = succs[b][top.second++];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack.emplace_back(s, 0);
+            }
+        } else {
+            postorder.push_back(b);
+            stack.pop_back();
+        }
+    }
+    rpo.assign(postorder.rbegin(), postorder.rend());
+    for (size_t k = 0; k < rpo.size(); k++) rpo_index[rpo[k]] = k;
+}
+
+DomTree::DomTree(const CFG &cfg)
+    : idom(cfg.size(), -1), children(cfg.size()),
+      pre(cfg.size(), -1), post(cfg.size(), -1) {
+    auto &order = cfg.rpo_index;
+    // Walk up from both blocks to their nearest common dominator. Blocks
+    // closer to the entry come earlier in reverse postorder.
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (order[a] > order[b]) a = idom[a];
+            while (order[b] > order[a]) b = idom[b];
+        }
+        return a;
+    };
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t k = 1; k < cfg.rpo.size(); k++) {
+            int b = cfg.rpo[k];
+            int new_idom = -1;
+            for (int p: cfg.preds[b]) {
+                if (idom[p] < 0) continue;  // not processed yet
+                new_idom = new_idom < 0 ? p : intersect(p, new_idom);
+            }
+            if (idom[b] != new_idom) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = -1;
+    for (int b: cfg.rpo) {
+        if (idom[b] >= 0) children[idom[b]].push_back(b);
+    }
+
+    int n = 0;
+    std::vector<std::pair<int, size_t>> stack{{0, 0}};
+    pre[0] = n++;
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        int b = top.first;
+        if (top.second < children[b].size()) {
+            int c = children[b][top.second++];
+            pre[c] = n++;
+            stack.emplace_back(c, 0);
+        } else {
+            post[b] = n++;
+            stack.pop_back();
+        }
+    }
+}
+
+// The frontiers are found from the joins: a predecessor of a join, and
+// its dominators up to but not including the immediate dominator of the
+// join, have the join in their frontier. The entry is also entered from
+// outside the function, so it's a join with a single predecessor.
+std::vector<std::vector<int>> DomTree::frontiers(const CFG &cfg) const {
+    std::vector<std::vector<int>> df(cfg.size());
+    for (int b: cfg.rpo) {
+        if (cfg.preds[b].size() < (b == 0 ? 1 : 2)) continue;
+        for (int p: cfg.preds[b]) {
+            if (!cfg.is_reachable(p)) continue;
+            for (int r = p; r != idom[b]; r = idom[r]) {
+                // Walks from the other predecessors may have been here
+                if (!df[r].empty() && df[r].back() == b) break;
+                df[r].push_back(b);
+            }
+        }
+    }
+    return df;
+}
+
+LoopForest::LoopForest(const CFG &cfg, const DomTree &dom)
+    : innermost(cfg.size()) {
+    // Each block found in a loop is joined to the set of its header, so
+    // that find() gives the header of the outermost loop found so far that
+    // contains it
+    std::vector<int> uf(cfg.size());
+    std::iota(uf.begin(), uf.end(), 0);
+    auto find = [&](int b) {
+        while (uf[b] != b) b = uf[b] = uf[uf[b]];
+        return b;
+    };
+    std::vector<Loop *> header_of(cfg.size());
+
+    // Inner loops have their headers later in reverse postorder, as they
+    // are dominated by the headers of the loops around them
+    std::vector<int> work;
+    for (size_t k = cfg.rpo.size(); k-- > 0;) {
+        int h = cfg.rpo[k];
+        work.clear();
+        for (int p: cfg.preds[h]) {
+            if (dom.dominates(h, p)) work.push_back(p);
+        }
+        if (work.empty()) continue;
+        loops.push_back(std::make_unique<Loop>());
+        auto loop = loops.back().get();
+        loop->header = h;
+        loop->blocks.push_back(h);
+        header_of[h] = loop;
+        innermost[h] = loop;
+        while (!work.empty()) {
+            int b = find(work.back());
+            work.pop_back();
+            if (b == h || !dom.dominates(h, b)) continue;
+            if (header_of[b]) {
+                // The outermost loop found so far around the block
+                auto inner = header_of[b];
+                inner->parent = loop;
+                loop->children.push_back(inner);
+            } else {
+                innermost[b] = loop;
+                loop->blocks.push_back(b);
+            }
+            uf[b] = h;
+            for (int p: cfg.preds[b]) {
+                if (cfg.is_reachable(p)) work.push_back(p);
+            }
+        }
+    }
+    // Outer loops were found last
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it) {
+        auto loop = it->get();
+        if (loop->parent)
+            loop->depth = loop->parent->depth + 1;
+        else
+            roots.push_back(loop);
+    }
+}
+
+namespace
+{
+
+void print_blocks(FILE *out, const char *what, const std::vector<int> &bs) {
+    if (bs.empty()) return;
+    fprintf(out, "; %s", what);
+    for (int b: bs) fprintf(out, " .%d", b);
+}
+
+void print_loop(FILE *out, const Loop *loop) {
+    fprintf(out, "  %*sloop .%d:", (loop->depth - 1) * 2, "", loop->header);
+    for (int b: loop->blocks) fprintf(out, " .%d", b);
+    fprintf(out, "\n");
+    for (auto c: loop->children) print_loop(out, c);
+}
+
+}
+
+void print_cfg(const IRFunction &f, FILE *out, bool stats) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    auto t0 = clock::now();
+    CFG cfg(f);
+    auto t1 = clock::now();
+    DomTree dom(cfg);
+    auto t2 = clock::now();
+    auto df = dom.frontiers(cfg);
+    auto t3 = clock::now();
+    LoopForest forest(cfg, dom);
+    auto t4 = clock::now();
+    if (stats) {
+        fprintf(stderr, "%s: %d blocks, %zu loops, cfg %.3f ms, dominators "
+                "%.3f ms, frontiers %.3f ms, loops %.3f ms\n",
+                f.name.c_str(), cfg.size(), forest.loops.size(), ms(t0, t1),
+                ms(t1, t2), ms(t2, t3), ms(t3, t4));
+    }
+
+    fprintf(out, "func %s {\n", f.name.c_str());
+    for (int b = 0; b < cfg.size(); b++) {
+        fprintf(out, ".%d:", b);
+        if (!cfg.is_reachable(b)) {
+            fprintf(out, " unreachable\n");
+            continue;
+        }
+        if (dom.idom[b] >= 0) fprintf(out, " idom .%d", dom.idom[b]);
+        else fprintf(out, " entry");
+        print_blocks(out, "succs", cfg.succs[b]);
+        print_blocks(out, "frontier", df[b]);
+        if (forest.depth(b))
+            fprintf(out, "; loop .%d depth %d", forest.loop_of(b)->header,
+                    forest.depth(b));
+        fprintf(out, "\n");
+    }
+    for (auto loop: forest.roots) print_loop(out, loop);
+    fprintf(out, "}\n");
+}
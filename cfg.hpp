@@ -0,0 +1,97 @@
+#ifndef CFG_HPP
+#define CFG_HPP
+#include "ir.hpp"
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Analyses of the control flow of an IRFunction. Blocks are referred to by
+// their ids, which must be numbered 0..n-1 in order, as the IR keeps them.
+// The lowering has already resolved gotos, switch cases, fallthrough,
+// break and continue into the targets of the terminators, so those are all
+// the edges there are.
+
+class CFG {
+public:
+    explicit CFG(const IRFunction &f);
+    // From the successors of each block, for other kinds of functions.
+    // Block 0 is the entry.
+    explicit CFG(std::vector<std::vector<int>> succs);
+    int size() const { return succs.size(); }
+    bool is_reachable(int b) const { return rpo_index[b] >= 0; }
+
+    std::vector<std::vector<int>> succs;
+    std::vector<std::vector<int>> preds;
+    // For each successor, the position of the block among its
+    // predecessors, to find the incoming edge without searching for it
+    std::vector<std::vector<int>> pred_index;
+    // The blocks reachable from the entry, in reverse postorder, and the
+    // position of each block in it, -1 if it's unreachable
+    std::vector<int> rpo;
+    std::vector<int> rpo_index;
+};
+
+// The dominator tree, computed with the iterative algorithm of Cooper,
+// Harvey and Kennedy. Each pass over the blocks in reverse postorder walks
+// up the current tree to intersect the dominators of the predecessors,
+// and the passes stop after one without changes, which takes a couple for
+// the control flow of structured code.
+class DomTree {
+public:
+    explicit DomTree(const CFG &cfg);
+    // Whether @a dominates @b, in constant time. Every block dominates
+    // itself; unreachable blocks neither dominate nor are dominated.
+    bool dominates(int a, int b) const {
+        return pre[a] >= 0 && pre[b] >= 0 && pre[a] <= pre[b] &&
+               post[b] <= post[a];
+    }
+    // The dominance frontier of each block: the blocks where its dominance
+    // ends, as those have a predecessor it dominates but aren't strictly
+    // dominated by it themselves
+    std::vector<std::vector<int>> frontiers(const CFG &cfg) const;
+
+    // The immediate dominator of each block, -1 for the entry and for
+    // unreachable blocks
+    std::vector<int> idom;
+    std::vector<std::vector<int>> children;
+private:
+    // Numbering of a depth first walk of the tree
+    std::vector<int> pre, post;
+};
+
+// A natural loop: a header, and the blocks that reach a back edge to it
+// without going through it
+struct Loop {
+    int header;
+    int depth = 1;  // 1 for outermost loops
+    Loop *parent = NULL;
+    std::vector<Loop *> children;
+    // The blocks of the loop but not of any nested loop
+    std::vector<int> blocks;
+};
+
+// The loops of a function, as a forest by nesting. Built by walking back
+// from the back edges of each header, innermost loops first, and jumping
+// over the loops already found with a union-find, so that each edge is
+// only looked at a few times however deep the nest is.
+//
+// Loops entered other than through their header, only possible with goto,
+// are not natural loops and have no back edge. Their blocks are left to
+// the enclosing loop, if any.
+class LoopForest {
+public:
+    LoopForest(const CFG &cfg, const DomTree &dom);
+    // The innermost loop containing @b, or NULL
+    Loop *loop_of(int b) const { return innermost[b]; }
+    int depth(int b) const { return innermost[b] ? innermost[b]->depth : 0; }
+
+    std::vector<std::unique_ptr<Loop>> loops;  // inner loops first
+    std::vector<Loop *> roots;
+private:
+    std::vector<Loop *> innermost;
+};
+
+// Print the analyses of @f, for --print-cfg. With @stats, also print the
+// time each took to stderr.
+void print_cfg(const IRFunction &f, FILE *out, bool stats);
+#endif
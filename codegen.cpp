@@ -0,0 +1,264 @@
+#include "codegen.hpp"
+#include "elf.hpp"
+#include "ir.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Call @fn(k) for each k below @n, on up to @jobs threads taking the next
+// k as they become free. Runs on the calling thread alone if @jobs is 1.
+void parallel_for(size_t n, int jobs, const std::function<void(size_t)> &fn) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t k; (k = next++) < n;) fn(k);
+    };
+    std::vector<std::thread> threads;
+    size_t nthreads = std::min((size_t)std::max(jobs, 1), n);
+    for (size_t i = 1; i < nthreads; i++) threads.emplace_back(worker);
+    worker();
+    for (auto &t: threads) t.join();
+}
+
+}
+
+// Frame slots are laid out downwards from the canonical frame address minus
+// the return address and the saved %rbp, if any. Leaf functions don't set up
+// %rbp at all: small frames fit in the 128-byte red zone below %rsp, which
+// the ABI guarantees won't be clobbered by signal handlers, larger ones are
+// allocated by adjusting %rsp.
+//
+// Code using 256-bit vectors clears their upper halves before calls and
+// returns, so that SSE code elsewhere doesn't pay for keeping them.
+void lower_frame(MFunction &mf) {
+    std::vector<int> regs;
+    bool used[NUM_GPRS] = {};
+    bool avx = false;
+    for (auto &b: mf.blocks) {
+        for (auto &i: b->instrs) {
+            avx = avx || (i.op >= M_VMOV && i.size == 32);
+            regs.clear();
+            i.defs(regs);
+            for (int r: regs) {
+                if (r < NUM_GPRS) used[r] = true;
+            }
+        }
+    }
+    std::vector<int> save_slots;
+    for (int r: callee_saved_regs) {
+        if (!used[r]) continue;
+        mf.saved_regs.push_back(r);
+        save_slots.push_back(mf.new_slot(8, 8));
+    }
+
+    std::vector<long> offsets;
+    long size = 0;
+    for (auto &s: mf.slots) {
+        size = align_to(size + s.first, s.second);
+        offsets.push_back(size);
+    }
+    size = align_to(size, 16);
+
+    enum { RED_ZONE, SP, FP } mode;
+    if (mf.has_calls) mode = FP;
+    else if (size <= 128) mode = RED_ZONE;
+    else mode = SP;
+
+    auto resolve = [&](MOperand &o) {
+        if (o.kind == MOperand::SLOT) {
+            long off = offsets[o.reg];
+            o.kind = MOperand::MEM;
+            o.reg = mode == FP ? RBP : RSP;
+            o.imm += mode == SP ? size - off : -off;
+        } else if (o.kind == MOperand::ARG) {
+            long off = 8 * o.reg;
+            o.kind = MOperand::MEM;
+            o.reg = mode == FP ? RBP : RSP;
+            o.imm = off + (mode == FP ? 16 : mode == SP ? size + 8 : 8);
+        }
+    };
+
+    std::vector<MInstr> prologue, epilogue;
+    auto add = [](std::vector<MInstr> &v, MOpcode op,
+                  std::vector<MOperand> ops) {
+        v.emplace_back(op);
+        v.back().ops = std::move(ops);
+    };
+    auto reg = MOperand::make_reg;
+    auto imm = MOperand::make_imm;
+    if (mode == FP) {
+        add(prologue, M_PUSH, {reg(RBP)});
+        add(prologue, M_MOV, {reg(RSP), reg(RBP)});
+    }
+    if (mode != RED_ZONE && size)
+        add(prologue, M_SUB, {imm(size), reg(RSP)});
+    for (size_t k = 0; k < mf.saved_regs.size(); k++) {
+        add(prologue, M_MOV, {reg(mf.saved_regs[k]),
+                              MOperand::make_slot(save_slots[k])});
+        add(epilogue, M_MOV, {MOperand::make_slot(save_slots[k]),
+                              reg(mf.saved_regs[k])});
+    }
+    if (mode == FP) {
+        add(epilogue, M_MOV, {reg(RBP), reg(RSP)});
+        add(epilogue, M_POP, {reg(RBP)});
+    } else if (mode == SP && size) {
+        add(epilogue, M_ADD, {imm(size), reg(RSP)});
+    }
+
+    for (auto &b: mf.blocks) {
+        std::vector<MInstr> out;
+        if (b.get() == mf.blocks[0].get())
+            out = prologue;
+        for (auto &i: b->instrs) {
+            bool leaves = i.op == M_RET || i.op == M_TAILCALL;
+            if (avx && (leaves || i.op == M_CALL))
+                out.emplace_back(M_VZEROUPPER);
+            if (leaves)
+                out.insert(out.end(), epilogue.begin(), epilogue.end());
+            out.push_back(i);
+        }
+        for (auto &i: out) {
+            for (auto &o: i.ops) resolve(o);
+        }
+        b->instrs = std::move(out);
+    }
+}
+
+std::unique_ptr<MFunction> compile_function(IRFunction &f,
+                                            const CodegenOptions &opts,
+                                            std::string &log) {
+    auto mf = select_instructions(f);
+    auto st = allocate_registers(*mf);
+    if (opts.stats) {
+        char buf[256];
+        snprintf(buf, sizeof buf, "%s: %d vregs, %d splits, %d spilled, "
+                 "%d reloads, %d spill stores, %d moves, %d coalesced\n",
+                 f.name.c_str(), st.vregs, st.splits, st.spilled,
+                 st.reloads, st.stores, st.moves, st.coalesced);
+        log += buf;
+    }
+    lower_frame(*mf);
+    if (opts.peephole) {
+        size_t instrs = 0, bytes = 0;
+        auto count = [&]() {
+            instrs = 0;
+            for (auto &b: mf->blocks) instrs += b->instrs.size();
+            std::string code;
+            std::vector<CodeReloc> relocs;
+            encode_function(*mf, code, relocs);
+            bytes = code.size();
+        };
+        if (opts.stats) count();
+        size_t old_instrs = instrs, old_bytes = bytes;
+        auto pst = optimize_peephole(*mf);
+        if (opts.stats) {
+            count();
+            char buf[256];
+            snprintf(buf, sizeof buf, "%s: peephole: %d rewrites, %d blocks "
+                     "removed, %zu -> %zu instructions, %zu -> %zu bytes\n",
+                     f.name.c_str(), pst.rewrites, pst.blocks, old_instrs,
+                     instrs, old_bytes, bytes);
+            log += buf;
+        }
+    }
+    return mf;
+}
+
+// Functions don't share any state in the backend, so each is compiled on
+// its own. The statistics go to a buffer per function, printed in order.
+std::vector<std::unique_ptr<MFunction>> compile_functions(
+    IRModule &m, const CodegenOptions &opts,
+    const std::function<void(size_t, const MFunction &)> &done) {
+    size_t n = m.funcs.size();
+    std::vector<std::unique_ptr<MFunction>> mfs(n);
+    std::vector<std::string> logs(n);
+    parallel_for(n, opts.jobs, [&](size_t k) {
+        mfs[k] = compile_function(*m.funcs[k], opts, logs[k]);
+        if (done) done(k, *mfs[k]);
+    });
+    for (auto &log: logs) fputs(log.c_str(), stderr);
+    return mfs;
+}
+
+std::vector<FunctionCode> compile_module(IRModule &m,
+                                         const CodegenOptions &opts) {
+    // The thread compiling a function also prints or encodes it, into a
+    // buffer of its own
+    std::vector<FunctionCode> code(m.funcs.size());
+    compile_functions(m, opts, [&](size_t k, const MFunction &mf) {
+        auto &c = code[k];
+        c.name = mf.name;
+        c.is_global = mf.is_global;
+        c.strings = m.funcs[k]->strings;
+        if (opts.object)
+            encode_function(mf, c.text, c.relocs);
+        else
+            print_function(mf, c.text);
+    });
+    return code;
+}
+
+void ModuleEmitter::add_global(const IRGlobal &g) {
+    if (opts.object) obj.add_global(g);
+    else print_global(g, out);
+}
+
+void ModuleEmitter::add_function(const FunctionCode &c) {
+    for (auto &s: c.strings) add_global(s);
+    if (opts.object)
+        obj.add_function(c.name, c.is_global, c.text, c.relocs);
+    else
+        out += c.text;
+}
+
+std::string ModuleEmitter::take() {
+    std::string text;
+    text.swap(out);
+    return text;
+}
+
+std::string ModuleEmitter::finish() {
+    if (opts.object) return obj.finish();
+    out += "\t.section .note.GNU-stack,\"\",@progbits\n";
+    return take();
+}
+
+std::string emit_module(const std::vector<IRGlobal> &globals,
+                        const std::vector<FunctionCode> &funcs,
+                        const CodegenOptions &opts) {
+    ModuleEmitter emitter(opts);
+    for (auto &g: globals) emitter.add_global(g);
+    for (auto &c: funcs) emitter.add_function(c);
+    return emitter.finish();
+}
+
+std::string codegen_module(IRModule &m, const CodegenOptions &opts) {
+    // The functions come out in source order however they were compiled,
+    // so the output is the same as if compiled one by one
+    return emit_module(m.globals, compile_module(m, opts), opts);
+}
+
+std::string codegen_module(MModule &m, const CodegenOptions &opts) {
+    std::string out;
+    ObjectWriter obj;
+    for (auto &g: m.globals) {
+        if (opts.object) obj.add_global(g);
+        else print_global(g, out);
+    }
+    for (auto &mf: m.funcs) {
+        if (opts.object) obj.add_function(*mf);
+        else print_function(*mf, out);
+    }
+    if (opts.object) return obj.finish();
+    out += "\t.section .note.GNU-stack,\"\",@progbits\n";
+    return out;
+}
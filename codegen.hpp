@@ -0,0 +1,122 @@
+#ifndef CODEGEN_HPP
+#define CODEGEN_HPP
+#include "elf.hpp"
+#include "ir.hpp"
+#include "x86.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The backend turns each IRFunction into an MFunction in a few steps:
+//
+// 1. select_instructions() picks x86-64 instructions operating on virtual
+//    registers, with the System V calling convention made explicit.
+// 2. allocate_registers() assigns each virtual register a physical register
+//    or a stack slot.
+// 3. lower_frame() lays out the stack frame and adds the prologue and the
+//    epilogues.
+// 4. optimize_peephole() rewrites short sequences of the final
+//    instructions into shorter ones.
+//
+// The result is printed as GNU assembly by print_function(), or encoded
+// into an ELF object by ObjectWriter.
+
+struct RegAllocStats {
+    int vregs = 0;
+    int splits = 0;     // intervals split
+    int spilled = 0;    // virtual registers given a stack slot
+    int reloads = 0;    // loads from spill slots
+    int stores = 0;     // stores to spill slots
+    int moves = 0;      // register to register moves inserted
+    int coalesced = 0;  // moves removed, as both sides got the same register
+};
+
+// What optimize_peephole() did
+struct PeepholeStats {
+    int rewrites = 0;   // rules applied
+    int blocks = 0;     // blocks removed, as nothing reached them
+};
+
+struct CodegenOptions {
+    // Print register allocation statistics for each function to stderr
+    bool stats = false;
+    // Produce a relocatable object file instead of assembly
+    bool object = false;
+    // Number of threads compiling functions at the same time
+    int jobs = 1;
+    // Run optimize_peephole() on each function. Set from
+    // OptOptions::peephole.
+    bool peephole = true;
+};
+
+std::unique_ptr<MFunction> select_instructions(IRFunction &f);
+RegAllocStats allocate_registers(MFunction &mf);
+void lower_frame(MFunction &mf);
+PeepholeStats optimize_peephole(MFunction &mf);
+void print_function(const MFunction &mf, std::string &out);
+void print_global(const IRGlobal &g, std::string &out);
+
+// Run all of the above but printing. The statistics are appended to @log,
+// if requested.
+std::unique_ptr<MFunction> compile_function(IRFunction &f,
+                                            const CodegenOptions &opts,
+                                            std::string &log);
+
+// Compile all functions of @m, on up to opts.jobs threads. @done is called
+// on the compiling thread with the index of each function and its code.
+// The results and the statistics come out in source order however the
+// functions were scheduled.
+std::vector<std::unique_ptr<MFunction>> compile_functions(
+    IRModule &m, const CodegenOptions &opts,
+    const std::function<void(size_t, const MFunction &)> &done = NULL);
+
+// What the output of a module has of each function: its string literals,
+// then its assembly, or its machine code and the relocations in it for an
+// object file. Only depends on the function.
+struct FunctionCode {
+    std::string name;
+    bool is_global = true;
+    std::vector<IRGlobal> strings;
+    std::string text;
+    std::vector<CodeReloc> relocs;
+};
+
+// Compile all functions of @m to the above, like compile_functions()
+std::vector<FunctionCode> compile_module(IRModule &m,
+                                         const CodegenOptions &opts);
+
+// The output of a module put together a global or a function at a time,
+// in the order they're added. The assembly can be taken as it's made.
+class ModuleEmitter {
+public:
+    explicit ModuleEmitter(const CodegenOptions &opts) : opts(opts) {}
+    void add_global(const IRGlobal &g);
+    void add_function(const FunctionCode &c);
+    // The assembly added since the last call, none for an object file
+    std::string take();
+    // The rest of the assembly, or the whole object file
+    std::string finish();
+private:
+    const CodegenOptions &opts;
+    std::string out;
+    ObjectWriter obj;
+};
+
+// The assembly or the object file of a module of @globals and @funcs
+std::string emit_module(const std::vector<IRGlobal> &globals,
+                        const std::vector<FunctionCode> &funcs,
+                        const CodegenOptions &opts);
+
+// Compile the whole module to assembly, or to the contents of an object
+// file: the two above
+std::string codegen_module(IRModule &m, const CodegenOptions &opts);
+
+// A module compiled without going through the IR, by compile_one_pass():
+// its data, and its functions with their frames already lowered
+struct MModule {
+    std::vector<IRGlobal> globals;
+    std::vector<std::unique_ptr<MFunction>> funcs;
+};
+std::string codegen_module(MModule &m, const CodegenOptions &opts);
+#endif
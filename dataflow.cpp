@@ -0,0 +1,255 @@
+#include "dataflow.hpp"
+#include "cfg.hpp"
+#include "ir.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+size_t DataflowResult::bytes() const {
+    size_t n = 0;
+    for (auto &s: in) n += s.bytes();
+    for (auto &s: out) n += s.bytes();
+    return n;
+}
+
+DataflowResult solve_dataflow(const CFG &cfg, const DataflowProblem &p) {
+    int n = cfg.size();
+    bool forward = p.dir == DataflowProblem::FORWARD;
+    // Unreachable blocks come last, in no particular order
+    std::vector<int> order(cfg.rpo);
+    for (int b = 0; b < n; b++) {
+        if (!cfg.is_reachable(b)) order.push_back(b);
+    }
+    if (!forward) std::reverse(order.begin(), order.end());
+    std::vector<int> pos(n);
+    for (int k = 0; k < n; k++) pos[order[k]] = k;
+
+    DataflowResult r;
+    r.in.assign(n, BitVector(p.boundary.size()));
+    r.out.assign(n, BitVector(p.boundary.size()));
+    // The side of each block where the edges meet, the side the transfer
+    // function gives, and the blocks on the other end of those edges
+    auto &met = forward ? r.in : r.out;
+    auto &given = forward ? r.out : r.in;
+    auto &from = forward ? cfg.preds : cfg.succs;
+    auto &to = forward ? cfg.succs : cfg.preds;
+    bool meet_all = p.meet == DataflowProblem::INTERSECT;
+    // Everything starts out at the identity of the meet, so that the first
+    // visits only see the edges already visited
+    if (meet_all) {
+        for (auto &s: given) s.set_all();
+    }
+
+    // Positions in the order of the blocks to visit
+    BitVector pending(n);
+    pending.set_all();
+    for (int k = 0;;) {
+        // Sweep on from the last visit, then start over from the top
+        if ((k = pending.find_next(k)) < 0 && (k = pending.find_next(0)) < 0)
+            break;
+        pending.reset(k);
+        int b = order[k++];
+        auto &m = met[b];
+        if (from[b].empty() || (forward && b == 0))
+            m = p.boundary;
+        else if (meet_all)
+            m.set_all();
+        else
+            m.clear();
+        for (int e: from[b]) {
+            if (meet_all)
+                m &= given[e];
+            else
+                m |= given[e];
+        }
+        r.visits++;
+        if (given[b].transfer(p.gen[b], m, p.kill[b])) {
+            for (int t: to[b]) pending.set(pos[t]);
+        }
+    }
+    return r;
+}
+
+Liveness live_registers(const IRFunction &f, const CFG &cfg) {
+    // The registers used before being defined in some block
+    std::vector<int> index(f.nregs, -1), defined(f.nregs, -1);
+    Liveness live;
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            for (int a: i.args) {
+                if (defined[a] != b->id && index[a] < 0) {
+                    index[a] = live.regs.size();
+                    live.regs.push_back(a);
+                }
+            }
+            if (i.dst >= 0) defined[i.dst] = b->id;
+        }
+    }
+
+    DataflowProblem p(DataflowProblem::BACKWARD, DataflowProblem::UNION,
+                      cfg.size(), live.regs.size());
+    for (auto &b: f.blocks) {
+        auto &gen = p.gen[b->id];
+        auto &kill = p.kill[b->id];
+        for (auto &i: b->instrs) {
+            for (int a: i.args) {
+                if (index[a] >= 0 && !kill.test(index[a])) gen.set(index[a]);
+            }
+            if (i.dst >= 0 && index[i.dst] >= 0) kill.set(index[i.dst]);
+        }
+    }
+    live.result = solve_dataflow(cfg, p);
+    return live;
+}
+
+ReachingDefs::ReachingDefs(const IRFunction &f, const CFG &cfg)
+    : tracked(f.slots.size(), true), f(f), slot_of_reg(f.nregs, -1),
+      undef(f.slots.size(), -1), defs_of_slot(f.slots.size()) {
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op == IR_LOCAL) slot_of_reg[i.dst] = i.imm;
+        }
+    }
+    // Any use of an address but to load or store right there lets it
+    // escape
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            for (size_t k = 0; k < i.args.size(); k++) {
+                int s = slot_of_reg[i.args[k]];
+                bool access = k == 0 && (i.op == IR_LOAD || i.op == IR_STORE);
+                if (s >= 0 && !access) tracked[s] = false;
+            }
+        }
+    }
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (!tracked[s]) continue;
+        undef[s] = defs.size();
+        defs_of_slot[s].push_back(defs.size());
+        defs.push_back({(int)s});
+    }
+    for (auto &b: f.blocks) {
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            if (b->instrs[k].op != IR_STORE) continue;
+            int s = slot_accessed(b->id, k);
+            if (s < 0) continue;
+            defs_of_slot[s].push_back(defs.size());
+            defs.push_back({s, b->id, (int)k});
+        }
+    }
+
+    DataflowProblem p(DataflowProblem::FORWARD, DataflowProblem::UNION,
+                      cfg.size(), defs.size());
+    for (int s: undef) {
+        if (s >= 0) p.boundary.set(s);
+    }
+    // Backwards, so that the stores overwritten later in the block are
+    // known when they're found. The stores were numbered in order, so
+    // counting down from the end gives their defs.
+    std::vector<int> overwritten(f.slots.size(), -1);
+    int d = defs.size();
+    for (auto b = f.blocks.rbegin(); b != f.blocks.rend(); ++b) {
+        int id = (*b)->id;
+        auto &instrs = (*b)->instrs;
+        for (size_t k = instrs.size(); k-- > 0;) {
+            int s = instrs[k].op == IR_STORE ? slot_accessed(id, k) : -1;
+            if (s < 0) continue;
+            d--;
+            if (overwritten[s] == id) continue;
+            p.gen[id].set(d);
+            if (instrs[k].size >= f.slots[s].size) {
+                overwritten[s] = id;
+                for (int e: defs_of_slot[s]) p.kill[id].set(e);
+            }
+        }
+    }
+    result = solve_dataflow(cfg, p);
+}
+
+int ReachingDefs::slot_accessed(int b, int i) const {
+    auto &instr = f.blocks[b]->instrs[i];
+    if (instr.op != IR_LOAD && instr.op != IR_STORE) return -1;
+    int s = slot_of_reg[instr.args[0]];
+    return s >= 0 && tracked[s] ? s : -1;
+}
+
+void ReachingDefs::step(int b, int i, BitVector &reach) const {
+    auto &instr = f.blocks[b]->instrs[i];
+    int s = instr.op == IR_STORE ? slot_accessed(b, i) : -1;
+    if (s < 0) return;
+    int d = -1;
+    for (int e: defs_of_slot[s]) {
+        if (defs[e].block == b && defs[e].index == i) d = e;
+        if (instr.size >= f.slots[s].size) reach.reset(e);
+    }
+    reach.set(d);
+}
+
+namespace
+{
+
+// Print the nonempty sets of a block separated by @sep
+// @names, if given, maps the elements of @set to what's printed
+void print_set(FILE *out, const char *&sep, const char *what,
+               const char *prefix, const BitVector &set,
+               const std::vector<int> *names = NULL) {
+    if (!set.count()) return;
+    fprintf(out, "%s%s", sep, what);
+    set.for_each([&](int k) {
+        fprintf(out, " %s%d", prefix, names ? (*names)[k] : k);
+    });
+    sep = "; ";
+}
+
+}
+
+void print_dataflow(const IRFunction &f, FILE *out, bool stats) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    CFG cfg(f);
+    auto t0 = clock::now();
+    auto live = live_registers(f, cfg);
+    auto t1 = clock::now();
+    ReachingDefs reaching(f, cfg);
+    auto t2 = clock::now();
+    if (stats) {
+        fprintf(stderr, "%s: %d blocks, %zu of %d registers, %zu "
+                "definitions, liveness %d visits %.3f ms, reaching "
+                "definitions %d visits %.3f ms, %zu bytes\n", f.name.c_str(),
+                cfg.size(), live.regs.size(), f.nregs, reaching.defs.size(), live.result.visits, ms(t0, t1),
+                reaching.result.visits, ms(t1, t2),
+                live.result.bytes() + reaching.result.bytes());
+    }
+
+    fprintf(out, "func %s {\n", f.name.c_str());
+    for (size_t d = 0; d < reaching.defs.size(); d++) {
+        auto &def = reaching.defs[d];
+        if (def.block < 0)
+            fprintf(out, "  d%zu: slot %d undefined\n", d, def.slot);
+        else
+            fprintf(out, "  d%zu: slot %d stored at .%d:%d\n", d, def.slot,
+                    def.block, def.index);
+    }
+    BitVector reach(reaching.defs.size());
+    for (auto &b: f.blocks) {
+        int id = b->id;
+        fprintf(out, ".%d:", id);
+        const char *sep = " ";
+        print_set(out, sep, "live in", "%", live.result.in[id], &live.regs);
+        print_set(out, sep, "live out", "%", live.result.out[id], &live.regs);
+        print_set(out, sep, "reaching", "d", reaching.result.in[id]);
+        fprintf(out, "\n");
+        reach = reaching.result.in[id];
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            int s = reaching.slot_accessed(id, k);
+            if (s >= 0 && b->instrs[k].op == IR_LOAD &&
+                reaching.maybe_undefined(s, reach))
+                fprintf(out, "  .%d:%zu: slot %d may be uninitialized\n", id,
+                        k, s);
+            reaching.step(id, k, reach);
+        }
+    }
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,92 @@
+#ifndef DATAFLOW_HPP
+#define DATAFLOW_HPP
+#include "bitvec.hpp"
+#include <cstdio>
+#include <vector>
+class CFG;
+class IRFunction;
+
+// Dataflow problems in gen/kill form over bit vectors: each block passes on
+// its gen set, plus what flows into it minus its kill set.
+struct DataflowProblem {
+    enum Direction { FORWARD, BACKWARD };
+    // How the sets flowing into a block from several edges combine
+    enum Meet { UNION, INTERSECT };
+
+    Direction dir;
+    Meet meet;
+    std::vector<BitVector> gen, kill;
+    // What flows into the entry going forward, or out of the blocks without
+    // successors going backward
+    BitVector boundary;
+
+    DataflowProblem(Direction dir, Meet meet, int nblocks, int nbits)
+        : dir(dir), meet(meet), gen(nblocks, BitVector(nbits)),
+          kill(nblocks, BitVector(nbits)), boundary(nbits) {}
+};
+
+struct DataflowResult {
+    // The sets at the start and the end of each block, in program order
+    // whichever way the problem goes
+    std::vector<BitVector> in, out;
+    int visits = 0;  // blocks visited until nothing changed
+
+    size_t bytes() const;
+};
+
+// Solve @p over @cfg. A worklist of the blocks whose inputs changed is
+// visited in reverse postorder going forward, and in postorder going
+// backward, so that a single sweep is enough without loops, and each loop
+// only adds about one sweep per level of nesting.
+DataflowResult solve_dataflow(const CFG &cfg, const DataflowProblem &p);
+
+// The virtual registers live at the start and end of each block of @f.
+// Only the registers used in some block other than the one defining them
+// can be, and the lowering keeps most values within a block, so the sets
+// are only over those, numbered in @regs.
+struct Liveness {
+    std::vector<int> regs;
+    DataflowResult result;
+};
+Liveness live_registers(const IRFunction &f, const CFG &cfg);
+
+// The stores to local variables that may reach each block, for the slots
+// only ever accessed by loads and stores right at their address. Slots whose
+// address is taken for anything else, e.g. arrays and variables with & on
+// them, may be written through pointers and aren't tracked.
+class ReachingDefs {
+public:
+    ReachingDefs(const IRFunction &f, const CFG &cfg);
+
+    struct Def {
+        int slot;
+        // The store, or -1 for the undefined value each tracked slot starts
+        // with, which reaches the uses of uninitialized variables
+        int block = -1, index = -1;
+    };
+    std::vector<Def> defs;
+    std::vector<char> tracked;  // for each slot
+    DataflowResult result;
+
+    // The tracked slot loaded from or stored to by @f.blocks[@b]->instrs[@i],
+    // or -1
+    int slot_accessed(int b, int i) const;
+    // Step @reach, the definitions reaching instruction @i of block @b, past
+    // that instruction
+    void step(int b, int i, BitVector &reach) const;
+    // Whether @slot may be uninitialized where the definitions @reach reach
+    bool maybe_undefined(int slot, const BitVector &reach) const {
+        return reach.test(undef[slot]);
+    }
+private:
+    const IRFunction &f;
+    std::vector<int> slot_of_reg;  // the slot of each IR_LOCAL result
+    std::vector<int> undef;        // the undefined def of each tracked slot
+    std::vector<std::vector<int>> defs_of_slot;
+};
+
+// Print the live registers and reaching definitions of each block of @f, for
+// --print-dataflow. With @stats, also print how long solving took, and how
+// much memory the sets need, to stderr.
+void print_dataflow(const IRFunction &f, FILE *out, bool stats);
+#endif
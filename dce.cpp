@@ -0,0 +1,228 @@
+#include "ir.hpp"
+#include "opt.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace
+{
+
+// Turn conditional branches on constants into jumps. Registers are only
+// assigned once, so a register defined by IR_CONST anywhere holds that
+// constant wherever it's used.
+void fold_branches(IRFunction &f, DCEStats &st) {
+    std::vector<char> is_const(f.nregs);
+    std::vector<long> value(f.nregs);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op == IR_CONST) {
+                is_const[i.dst] = true;
+                value[i.dst] = i.imm;
+            }
+        }
+    }
+    for (auto &b: f.blocks) {
+        if (!b->is_terminated()) continue;
+        auto &t = b->terminator();
+        if ((t.op != IR_BR && t.op != IR_SWITCH) || !is_const[t.args[0]])
+            continue;
+        long v = value[t.args[0]];
+        IRBlock *target;
+        if (t.op == IR_BR) {
+            target = t.targets[v ? 0 : 1];
+        } else {
+            target = t.targets[0];
+            for (size_t k = 0; k < t.cases.size(); k++) {
+                if (t.cases[k] == v) {
+                    target = t.targets[k + 1];
+                    break;
+                }
+            }
+        }
+        t = IRInstr(IR_JMP);
+        t.targets = {target};
+        st.branches++;
+    }
+}
+
+// The block reached from @b by following jumps out of empty blocks, as left
+// behind by labels and loops. Stops on cycles, as in "for (;;);", and
+// before blocks with phis, which tell the blocks jumping to them apart.
+IRBlock *skip_jumps(IRBlock *b, size_t limit) {
+    for (size_t n = 0; n < limit; n++) {
+        if (b->instrs.size() != 1 || b->instrs[0].op != IR_JMP ||
+            b->instrs[0].targets[0]->has_phis())
+            break;
+        b = b->instrs[0].targets[0];
+    }
+    return b;
+}
+
+void thread_jumps(IRFunction &f) {
+    for (auto &b: f.blocks) {
+        if (!b->is_terminated()) continue;
+        for (auto &t: b->terminator().targets)
+            t = skip_jumps(t, f.blocks.size());
+    }
+}
+
+// Drop the blocks for which @keep is false, renumbering the rest
+void compact_blocks(IRFunction &f, const std::vector<char> &keep) {
+    size_t n = 0;
+    for (size_t k = 0; k < f.blocks.size(); k++) {
+        if (keep[k]) f.blocks[n++] = std::move(f.blocks[k]);
+    }
+    f.blocks.resize(n);
+    for (size_t k = 0; k < n; k++) f.blocks[k]->id = k;
+}
+
+// Drop the arguments of the phis coming from blocks not @reached or no
+// longer jumping to theirs. Phis left with a single argument are copies.
+void remove_phi_args(IRFunction &f, const std::vector<char> &reached) {
+    std::vector<char> is_pred(f.blocks.size());
+    for (auto &b: f.blocks) {
+        if (!reached[b->id] || !b->has_phis()) continue;
+        for (auto &p: f.blocks) {
+            is_pred[p->id] = false;
+            if (!reached[p->id] || !p->is_terminated()) continue;
+            for (auto t: p->terminator().targets) {
+                if (t == b.get()) is_pred[p->id] = true;
+            }
+        }
+        auto &instrs = b->instrs;
+        auto end = instrs.begin();
+        while (end != instrs.end() && end->op == IR_PHI) ++end;
+        for (auto i = instrs.begin(); i != end; ++i) {
+            size_t n = 0;
+            for (size_t k = 0; k < i->args.size(); k++) {
+                if (!is_pred[i->targets[k]->id]) continue;
+                i->args[n] = i->args[k];
+                i->targets[n++] = i->targets[k];
+            }
+            i->args.resize(n);
+            i->targets.resize(n);
+            if (n == 1) {
+                i->op = IR_COPY;
+                i->targets.clear();
+            }
+        }
+        // Keep the phis first
+        std::stable_partition(instrs.begin(), end, [](const IRInstr &i) {
+            return i.op == IR_PHI;
+        });
+    }
+}
+
+void remove_unreachable(IRFunction &f, DCEStats &st) {
+    std::vector<char> reached(f.blocks.size());
+    std::vector<IRBlock *> stack{f.entry()};
+    reached[0] = true;
+    while (!stack.empty()) {
+        auto b = stack.back();
+        stack.pop_back();
+        if (!b->is_terminated()) continue;
+        for (auto t: b->terminator().targets) {
+            if (!reached[t->id]) {
+                reached[t->id] = true;
+                stack.push_back(t);
+            }
+        }
+    }
+    for (auto &b: f.blocks) {
+        if (reached[b->id]) continue;
+        st.blocks++;
+        st.instrs += b->instrs.size();
+    }
+    remove_phi_args(f, reached);
+    compact_blocks(f, reached);
+}
+
+// Append each block with a single predecessor ending in a jump to it to
+// that predecessor
+void merge_blocks(IRFunction &f, DCEStats &st) {
+    std::vector<int> preds(f.blocks.size());
+    for (auto &b: f.blocks) {
+        if (!b->is_terminated()) continue;
+        for (auto t: b->terminator().targets) preds[t->id]++;
+    }
+    std::vector<char> keep(f.blocks.size(), true);
+    // The block each was merged into, for the phis coming from it
+    std::vector<IRBlock *> merged_into(f.blocks.size());
+    for (auto &b: f.blocks) merged_into[b->id] = b.get();
+    for (auto &b: f.blocks) {
+        if (!keep[b->id]) continue;
+        while (b->is_terminated() && b->terminator().op == IR_JMP) {
+            auto next = b->terminator().targets[0];
+            if (next == b.get() || next == f.entry() || preds[next->id] != 1)
+                break;
+            b->instrs.pop_back();
+            st.instrs++;
+            for (auto &i: next->instrs) b->instrs.push_back(std::move(i));
+            next->instrs.clear();
+            keep[next->id] = false;
+            merged_into[next->id] = b.get();
+            st.blocks++;
+        }
+    }
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op != IR_PHI) break;
+            for (auto &t: i.targets) {
+                while (merged_into[t->id] != t) t = merged_into[t->id];
+            }
+        }
+    }
+    compact_blocks(f, keep);
+}
+
+// Remove the instructions without side effects whose results are unused,
+// until there are none left
+void remove_dead_instrs(IRFunction &f, DCEStats &st) {
+    std::vector<int> uses(f.nregs);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            for (int a: i.args) uses[a]++;
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // Backwards, so that most values die in one sweep with their users
+        for (auto b = f.blocks.rbegin(); b != f.blocks.rend(); ++b) {
+            auto &instrs = (*b)->instrs;
+            size_t n = instrs.size();
+            std::vector<char> dead(n);
+            for (size_t k = n; k-- > 0;) {
+                auto &i = instrs[k];
+                if (i.dst < 0 || uses[i.dst]) continue;
+                if (i.has_side_effects()) {
+                    if (i.op == IR_CALL) i.dst = -1;
+                    continue;
+                }
+                dead[k] = true;
+                for (int a: i.args) uses[a]--;
+                changed = true;
+            }
+            size_t m = 0;
+            for (size_t k = 0; k < n; k++) {
+                if (dead[k]) continue;
+                if (m != k) instrs[m] = std::move(instrs[k]);
+                m++;
+            }
+            st.instrs += n - m;
+            instrs.resize(m, IRInstr(IR_RET));
+        }
+    }
+}
+
+}
+
+DCEStats eliminate_dead_code(IRFunction &f) {
+    DCEStats st;
+    fold_branches(f, st);
+    thread_jumps(f);
+    remove_unreachable(f, st);
+    merge_blocks(f, st);
+    remove_dead_instrs(f, st);
+    return st;
+}
@@ -6,6 +6,7 @@
 #include <string>
 #include <utility>
 #include <vector>
+class ParamDeclAST;
 class StmtAST;
 
 // A function declaration contains a block statement, and a block statement in
@@ -14,6 +15,14 @@ class StmtAST;
 // the implementation of statement related functions into the cpp file. In the
 // statements header file, we include this header normally.
 
+// Filled in while deriving the type of a declarator. @params points to the
+// parameter list of the function being declared, if any, so that a function
+// definition can find the names of its parameters.
+struct DeclInfo {
+    std::string name;
+    const std::vector<std::unique_ptr<ParamDeclAST>> *params = NULL;
+};
+
 class DirectDecl {
 public:
     virtual ~DirectDecl() = default;
@@ -27,6 +36,13 @@ public:
     // can be private in the subclasses since it's only ever called through
     // the base class.
     virtual void print(int level, bool has_postfix) = 0;
+    // Derive the type of the declared name, given the type @base that the
+    // declarator is applied to. Like print(), this is only ever called
+    // through the base class.
+    virtual const Type *declare(Lowering &L, const Type *base,
+                                DeclInfo &info) = 0;
+    // The name declared, without deriving the type
+    virtual const std::string &declared_name() const = 0;
 };
 
 class Declarator : public DirectDecl {
@@ -48,6 +64,11 @@ public:
     // We need this public interface here since the *DeclAST classes contain
     // one or more declarators and they want to print them.
     void print(int level) { print(level, false); }
+    const Type *declare(Lowering &L, const Type *base,
+                        DeclInfo &info) override;
+    const std::string &declared_name() const override {
+        return decl->declared_name();
+    }
 };
 
 class DeclASTBase {
@@ -63,15 +84,38 @@ class ExtDeclAST : public DeclASTBase {
 public:
     ExtDeclAST(Token type) : DeclASTBase(type) {}
     virtual ~ExtDeclAST() = default;
+    virtual void lower(Lowering &L) = 0;
+    // Declare the names for the AST evaluator, allocating and initializing
+    // the objects of declarations in blocks
+    virtual void eval(Evaluator &E) = 0;
+    // Add the names declared to @names, for the dependencies between
+    // declarations
+    virtual void names(std::vector<std::string> &names) const = 0;
+    // Whether this is a function definition, a FuncDeclAST
+    virtual bool is_function() const { return false; }
 };
 
 class FuncDeclAST : public ExtDeclAST {
     std::unique_ptr<Declarator> decl;
     std::unique_ptr<StmtAST> body;
+    // The type of the function and the names and types of its parameters,
+    // derived by eval() once for all calls
+    const Type *type = NULL;
+    std::vector<std::pair<std::string, const Type *>> params;
 public:
     FuncDeclAST(Token type, std::unique_ptr<Declarator> decl,
                 std::unique_ptr<StmtAST> body);
     void print(int level) override;
+    void lower(Lowering &L) override;
+    void eval(Evaluator &E) override;
+    void names(std::vector<std::string> &names) const override {
+        names.push_back(decl->declared_name());
+    }
+    bool is_function() const override { return true; }
+    // Only declare the function, whose code comes from elsewhere
+    void declare(Lowering &L);
+    // Run the function in the evaluator, returning its result
+    long call(Evaluator &E, const std::vector<long> &args);
 };
 
 class InitDecl {
@@ -81,6 +125,9 @@ public:
     InitDecl(std::unique_ptr<Declarator> decl, std::unique_ptr<ExprAST> init)
         : decl(std::move(decl)), init(std::move(init)) {}
     void print(int level);
+    void lower(Lowering &L, const Type *base);
+    void eval(Evaluator &E, const Type *base);
+    const std::string &name() const { return decl->declared_name(); }
 };
 
 class DeclAST : public ExtDeclAST {
@@ -89,6 +136,13 @@ public:
     DeclAST(Token type, std::unique_ptr<std::vector<InitDecl>> decl)
         : ExtDeclAST(type), decl(std::move(decl)) {}
     void print(int level) override;
+    // Declarations appear both at file scope and in blocks, Lowering knows
+    // which one we're in.
+    void lower(Lowering &L) override;
+    void eval(Evaluator &E) override;
+    void names(std::vector<std::string> &names) const override {
+        for (auto &d: *decl) names.push_back(d.name());
+    }
 };
 
 class ParamDeclAST : public DeclASTBase {
@@ -97,11 +151,17 @@ public:
     ParamDeclAST(Token type, std::unique_ptr<Declarator> decl)
         : DeclASTBase(type), decl(std::move(decl)) {}
     void print(int level) override;
+    // Derive the type of the parameter, adjusted as C requires for arrays
+    // and functions, and its name, which is empty for abstract declarators.
+    const Type *declare(Lowering &L, std::string &name);
 };
 
 class VarDecl : public DirectDecl {
     std::string name;
     void print(int, bool) override;
+    const Type *declare(Lowering &L, const Type *base,
+                        DeclInfo &info) override;
+    const std::string &declared_name() const override { return name; }
 public:
     VarDecl(std::string &&name) : name(name) {}
 };
@@ -110,6 +170,11 @@ class ArrayDecl : public DirectDecl {
     std::unique_ptr<DirectDecl> name;
     std::unique_ptr<ExprAST> dim;
     void print(int level, bool) override;
+    const Type *declare(Lowering &L, const Type *base,
+                        DeclInfo &info) override;
+    const std::string &declared_name() const override {
+        return name->declared_name();
+    }
 public:
     ArrayDecl(std::unique_ptr<DirectDecl> name, std::unique_ptr<ExprAST> dim)
         : name(std::move(name)), dim(std::move(dim)) {}
@@ -123,6 +188,11 @@ private:
     std::unique_ptr<DirectDecl> name;
     std::unique_ptr<ParamList> params;
     void print(int level, bool) override;
+    const Type *declare(Lowering &L, const Type *base,
+                        DeclInfo &info) override;
+    const std::string &declared_name() const override {
+        return name->declared_name();
+    }
 public:
     FuncDecl(bool is_variadic, std::unique_ptr<DirectDecl> name,
              std::unique_ptr<ParamList> params)
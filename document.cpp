@@ -0,0 +1,207 @@
+#include "document.hpp"
+#include "decl.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+// The tokens of a Document from one on, for a Parser, noting the index of
+// the one last returned
+class Document::Cursor : public TokenSource {
+public:
+    Cursor(const Document &doc, size_t at) : doc(doc), at(at) {}
+    Token next() override {
+        Token t = doc.token(at);
+        t.offset = doc.offset_of(at);
+        last = at;
+        if (at + 1 < doc.count()) at++;
+        return t;
+    }
+    size_t last = 0;
+private:
+    const Document &doc;
+    size_t at;
+};
+
+size_t Document::find(size_t offset, size_t from) const {
+    size_t lo = from, hi = count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (offset_of(mid) < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Before the source changes, so the offsets from its end still hold
+void Document::move_gap(size_t to) {
+    for (; gap > to; gap--) {
+        auto &t = tokens[gap - 1 + gap_size];
+        if (gap_size > 0) t = std::move(tokens[gap - 1]);
+        t.offset -= src.size();
+    }
+    for (; gap < to; gap++) {
+        auto &t = tokens[gap];
+        if (gap_size > 0) t = std::move(tokens[gap + gap_size]);
+        t.offset += src.size();
+    }
+}
+
+bool Document::parse(std::string text) {
+    src = std::move(text);
+    tokens.clear();
+    Scanner scanner(src.c_str());
+    do {
+        tokens.push_back(scanner.scan());
+    } while (tokens.back().type != TOK_EOF);
+    gap = tokens.size();
+    gap_size = 0;
+    bool ok = parse_tokens();
+    stats = EditStats();
+    return ok;
+}
+
+bool Document::parse_tokens() {
+    Cursor cursor(*this, 0);
+    Parser parser(cursor);
+    Parser::ExtDeclList parsed_decls;
+    std::vector<size_t> parsed_starts;
+    while (token(cursor.last).type != TOK_EOF) {
+        parsed_starts.push_back(cursor.last);
+        auto decl = parser.parse_external_decl();
+        if (!decl) {
+            parsed = false;
+            return false;
+        }
+        parsed_decls.push_back(std::move(decl));
+    }
+    parsed_starts.push_back(cursor.last);
+    stats.reparsed += parsed_decls.size();
+    decls = std::move(parsed_decls);
+    starts = std::move(parsed_starts);
+    parsed = true;
+    stale_begin = stale_end = 0;
+    return true;
+}
+
+bool Document::edit(size_t offset, size_t removed,
+                    const std::string &inserted) {
+    if (offset > src.size() || removed > src.size() - offset) {
+        fprintf(stderr, "mycc: edit of %zu bytes at %zu out of %zu\n",
+                removed, offset, src.size());
+        return false;
+    }
+    stats.edits++;
+
+    // Scan from the first token the edit may change, the one before that
+    // starting at most a byte before it, or from the start, up to one
+    // starting where one did before, after the edit. That of TOK_EOF
+    // always does.
+    size_t first = find(offset < 2 ? 0 : offset - 1);
+    first = first > 0 ? first - 1 : 0;
+    size_t from = first > 0 ? offset_of(first) : 0;
+    size_t after = find(offset + removed);
+    move_gap(first);
+    src.replace(offset, removed, inserted);
+    Scanner scanner(src.c_str(), from);
+    std::vector<Token> relexed;
+    size_t last;
+    for (;;) {
+        auto token = scanner.scan();
+        if (token.offset >= offset + inserted.size()) {
+            last = find(token.offset, after);
+            if (offset_of(last) == token.offset) break;
+        }
+        relexed.push_back(std::move(token));
+    }
+    stats.relexed += relexed.size();
+    // In place of the tokens changed, at the start of those after the gap
+    long shift = (long)relexed.size() - (long)(last - first);
+    gap_size += last - first;
+    if (gap_size < relexed.size()) {
+        size_t grow = relexed.size() + tokens.size() / 8 + 16;
+        tokens.insert(tokens.begin() + gap, grow, Token());
+        gap_size += grow;
+    }
+    std::move(relexed.begin(), relexed.end(), tokens.begin() + gap);
+    gap += relexed.size();
+    gap_size -= relexed.size();
+    if (!parsed) return parse_tokens();
+
+    // Parse from the declaration with the first token changed, or from
+    // TOK_EOF, up to one starting at a token after those changed, where
+    // one started before. Both ends take in the declarations out of date.
+    bool stale = stale_begin < stale_end;
+    auto it = std::upper_bound(starts.begin(), starts.end(), first);
+    size_t k = it == starts.begin() ? 0 : it - starts.begin() - 1;
+    size_t until = first + relexed.size();
+    if (stale) {
+        k = std::min(k, stale_begin);
+        if (starts[stale_end] >= last)
+            until = std::max(until, starts[stale_end] + shift);
+    }
+    Cursor cursor(*this, starts[k]);
+    Parser parser(cursor);
+    Parser::ExtDeclList parsed_decls;
+    std::vector<size_t> parsed_starts;
+    size_t resume;
+    for (;;) {
+        size_t at = cursor.last;
+        if (at >= until) {
+            // The last of the declarations starting there, as those out
+            // of date may
+            auto it = std::upper_bound(starts.begin() + k, starts.end(),
+                                       at - shift) - 1;
+            if (*it == at - shift) {
+                resume = it - starts.begin();
+                break;
+            }
+        }
+        parsed_starts.push_back(at);
+        auto decl = parser.parse_external_decl();
+        if (!decl) {
+            // Keep the declarations changed, up to the first after the
+            // tokens changed, as they were. One starting right after them
+            // is counted as changed, as the tokens inserted before it
+            // would belong to no declaration, and so is the last one for
+            // those inserted before TOK_EOF. With none, the tokens are
+            // parsed again from the start.
+            size_t end = std::upper_bound(starts.begin() + k, starts.end(),
+                                          last) - starts.begin();
+            end = std::min(end, starts.size() - 1);
+            if (stale) end = std::max(end, stale_end);
+            if (end == k) {
+                if (k == 0) {
+                    parsed = false;
+                    return false;
+                }
+                k--;
+            }
+            for (size_t j = end; j < starts.size(); j++) starts[j] += shift;
+            for (size_t j = k + 1; j < end; j++) starts[j] = starts[k];
+            stale_begin = k;
+            stale_end = end;
+            return false;
+        }
+        parsed_decls.push_back(std::move(decl));
+    }
+    stats.reparsed += parsed_decls.size();
+    for (size_t j = resume; j < starts.size(); j++) starts[j] += shift;
+    starts.erase(starts.begin() + k, starts.begin() + resume);
+    starts.insert(starts.begin() + k, parsed_starts.begin(),
+                  parsed_starts.end());
+    decls.erase(decls.begin() + k, decls.begin() + std::min(resume,
+                                                            decls.size()));
+    decls.insert(decls.begin() + k,
+                 std::make_move_iterator(parsed_decls.begin()),
+                 std::make_move_iterator(parsed_decls.end()));
+    stale_begin = stale_end = 0;
+    return true;
+}
+
+std::vector<SourceRange> Document::ranges() const {
+    std::vector<SourceRange> ranges;
+    if (!parsed || stale_begin < stale_end) return ranges;
+    for (size_t k = 0; k + 1 < starts.size(); k++)
+        ranges.push_back({offset_of(starts[k]), offset_of(starts[k + 1])});
+    return ranges;
+}
@@ -0,0 +1,79 @@
+#ifndef DOCUMENT_HPP
+#define DOCUMENT_HPP
+#include "parse.hpp"
+#include "scan.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct EditStats {
+    int edits = 0;
+    long relexed = 0;   // tokens scanned again
+    long reparsed = 0;  // external declarations parsed again
+};
+
+// A translation unit kept parsed through edits of its source, as made in
+// an editor. An edit is scanned again from the first token it may change,
+// one that ends less than two bytes before it as the scanner looks that
+// far ahead, until a token starts after it where one did before: the
+// scanner carries nothing but its position from one token to the next,
+// so the tokens from there on are those from before, moved. The external
+// declarations with tokens changed are then parsed again, up to one
+// starting at a token the edit left alone, and replace those from before.
+// How a declaration is parsed depends on its tokens only, there being no
+// typedefs.
+//
+// An edit that doesn't parse, as most do while typing, leaves the
+// declarations it changed as they were. The next edit parses them again
+// along with its own, which is how a full parse is avoided after an edit
+// that does parse again.
+//
+// The tokens are kept with a gap where the last edit was, those after it
+// with their offsets from the end of the source. An edit only moves the
+// tokens between its own and the last, as editors send them close to each
+// other, and none of the offsets of those after it change.
+class Document {
+public:
+    // Parse @text. Returns false on errors, which have been reported.
+    bool parse(std::string text);
+    // Replace the @removed bytes at @offset in the source with @inserted.
+    // Returns false on errors, which have been reported, like a parse
+    // error, after which the declarations are partly out of date until an
+    // edit parses again.
+    bool edit(size_t offset, size_t removed, const std::string &inserted);
+    const std::string &text() const { return src; }
+    // The bytes of each declaration in the source, none while some are out
+    // of date
+    std::vector<SourceRange> ranges() const;
+
+    Parser::ExtDeclList decls;
+    EditStats stats;
+private:
+    class Cursor;
+
+    std::string src;
+    std::vector<Token> tokens;  // up to TOK_EOF, and the gap
+    size_t gap = 0, gap_size = 0;
+    // The index of the first token of each declaration, then that of
+    // TOK_EOF
+    std::vector<size_t> starts;
+    // Whether @decls are those of the tokens, but for any out of date
+    bool parsed = false;
+    // The declarations out of date, of which only the start of the first
+    // and that of the one after are kept up to date in @starts
+    size_t stale_begin = 0, stale_end = 0;
+
+    size_t count() const { return tokens.size() - gap_size; }
+    const Token &token(size_t k) const {
+        return tokens[k < gap ? k : k + gap_size];
+    }
+    size_t offset_of(size_t k) const {
+        return k < gap ? tokens[k].offset
+                       : tokens[k + gap_size].offset + src.size();
+    }
+    // The first token from that at @from on starting at @offset or after
+    size_t find(size_t offset, size_t from = 0) const;
+    void move_gap(size_t to);
+    bool parse_tokens();
+};
+#endif
@@ -0,0 +1,234 @@
+#include "elf.hpp"
+#include "util.hpp"
+#include <cstring>
+#include <elf.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+// Section header indices in the output. The sections holding code and data
+// come first, in the order of ObjectWriter::Section.
+enum {
+    SH_NULL,
+    SH_TEXT,
+    SH_DATA,
+    SH_BSS,
+    SH_RODATA,
+    SH_RELA_TEXT,
+    SH_RELA_DATA,
+    SH_SYMTAB,
+    SH_STRTAB,
+    SH_SHSTRTAB,
+    SH_NOTE_GNU_STACK,
+    NUM_SHDRS,
+};
+
+class StringTable {
+public:
+    StringTable() { data += '\0'; }
+    int add(const std::string &s) {
+        int off = data.size();
+        data += s;
+        data += '\0';
+        return off;
+    }
+    std::string data;
+};
+
+template <typename T>
+void append(std::string &out, const T &v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof v);
+}
+
+// Labels starting with .L are local to the assembly file, and not put in
+// the symbol table. References to them go through the section symbol.
+bool is_label(const std::string &name) {
+    return name.compare(0, 2, ".L") == 0;
+}
+
+}
+
+void ObjectWriter::add_function(const MFunction &mf) {
+    std::string code;
+    std::vector<CodeReloc> code_relocs;
+    encode_function(mf, code, code_relocs);
+    add_function(mf.name, mf.is_global, code, code_relocs);
+}
+
+void ObjectWriter::add_function(const std::string &name, bool is_global,
+                                const std::string &code,
+                                const std::vector<CodeReloc> &code_relocs) {
+    auto &text = contents[TEXT];
+    long start = text.size();
+    text += code;
+    symbols.push_back({name, TEXT, start, (long)code.size(), is_global,
+                       true});
+    for (auto &r: code_relocs) {
+        int type = r.kind == CodeReloc::PLT32 ? R_X86_64_PLT32
+                                              : R_X86_64_PC32;
+        relocs.push_back({TEXT, type, start + r.offset, r.sym, r.addend});
+    }
+}
+
+void ObjectWriter::add_global(const IRGlobal &g) {
+    Section s = g.is_string ? RODATA : g.is_zero ? BSS : DATA;
+    if (g.align > align[s]) align[s] = g.align;
+    long off;
+    if (s == BSS) {
+        off = bss_size = align_to(bss_size, g.align);
+        bss_size += g.size;
+    } else {
+        auto &c = contents[s];
+        off = align_to(c.size(), g.align);
+        c.resize(off, '\0');
+        c += g.data;
+        c.resize(off + g.size, '\0');
+        for (auto &r: g.relocs)
+            relocs.push_back({s, R_X86_64_64, off + r.offset, r.sym,
+                              r.addend});
+    }
+    symbols.push_back({g.name, s, off, g.size, !g.is_static, false});
+}
+
+std::string ObjectWriter::finish() {
+    StringTable strtab, shstrtab;
+    std::vector<Elf64_Sym> syms;
+    std::unordered_map<std::string, int> sym_index;
+    std::unordered_map<std::string, const Symbol *> defined;
+    for (auto &s: symbols) defined[s.name] = &s;
+
+    // Local symbols come first: the null symbol, the sections, then named
+    // local symbols
+    syms.push_back({});
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        Elf64_Sym sym = {};
+        sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        sym.st_shndx = SH_TEXT + s;
+        syms.push_back(sym);
+    }
+    auto add_defined = [&](const Symbol &s) {
+        Elf64_Sym sym = {};
+        sym.st_name = strtab.add(s.name);
+        sym.st_info = ELF64_ST_INFO(s.is_global ? STB_GLOBAL : STB_LOCAL,
+                                    s.is_func ? STT_FUNC : STT_OBJECT);
+        sym.st_shndx = SH_TEXT + s.section;
+        sym.st_value = s.offset;
+        sym.st_size = s.size;
+        sym_index[s.name] = syms.size();
+        syms.push_back(sym);
+    };
+    for (auto &s: symbols) {
+        if (!s.is_global && !is_label(s.name)) add_defined(s);
+    }
+    int first_global = syms.size();
+    for (auto &s: symbols) {
+        if (s.is_global) add_defined(s);
+    }
+
+    std::string rela[2];
+    for (auto &r: relocs) {
+        long addend = r.addend;
+        int index;
+        auto d = defined.find(r.sym);
+        if (d != defined.end() && is_label(r.sym)) {
+            index = 1 + d->second->section;
+            addend += d->second->offset;
+        } else {
+            auto i = sym_index.find(r.sym);
+            if (i == sym_index.end()) {
+                // Undefined, to be resolved by the linker
+                Elf64_Sym sym = {};
+                sym.st_name = strtab.add(r.sym);
+                sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+                sym.st_shndx = SHN_UNDEF;
+                i = sym_index.emplace(r.sym, syms.size()).first;
+                syms.push_back(sym);
+            }
+            index = i->second;
+        }
+        Elf64_Rela rel;
+        rel.r_offset = r.offset;
+        rel.r_info = ELF64_R_INFO(index, r.type);
+        rel.r_addend = addend;
+        append(rela[r.section == TEXT ? 0 : 1], rel);
+    }
+    std::string symtab;
+    for (auto &s: syms) append(symtab, s);
+
+    // The file is laid out as the ELF header, the contents of the sections,
+    // then the section headers
+    std::string out(sizeof(Elf64_Ehdr), '\0');
+    Elf64_Shdr shdrs[NUM_SHDRS] = {};
+    auto add_section = [&](int index, const char *name, int type, long flags,
+                           const std::string &data, long align) {
+        auto &sh = shdrs[index];
+        sh.sh_name = shstrtab.add(name);
+        sh.sh_type = type;
+        sh.sh_flags = flags;
+        sh.sh_addralign = align;
+        out.resize(align_to(out.size(), align), '\0');
+        sh.sh_offset = out.size();
+        sh.sh_size = data.size();
+        out += data;
+    };
+    add_section(SH_TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                contents[TEXT], align[TEXT]);
+    add_section(SH_DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                contents[DATA], align[DATA]);
+    add_section(SH_BSS, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, "",
+                align[BSS]);
+    shdrs[SH_BSS].sh_size = bss_size;
+    add_section(SH_RODATA, ".rodata", SHT_PROGBITS, SHF_ALLOC,
+                contents[RODATA], align[RODATA]);
+    add_section(SH_RELA_TEXT, ".rela.text", SHT_RELA, SHF_INFO_LINK,
+                rela[0], 8);
+    add_section(SH_RELA_DATA, ".rela.data", SHT_RELA, SHF_INFO_LINK,
+                rela[1], 8);
+    for (int k: {SH_RELA_TEXT, SH_RELA_DATA}) {
+        shdrs[k].sh_link = SH_SYMTAB;
+        shdrs[k].sh_info = k == SH_RELA_TEXT ? SH_TEXT : SH_DATA;
+        shdrs[k].sh_entsize = sizeof(Elf64_Rela);
+    }
+    add_section(SH_SYMTAB, ".symtab", SHT_SYMTAB, 0, symtab, 8);
+    shdrs[SH_SYMTAB].sh_link = SH_STRTAB;
+    shdrs[SH_SYMTAB].sh_info = first_global;
+    shdrs[SH_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    add_section(SH_STRTAB, ".strtab", SHT_STRTAB, 0, strtab.data, 1);
+    // The name has to be added before the contents are written
+    shdrs[SH_SHSTRTAB].sh_name = shstrtab.add(".shstrtab");
+    int note_name = shstrtab.add(".note.GNU-stack");
+    shdrs[SH_SHSTRTAB].sh_type = SHT_STRTAB;
+    shdrs[SH_SHSTRTAB].sh_addralign = 1;
+    shdrs[SH_SHSTRTAB].sh_offset = out.size();
+    shdrs[SH_SHSTRTAB].sh_size = shstrtab.data.size();
+    out += shstrtab.data;
+    // An empty .note.GNU-stack says the stack needn't be executable
+    shdrs[SH_NOTE_GNU_STACK].sh_name = note_name;
+    shdrs[SH_NOTE_GNU_STACK].sh_type = SHT_PROGBITS;
+    shdrs[SH_NOTE_GNU_STACK].sh_addralign = 1;
+    shdrs[SH_NOTE_GNU_STACK].sh_offset = out.size();
+
+    out.resize(align_to(out.size(), 8), '\0');
+    long shoff = out.size();
+    for (auto &sh: shdrs) append(out, sh);
+
+    Elf64_Ehdr eh = {};
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    eh.e_type = ET_REL;
+    eh.e_machine = EM_X86_64;
+    eh.e_version = EV_CURRENT;
+    eh.e_shoff = shoff;
+    eh.e_ehsize = sizeof(Elf64_Ehdr);
+    eh.e_shentsize = sizeof(Elf64_Shdr);
+    eh.e_shnum = NUM_SHDRS;
+    eh.e_shstrndx = SH_SHSTRTAB;
+    memcpy(&out[0], &eh, sizeof eh);
+    return out;
+}
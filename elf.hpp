@@ -0,0 +1,66 @@
+#ifndef ELF_HPP
+#define ELF_HPP
+#include "ir.hpp"
+#include "x86.hpp"
+#include <string>
+#include <vector>
+
+// A relocation in the machine code of a function, at @offset from its start
+struct CodeReloc {
+    enum Kind {
+        PC32,   // @sym+@addend-(address of the field)
+        PLT32,  // the same, for a call target
+    };
+    Kind kind;
+    long offset;
+    std::string sym;
+    long addend;
+};
+
+// Encode the instructions of @mf, after frame lowering, appending the bytes
+// to @code. The offsets of the relocations are relative to the start of @mf.
+void encode_function(const MFunction &mf, std::string &code,
+                     std::vector<CodeReloc> &relocs);
+
+// ObjectWriter collects the functions and globals of a module and lays them
+// out in the sections of a relocatable ELF64 object.
+class ObjectWriter {
+public:
+    void add_function(const MFunction &mf);
+    // Add a function already encoded
+    void add_function(const std::string &name, bool is_global,
+                      const std::string &code,
+                      const std::vector<CodeReloc> &code_relocs);
+    void add_global(const IRGlobal &g);
+    // The contents of the object file
+    std::string finish();
+private:
+    enum Section {
+        TEXT,
+        DATA,
+        BSS,
+        RODATA,
+        NUM_SECTIONS,
+    };
+    struct Symbol {
+        std::string name;
+        Section section;
+        long offset;
+        long size;
+        bool is_global;
+        bool is_func;
+    };
+    struct Reloc {
+        Section section;
+        int type;
+        long offset;
+        std::string sym;
+        long addend;
+    };
+    std::string contents[NUM_SECTIONS];
+    long bss_size = 0;
+    int align[NUM_SECTIONS] = {1, 1, 1, 1};
+    std::vector<Symbol> symbols;
+    std::vector<Reloc> relocs;
+};
+#endif
@@ -0,0 +1,416 @@
+#include "elf.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+#include <string>
+#include <vector>
+
+// The encoder only knows the instruction forms the instruction selector and
+// the register allocator produce. Jumps always use 32-bit displacements, so
+// the size of each instruction is known when it's emitted, and jumps forward
+// are patched at the end of the function.
+
+namespace
+{
+
+const int cc_codes[] = {
+    0x4,  // CC_E
+    0x5,  // CC_NE
+    0xc,  // CC_L
+    0xe,  // CC_LE
+    0xf,  // CC_G
+    0xd,  // CC_GE
+    0x2,  // CC_B
+    0x6,  // CC_BE
+    0x7,  // CC_A
+    0x3,  // CC_AE
+};
+
+bool fits_imm8(long v) {
+    return v >= -128 && v <= 127;
+}
+
+class Encoder {
+public:
+    Encoder(const MFunction &mf, std::string &code,
+            std::vector<CodeReloc> &relocs)
+        : mf(mf), code(code), relocs(relocs), start(code.size()) {}
+    void run();
+private:
+    const MFunction &mf;
+    std::string &code;
+    std::vector<CodeReloc> &relocs;
+    long start;
+    std::vector<long> block_offsets;
+    // The offsets of rel32 fields, and the block they refer to
+    std::vector<std::pair<long, const MBlock *>> fixups;
+
+    long offset() { return code.size() - start; }
+    void byte(int b) { code += (char)b; }
+    void imm(long v, int size) {
+        for (int k = 0; k < size; k++) byte(v >> (8 * k) & 0xff);
+    }
+    // Emit an instruction with a ModRM byte. @reg is the register field,
+    // either a register or an opcode extension, @rm the register or memory
+    // operand. The REX prefix is added if needed for 64-bit operations,
+    // extended registers, or the byte registers %spl to %dil, which
+    // @byte_reg and @byte_rm say the operands are. @imm_size is the size of
+    // an immediate following the operands, which RIP-relative addresses
+    // need to account for.
+    void modrm(int size, std::initializer_list<int> opcode, int reg,
+               const MOperand &rm, int imm_size = 0, bool byte_reg = false,
+               bool byte_rm = false);
+    // The ModRM byte and the rest of the operands after the opcode
+    void operand(int reg, const MOperand &rm, int imm_size);
+    // Emit a vector instruction with a VEX prefix, which replaces the REX
+    // prefix, the mandatory prefix @pp (1 for 0x66, 2 for 0xf3) and the
+    // opcode map @map (1 for 0x0f, 2 for 0x0f 0x38). @l is set for 256-bit
+    // vectors and @vvvv is the extra source register of the three operand
+    // forms, 0 if unused.
+    void vex(int pp, int map, bool w, bool l, int vvvv, int opcode, int reg,
+             const MOperand &rm);
+    void encode(const MInstr &i);
+    void encode_vector(const MInstr &i);
+    void alu(const MInstr &i, int base, int ext);
+    void jump_to(const MBlock *b) {
+        fixups.emplace_back(offset(), b);
+        imm(0, 4);
+    }
+};
+
+void Encoder::modrm(int size, std::initializer_list<int> opcode, int reg,
+                    const MOperand &rm, int imm_size, bool byte_reg,
+                    bool byte_rm) {
+    if (size == 2) byte(0x66);
+    int base = rm.kind == MOperand::RIP ? 0 : rm.reg;
+    int rex = 0;
+    if (size == 8) rex |= 8;
+    if (reg & 8) rex |= 4;
+    if (base & 8) rex |= 1;
+    if ((byte_reg && reg >= 4 && reg < 8) ||
+        (byte_rm && rm.kind == MOperand::REG && rm.reg >= 4 && rm.reg < 8))
+        rex |= 0x40;
+    if (rex) byte(0x40 | rex);
+    for (int b: opcode) byte(b);
+    operand(reg, rm, imm_size);
+}
+
+void Encoder::operand(int reg, const MOperand &rm, int imm_size) {
+    int base = rm.kind == MOperand::RIP ? 0 : rm.reg;
+    reg &= 7;
+    switch (rm.kind) {
+    case MOperand::REG:
+        byte(0xc0 | reg << 3 | (rm.reg & 7));
+        break;
+    case MOperand::MEM: {
+        long disp = rm.imm;
+        int mod = disp == 0 && (base & 7) != RBP ? 0 : fits_imm8(disp) ? 1 : 2;
+        byte(mod << 6 | reg << 3 | (base & 7));
+        // %rsp and %r12 as a base need a SIB byte
+        if ((base & 7) == RSP) byte(0x24);
+        if (mod == 1) imm(disp, 1);
+        else if (mod == 2) imm(disp, 4);
+        break;
+    }
+    case MOperand::RIP:
+        byte(reg << 3 | 5);
+        relocs.push_back({CodeReloc::PC32, offset(), rm.sym,
+                          rm.imm - 4 - imm_size});
+        imm(0, 4);
+        break;
+    default:
+        break;
+    }
+}
+
+void Encoder::vex(int pp, int map, bool w, bool l, int vvvv, int opcode,
+                  int reg, const MOperand &rm) {
+    int base = rm.kind == MOperand::RIP ? 0 : rm.reg;
+    // The register extension bits are inverted
+    int r = !(reg & 8), b = !(base & 8);
+    int last = (~vvvv & 15) << 3 | l << 2 | pp;
+    if (map == 1 && !w && b) {
+        byte(0xc5);
+        byte(r << 7 | last);
+    } else {
+        byte(0xc4);
+        byte(r << 7 | 1 << 6 | b << 5 | map);
+        byte(w << 7 | last);
+    }
+    byte(opcode);
+    operand(reg, rm, 0);
+}
+
+// Arithmetic with the classic encoding, where @base is the opcode for
+// byte operations with a register source, and @ext the opcode extension
+// used with an immediate source.
+void Encoder::alu(const MInstr &i, int base, int ext) {
+    auto &src = i.ops[0], &dst = i.ops[1];
+    int size = i.size;
+    if (src.kind == MOperand::IMM) {
+        if (size == 1) {
+            modrm(size, {0x80}, ext, dst, 1, false, true);
+            imm(src.imm, 1);
+        } else if (fits_imm8(src.imm)) {
+            modrm(size, {0x83}, ext, dst, 1);
+            imm(src.imm, 1);
+        } else {
+            int n = size == 2 ? 2 : 4;
+            modrm(size, {0x81}, ext, dst, n);
+            imm(src.imm, n);
+        }
+    } else if (src.kind == MOperand::REG) {
+        modrm(size, {base + (size != 1)}, src.reg, dst, 0, size == 1,
+              size == 1);
+    } else {
+        modrm(size, {base + 2 + (size != 1)}, dst.reg, src, 0, size == 1,
+              size == 1);
+    }
+}
+
+void Encoder::encode(const MInstr &i) {
+    auto &ops = i.ops;
+    switch (i.op) {
+    case M_MOV: {
+        auto &src = ops[0], &dst = ops[1];
+        bool b = i.size == 1;
+        if (src.kind == MOperand::IMM && dst.kind == MOperand::REG) {
+            if (i.size == 8 && !fits_int(src.imm)) {
+                byte(0x48 | (dst.reg >> 3));
+                byte(0xb8 + (dst.reg & 7));
+                imm(src.imm, 8);
+            } else if (i.size == 8) {
+                modrm(8, {0xc7}, 0, dst, 4);
+                imm(src.imm, 4);
+            } else {
+                if (i.size == 2) byte(0x66);
+                if (dst.reg >= 8 || (b && dst.reg >= 4))
+                    byte(0x40 | (dst.reg >> 3));
+                byte((b ? 0xb0 : 0xb8) + (dst.reg & 7));
+                imm(src.imm, i.size);
+            }
+        } else if (src.kind == MOperand::IMM) {
+            int n = i.size == 8 ? 4 : i.size;
+            modrm(i.size, {b ? 0xc6 : 0xc7}, 0, dst, n);
+            imm(src.imm, n);
+        } else if (src.kind == MOperand::REG) {
+            modrm(i.size, {b ? 0x88 : 0x89}, src.reg, dst, 0, b, b);
+        } else {
+            modrm(i.size, {b ? 0x8a : 0x8b}, dst.reg, src, 0, b, b);
+        }
+        break;
+    }
+    case M_MOVSX:
+        if (i.src_size == 4)
+            modrm(8, {0x63}, ops[1].reg, ops[0]);
+        else
+            modrm(8, {0x0f, i.src_size == 1 ? 0xbe : 0xbf}, ops[1].reg,
+                  ops[0], 0, false, i.src_size == 1);
+        break;
+    case M_MOVZX:
+        modrm(8, {0x0f, i.src_size == 1 ? 0xb6 : 0xb7}, ops[1].reg, ops[0],
+              0, false, i.src_size == 1);
+        break;
+    case M_LEA:
+        modrm(8, {0x8d}, ops[1].reg, ops[0]);
+        break;
+    case M_ADD: alu(i, 0x00, 0); break;
+    case M_OR:  alu(i, 0x08, 1); break;
+    case M_AND: alu(i, 0x20, 4); break;
+    case M_SUB: alu(i, 0x28, 5); break;
+    case M_XOR: alu(i, 0x30, 6); break;
+    case M_CMP: alu(i, 0x38, 7); break;
+    case M_TEST:
+        modrm(i.size, {i.size == 1 ? 0x84 : 0x85}, ops[0].reg, ops[1], 0,
+              i.size == 1, i.size == 1);
+        break;
+    case M_IMUL:
+        if (ops[0].kind == MOperand::IMM) {
+            bool short_imm = fits_imm8(ops[0].imm);
+            modrm(i.size, {short_imm ? 0x6b : 0x69}, ops[1].reg, ops[1],
+                  short_imm ? 1 : 4);
+            imm(ops[0].imm, short_imm ? 1 : 4);
+        } else {
+            modrm(i.size, {0x0f, 0xaf}, ops[1].reg, ops[0]);
+        }
+        break;
+    case M_SHL:
+    case M_SHR:
+    case M_SAR: {
+        int ext = i.op == M_SHL ? 4 : i.op == M_SHR ? 5 : 7;
+        if (ops[0].kind == MOperand::IMM) {
+            modrm(i.size, {0xc1}, ext, ops[1], 1);
+            imm(ops[0].imm, 1);
+        } else {
+            modrm(i.size, {0xd3}, ext, ops[1]);
+        }
+        break;
+    }
+    case M_NEG:
+        modrm(i.size, {0xf7}, 3, ops[0]);
+        break;
+    case M_NOT:
+        modrm(i.size, {0xf7}, 2, ops[0]);
+        break;
+    case M_CQO:
+        byte(0x48);
+        byte(0x99);
+        break;
+    case M_IDIV:
+        modrm(i.size, {0xf7}, 7, ops[0]);
+        break;
+    case M_DIV:
+        modrm(i.size, {0xf7}, 6, ops[0]);
+        break;
+    case M_SETCC:
+        modrm(1, {0x0f, 0x90 + cc_codes[i.cc]}, 0, ops[0], 0, false, true);
+        break;
+    case M_CMOV:
+        modrm(8, {0x0f, 0x40 + cc_codes[i.cc]}, ops[1].reg, ops[0]);
+        break;
+    case M_JMP:
+        byte(0xe9);
+        jump_to(ops[0].block);
+        break;
+    case M_JCC:
+        byte(0x0f);
+        byte(0x80 + cc_codes[i.cc]);
+        jump_to(ops[0].block);
+        break;
+    case M_CALL:
+        if (ops[0].kind == MOperand::SYM) {
+            byte(0xe8);
+            relocs.push_back({CodeReloc::PLT32, offset(), ops[0].sym, -4});
+            imm(0, 4);
+        } else {
+            modrm(4, {0xff}, 2, ops[0]);
+        }
+        break;
+    case M_RET:
+        byte(0xc3);
+        break;
+    case M_TAILCALL:
+        byte(0xe9);
+        relocs.push_back({CodeReloc::PLT32, offset(), ops[0].sym, -4});
+        imm(0, 4);
+        break;
+    case M_PUSH:
+        if (ops[0].kind == MOperand::IMM) {
+            bool short_imm = fits_imm8(ops[0].imm);
+            byte(short_imm ? 0x6a : 0x68);
+            imm(ops[0].imm, short_imm ? 1 : 4);
+        } else {
+            if (ops[0].reg >= 8) byte(0x41);
+            byte(0x50 + (ops[0].reg & 7));
+        }
+        break;
+    case M_POP:
+        if (ops[0].reg >= 8) byte(0x41);
+        byte(0x58 + (ops[0].reg & 7));
+        break;
+    default:
+        encode_vector(i);
+        break;
+    }
+}
+
+// The SSE2 forms have a mandatory prefix in front of the REX prefix, which
+// the AVX2 ones fold into the VEX prefix along with the size of the vector
+void Encoder::encode_vector(const MInstr &i) {
+    auto &src = i.ops[0], &dst = i.ops.back();
+    bool avx = i.size == 32;
+    // pp, map and opcode of each lane size for the arithmetic
+    int pp = 1, map = 1, opcode = 0;
+    switch (i.op) {
+    case M_VMOV: {
+        // movdqu to and from memory, movdqa between registers
+        bool store = dst.kind != MOperand::REG;
+        int reg = store ? src.reg : dst.reg;
+        auto &rm = store ? dst : src;
+        pp = src.kind == MOperand::REG && !store ? 1 : 2;
+        opcode = store ? 0x7f : 0x6f;
+        if (avx) {
+            vex(pp, 1, false, true, 0, opcode, reg, rm);
+        } else {
+            byte(pp == 1 ? 0x66 : 0xf3);
+            modrm(4, {0x0f, opcode}, reg, rm);
+        }
+        return;
+    }
+    case M_VADD: {
+        static const int codes[] = {0xfc, 0xfd, 0, 0xfe, 0, 0, 0, 0xd4};
+        opcode = codes[i.src_size - 1];
+        break;
+    }
+    case M_VSUB: {
+        static const int codes[] = {0xf8, 0xf9, 0, 0xfa, 0, 0, 0, 0xfb};
+        opcode = codes[i.src_size - 1];
+        break;
+    }
+    case M_VMUL:
+        // pmullw, or pmulld from the 0x0f 0x38 map
+        if (i.src_size == 2) {
+            opcode = 0xd5;
+        } else {
+            map = 2;
+            opcode = 0x40;
+        }
+        break;
+    case M_VAND: opcode = 0xdb; break;
+    case M_VOR:  opcode = 0xeb; break;
+    case M_VXOR: opcode = 0xef; break;
+    case M_MOVQ:
+        if (avx) {
+            vex(1, 1, true, false, 0, 0x6e, dst.reg, src);
+        } else {
+            byte(0x66);
+            modrm(8, {0x0f, 0x6e}, dst.reg, src);
+        }
+        return;
+    case M_VBCAST:
+        // vpbroadcastq, or punpcklqdq of the register with itself
+        if (avx) {
+            vex(1, 2, false, true, 0, 0x59, src.reg, src);
+        } else {
+            byte(0x66);
+            modrm(4, {0x0f, 0x6c}, src.reg, src);
+        }
+        return;
+    case M_VZEROUPPER:
+        byte(0xc5);
+        byte(0xf8);
+        byte(0x77);
+        return;
+    default:
+        return;
+    }
+    if (avx) {
+        vex(pp, map, false, true, dst.reg, opcode, dst.reg, src);
+    } else if (map == 2) {
+        byte(0x66);
+        modrm(4, {0x0f, 0x38, opcode}, dst.reg, src);
+    } else {
+        byte(0x66);
+        modrm(4, {0x0f, opcode}, dst.reg, src);
+    }
+}
+
+void Encoder::run() {
+    for (auto &b: mf.blocks) {
+        if ((size_t)b->id >= block_offsets.size())
+            block_offsets.resize(b->id + 1);
+        block_offsets[b->id] = offset();
+        for (auto &i: b->instrs) encode(i);
+    }
+    for (auto &f: fixups) {
+        long rel = block_offsets[f.second->id] - (f.first + 4);
+        for (int k = 0; k < 4; k++)
+            code[start + f.first + k] = rel >> (8 * k) & 0xff;
+    }
+}
+
+}
+
+void encode_function(const MFunction &mf, std::string &code,
+                     std::vector<CodeReloc> &relocs) {
+    Encoder(mf, code, relocs).run();
+}
@@ -0,0 +1,586 @@
+#include "eval.hpp"
+#include "decl.hpp"
+#include "expr.hpp"
+#include "stmt.hpp"
+#include "util.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The evaluator follows the lowering closely, computing the value of each
+// node where the lowering emits the code for it. It's not meant to be fast,
+// but to show what walking the tree costs compared to the bytecode, so it
+// does what a straightforward tree walker does: names are looked up in
+// hash tables on every use, and types are recomputed every time.
+//
+// Jumps into the middle of a statement are made by skipping statements
+// until the label is found: a switch looks through its body for the case
+// label, and a goto completes every statement up to the body of the
+// function, which is then looked through for its label. The locals keep
+// their values across a goto, as the blocks on the way to the label
+// allocate them at the same addresses again.
+
+namespace
+{
+
+long arith(TokenType op, long a, long b, bool is_signed) {
+    unsigned long ua = a, ub = b;
+    switch (op) {
+    case TOK_PLUS:   return ua + ub;
+    case TOK_MINUS:  return ua - ub;
+    case TOK_STAR:   return ua * ub;
+    case TOK_SLASH:  return is_signed ? a / b : ua / ub;
+    case TOK_MOD:    return is_signed ? a % b : ua % ub;
+    case TOK_AND:    return a & b;
+    case TOK_OR:     return a | b;
+    case TOK_XOR:    return a ^ b;
+    case TOK_LSHIFT: return ua << (b & 63);
+    default:         return is_signed ? a >> (b & 63) : ua >> (b & 63);
+    }
+}
+
+bool compare(TokenType op, long a, long b, bool is_signed) {
+    unsigned long ua = a, ub = b;
+    switch (op) {
+    case TOK_EQ: return a == b;
+    case TOK_NE: return a != b;
+    case TOK_LT: return is_signed ? a < b : ua < ub;
+    case TOK_LE: return is_signed ? a <= b : ua <= ub;
+    case TOK_GT: return is_signed ? a > b : ua > ub;
+    default:     return is_signed ? a >= b : ua >= ub;
+    }
+}
+
+bool is_comparison(TokenType t) {
+    return t >= TOK_LT && t <= TOK_NE;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Evaluator
+
+Evaluator::Evaluator(Runtime &rt, IRModule &scratch)
+    : rt(rt), types(scratch), stack(new char[STACK_SIZE]) {
+    push_scope();
+}
+
+void Evaluator::fatal(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "mycc: error: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+void Evaluator::declare(const std::string &name, EvalValue var) {
+    if (!name.empty()) scopes.back()[name] = var;
+}
+
+const EvalValue *Evaluator::lookup(const std::string &name) {
+    EvalValue *var = NULL;
+    for (size_t k = scopes.size(); k-- > scope_base && !var;) {
+        auto it = scopes[k].find(name);
+        if (it != scopes[k].end()) var = &it->second;
+    }
+    if (!var) {
+        auto it = scopes[0].find(name);
+        if (it == scopes[0].end()) return NULL;
+        var = &it->second;
+    }
+    if (!var->v) {
+        void *addr = rt.address(name);
+        if (!addr) exit(1);
+        var->v = (long)addr;
+    }
+    return var;
+}
+
+void Evaluator::define_function(const std::string &name, FuncDeclAST *f,
+                                const Type *type) {
+    functions[(long)f] = f;
+    rt.define_function(name, f);
+    scopes[0][name] = {(long)f, type};
+}
+
+FuncDeclAST *Evaluator::function(long addr) {
+    auto it = functions.find(addr);
+    return it == functions.end() ? NULL : it->second;
+}
+
+EvalValue Evaluator::call(EvalValue f, std::vector<long> &args) {
+    auto ret = f.type->base->base;
+    long v;
+    if (auto def = function(f.v)) {
+        v = def->call(*this, args);
+    } else {
+        if (args.size() > MAX_NATIVE_ARGS)
+            fatal("too many arguments to native function");
+        v = call_native((void *)f.v, args.data(), args.size());
+    }
+    if (ret->is_void()) return {0, ret};
+    return {normalize(v, ret), ret};
+}
+
+Evaluator::Frame Evaluator::enter_function(const Type *type) {
+    Frame saved = {scope_base, sp, func_type};
+    push_scope();
+    scope_base = scopes.size() - 1;
+    func_type = type;
+    return saved;
+}
+
+void Evaluator::leave_function(const Frame &saved) {
+    scopes.resize(scope_base);
+    scope_base = saved.scope_base;
+    sp = saved.sp;
+    func_type = saved.func_type;
+}
+
+long Evaluator::alloc(const Type *type) {
+    size_t align = type->align();
+    size_t start = (sp + align - 1) / align * align;
+    if (start + type->size() > STACK_SIZE) fatal("stack overflow");
+    sp = start + type->size();
+    return (long)&stack[start];
+}
+
+long Evaluator::string_literal(const ExprAST *e, const std::string &lexeme) {
+    auto it = strings.find(e);
+    if (it == strings.end()) it = strings.emplace(e, unescape(lexeme)).first;
+    return (long)it->second.c_str();
+}
+
+long Evaluator::load(long addr, const Type *type) {
+    long v = 0;
+    memcpy(&v, (const void *)addr, type->size());
+    return normalize(v, type);
+}
+
+void Evaluator::store(long addr, long v, const Type *type) {
+    memcpy((void *)addr, &v, type->size());
+}
+
+long Evaluator::normalize(long v, const Type *type) {
+    switch (type->kind) {
+    case TY_CHAR:  return (signed char)v;
+    case TY_SHORT: return (short)v;
+    case TY_INT:   return (int)v;
+    case TY_UINT:  return (unsigned)v;
+    default:       return v;
+    }
+}
+
+EvalValue Evaluator::rvalue(EvalValue lv) {
+    if (lv.type->is_array())
+        return {lv.v, Type::pointer_to(lv.type->base)};
+    if (lv.type->is_func())
+        return {lv.v, Type::pointer_to(lv.type)};
+    return {load(lv.v, lv.type), lv.type};
+}
+
+EvalValue Evaluator::convert(EvalValue v, const Type *type) {
+    if (type->is_void()) return {0, type};
+    return {normalize(v.v, type), type};
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Declarations
+
+void FuncDeclAST::eval(Evaluator &E) {
+    DeclInfo info;
+    type = decl->declare(E.types, type_of_spec(get_type()), info);
+    params.clear();
+    for (size_t i = 0; i < type->params.size(); i++) {
+        std::string pname;
+        auto ptype = (*info.params)[i]->declare(E.types, pname);
+        params.emplace_back(pname, ptype);
+    }
+    E.define_function(info.name, this, type);
+}
+
+long FuncDeclAST::call(Evaluator &E, const std::vector<long> &args) {
+    auto saved = E.enter_function(type);
+    for (size_t i = 0; i < params.size(); i++) {
+        auto ptype = params[i].second;
+        long addr = E.alloc(ptype);
+        long v = i < args.size() ? args[i] : 0;
+        E.store(addr, E.normalize(v, ptype), ptype);
+        E.declare(params[i].first, {addr, ptype});
+    }
+    auto c = body->exec(E);
+    while (c == StmtAST::GOTO) {
+        E.seeking = true;
+        c = body->exec(E);
+    }
+    long v = c == StmtAST::RETURN ? E.ret : 0;
+    E.leave_function(saved);
+    return v;
+}
+
+void InitDecl::eval(Evaluator &E, const Type *base) {
+    DeclInfo info;
+    auto type = decl->declare(E.types, base, info);
+    if (type->is_func()) {
+        E.declare(info.name, {0, type});
+        return;
+    }
+    if (E.at_file_scope()) {
+        E.declare(info.name, {(long)E.rt.address(info.name), type});
+        return;
+    }
+    // Initializers are skipped when a switch jumps past them
+    if (type->is_array() && init) {
+        IRGlobal g;
+        g.size = type->len < 0 ? 0 : type->size();
+        g.data.assign(g.size, '\0');
+        init->init_static(E.types, type, g);
+        if (type->len < 0)
+            type = Type::array_of(type->base, g.size);
+        long addr = E.alloc(type);
+        if (!E.seeking) memcpy((void *)addr, g.data.data(), g.size);
+        E.declare(info.name, {addr, type});
+        return;
+    }
+    long addr = E.alloc(type);
+    E.declare(info.name, {addr, type});
+    if (init && !E.seeking) {
+        auto v = E.convert(init->eval(E), type);
+        E.store(addr, v.v, type);
+    }
+}
+
+void DeclAST::eval(Evaluator &E) {
+    auto base = type_of_spec(get_type());
+    for (auto &d: *decl) d.eval(E, base);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Statements
+
+StmtAST::Completion LabelStmtAST::exec(Evaluator &E) {
+    if (E.seeking && E.seek_label) {
+        if (type == LABEL && *label == *E.seek_label) {
+            E.seeking = false;
+            E.seek_label = NULL;
+        }
+    } else if (E.seeking) {
+        long v = 0;
+        if (type == CASE && case_exp->eval_const(v) &&
+            E.normalize(v, E.case_type) == E.case_value)
+            E.seeking = false;
+        else if (type == DEFAULT && E.seek_default)
+            E.seeking = false;
+    }
+    return stmt->exec(E);
+}
+
+StmtAST::Completion ExprStmtAST::exec(Evaluator &E) {
+    if (!E.seeking) e->eval(E);
+    return NORMAL;
+}
+
+StmtAST::Completion BlockStmtAST::exec(Evaluator &E) {
+    auto mark = E.mark();
+    E.push_scope();
+    for (auto &d: *decls) d->eval(E);
+    auto c = NORMAL;
+    for (auto &s: *stmts) {
+        if ((c = s->exec(E)) != NORMAL) break;
+    }
+    E.pop_scope();
+    E.release(mark);
+    return c;
+}
+
+StmtAST::Completion IfStmtAST::exec(Evaluator &E) {
+    if (E.seeking) {
+        auto c = then_branch->exec(E);
+        if (E.seeking && else_branch) c = else_branch->exec(E);
+        return c;
+    }
+    if (cond->eval(E).v) return then_branch->exec(E);
+    if (else_branch) return else_branch->exec(E);
+    return NORMAL;
+}
+
+StmtAST::Completion SwitchStmtAST::exec(Evaluator &E) {
+    if (E.seeking) {
+        // The case labels inside belong to this switch, not the one being
+        // looked at, but a goto may jump in
+        if (!E.seek_label) return NORMAL;
+        auto r = body->exec(E);
+        return r == BREAK ? NORMAL : r;
+    }
+    auto c = cond->eval(E);
+    auto type = E.types.arith_type(c.type, Type::int_type());
+    E.seeking = true;
+    E.seek_default = false;
+    E.case_value = E.convert(c, type).v;
+    E.case_type = type;
+    auto r = body->exec(E);
+    if (E.seeking) {
+        E.seek_default = true;
+        r = body->exec(E);
+    }
+    E.seeking = false;
+    return r == BREAK ? NORMAL : r;
+}
+
+// A case label inside a loop is found by looking through its body. The loop
+// then goes on as if the body had just completed.
+
+StmtAST::Completion ForStmtAST::exec(Evaluator &E) {
+    if (E.seeking) {
+        auto c = body->exec(E);
+        if (E.seeking || c == BREAK) return NORMAL;
+        if (c == RETURN || c == GOTO) return c;
+        if (incr) incr->eval(E);
+    } else if (init) {
+        init->eval(E);
+    }
+    while (!cond || cond->eval(E).v) {
+        auto c = body->exec(E);
+        if (c == BREAK) break;
+        if (c == RETURN || c == GOTO) return c;
+        if (incr) incr->eval(E);
+    }
+    return NORMAL;
+}
+
+StmtAST::Completion WhileStmtAST::exec(Evaluator &E) {
+    if (E.seeking) {
+        auto c = body->exec(E);
+        if (E.seeking || c == BREAK) return NORMAL;
+        if (c == RETURN || c == GOTO) return c;
+    }
+    while (cond->eval(E).v) {
+        auto c = body->exec(E);
+        if (c == BREAK) break;
+        if (c == RETURN || c == GOTO) return c;
+    }
+    return NORMAL;
+}
+
+StmtAST::Completion DoStmtAST::exec(Evaluator &E) {
+    if (E.seeking) {
+        auto c = body->exec(E);
+        if (E.seeking || c == BREAK) return NORMAL;
+        if (c == RETURN || c == GOTO) return c;
+        if (!cond->eval(E).v) return NORMAL;
+    }
+    do {
+        auto c = body->exec(E);
+        if (c == BREAK) break;
+        if (c == RETURN || c == GOTO) return c;
+    } while (cond->eval(E).v);
+    return NORMAL;
+}
+
+StmtAST::Completion JumpStmtAST::exec(Evaluator &E) {
+    if (E.seeking) return NORMAL;
+    switch (type) {
+    case GOTO:
+        E.seek_label = label.get();
+        return StmtAST::GOTO;
+    case CONTINUE:
+        return StmtAST::CONTINUE;
+    default:
+        return StmtAST::BREAK;
+    }
+}
+
+StmtAST::Completion ReturnStmtAST::exec(Evaluator &E) {
+    if (E.seeking) return NORMAL;
+    if (e) {
+        auto v = e->eval(E);
+        E.ret = E.convert(v, E.return_type()).v;
+    }
+    return RETURN;
+}
+
+StmtAST::Completion EmptyStmtAST::exec(Evaluator &) {
+    return NORMAL;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Expressions
+
+EvalValue ExprAST::eval_addr(Evaluator &E) {
+    E.fatal("lvalue required");
+}
+
+EvalValue ExprAST::eval_callee(Evaluator &E) {
+    return eval(E);
+}
+
+EvalValue VarExprAST::eval_addr(Evaluator &E) {
+    auto var = E.lookup(*name);
+    if (!var) E.fatal("'%s' undeclared", name->c_str());
+    return *var;
+}
+
+EvalValue VarExprAST::eval(Evaluator &E) {
+    return E.rvalue(eval_addr(E));
+}
+
+EvalValue VarExprAST::eval_callee(Evaluator &E) {
+    if (!E.lookup(*name)) {
+        auto type = Type::func_returning(Type::int_type(), {}, false, false);
+        E.declare(*name, {0, type});
+    }
+    return eval(E);
+}
+
+EvalValue NumberExprAST::eval(Evaluator &) {
+    return {v, fits_int(v) ? Type::int_type() : Type::long_type()};
+}
+
+EvalValue StringExprAST::eval(Evaluator &E) {
+    return {E.string_literal(this, str),
+            Type::pointer_to(Type::char_type())};
+}
+
+EvalValue IndexExprAst::eval_addr(Evaluator &E) {
+    auto b = base->eval(E);
+    auto i = index->eval(E);
+    if (i.type->is_pointer()) std::swap(b, i);
+    auto elem = b.type->base;
+    return {arith(TOK_PLUS, b.v, i.v * elem->size(), true), elem};
+}
+
+EvalValue IndexExprAst::eval(Evaluator &E) {
+    return E.rvalue(eval_addr(E));
+}
+
+EvalValue CallExprAST::eval(Evaluator &E) {
+    auto f = func->eval_callee(E);
+    auto ftype = f.type->base;
+    std::vector<long> values;
+    size_t nargs = args ? args->size() : 0;
+    for (size_t i = 0; i < nargs; i++) {
+        auto a = (*args)[i]->eval(E);
+        if (ftype->has_proto && i < ftype->params.size())
+            a = E.convert(a, ftype->params[i]);
+        values.push_back(a.v);
+    }
+    return E.call(f, values);
+}
+
+EvalValue UnaryExprAST::eval_addr(Evaluator &E) {
+    if (token.type != TOK_STAR) return ExprAST::eval_addr(E);
+    auto p = exp->eval(E);
+    return {p.v, p.type->base};
+}
+
+EvalValue UnaryExprAST::eval(Evaluator &E) {
+    switch (token.type) {
+    case TOK_STAR:
+        return E.rvalue(eval_addr(E));
+    case TOK_AND: {
+        auto lv = exp->eval_addr(E);
+        return {lv.v, Type::pointer_to(lv.type)};
+    }
+    case TOK_INCR:
+    case TOK_DECR: {
+        auto lv = exp->eval_addr(E);
+        long old = E.load(lv.v, lv.type);
+        long step = lv.type->is_pointer() ? lv.type->base->size() : 1;
+        long v = arith(token.type == TOK_INCR ? TOK_PLUS : TOK_MINUS, old,
+                       step, true);
+        v = E.normalize(v, lv.type);
+        E.store(lv.v, v, lv.type);
+        return {postfix ? old : v, lv.type};
+    }
+    default:
+        break;
+    }
+    auto v = exp->eval(E);
+    if (token.type == TOK_BANG) return {v.v == 0, Type::int_type()};
+    auto type = E.types.arith_type(v.type, Type::int_type());
+    v = E.convert(v, type);
+    switch (token.type) {
+    case TOK_MINUS:
+        return {E.normalize(arith(TOK_MINUS, 0, v.v, true), type), type};
+    case TOK_TILDE:
+        return {E.normalize(~v.v, type), type};
+    default:  // TOK_PLUS
+        return v;
+    }
+}
+
+EvalValue BinaryExprAST::eval(Evaluator &E) {
+    auto op = token.type;
+    if (op == TOK_ASSIGN) {
+        auto lv = LHS->eval_addr(E);
+        auto v = E.convert(RHS->eval(E), lv.type);
+        E.store(lv.v, v.v, lv.type);
+        return v;
+    }
+    if (op == TOK_AND_AND || op == TOK_OR_OR) {
+        bool l = LHS->eval(E).v != 0;
+        if (l == (op == TOK_OR_OR)) return {l, Type::int_type()};
+        return {RHS->eval(E).v != 0, Type::int_type()};
+    }
+
+    auto l = LHS->eval(E);
+    auto r = RHS->eval(E);
+    // Pointer arithmetic
+    if (op == TOK_PLUS && r.type->is_pointer()) std::swap(l, r);
+    if ((op == TOK_PLUS || op == TOK_MINUS) && l.type->is_pointer()) {
+        long size = l.type->base->size();
+        if (r.type->is_pointer())
+            return {arith(TOK_MINUS, l.v, r.v, true) / size,
+                    Type::long_type()};
+        return {arith(op, l.v, r.v * size, true), l.type};
+    }
+    if (is_comparison(op)) {
+        bool is_signed = false;
+        if (!l.type->is_pointer() && !r.type->is_pointer()) {
+            auto type = E.types.arith_type(l.type, r.type);
+            l = E.convert(l, type);
+            r = E.convert(r, type);
+            is_signed = type->is_signed();
+        }
+        return {compare(op, l.v, r.v, is_signed), Type::int_type()};
+    }
+    const Type *type;
+    if (op == TOK_LSHIFT || op == TOK_RSHIFT) {
+        type = E.types.arith_type(l.type, Type::int_type());
+        r = E.convert(r, Type::int_type());
+    } else {
+        type = E.types.arith_type(l.type, r.type);
+        r = E.convert(r, type);
+    }
+    l = E.convert(l, type);
+    return {E.normalize(arith(op, l.v, r.v, type->is_signed()), type), type};
+}
+
+// The program is lowered before it's evaluated, which found the type,
+// unless it was only lowered as a condition, needing just its truth value
+EvalValue TernaryExprAST::eval(Evaluator &E) {
+    auto v = cond->eval(E).v ? then_expr->eval(E) : else_expr->eval(E);
+    return type ? E.convert(v, type) : v;
+}
+
+int evaluate_program(std::vector<std::unique_ptr<ExtDeclAST>> &decls,
+                     IRModule &m, int argc, char **argv) {
+    Runtime rt(m);
+    IRModule scratch;
+    Evaluator E(rt, scratch);
+    for (auto &d: decls) d->eval(E);
+    if (!rt.link()) return 1;
+    auto main_fn = E.lookup("main");
+    if (!main_fn || !E.function(main_fn->v)) {
+        fprintf(stderr, "mycc: no main function\n");
+        return 1;
+    }
+    std::vector<long> args = {argc, (long)argv};
+    return E.call({main_fn->v, Type::pointer_to(main_fn->type)}, args).v;
+}
@@ -0,0 +1,98 @@
+#ifndef EVAL_HPP
+#define EVAL_HPP
+#include "interp.hpp"
+#include "ir.hpp"
+#include "lower.hpp"
+#include "types.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+class ExprAST;
+class FuncDeclAST;
+
+// A value computed by the evaluator, normalized like the registers of the
+// IR. For an lvalue, as returned by ExprAST::eval_addr, @v is the address
+// of an object of @type instead.
+struct EvalValue {
+    long v;
+    const Type *type;
+};
+
+// Evaluator holds the state of a program run by walking its syntax tree.
+// Like Lowering, it's driven by the nodes, through their eval() and exec()
+// methods. Names are looked up in a chain of scopes each time they're used,
+// and locals live on a stack of the evaluator.
+class Evaluator {
+public:
+    Runtime &rt;
+    // Declarators derive their types with a Lowering, which they only need
+    // to report errors. There are none, since the program has been lowered.
+    Lowering types;
+    // Set by a return statement
+    long ret = 0;
+    // Set while looking for the label a switch or goto statement jumps to.
+    // The statements are skipped until the label is found.
+    bool seeking = false;
+    bool seek_default = false;
+    long case_value = 0;
+    const Type *case_type = NULL;
+    // The label of a goto, NULL for a switch
+    const std::string *seek_label = NULL;
+
+    Evaluator(Runtime &rt, IRModule &scratch);
+
+    void fatal(const char *fmt, ...)
+        __attribute__((format(printf, 2, 3), noreturn));
+
+    // Scopes. Functions have a value of 0 until they're used, as they may be
+    // declared before they're defined.
+    void push_scope() { scopes.emplace_back(); }
+    void pop_scope() { scopes.pop_back(); }
+    void declare(const std::string &name, EvalValue var);
+    const EvalValue *lookup(const std::string &name);
+    bool at_file_scope() { return func_type == NULL; }
+
+    // Functions
+    void define_function(const std::string &name, FuncDeclAST *f,
+                         const Type *type);
+    // The definition of the function at @addr, NULL if it's native
+    FuncDeclAST *function(long addr);
+    // Call the function @f points to
+    EvalValue call(EvalValue f, std::vector<long> &args);
+    // A call of a function defined in the program runs in a frame of its
+    // own, in which only its own locals and the globals are visible
+    struct Frame {
+        size_t scope_base;
+        size_t sp;
+        const Type *func_type;
+    };
+    Frame enter_function(const Type *type);
+    void leave_function(const Frame &saved);
+    const Type *return_type() { return func_type->base; }
+
+    // Storage for a local, freed when the block declaring it is left
+    long alloc(const Type *type);
+    size_t mark() { return sp; }
+    void release(size_t mark) { sp = mark; }
+    // The address of the string literal @e
+    long string_literal(const ExprAST *e, const std::string &lexeme);
+
+    // Values
+    long load(long addr, const Type *type);
+    void store(long addr, long v, const Type *type);
+    long normalize(long v, const Type *type);
+    EvalValue rvalue(EvalValue lv);
+    EvalValue convert(EvalValue v, const Type *type);
+private:
+    static const size_t STACK_SIZE = 8 << 20;
+    std::vector<std::unordered_map<std::string, EvalValue>> scopes;
+    size_t scope_base = 1;
+    const Type *func_type = NULL;
+    std::unordered_map<long, FuncDeclAST *> functions;
+    std::unique_ptr<char[]> stack;
+    size_t sp = 0;
+    std::unordered_map<const ExprAST *, std::string> strings;
+};
+#endif
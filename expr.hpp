@@ -5,11 +5,51 @@
 #include <string>
 #include <utility>
 #include <vector>
+struct EvalValue;
+class Evaluator;
+class IRBlock;
+struct IRGlobal;
+class Lowering;
+class Type;
+struct Value;
 
 class ExprAST {
 public:
     virtual ~ExprAST() = default;
     virtual void print() = 0;
+    // Emit IR computing the value of the expression
+    virtual Value lower(Lowering &L) = 0;
+    // Emit IR computing the address of the object the expression designates.
+    // Only lvalues override this, the default reports an error.
+    virtual Value lower_addr(Lowering &L);
+    // Like lower(), but for the function operand of a call, where an unde-
+    // clared identifier is implicitly declared as a function.
+    virtual Value lower_callee(Lowering &L);
+    // Emit IR going to @then_block if the expression is nonzero and to
+    // @else_block otherwise. &&, || and ! become chains of branches, never
+    // computing a 0 or 1. @context completes the error for a non-scalar
+    // condition, as in "in if condition".
+    virtual void lower_cond(Lowering &L, IRBlock *then_block,
+                            IRBlock *else_block, const char *context);
+    // The number of instructions computing the value takes, if it can be
+    // computed where the program wouldn't: without side effects, and
+    // without loads or divisions that may trap. -1 otherwise.
+    virtual int speculation_cost() { return -1; }
+    // Fold an integer constant expression. Returns false if the expression
+    // isn't one.
+    virtual bool eval_const(long &) { return false; }
+    // If the expression names an object or function with static storage,
+    // return its symbol. This is used for direct calls and for address
+    // constants in initializers.
+    virtual bool static_addr(Lowering &, std::string &) { return false; }
+    // Write the expression as the initial value of an object of @type with
+    // static storage. Returns false if it isn't a constant expression.
+    virtual bool init_static(Lowering &L, const Type *type, IRGlobal &g);
+    // The counterparts of lower(), lower_addr() and lower_callee() for the
+    // AST evaluator, computing values instead of emitting code for them
+    virtual EvalValue eval(Evaluator &E) = 0;
+    virtual EvalValue eval_addr(Evaluator &E);
+    virtual EvalValue eval_callee(Evaluator &E);
 };
 
 class VarExprAST : public ExprAST {
@@ -17,6 +57,14 @@ class VarExprAST : public ExprAST {
 public:
     VarExprAST(std::unique_ptr<std::string> name) : name(std::move(name)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    Value lower_addr(Lowering &L) override;
+    Value lower_callee(Lowering &L) override;
+    int speculation_cost() override { return 1; }
+    bool static_addr(Lowering &L, std::string &sym) override;
+    EvalValue eval(Evaluator &E) override;
+    EvalValue eval_addr(Evaluator &E) override;
+    EvalValue eval_callee(Evaluator &E) override;
 };
 
 class NumberExprAST : public ExprAST {
@@ -24,6 +72,10 @@ class NumberExprAST : public ExprAST {
 public:
     NumberExprAST(long v) : v(v) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    bool eval_const(long &v) override;
+    int speculation_cost() override { return 0; }
+    EvalValue eval(Evaluator &E) override;
 };
 
 class StringExprAST : public ExprAST {
@@ -31,6 +83,10 @@ class StringExprAST : public ExprAST {
 public:
     StringExprAST(std::string &&str) : str(str) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    int speculation_cost() override { return 1; }
+    bool init_static(Lowering &L, const Type *type, IRGlobal &g) override;
+    EvalValue eval(Evaluator &E) override;
 };
 
 class IndexExprAst : public ExprAST {
@@ -41,6 +97,10 @@ public:
                  std::unique_ptr<ExprAST> index)
         : base(std::move(base)), index(std::move(index)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    Value lower_addr(Lowering &L) override;
+    EvalValue eval(Evaluator &E) override;
+    EvalValue eval_addr(Evaluator &E) override;
 };
 
 class CallExprAST : public ExprAST {
@@ -53,6 +113,8 @@ public:
     CallExprAST(std::unique_ptr<ExprAST> func, std::unique_ptr<ArgList> args)
         : func(std::move(func)), args(std::move(args)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    EvalValue eval(Evaluator &E) override;
 };
 
 class UnaryExprAST : public ExprAST {
@@ -63,6 +125,15 @@ public:
     UnaryExprAST(bool postfix, Token token, std::unique_ptr<ExprAST> exp)
         : postfix(postfix), token(token), exp(std::move(exp)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    Value lower_addr(Lowering &L) override;
+    void lower_cond(Lowering &L, IRBlock *then_block, IRBlock *else_block,
+                    const char *context) override;
+    int speculation_cost() override;
+    bool eval_const(long &v) override;
+    bool init_static(Lowering &L, const Type *type, IRGlobal &g) override;
+    EvalValue eval(Evaluator &E) override;
+    EvalValue eval_addr(Evaluator &E) override;
 };
 
 class BinaryExprAST : public ExprAST {
@@ -73,10 +144,19 @@ public:
                   std::unique_ptr<ExprAST> RHS)
         : token(token), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    void lower_cond(Lowering &L, IRBlock *then_block, IRBlock *else_block,
+                    const char *context) override;
+    int speculation_cost() override;
+    bool eval_const(long &v) override;
+    EvalValue eval(Evaluator &E) override;
 };
 
 class TernaryExprAST : public ExprAST {
     std::unique_ptr<ExprAST> cond, then_expr, else_expr;
+    // The common type of the arms, found by lower(), for eval(), which
+    // only evaluates one of them
+    const Type *type = NULL;
 public:
     TernaryExprAST(std::unique_ptr<ExprAST> cond,
                    std::unique_ptr<ExprAST> then_expr,
@@ -84,5 +164,11 @@ public:
         : cond(std::move(cond)), then_expr(std::move(then_expr))
         , else_expr(std::move(else_expr)) {}
     void print() override;
+    Value lower(Lowering &L) override;
+    void lower_cond(Lowering &L, IRBlock *then_block, IRBlock *else_block,
+                    const char *context) override;
+    int speculation_cost() override;
+    bool eval_const(long &v) override;
+    EvalValue eval(Evaluator &E) override;
 };
 #endif
@@ -0,0 +1,203 @@
+#include "alias.hpp"
+#include "cfg.hpp"
+#include "ir.hpp"
+#include "opt.hpp"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Value numbering over the dominator tree. Walking it from the entry, each
+// pure instruction is looked up in a table of the expressions computed in
+// the blocks dominating it, by opcode and operands; if it's there, its
+// uses are given the register already holding the value instead. Entries
+// are undone on the way back up, so the table only ever holds what
+// dominates the current block.
+//
+// Loads are also numbered, and one found in the table is redundant unless
+// something may have written to what it reads since. The stores and calls
+// on the way down the tree are kept for AliasAnalysis to tell, along with
+// a barrier for entering a block that can be reached other than from the
+// end of its immediate dominator, since stores on the other paths may have
+// come in between.
+
+namespace
+{
+
+struct Expr {
+    IROp op;
+    int a = -1, b = -1, c = -1;
+    long imm = 0;
+    int size = 0;
+    bool is_signed = false;
+    std::string sym;
+
+    bool operator==(const Expr &o) const {
+        return op == o.op && a == o.a && b == o.b && c == o.c &&
+               imm == o.imm &&
+               size == o.size && is_signed == o.is_signed && sym == o.sym;
+    }
+};
+
+struct ExprHash {
+    size_t operator()(const Expr &e) const {
+        size_t h = std::hash<std::string>()(e.sym);
+        for (long v: {(long)e.op, (long)e.a, (long)e.b, (long)e.c, e.imm,
+                      (long)e.size, (long)e.is_signed})
+            h = h * 1000003 ^ std::hash<long>()(v);
+        return h;
+    }
+};
+
+bool is_commutative(IROp op) {
+    switch (op) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR:
+    case IR_EQ:
+    case IR_NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+class GVN {
+public:
+    GVN(IRFunction &f, const OptOptions &opts)
+        : f(f), cfg(f), dom(cfg), aa(f, opts.strict_aliasing),
+          leader(f.nregs), since(f.nregs) {}
+    GVNStats run();
+private:
+    IRFunction &f;
+    CFG cfg;
+    DomTree dom;
+    AliasAnalysis aa;
+    // The register holding the value of each register, itself unless it
+    // was found redundant
+    std::vector<int> leader;
+    std::unordered_map<Expr, int, ExprHash> table;
+    // The entries added or replaced, with the register they had before or
+    // -1, to be undone when leaving the blocks changing them
+    std::vector<std::pair<Expr, int>> undo;
+    // The stores and calls on the path from the entry, NULL for a barrier,
+    // and for each load in the table, how many of them came before it
+    std::vector<const IRInstr *> writes;
+    std::vector<size_t> since;
+    GVNStats st;
+
+    void number(int b);
+    bool clobbered(const IRInstr &load, int prior);
+};
+
+// Whether anything after the load giving @prior may have written to what
+// @load reads
+bool GVN::clobbered(const IRInstr &load, int prior) {
+    for (size_t k = since[prior]; k < writes.size(); k++) {
+        auto w = writes[k];
+        if (!w) return true;
+        bool may_write = w->op == IR_CALL ? aa.call_may_access(load)
+                                          : aa.may_alias(load, *w);
+        if (may_write) return true;
+    }
+    return false;
+}
+
+void GVN::number(int b) {
+    for (auto &i: f.blocks[b]->instrs) {
+        for (auto &a: i.args) a = leader[a];
+        if (i.op == IR_STORE || i.op == IR_VSTORE || i.op == IR_CALL) {
+            writes.push_back(&i);
+            continue;
+        }
+        if (i.dst < 0 || i.op == IR_PARAM || i.op == IR_PHI) continue;
+        if (i.op == IR_COPY) {
+            leader[i.dst] = i.args[0];
+            continue;
+        }
+        Expr e;
+        e.op = i.op;
+        e.imm = i.imm;
+        e.sym = i.sym;
+        if (i.args.size() > 0) e.a = i.args[0];
+        if (i.args.size() > 1) e.b = i.args[1];
+        if (i.args.size() > 2) e.c = i.args[2];
+        if (is_commutative(i.op) && e.a > e.b) std::swap(e.a, e.b);
+        switch (i.op) {
+        case IR_SEXT:
+        case IR_ZEXT:
+            e.size = i.size;
+            break;
+        case IR_LOAD:
+            e.size = i.size;
+            e.is_signed = i.is_signed;
+            since[i.dst] = writes.size();
+            break;
+        default:
+            break;
+        }
+        leader[i.dst] = i.dst;
+        auto it = table.find(e);
+        if (it != table.end() &&
+            (i.op != IR_LOAD || !clobbered(i, it->second))) {
+            leader[i.dst] = it->second;
+            if (i.op == IR_LOAD)
+                st.loads++;
+            else if (i.op != IR_CONST && i.op != IR_LOCAL && i.op != IR_GLOBAL)
+                st.exprs++;
+            continue;
+        }
+        if (it != table.end()) {
+            undo.emplace_back(e, it->second);
+            it->second = i.dst;
+            continue;
+        }
+        undo.emplace_back(e, -1);
+        table.emplace(std::move(e), i.dst);
+    }
+}
+
+GVNStats GVN::run() {
+    for (int r = 0; r < f.nregs; r++) leader[r] = r;
+    // Preorder over the dominator tree, with the undo log and write
+    // positions of each block on the stack
+    std::vector<std::pair<int, size_t>> stack;
+    std::vector<std::pair<size_t, size_t>> marks;
+    auto enter = [&](int b) {
+        marks.emplace_back(undo.size(), writes.size());
+        if (b == 0 || cfg.preds[b].size() != 1) writes.push_back(NULL);
+        number(b);
+        stack.emplace_back(b, 0);
+    };
+    enter(0);
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        int b = top.first;
+        if (top.second < dom.children[b].size()) {
+            enter(dom.children[b][top.second++]);
+            continue;
+        }
+        for (size_t n = marks.back().first; undo.size() > n;
+             undo.pop_back()) {
+            auto &u = undo.back();
+            if (u.second < 0)
+                table.erase(u.first);
+            else
+                table[u.first] = u.second;
+        }
+        writes.resize(marks.back().second);
+        marks.pop_back();
+        stack.pop_back();
+    }
+    st.alias = aa.stats;
+    return st;
+}
+
+}
+
+GVNStats number_values(IRFunction &f, const OptOptions &opts) {
+    return GVN(f, opts).run();
+}
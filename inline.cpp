@@ -0,0 +1,411 @@
+#include "ir.hpp"
+#include "opt.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Inlining of direct calls to the functions defined in the module. The
+// call graph is split into strongly connected components, which are
+// visited bottom-up, callees before callers, so a function has already had
+// its own calls inlined when it's considered for inlining into its
+// callers. Calls within a component are recursive and never inlined.
+//
+// The body of the callee is copied into the caller in place of the call,
+// with its registers, slots and blocks renumbered, its parameters replaced
+// by copies of the arguments and its returns by jumps to the rest of the
+// calling block. A value returned from more than one place goes through a
+// new slot, for the later passes to keep in a register.
+//
+// A module compiled a function at a time has its functions inlined as
+// they're lowered, only into those after them, from copies kept of the
+// functions small enough to be inlined anywhere. There being no call graph
+// of the whole module, a call is recursive if the callee calls the caller
+// back by name, directly or through the copies kept.
+
+namespace
+{
+
+// The cost of a call itself, not paid for an inlined body: the call, the
+// return and the spills around it
+const int call_cost = 8;
+// Saved for each constant argument, which constant propagation can then
+// fold into the body
+const int constant_bonus = 6;
+// Callers aren't grown past this many instructions
+const int max_caller = 4000;
+// With a profile, calls run at least this fraction as often as the hottest
+// block of the module are hot, and allowed as much as calls in loops.
+// Calls never run aren't inlined.
+const long hot_fraction = 100;
+
+class Inliner {
+public:
+    // The calls to @funcs are inlined
+    Inliner(std::unordered_map<std::string, IRFunction *> &funcs,
+            const OptOptions &opts) : funcs(funcs), opts(opts) {}
+    InlineStats run(IRModule &m);
+    InlineStats run(IRFunction &f) {
+        inline_calls(f);
+        return st;
+    }
+
+private:
+    std::unordered_map<std::string, IRFunction *> &funcs;
+    const OptOptions &opts;
+    // None for a function inlining those before it only, whose cycles
+    // through them are found by following their calls instead
+    std::unordered_map<const IRFunction *, int> component;
+    // Whether each of @funcs calls the function being inlined into, for
+    // one inlining those before it
+    std::unordered_map<const IRFunction *, bool> calls_back;
+    long hottest = 0;
+    InlineStats st;
+
+    void find_components(IRModule &m);
+    bool calls(const IRFunction &g, const std::string &name);
+    void inline_calls(IRFunction &f);
+    const char *reject(const IRFunction &f, const IRInstr &call,
+                       const IRFunction &g);
+    int cost(const IRInstr &call, const IRFunction &g,
+             const std::vector<char> &is_const) const;
+    IRBlock *expand(IRFunction &f, size_t at, size_t k, const IRFunction &g,
+                    std::unordered_map<std::string, std::string> &strings);
+};
+
+int size_of(const IRFunction &f) {
+    int n = 0;
+    for (auto &b: f.blocks) n += b->instrs.size();
+    return n;
+}
+
+std::unique_ptr<IRFunction> copy_function(const IRFunction &f) {
+    auto copy = std::make_unique<IRFunction>(f.name, f.type);
+    copy->slots = f.slots;
+    copy->strings = f.strings;
+    copy->nregs = f.nregs;
+    std::unordered_map<const IRBlock *, IRBlock *> copies;
+    for (auto &b: f.blocks) {
+        auto nb = copy->new_block();
+        nb->id = b->id;
+        nb->loop_depth = b->loop_depth;
+        nb->count = b->count;
+        nb->instrs = b->instrs;
+        copies[b.get()] = nb;
+    }
+    for (auto &b: copy->blocks) {
+        for (auto &i: b->instrs) {
+            for (auto &t: i.targets) t = copies[t];
+        }
+    }
+    return copy;
+}
+
+// Number the strongly connected components of the call graph with
+// Tarjan's algorithm, which finishes them callees first
+void Inliner::find_components(IRModule &m) {
+    std::unordered_map<const IRFunction *, int> index, low;
+    std::vector<IRFunction *> stack;
+    std::vector<char> on_stack(m.funcs.size());
+    std::unordered_map<const IRFunction *, size_t> position;
+    for (size_t k = 0; k < m.funcs.size(); k++)
+        position[m.funcs[k].get()] = k;
+    int counter = 0, ncomponents = 0;
+    std::function<void(IRFunction *)> visit = [&](IRFunction *f) {
+        index[f] = low[f] = counter++;
+        stack.push_back(f);
+        on_stack[position[f]] = true;
+        for (auto &b: f->blocks) {
+            for (auto &i: b->instrs) {
+                if (i.op != IR_CALL || i.sym.empty()) continue;
+                auto it = funcs.find(i.sym);
+                if (it == funcs.end()) continue;
+                auto g = it->second;
+                if (!index.count(g)) {
+                    visit(g);
+                    low[f] = std::min(low[f], low[g]);
+                } else if (on_stack[position[g]]) {
+                    low[f] = std::min(low[f], index[g]);
+                }
+            }
+        }
+        if (low[f] != index[f]) return;
+        IRFunction *g;
+        do {
+            g = stack.back();
+            stack.pop_back();
+            on_stack[position[g]] = false;
+            component[g] = ncomponents;
+        } while (g != f);
+        ncomponents++;
+    };
+    for (auto &f: m.funcs) {
+        if (!index.count(f.get())) visit(f.get());
+    }
+}
+
+// Whether @g calls the function named @name, directly or through those of
+// @funcs it calls
+bool Inliner::calls(const IRFunction &g, const std::string &name) {
+    auto it = calls_back.find(&g);
+    if (it != calls_back.end()) return it->second;
+    // While it's looked through, for the cycles among them
+    calls_back[&g] = false;
+    for (auto &b: g.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op != IR_CALL || i.sym.empty()) continue;
+            auto callee = funcs.find(i.sym);
+            if (i.sym == name ||
+                (callee != funcs.end() && calls(*callee->second, name)))
+                return calls_back[&g] = true;
+        }
+    }
+    return false;
+}
+
+// Why the call @call in @f to @g can't be inlined at all, or NULL
+const char *Inliner::reject(const IRFunction &f, const IRInstr &call,
+                            const IRFunction &g) {
+    if (component.empty() && calls(g, f.name)) {
+        // Those found not to may have been cut short by a cycle through
+        // one that does
+        for (auto it = calls_back.begin(); it != calls_back.end();) {
+            if (it->second) ++it;
+            else it = calls_back.erase(it);
+        }
+        return "recursive";
+    }
+    if (!component.empty() && component.at(&f) == component.at(&g))
+        return "recursive";
+    if (g.type->is_variadic) return "variadic";
+    if (call.args.size() != g.type->params.size())
+        return "wrong number of arguments";
+    for (auto &b: g.blocks) {
+        if (!b->is_terminated()) return "unterminated block";
+    }
+    return NULL;
+}
+
+// What inlining @g at @call adds to the caller, less what it saves, given
+// which registers of the caller hold constants
+int Inliner::cost(const IRInstr &call, const IRFunction &g,
+                  const std::vector<char> &is_const) const {
+    int n = size_of(g) - call_cost;
+    for (int a: call.args) {
+        if (is_const[a]) n -= constant_bonus;
+    }
+    return n;
+}
+
+// Copy the body of @g over the call at instruction @k of block @at in @f,
+// returning the block with the instructions after the call. The string
+// literals of @g are given copies in @f, named in @strings.
+IRBlock *Inliner::expand(
+        IRFunction &f, size_t at, size_t k, const IRFunction &g,
+        std::unordered_map<std::string, std::string> &strings) {
+    auto b = f.blocks[at].get();
+    IRInstr call = std::move(b->instrs[k]);
+    int reg = f.nregs, slot = f.slots.size();
+    f.nregs += g.nregs;
+    f.slots.insert(f.slots.end(), g.slots.begin(), g.slots.end());
+
+    // The blocks of @g, then the rest of @b, go right after @b. Their
+    // counts are those of @g scaled to the call.
+    std::vector<std::unique_ptr<IRBlock>> added;
+    std::unordered_map<const IRBlock *, IRBlock *> copies;
+    long calls = g.blocks[0]->count;
+    for (auto &gb: g.blocks) {
+        added.emplace_back(std::make_unique<IRBlock>(0));
+        added.back()->loop_depth = gb->loop_depth + b->loop_depth;
+        if (b->count >= 0 && gb->count >= 0 && calls > 0)
+            added.back()->count = (double)gb->count * b->count / calls;
+        copies[gb.get()] = added.back().get();
+    }
+    added.emplace_back(std::make_unique<IRBlock>(0));
+    auto cont = added.back().get();
+    cont->loop_depth = b->loop_depth;
+    cont->count = b->count;
+    cont->instrs.assign(std::make_move_iterator(b->instrs.begin() + k + 1),
+                        std::make_move_iterator(b->instrs.end()));
+    b->instrs.erase(b->instrs.begin() + k, b->instrs.end());
+    IRInstr enter(IR_JMP);
+    enter.targets = {copies[g.blocks[0].get()]};
+    b->instrs.push_back(std::move(enter));
+
+    int nrets = 0;
+    for (auto &gb: g.blocks) nrets += gb->terminator().op == IR_RET;
+    int result = -1;
+    if (call.dst >= 0 && nrets > 1) result = f.new_slot(8, 8);
+
+    for (auto &gb: g.blocks) {
+        auto nb = copies[gb.get()];
+        for (auto &gi: gb->instrs) {
+            IRInstr i = gi;
+            if (i.dst >= 0) i.dst += reg;
+            for (auto &a: i.args) a += reg;
+            for (auto &t: i.targets) t = copies[t];
+            if (i.op == IR_LOCAL) i.imm += slot;
+            if (i.op == IR_GLOBAL && strings.count(i.sym))
+                i.sym = strings[i.sym];
+            if (i.op == IR_PARAM) {
+                int arg = call.args[i.imm];
+                i = IRInstr(IR_COPY);
+                i.dst = gi.dst + reg;
+                i.args = {arg};
+            }
+            if (i.op != IR_RET) {
+                nb->instrs.push_back(std::move(i));
+                continue;
+            }
+            // A return hands its value over and goes on after the call
+            int v = -1;
+            if (call.dst >= 0 && !i.args.empty()) {
+                v = i.args[0];
+            } else if (call.dst >= 0) {
+                IRInstr zero(IR_CONST);
+                zero.dst = v = f.new_reg();
+                nb->instrs.push_back(std::move(zero));
+            }
+            if (result >= 0) {
+                IRInstr addr(IR_LOCAL);
+                addr.dst = f.new_reg();
+                addr.imm = result;
+                IRInstr store(IR_STORE);
+                store.args = {addr.dst, v};
+                nb->instrs.push_back(std::move(addr));
+                nb->instrs.push_back(std::move(store));
+            } else if (v >= 0) {
+                IRInstr copy(IR_COPY);
+                copy.dst = call.dst;
+                copy.args = {v};
+                nb->instrs.push_back(std::move(copy));
+            }
+            IRInstr jmp(IR_JMP);
+            jmp.targets = {cont};
+            nb->instrs.push_back(std::move(jmp));
+        }
+    }
+    if (result >= 0) {
+        IRInstr addr(IR_LOCAL);
+        addr.dst = f.new_reg();
+        addr.imm = result;
+        IRInstr load(IR_LOAD);
+        load.dst = call.dst;
+        load.args = {addr.dst};
+        cont->instrs.insert(cont->instrs.begin(), std::move(load));
+        cont->instrs.insert(cont->instrs.begin(), std::move(addr));
+    }
+    f.blocks.insert(f.blocks.begin() + at + 1,
+                    std::make_move_iterator(added.begin()),
+                    std::make_move_iterator(added.end()));
+    return cont;
+}
+
+void Inliner::inline_calls(IRFunction &f) {
+    std::unordered_map<std::string, std::string> strings;
+    int size = size_of(f);
+    // Only the blocks of @f as it was are looked through; the calls left
+    // in the bodies inlined were already turned down for their callers
+    std::vector<IRBlock *> work;
+    for (auto &b: f.blocks) work.push_back(b.get());
+    std::reverse(work.begin(), work.end());
+    while (!work.empty()) {
+        auto b = work.back();
+        work.pop_back();
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            auto &call = b->instrs[k];
+            if (call.op != IR_CALL || call.sym.empty()) continue;
+            auto it = funcs.find(call.sym);
+            if (it == funcs.end()) continue;
+            auto &g = *it->second;
+            int limit = opts.inline_limit * (1 + std::min(b->loop_depth, 2));
+            if (b->count > 0 && b->count >= hottest / hot_fraction)
+                limit = opts.inline_limit * 3;
+            int n = 0;
+            const char *why = reject(f, call, g);
+            if (!why && b->count == 0) why = "never run";
+            if (!why) {
+                std::vector<char> is_const(f.nregs);
+                for (auto &fb: f.blocks) {
+                    for (auto &i: fb->instrs) {
+                        if (i.op == IR_CONST) is_const[i.dst] = true;
+                    }
+                }
+                n = cost(call, g, is_const);
+                if (n > limit)
+                    why = "too large";
+                else if (size + n > max_caller)
+                    why = "caller too large";
+            }
+            if (opts.inline_report) {
+                fprintf(stderr, "%s: %s %s", f.name.c_str(),
+                        why ? "not inlined" : "inlined", g.name.c_str());
+                if (!why || n > limit)
+                    fprintf(stderr, " (cost %d, limit %d)", n, limit);
+                if (why) fprintf(stderr, ": %s", why);
+                fprintf(stderr, "\n");
+            }
+            if (why) {
+                st.rejected++;
+                continue;
+            }
+            for (auto &s: g.strings) {
+                if (strings.count(s.name)) continue;
+                strings[s.name] = s.name + "." + f.name;
+                f.strings.push_back(s);
+                f.strings.back().name = strings[s.name];
+            }
+            size_t at = 0;
+            while (f.blocks[at].get() != b) at++;
+            work.push_back(expand(f, at, k, g, strings));
+            size += n;
+            st.inlined++;
+            break;
+        }
+    }
+    for (size_t k = 0; k < f.blocks.size(); k++) f.blocks[k]->id = k;
+}
+
+InlineStats Inliner::run(IRModule &m) {
+    for (auto &f: m.funcs) {
+        funcs[f->name] = f.get();
+        for (auto &b: f->blocks) hottest = std::max(hottest, b->count);
+    }
+    find_components(m);
+    std::vector<IRFunction *> order;
+    for (auto &f: m.funcs) order.push_back(f.get());
+    std::stable_sort(order.begin(), order.end(),
+                     [&](IRFunction *a, IRFunction *b) {
+                         return component[a] < component[b];
+                     });
+    for (auto f: order) inline_calls(*f);
+    return st;
+}
+
+}
+
+InlineStats inline_functions(IRModule &m, const OptOptions &opts) {
+    if (!opts.inline_functions) return InlineStats();
+    std::unordered_map<std::string, IRFunction *> funcs;
+    return Inliner(funcs, opts).run(m);
+}
+
+InlineStats inline_earlier(IRFunction &f, EarlierFunctions &earlier,
+                           const OptOptions &opts) {
+    if (!opts.inline_functions) return InlineStats();
+    auto st = Inliner(earlier.by_name, opts).run(f);
+    // The most a call could save is its own cost and the bonus for each
+    // argument being constant, and the most it's allowed is three times
+    // the limit, in loops
+    int saved = call_cost + constant_bonus * f.type->params.size();
+    if (!f.type->is_variadic &&
+        size_of(f) - saved <= opts.inline_limit * 3) {
+        earlier.funcs.push_back(copy_function(f));
+        earlier.by_name[f.name] = earlier.funcs.back().get();
+    }
+    return st;
+}
@@ -0,0 +1,82 @@
+#include "interp.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include <vector>
+
+Runtime::Runtime(IRModule &m) : module(m) {
+    std::vector<const IRGlobal *> globals;
+    for (auto &g: m.globals) globals.push_back(&g);
+    for (auto &f: m.funcs) {
+        for (auto &s: f->strings) globals.push_back(&s);
+    }
+    std::vector<long> offsets;
+    long size = 0;
+    for (auto g: globals) {
+        size = align_to(size, g->align);
+        offsets.push_back(size);
+        size += g->size;
+    }
+    // Never freed, the program may use its globals until it exits
+    char *data = (char *)calloc(1, std::max(size, 1L));
+    if (!data) {
+        perror("mycc: calloc");
+        exit(1);
+    }
+    for (size_t k = 0; k < globals.size(); k++) {
+        auto &g = *globals[k];
+        memcpy(data + offsets[k], g.data.data(), g.data.size());
+        symbols[g.name] = data + offsets[k];
+    }
+}
+
+void Runtime::define_function(const std::string &name, void *addr) {
+    symbols[name] = addr;
+}
+
+bool Runtime::link() {
+    bool ok = true;
+    auto relocate = [&](const IRGlobal &g) {
+        char *base = (char *)symbols[g.name];
+        for (auto &r: g.relocs) {
+            void *addr = address(r.sym);
+            if (!addr) {
+                ok = false;
+                continue;
+            }
+            long v = (long)addr + r.addend;
+            memcpy(base + r.offset, &v, 8);
+        }
+    };
+    for (auto &g: module.globals) relocate(g);
+    for (auto &f: module.funcs) {
+        for (auto &s: f->strings) relocate(s);
+    }
+    return ok;
+}
+
+void *Runtime::address(const std::string &sym) {
+    auto it = symbols.find(sym);
+    if (it != symbols.end()) return it->second;
+    void *addr = dlsym(RTLD_DEFAULT, sym.c_str());
+    if (!addr) {
+        fprintf(stderr, "mycc: undefined reference to '%s'\n", sym.c_str());
+        return NULL;
+    }
+    symbols[sym] = addr;
+    return addr;
+}
+
+long call_native(void *fn, const long *args, int nargs) {
+    long a[MAX_NATIVE_ARGS] = {};
+    std::copy(args, args + nargs, a);
+    // Calling through a variadic type sets %al as variadic functions need,
+    // and the unused arguments don't bother the others
+    auto f = (long (*)(...))fn;
+    return f(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9],
+             a[10], a[11]);
+}
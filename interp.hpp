@@ -0,0 +1,51 @@
+#ifndef INTERP_HPP
+#define INTERP_HPP
+#include "ir.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+class ExtDeclAST;
+
+// The interpreters run a program without going through the native backend.
+// run_bytecode() compiles the IR of each function to a compact register
+// based bytecode, which is executed by a threaded interpreter.
+// evaluate_program() walks the syntax tree instead. It's a deliberately
+// naive baseline to measure the bytecode against.
+//
+// Both work on the memory of the process: globals, locals and pointers are
+// real addresses, so the program can call the C library directly. The
+// address of an interpreted function is a handle only the interpreter
+// understands, so it can't be passed to native code as a callback.
+
+// The globals and string literals of a module, laid out in memory with
+// their initializers, and the symbols the program refers to.
+class Runtime {
+public:
+    Runtime(IRModule &m);
+    // Give the interpreted function @name the address @addr
+    void define_function(const std::string &name, void *addr);
+    // Fill in the addresses in the initializers of the globals, after the
+    // functions are defined. Returns false if a symbol is undefined.
+    bool link();
+    // The address of @sym, looking in the process if it isn't part of the
+    // program. Reports an error and returns NULL if there's no such symbol.
+    void *address(const std::string &sym);
+private:
+    IRModule &module;
+    std::unordered_map<std::string, void *> symbols;
+};
+
+// Call the native function at @fn with @nargs integer arguments
+const int MAX_NATIVE_ARGS = 12;
+long call_native(void *fn, const long *args, int nargs);
+
+// Run main() of @m with @argc and @argv, returning its exit status.
+// @stats prints the size of the bytecode to stderr.
+int run_bytecode(IRModule &m, bool stats, int argc, char **argv);
+// Same for the program @decls, which must have been lowered into @m
+// without errors before, as the evaluator takes the initialized data from
+// there and doesn't diagnose errors.
+int evaluate_program(std::vector<std::unique_ptr<ExtDeclAST>> &decls,
+                     IRModule &m, int argc, char **argv);
+#endif
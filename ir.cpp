@@ -0,0 +1,134 @@
+#include "ir.hpp"
+#include <cstdio>
+
+namespace
+{
+
+const char *const op_names[] = {
+    "const", "copy", "param",
+    "add", "sub", "mul", "div", "udiv", "mod", "umod",
+    "and", "or", "xor", "shl", "shr", "sar",
+    "eq", "ne", "lt", "le", "gt", "ge", "ult", "ule", "ugt", "uge",
+    "neg", "not", "sext", "zext", "select",
+    "local", "global", "load", "store", "call", "phi",
+    "vload", "vstore", "vsplat", "vadd", "vsub", "vmul", "vand", "vor",
+    "vxor", "vreduce",
+    "jmp", "br", "switch", "ret",
+};
+
+}
+
+long extend(long v, int size, bool is_signed) {
+    switch (size) {
+    case 1: return is_signed ? (long)(signed char)v : (long)(unsigned char)v;
+    case 2: return is_signed ? (long)(short)v : (long)(unsigned short)v;
+    case 4: return is_signed ? (long)(int)v : (long)(unsigned)v;
+    default: return v;
+    }
+}
+
+bool is_comparison(IROp op) {
+    return op >= IR_EQ && op <= IR_UGE;
+}
+
+IROp swap_comparison(IROp op) {
+    switch (op) {
+    case IR_LT:  return IR_GT;
+    case IR_LE:  return IR_GE;
+    case IR_GT:  return IR_LT;
+    case IR_GE:  return IR_LE;
+    case IR_ULT: return IR_UGT;
+    case IR_ULE: return IR_UGE;
+    case IR_UGT: return IR_ULT;
+    case IR_UGE: return IR_ULE;
+    default:     return op;
+    }
+}
+
+bool IRInstr::has_side_effects() const {
+    switch (op) {
+    case IR_STORE:
+    case IR_VSTORE:
+    case IR_CALL:
+        return true;
+    // Division traps on a zero divisor, but that is undefined behavior, so
+    // we're free to drop it.
+    default:
+        return is_terminator();
+    }
+}
+
+void IRInstr::print(FILE *out) const {
+    fprintf(out, "    ");
+    if (dst >= 0) fprintf(out, "%%%d = ", dst);
+    if (is_tail) fprintf(out, "tail ");
+    fprintf(out, "%s", op_names[op]);
+    // Vectors as <lane bits>x<lanes>
+    if (width) {
+        fprintf(out, "%dx%d", size * 8, width / size);
+        if (op == IR_VREDUCE) fprintf(out, " %s,", op_names[imm]);
+    }
+    switch (op) {
+    case IR_SEXT:
+    case IR_ZEXT:
+    case IR_LOAD:
+    case IR_STORE:
+        fprintf(out, "%d", size * 8);
+        break;
+    default:
+        break;
+    }
+    const char *sep = " ";
+    if (op == IR_CONST || op == IR_PARAM || op == IR_LOCAL) {
+        fprintf(out, "%s%ld", sep, imm);
+        sep = ", ";
+    }
+    if (!sym.empty()) {
+        fprintf(out, "%s@%s", sep, sym.c_str());
+        sep = ", ";
+    }
+    if (op == IR_PHI) {
+        // Each argument with the block it comes from
+        for (size_t k = 0; k < args.size(); k++)
+            fprintf(out, "%s[%%%d, .%d]", k ? ", " : " ", args[k],
+                    targets[k]->id);
+        fprintf(out, "\n");
+        return;
+    }
+    for (int a: args) {
+        fprintf(out, "%s%%%d", sep, a);
+        sep = ", ";
+    }
+    if (op == IR_SWITCH) {
+        fprintf(out, "%sdefault .%d", sep, targets[0]->id);
+        for (size_t i = 0; i < cases.size(); i++)
+            fprintf(out, ", %ld .%d", cases[i], targets[i + 1]->id);
+    } else {
+        for (auto *b: targets) {
+            fprintf(out, "%s.%d", sep, b->id);
+            sep = ", ";
+        }
+    }
+    fprintf(out, "\n");
+}
+
+void IRFunction::print(FILE *out) const {
+    fprintf(out, "func %s {\n", name.c_str());
+    for (size_t i = 0; i < slots.size(); i++)
+        fprintf(out, "  slot %zu: size %ld, align %d\n",
+                i, slots[i].size, slots[i].align);
+    for (auto &b: blocks) {
+        fprintf(out, ".%d:", b->id);
+        if (b->loop_depth) fprintf(out, "  ; loop depth %d", b->loop_depth);
+        if (b->count >= 0) fprintf(out, "  ; count %ld", b->count);
+        fprintf(out, "\n");
+        for (auto &i: b->instrs) i.print(out);
+    }
+    fprintf(out, "}\n");
+}
+
+void IRModule::print(FILE *out) const {
+    for (auto &g: globals)
+        fprintf(out, "global %s: size %ld\n", g.name.c_str(), g.size);
+    for (auto &f: funcs) f->print(out);
+}
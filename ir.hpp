@@ -0,0 +1,202 @@
+#ifndef IR_HPP
+#define IR_HPP
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+class Type;
+class IRBlock;
+
+// The IR is a conventional three-address code over an unbounded set of
+// virtual registers, organized into basic blocks. Every register holds a
+// 64-bit integer or pointer. Values narrower than that are kept normalized,
+// i.e. sign- or zero-extended according to their C type, so the lowering
+// emits an explicit IR_SEXT or IR_ZEXT wherever a result may leave the
+// range of its type.
+//
+// The vector instructions added by the vectorizer work on registers holding
+// a vector of @width bytes instead, in lanes of @size bytes. Only the
+// native backends have them.
+//
+// Registers are only ever assigned by one instruction. Local variables live
+// in frame slots and are accessed through IR_LOCAL/IR_LOAD/IR_STORE, until
+// the last of the optimizations makes registers of those whose address
+// doesn't escape. The optimizations may add phis for the values they carry
+// around loops and for those variables, which are replaced by copies before
+// the IR leaves them, so the backends never see any; the copies assign the
+// registers standing for the phis at the end of each predecessor.
+
+enum IROp {
+    IR_CONST,   // dst = imm
+    IR_COPY,    // dst = args[0]
+    IR_PARAM,   // dst = incoming parameter #imm
+    // Arithmetic, dst = args[0] op args[1]
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_UDIV,
+    IR_MOD,
+    IR_UMOD,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_SHL,
+    IR_SHR,
+    IR_SAR,
+    // Comparisons, dst = args[0] op args[1] ? 1 : 0
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_ULT,
+    IR_ULE,
+    IR_UGT,
+    IR_UGE,
+    // Unary, dst = op args[0]
+    IR_NEG,
+    IR_NOT,
+    IR_SEXT,    // sign extend the low @size bytes
+    IR_ZEXT,    // zero extend the low @size bytes
+    // dst = args[0] ? args[1] : args[2], both arms already computed
+    IR_SELECT,
+    // Memory
+    IR_LOCAL,   // dst = address of frame slot #imm
+    IR_GLOBAL,  // dst = address of @sym
+    IR_LOAD,    // dst = *args[0], @size bytes, extended per @is_signed
+    IR_STORE,   // *args[0] = args[1], @size bytes
+    // dst = call @sym(args...) if @sym is set, else args[0](args[1...]).
+    // @dst is -1 if the result is unused or void.
+    IR_CALL,
+    // dst = args[k] when entered from targets[k]. Phis come first in their
+    // block, with one argument for each predecessor.
+    IR_PHI,
+    // Vectors. Copies and phis with a @width move vectors as well.
+    IR_VLOAD,    // dst = the vector at args[0]
+    IR_VSTORE,   // the vector at args[0] = args[1]
+    IR_VSPLAT,   // dst = args[0] in every lane
+    // Arithmetic lane by lane, dst = args[0] op args[1]
+    IR_VADD,
+    IR_VSUB,
+    IR_VMUL,
+    IR_VAND,
+    IR_VOR,
+    IR_VXOR,
+    // dst = the lanes of args[0] combined with the operation @imm, one of
+    // IR_ADD, IR_OR or IR_XOR, extended from @size bytes per @is_signed
+    IR_VREDUCE,
+    // Terminators
+    IR_JMP,     // goto targets[0]
+    IR_BR,      // if args[0] goto targets[0] else goto targets[1]
+    IR_SWITCH,  // jump to targets[i+1] if args[0] == cases[i], else targets[0]
+    IR_RET,     // return args[0], if any
+};
+
+// The low @size bytes of @v, extended as a load of them would be
+long extend(long v, int size, bool is_signed);
+bool is_comparison(IROp op);
+// The comparison giving the same result with the operands swapped
+IROp swap_comparison(IROp op);
+
+struct IRInstr {
+    IROp op;
+    int dst = -1;
+    std::vector<int> args;
+    long imm = 0;
+    int size = 8;
+    bool is_signed = true;
+    bool is_variadic = false;  // IR_CALL: callee takes "..."
+    // IR_CALL: followed by a return of its result, made by leaving the
+    // frame and jumping to the callee
+    bool is_tail = false;
+    int width = 0;             // bytes in a vector, 0 for scalars
+    std::string sym;
+    std::vector<IRBlock *> targets;
+    std::vector<long> cases;
+
+    IRInstr(IROp op) : op(op) {}
+    bool is_terminator() const { return op >= IR_JMP; }
+    bool is_vector() const { return width > 0; }
+    // Whether the instruction can be removed when its result is unused
+    bool has_side_effects() const;
+    void print(FILE *out) const;
+};
+
+class IRBlock {
+public:
+    int id;
+    std::vector<IRInstr> instrs;
+    // Number of loops enclosing the block, used to weigh spill costs
+    int loop_depth = 0;
+    // Times the block ran in the runs profiled, as read with
+    // -fprofile-use, or -1 without a profile
+    long count = -1;
+
+    IRBlock(int id) : id(id) {}
+    IRInstr &terminator() { return instrs.back(); }
+    bool is_terminated() const {
+        return !instrs.empty() && instrs.back().is_terminator();
+    }
+    bool has_phis() const {
+        return !instrs.empty() && instrs[0].op == IR_PHI;
+    }
+};
+
+// Initialized data. Bytes not covered by a relocation are stored in @data;
+// each relocation adds the address of @sym + @addend at @offset.
+struct IRGlobal {
+    struct Reloc {
+        long offset;
+        std::string sym;
+        long addend;
+    };
+    std::string name;
+    long size;
+    int align;
+    bool is_static = false;  // local symbol, not visible to the linker
+    bool is_string = false;  // string literal, placed in .rodata
+    bool is_zero = true;     // no initializer, placed in .bss
+    std::string data;
+    std::vector<Reloc> relocs;
+};
+
+struct IRSlot {
+    long size;
+    int align;
+};
+
+class IRFunction {
+public:
+    std::string name;
+    const Type *type;
+    std::vector<std::unique_ptr<IRBlock>> blocks;
+    std::vector<IRSlot> slots;
+    // String literals referenced by the function. They're emitted along with
+    // it so each function's output only depends on its own source.
+    std::vector<IRGlobal> strings;
+    int nregs = 0;
+
+    IRFunction(std::string name, const Type *type)
+        : name(std::move(name)), type(type) {}
+    int new_reg() { return nregs++; }
+    int new_slot(long size, int align) {
+        slots.push_back({size, align});
+        return slots.size() - 1;
+    }
+    IRBlock *new_block() {
+        blocks.emplace_back(std::make_unique<IRBlock>(blocks.size()));
+        return blocks.back().get();
+    }
+    IRBlock *entry() { return blocks[0].get(); }
+    void print(FILE *out) const;
+};
+
+class IRModule {
+public:
+    std::vector<std::unique_ptr<IRFunction>> funcs;
+    std::vector<IRGlobal> globals;
+    void print(FILE *out) const;
+};
+#endif
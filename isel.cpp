@@ -0,0 +1,531 @@
+#include "codegen.hpp"
+#include "ir.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+CondCode cond_code(IROp op) {
+    switch (op) {
+    case IR_EQ:  return CC_E;
+    case IR_NE:  return CC_NE;
+    case IR_LT:  return CC_L;
+    case IR_LE:  return CC_LE;
+    case IR_GT:  return CC_G;
+    case IR_GE:  return CC_GE;
+    case IR_ULT: return CC_B;
+    case IR_ULE: return CC_BE;
+    case IR_UGT: return CC_A;
+    default:     return CC_AE;
+    }
+}
+
+long mul(long a, long b) { return (unsigned long)a * (unsigned long)b; }
+
+class ISel {
+public:
+    ISel(IRFunction &f) : f(f), mf(std::make_unique<MFunction>()) {}
+    std::unique_ptr<MFunction> run();
+private:
+    IRFunction &f;
+    std::unique_ptr<MFunction> mf;
+    MBlock *mb = NULL;
+    // The defining instruction of each IR register, and the number of uses
+    std::vector<const IRInstr *> defs;
+    std::vector<int> nuses;
+    std::vector<bool> used_by_branch;
+
+    static int vreg(int r) { return FIRST_VREG + r; }
+    const IRInstr *def(int r) { return defs[r]; }
+    bool is_const(int r, long &v) {
+        if (!defs[r] || defs[r]->op != IR_CONST) return false;
+        v = defs[r]->imm;
+        return true;
+    }
+
+    MInstr &emit(MOpcode op, int size = 8) {
+        mb->instrs.emplace_back(op, size);
+        return mb->instrs.back();
+    }
+    void emit2(MOpcode op, MOperand src, MOperand dst, int size = 8) {
+        emit(op, size).ops = {src, dst};
+    }
+    void emit_mov(MOperand src, MOperand dst, int size = 8) {
+        emit2(M_MOV, src, dst, size);
+    }
+    MOperand reg(int r) { return MOperand::make_reg(r); }
+    // An operand holding the value of IR register @r. Constants are mate-
+    // rialized where they're used, unless they can be an immediate.
+    MOperand value(int r, bool allow_imm);
+    // A memory operand addressing the object at the address in @r
+    MOperand address(int r);
+    void select(const IRInstr &i);
+    void select_binary(const IRInstr &i, MOpcode op);
+    void select_div(const IRInstr &i);
+    void select_shift(const IRInstr &i, MOpcode op);
+    void select_call(const IRInstr &i);
+    void select_br(const IRInstr &i);
+    void select_cmov(const IRInstr &i);
+    void select_splat(const IRInstr &i);
+    void select_reduce(const IRInstr &i);
+    void compare(const IRInstr &cmp);
+    void remove_dead_defs();
+};
+
+MOperand ISel::value(int r, bool allow_imm) {
+    long v;
+    if (is_const(r, v)) {
+        if (allow_imm && fits_int(v)) return MOperand::make_imm(v);
+        int t = mf->new_vreg();
+        emit_mov(MOperand::make_imm(v), reg(t));
+        return reg(t);
+    }
+    return reg(vreg(r));
+}
+
+MOperand ISel::address(int r) {
+    auto d = def(r);
+    long disp = 0;
+    if (d && d->op == IR_ADD && is_const(d->args[1], disp) &&
+        fits_int(disp)) {
+        r = d->args[0];
+        d = def(r);
+    } else {
+        disp = 0;
+    }
+    MOperand m;
+    if (d && d->op == IR_LOCAL) {
+        m = MOperand::make_slot(d->imm);
+    } else if (d && d->op == IR_GLOBAL) {
+        m = MOperand::make_rip(d->sym);
+    } else {
+        m = MOperand::make_mem(value(r, false).reg, 0);
+    }
+    m.imm += disp;
+    return m;
+}
+
+std::unique_ptr<MFunction> ISel::run() {
+    mf->name = f.name;
+    mf->nvregs = f.nregs;
+    mf->widths.assign(f.nregs, 0);
+    for (auto &s: f.slots) mf->new_slot(s.size, s.align);
+    defs.assign(f.nregs, NULL);
+    nuses.assign(f.nregs, 0);
+    used_by_branch.assign(f.nregs, false);
+    for (auto &b: f.blocks) {
+        mf->new_block()->loop_depth = b->loop_depth;
+        for (auto &i: b->instrs) {
+            if (i.dst >= 0) defs[i.dst] = &i;
+            if (i.dst >= 0 && i.op != IR_VREDUCE)
+                mf->widths[i.dst] = i.width;
+            for (int a: i.args) nuses[a]++;
+            if (i.op == IR_BR || i.op == IR_SELECT)
+                used_by_branch[i.args[0]] = true;
+        }
+    }
+    for (auto &b: f.blocks) {
+        mb = mf->blocks[b->id].get();
+        for (auto &i: b->instrs) select(i);
+    }
+    remove_dead_defs();
+    for (auto &b: mf->blocks) {
+        for (auto &i: b->instrs) {
+            if (i.is_jump()) b->succs.push_back(i.ops[0].block);
+        }
+    }
+    return std::move(mf);
+}
+
+// Addresses folded into memory operands leave their IR_LOCAL and IR_GLOBAL
+// behind, and direct calls leave the address of the callee. Remove the moves
+// that compute them.
+void ISel::remove_dead_defs() {
+    std::vector<int> nuses(mf->nvregs), regs;
+    for (auto &b: mf->blocks) {
+        for (auto &i: b->instrs) {
+            regs.clear();
+            i.uses(regs);
+            for (int r: regs) {
+                if (r >= FIRST_VREG) nuses[r - FIRST_VREG]++;
+            }
+        }
+    }
+    for (auto &b: mf->blocks) {
+        auto &v = b->instrs;
+        for (size_t k = v.size(); k-- > 0;) {
+            auto &i = v[k];
+            bool pure = i.op == M_MOV || i.op == M_LEA || i.op == M_MOVSX ||
+                        i.op == M_MOVZX;
+            if (!pure || !i.ops[1].is_vreg() ||
+                nuses[i.ops[1].reg - FIRST_VREG])
+                continue;
+            regs.clear();
+            i.uses(regs);
+            for (int r: regs) {
+                if (r >= FIRST_VREG) nuses[r - FIRST_VREG]--;
+            }
+            v.erase(v.begin() + k);
+        }
+    }
+}
+
+void ISel::select(const IRInstr &i) {
+    auto dst = reg(i.dst >= 0 ? vreg(i.dst) : 0);
+    switch (i.op) {
+    case IR_CONST:
+        break;  // materialized at the uses
+    case IR_COPY:
+        if (i.is_vector())
+            emit2(M_VMOV, reg(vreg(i.args[0])), dst, i.width);
+        else
+            emit_mov(value(i.args[0], true), dst);
+        break;
+    case IR_PARAM:
+        if (i.imm < 6)
+            emit_mov(reg(arg_regs[i.imm]), dst);
+        else
+            emit_mov(MOperand::make_arg(i.imm - 6), dst);
+        break;
+    case IR_ADD: select_binary(i, M_ADD); break;
+    case IR_SUB: select_binary(i, M_SUB); break;
+    case IR_MUL: select_binary(i, M_IMUL); break;
+    case IR_AND: select_binary(i, M_AND); break;
+    case IR_OR:  select_binary(i, M_OR); break;
+    case IR_XOR: select_binary(i, M_XOR); break;
+    case IR_DIV:
+    case IR_UDIV:
+    case IR_MOD:
+    case IR_UMOD:
+        select_div(i);
+        break;
+    case IR_SHL: select_shift(i, M_SHL); break;
+    case IR_SHR: select_shift(i, M_SHR); break;
+    case IR_SAR: select_shift(i, M_SAR); break;
+    case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    case IR_ULT: case IR_ULE: case IR_UGT: case IR_UGE: {
+        // A comparison only used by a branch or a select is folded into it
+        if (nuses[i.dst] == 1 && used_by_branch[i.dst]) break;
+        compare(i);
+        int t = mf->new_vreg();
+        auto &set = emit(M_SETCC, 1);
+        set.cc = cond_code(i.op);
+        set.ops = {reg(t)};
+        auto &ext = emit(M_MOVZX);
+        ext.src_size = 1;
+        ext.ops = {reg(t), dst};
+        break;
+    }
+    case IR_NEG:
+    case IR_NOT:
+        emit_mov(value(i.args[0], true), dst);
+        emit(i.op == IR_NEG ? M_NEG : M_NOT).ops = {dst};
+        break;
+    case IR_SEXT:
+    case IR_ZEXT: {
+        auto src = value(i.args[0], false);
+        if (i.op == IR_ZEXT && i.size == 4) {
+            // Writing a 32-bit register clears the upper half
+            emit_mov(src, dst, 4);
+        } else {
+            auto &ext = emit(i.op == IR_SEXT ? M_MOVSX : M_MOVZX);
+            ext.src_size = i.size;
+            ext.ops = {src, dst};
+        }
+        break;
+    }
+    case IR_SELECT:
+        select_cmov(i);
+        break;
+    case IR_LOCAL:
+        emit2(M_LEA, MOperand::make_slot(i.imm), dst);
+        break;
+    case IR_GLOBAL:
+        emit2(M_LEA, MOperand::make_rip(i.sym), dst);
+        break;
+    case IR_LOAD: {
+        auto src = address(i.args[0]);
+        if (i.size == 8 || (i.size == 4 && !i.is_signed)) {
+            emit_mov(src, dst, i.size);
+        } else {
+            auto &ext = emit(i.is_signed ? M_MOVSX : M_MOVZX);
+            ext.src_size = i.size;
+            ext.ops = {src, dst};
+        }
+        break;
+    }
+    case IR_STORE: {
+        auto dst_mem = address(i.args[0]);
+        long v;
+        MOperand src;
+        if (is_const(i.args[1], v) && fits_int(v)) {
+            if (i.size < 8) v = (long)(v << (64 - i.size * 8)) >>
+                                (64 - i.size * 8);
+            src = MOperand::make_imm(v);
+        } else {
+            src = value(i.args[1], false);
+        }
+        emit_mov(src, dst_mem, i.size);
+        break;
+    }
+    case IR_CALL:
+        select_call(i);
+        break;
+    case IR_PHI:
+        break;  // replaced by copies before the IR gets here
+    case IR_VLOAD:
+        emit2(M_VMOV, address(i.args[0]), dst, i.width);
+        break;
+    case IR_VSTORE:
+        emit2(M_VMOV, reg(vreg(i.args[1])), address(i.args[0]), i.width);
+        break;
+    case IR_VSPLAT:
+        select_splat(i);
+        break;
+    case IR_VADD: case IR_VSUB: case IR_VMUL:
+    case IR_VAND: case IR_VOR: case IR_VXOR: {
+        static const MOpcode ops[] = {
+            M_VADD, M_VSUB, M_VMUL, M_VAND, M_VOR, M_VXOR,
+        };
+        emit2(M_VMOV, reg(vreg(i.args[0])), dst, i.width);
+        auto &op = emit(ops[i.op - IR_VADD], i.width);
+        op.src_size = i.size;
+        op.ops = {reg(vreg(i.args[1])), dst};
+        break;
+    }
+    case IR_VREDUCE:
+        select_reduce(i);
+        break;
+    case IR_JMP:
+        emit(M_JMP).ops = {MOperand::make_block(
+                mf->blocks[i.targets[0]->id].get())};
+        break;
+    case IR_BR:
+        select_br(i);
+        break;
+    case IR_SWITCH: {
+        auto v = value(i.args[0], false);
+        for (size_t k = 0; k < i.cases.size(); k++) {
+            long c = i.cases[k];
+            if (fits_int(c)) {
+                emit2(M_CMP, MOperand::make_imm(c), v);
+            } else {
+                int t = mf->new_vreg();
+                emit_mov(MOperand::make_imm(c), reg(t));
+                emit2(M_CMP, reg(t), v);
+            }
+            auto &j = emit(M_JCC);
+            j.cc = CC_E;
+            j.ops = {MOperand::make_block(
+                    mf->blocks[i.targets[k + 1]->id].get())};
+        }
+        emit(M_JMP).ops = {MOperand::make_block(
+                mf->blocks[i.targets[0]->id].get())};
+        break;
+    }
+    case IR_RET:
+        // The callee returns for us
+        if (!mb->instrs.empty() && mb->instrs.back().op == M_TAILCALL) break;
+        if (!i.args.empty())
+            emit_mov(value(i.args[0], true), reg(RAX));
+        emit(M_RET).nargs = i.args.size();
+        break;
+    }
+}
+
+void ISel::select_binary(const IRInstr &i, MOpcode op) {
+    int a = i.args[0], b = i.args[1];
+    long v;
+    bool commutative = op != M_SUB;
+    // Put a constant operand second so it can be an immediate
+    if (commutative && is_const(a, v) && !is_const(b, v)) std::swap(a, b);
+    auto dst = reg(vreg(i.dst));
+    emit_mov(value(a, true), dst);
+    emit2(op, value(b, true), dst);
+}
+
+void ISel::select_div(const IRInstr &i) {
+    bool is_signed = i.op == IR_DIV || i.op == IR_MOD;
+    emit_mov(value(i.args[0], true), reg(RAX));
+    if (is_signed)
+        emit(M_CQO);
+    else
+        emit2(M_XOR, reg(RDX), reg(RDX), 4);
+    emit(is_signed ? M_IDIV : M_DIV).ops = {value(i.args[1], false)};
+    bool is_mod = i.op == IR_MOD || i.op == IR_UMOD;
+    emit_mov(reg(is_mod ? RDX : RAX), reg(vreg(i.dst)));
+}
+
+void ISel::select_shift(const IRInstr &i, MOpcode op) {
+    auto dst = reg(vreg(i.dst));
+    long v;
+    if (is_const(i.args[1], v)) {
+        emit_mov(value(i.args[0], true), dst);
+        emit2(op, MOperand::make_imm(v & 63), dst);
+    } else {
+        emit_mov(value(i.args[1], false), reg(RCX));
+        emit_mov(value(i.args[0], true), dst);
+        emit2(op, reg(RCX), dst);
+    }
+}
+
+void ISel::select_call(const IRInstr &i) {
+    bool indirect = i.sym.empty();
+    std::vector<int> args(i.args.begin() + indirect, i.args.end());
+    int nstack = args.size() > 6 ? args.size() - 6 : 0;
+    // Stack arguments are pushed right to left, keeping %rsp 16-byte
+    // aligned at the call.
+    if (nstack % 2)
+        emit2(M_SUB, MOperand::make_imm(8), reg(RSP));
+    for (int k = args.size() - 1; k >= 6; k--)
+        emit(M_PUSH).ops = {value(args[k], true)};
+    std::vector<MOperand> vals;
+    for (size_t k = 0; k < args.size() && k < 6; k++)
+        vals.push_back(value(args[k], true));
+    MOperand target = indirect ? value(i.args[0], false)
+                               : MOperand::make_sym(i.sym);
+    for (size_t k = 0; k < vals.size(); k++)
+        emit_mov(vals[k], reg(arg_regs[k]));
+    // %al holds the number of vector registers used by a variadic call
+    if (i.is_variadic)
+        emit_mov(MOperand::make_imm(0), reg(RAX), 4);
+    if (i.is_tail && !indirect && !nstack) {
+        auto &jmp = emit(M_TAILCALL);
+        jmp.ops = {target};
+        jmp.nargs = vals.size();
+        jmp.is_variadic = i.is_variadic;
+        return;
+    }
+    auto &call = emit(M_CALL);
+    call.ops = {target};
+    call.nargs = vals.size();
+    call.is_variadic = i.is_variadic;
+    mf->has_calls = true;
+    if (nstack)
+        emit2(M_ADD, MOperand::make_imm((nstack + nstack % 2) * 8), reg(RSP));
+    if (i.dst >= 0)
+        emit_mov(reg(RAX), reg(vreg(i.dst)));
+}
+
+// Repeat the lanes of @i.size bytes in a general purpose register by
+// multiplying with 0x0101..., move them over and broadcast them. Zero is
+// the usual pxor with itself.
+void ISel::select_splat(const IRInstr &i) {
+    auto dst = reg(vreg(i.dst));
+    long v, ones = i.size == 1 ? 0x0101010101010101L
+                 : i.size == 2 ? 0x0001000100010001L
+                 : i.size == 4 ? 0x0000000100000001L : 1;
+    if (is_const(i.args[0], v) && v == 0) {
+        emit(M_VXOR, i.width).ops = {dst, dst};
+        return;
+    }
+    int t = mf->new_vreg();
+    if (is_const(i.args[0], v)) {
+        if (i.size < 8) v &= (1L << i.size * 8) - 1;
+        emit_mov(MOperand::make_imm(mul(v, ones)), reg(t));
+    } else {
+        auto src = value(i.args[0], false);
+        if (i.size == 4) {
+            emit_mov(src, reg(t), 4);
+        } else if (i.size < 4) {
+            auto &ext = emit(M_MOVZX);
+            ext.src_size = i.size;
+            ext.ops = {src, reg(t)};
+        } else {
+            emit_mov(src, reg(t));
+        }
+        if (i.size < 8) {
+            int k = mf->new_vreg();
+            emit_mov(MOperand::make_imm(ones), reg(k));
+            emit2(M_IMUL, reg(k), reg(t));
+        }
+    }
+    emit2(M_MOVQ, reg(t), dst, i.width);
+    emit(M_VBCAST, i.width).ops = {dst};
+}
+
+// Spill the vector to the frame and combine its lanes one by one
+void ISel::select_reduce(const IRInstr &i) {
+    static const MOpcode ops[] = {M_ADD, M_OR, M_XOR};
+    MOpcode op = ops[i.imm == IR_ADD ? 0 : i.imm == IR_OR ? 1 : 2];
+    int slot = mf->new_slot(i.width, 16);
+    emit2(M_VMOV, reg(vreg(i.args[0])), MOperand::make_slot(slot), i.width);
+    int acc = -1;
+    for (int k = 0; k < i.width / i.size; k++) {
+        int t = mf->new_vreg();
+        auto lane = MOperand::make_slot(slot, k * i.size);
+        if (i.size >= 4) {
+            emit_mov(lane, reg(t), i.size);
+        } else {
+            auto &ext = emit(M_MOVZX);
+            ext.src_size = i.size;
+            ext.ops = {lane, reg(t)};
+        }
+        if (acc >= 0) emit2(op, reg(t), reg(acc));
+        else acc = t;
+    }
+    auto dst = reg(vreg(i.dst));
+    if (i.size == 8 || (i.size == 4 && !i.is_signed)) {
+        emit_mov(reg(acc), dst, i.size);
+    } else {
+        auto &ext = emit(i.is_signed ? M_MOVSX : M_MOVZX);
+        ext.src_size = i.size;
+        ext.ops = {reg(acc), dst};
+    }
+}
+
+void ISel::compare(const IRInstr &cmp) {
+    auto b = value(cmp.args[1], true);
+    auto a = value(cmp.args[0], false);
+    emit2(M_CMP, b, a);
+}
+
+void ISel::select_br(const IRInstr &i) {
+    auto then_block = mf->blocks[i.targets[0]->id].get();
+    auto else_block = mf->blocks[i.targets[1]->id].get();
+    auto d = def(i.args[0]);
+    if (d && is_comparison(d->op) && nuses[i.args[0]] == 1) {
+        compare(*d);
+        auto &jcc = emit(M_JCC);
+        jcc.cc = cond_code(d->op);
+        jcc.ops = {MOperand::make_block(then_block)};
+    } else {
+        auto v = value(i.args[0], false);
+        emit2(M_TEST, v, v);
+        auto &jcc = emit(M_JCC);
+        jcc.cc = CC_NE;
+        jcc.ops = {MOperand::make_block(then_block)};
+    }
+    emit(M_JMP).ops = {MOperand::make_block(else_block)};
+}
+
+// The else arm goes to the destination, then the compare, or a test of the
+// condition, and a cmov of the other arm over it. Nothing in between may
+// touch the flags; the moves of the register allocator don't.
+void ISel::select_cmov(const IRInstr &i) {
+    auto dst = reg(vreg(i.dst));
+    auto then_value = value(i.args[1], false);
+    emit_mov(value(i.args[2], true), dst);
+    auto d = def(i.args[0]);
+    CondCode cc = CC_NE;
+    if (d && is_comparison(d->op) && nuses[i.args[0]] == 1) {
+        compare(*d);
+        cc = cond_code(d->op);
+    } else {
+        auto v = value(i.args[0], false);
+        emit2(M_TEST, v, v);
+    }
+    auto &cmov = emit(M_CMOV);
+    cmov.cc = cc;
+    cmov.ops = {then_value, dst};
+}
+
+}
+
+std::unique_ptr<MFunction> select_instructions(IRFunction &f) {
+    return ISel(f).run();
+}
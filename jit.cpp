@@ -0,0 +1,215 @@
+#include "jit.hpp"
+#include "codegen.hpp"
+#include "elf.hpp"
+#include "util.hpp"
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// The JIT does the work of the linker and the dynamic loader: the code and
+// data of the module are laid out in one mapping, code first, and relocated
+// in place. Functions outside of the module are looked up in the running
+// process with dlsym(). Those are usually too far away for a 32-bit
+// displacement, so calls and references to them go through a stub jumping
+// to the real address, in the same way as the PLT of a shared library.
+
+namespace
+{
+
+enum Section {
+    TEXT,
+    RODATA,
+    DATA,
+    BSS,
+    NUM_SECTIONS,
+};
+
+struct Reloc {
+    enum Kind {
+        PC32,
+        ABS64,
+    };
+    Kind kind;
+    Section section;
+    long offset;
+    std::string sym;
+    long addend;
+};
+
+class Jit {
+public:
+    // The image is never unmapped, as the program may have registered
+    // functions in it with atexit()
+    Jit(const CodegenOptions &opts) : opts(opts) {}
+    void add_function(const MFunction &mf);
+    void add_global(const IRGlobal &g);
+    // Map and relocate the image, returning false if a symbol is missing
+    bool load();
+    void *lookup(const std::string &name);
+    // Load the image and call its main()
+    int run(int argc, char **argv,
+            std::chrono::steady_clock::time_point start);
+private:
+    const CodegenOptions &opts;
+    std::string contents[NUM_SECTIONS];
+    long bss_size = 0;
+    std::unordered_map<std::string, std::pair<Section, long>> symbols;
+    std::vector<Reloc> relocs;
+    char *image = NULL;
+    long base[NUM_SECTIONS];
+};
+
+void Jit::add_function(const MFunction &mf) {
+    auto &text = contents[TEXT];
+    long start = text.size();
+    std::vector<CodeReloc> code_relocs;
+    encode_function(mf, text, code_relocs);
+    symbols[mf.name] = {TEXT, start};
+    // A PLT32 relocation is resolved like PC32, the stubs are added for
+    // both when needed
+    for (auto &r: code_relocs)
+        relocs.push_back({Reloc::PC32, TEXT, start + r.offset, r.sym,
+                          r.addend});
+}
+
+void Jit::add_global(const IRGlobal &g) {
+    Section s = g.is_string ? RODATA : g.is_zero ? BSS : DATA;
+    long off;
+    if (s == BSS) {
+        off = bss_size = align_to(bss_size, g.align);
+        bss_size += g.size;
+    } else {
+        auto &c = contents[s];
+        off = align_to(c.size(), g.align);
+        c.resize(off, '\0');
+        c += g.data;
+        c.resize(off + g.size, '\0');
+        for (auto &r: g.relocs)
+            relocs.push_back({Reloc::ABS64, s, off + r.offset, r.sym,
+                              r.addend});
+    }
+    symbols[g.name] = {s, off};
+}
+
+bool Jit::load() {
+    // Resolve the external symbols first, as their stubs go after the code
+    std::unordered_map<std::string, void *> externals;
+    std::unordered_map<std::string, long> stubs;
+    bool ok = true;
+    for (auto &r: relocs) {
+        if (symbols.count(r.sym) || externals.count(r.sym)) continue;
+        void *addr = dlsym(RTLD_DEFAULT, r.sym.c_str());
+        if (!addr) {
+            fprintf(stderr, "mycc: undefined reference to '%s'\n",
+                    r.sym.c_str());
+            ok = false;
+        }
+        externals[r.sym] = addr;
+        if (r.kind == Reloc::PC32) {
+            auto &text = contents[TEXT];
+            text.resize(align_to(text.size(), 16), '\xcc');
+            stubs[r.sym] = text.size();
+            // jmp *0(%rip), followed by the address
+            text += "\xff\x25";
+            text.append(4, '\0');
+            text.append((const char *)&addr, 8);
+        }
+    }
+    if (!ok) return false;
+
+    long page = sysconf(_SC_PAGESIZE);
+    long size = 0;
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        // Code is on pages of its own, so that it can be made executable
+        size = align_to(size, s == RODATA ? page : 16);
+        base[s] = size;
+        size += s == BSS ? bss_size : contents[s].size();
+    }
+    void *p = mmap(NULL, align_to(size, page), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mycc: mmap");
+        return false;
+    }
+    image = (char *)p;
+    for (int s = 0; s < BSS; s++)
+        memcpy(image + base[s], contents[s].data(), contents[s].size());
+
+    for (auto &r: relocs) {
+        char *where = image + base[r.section] + r.offset;
+        long target;
+        auto sym = symbols.find(r.sym);
+        if (sym != symbols.end())
+            target = (long)(image + base[sym->second.first] +
+                            sym->second.second);
+        else if (r.kind == Reloc::PC32)
+            target = (long)(image + base[TEXT] + stubs[r.sym]);
+        else
+            target = (long)externals[r.sym];
+        target += r.addend;
+        if (r.kind == Reloc::ABS64) {
+            memcpy(where, &target, 8);
+        } else {
+            int rel = target - (long)where;
+            memcpy(where, &rel, 4);
+        }
+    }
+    if (mprotect(image, base[RODATA], PROT_READ | PROT_EXEC) < 0) {
+        perror("mycc: mprotect");
+        return false;
+    }
+    if (opts.stats) {
+        fprintf(stderr, "jit: %zu bytes of code, %ld of data, %zu stubs\n",
+                contents[TEXT].size(), size - base[RODATA], stubs.size());
+    }
+    return true;
+}
+
+void *Jit::lookup(const std::string &name) {
+    auto sym = symbols.find(name);
+    if (sym == symbols.end() || sym->second.first != TEXT) return NULL;
+    return image + base[TEXT] + sym->second.second;
+}
+
+int Jit::run(int argc, char **argv,
+             std::chrono::steady_clock::time_point start) {
+    if (!load()) return 1;
+    auto main_fn = (int (*)(int, char **))lookup("main");
+    if (!main_fn) {
+        fprintf(stderr, "mycc: no main function\n");
+        return 1;
+    }
+    if (opts.stats) {
+        std::chrono::duration<double, std::milli> t =
+            std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "jit: %.3f ms from source to main\n", t.count());
+    }
+    return main_fn(argc, argv);
+}
+
+}
+
+int run_module(IRModule &m, const CodegenOptions &opts, int argc,
+               char **argv, std::chrono::steady_clock::time_point start) {
+    Jit jit(opts);
+    for (auto &g: m.globals) jit.add_global(g);
+    auto mfs = compile_functions(m, opts);
+    for (size_t k = 0; k < m.funcs.size(); k++) {
+        for (auto &s: m.funcs[k]->strings) jit.add_global(s);
+        jit.add_function(*mfs[k]);
+    }
+    return jit.run(argc, argv, start);
+}
+
+int run_module(MModule &m, const CodegenOptions &opts, int argc,
+               char **argv, std::chrono::steady_clock::time_point start) {
+    Jit jit(opts);
+    for (auto &g: m.globals) jit.add_global(g);
+    for (auto &mf: m.funcs) jit.add_function(*mf);
+    return jit.run(argc, argv, start);
+}
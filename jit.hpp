@@ -0,0 +1,15 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+#include "codegen.hpp"
+#include "ir.hpp"
+#include <chrono>
+
+// Compile @m into executable memory and call its main() with @argc and
+// @argv, returning its exit status. @start is when compilation started, to
+// report the time until main() is entered with --stats.
+int run_module(IRModule &m, const CodegenOptions &opts, int argc,
+               char **argv, std::chrono::steady_clock::time_point start);
+// The same for a module compiled by compile_one_pass()
+int run_module(MModule &m, const CodegenOptions &opts, int argc,
+               char **argv, std::chrono::steady_clock::time_point start);
+#endif
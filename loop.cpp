@@ -0,0 +1,851 @@
+#include "alias.hpp"
+#include "cfg.hpp"
+#include "ir.hpp"
+#include "opt.hpp"
+#include "ssa.hpp"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Optimizations of the natural loops found by LoopForest, inner loops
+// first. Each loop is first given a preheader, a block of its own jumping
+// to the header, that the edges entering the loop all go through.
+//
+// - Invariant code motion moves the pure computations whose operands don't
+//   change in the loop to the preheader, along with the loads of what
+//   AliasAnalysis finds nothing in the loop can store to.
+// - Strength reduction finds the local variables stepped by a constant once
+//   in every iteration, as the counters of for loops, and the addresses
+//   computed from them by multiplying and adding invariants, as in array
+//   indexing. Each such address is carried over the iterations in a
+//   register of its own, by a phi in the header, and stepped along with the
+//   counter by an addition in the latch.
+// - Unrolling makes copies of the body of an innermost loop with a known
+//   trip count, as many as divide it, so that the test in the header is
+//   only made once for all of them.
+//
+// Int arithmetic on the counters is taken not to overflow, since that's
+// undefined behavior, so the sign extensions normalizing it are looked
+// through.
+
+namespace
+{
+
+// Instructions in all the copies of an unrolled loop, at most
+const int MAX_UNROLLED_SIZE = 256;
+
+long add(long a, long b) { return (unsigned long)a + (unsigned long)b; }
+long mul(long a, long b) { return (unsigned long)a * (unsigned long)b; }
+
+// How many times a loop testing "i op n" before each iteration runs, with
+// i starting at @init and stepped by @step, or -1 if it never stops
+long count_trips(IROp op, long init, long n, long step) {
+    switch (op) {
+    case IR_LT:
+    case IR_ULT:
+        if (step <= 0) return -1;
+        return init >= n ? 0 : (n - init + step - 1) / step;
+    case IR_LE:
+    case IR_ULE:
+        if (step <= 0) return -1;
+        return init > n ? 0 : (n - init) / step + 1;
+    case IR_GT:
+    case IR_UGT:
+        if (step >= 0) return -1;
+        return init <= n ? 0 : (init - n - step - 1) / -step;
+    case IR_GE:
+    case IR_UGE:
+        if (step >= 0) return -1;
+        return init < n ? 0 : (init - n) / -step + 1;
+    case IR_NE:
+        if ((n - init) % step || (n - init) / step < 0) return -1;
+        return (n - init) / step;
+    default:
+        return -1;
+    }
+}
+
+// Put the blocks added to @f since it had @n each before the original
+// block it's paired with, or at the end for NULL, and renumber them all
+void place_blocks(IRFunction &f, size_t n,
+                  const std::vector<std::pair<IRBlock *, IRBlock *>> &placed) {
+    std::vector<std::vector<IRBlock *>> before(n + 1);
+    for (auto &p: placed) before[p.second ? p.second->id : n].push_back(p.first);
+    std::vector<std::unique_ptr<IRBlock>> blocks;
+    for (size_t k = 0; k <= n; k++) {
+        for (auto b: before[k]) blocks.push_back(std::move(f.blocks[b->id]));
+        if (k < n) blocks.push_back(std::move(f.blocks[k]));
+    }
+    f.blocks = std::move(blocks);
+    for (size_t k = 0; k < f.blocks.size(); k++) f.blocks[k]->id = k;
+}
+
+// A local variable stepped by a constant once in every iteration, by the
+// store at @block, @index
+struct Induction {
+    int slot;
+    long step;
+    bool is_signed;  // as it's loaded
+    int block, index;
+};
+
+// A value in terms of an induction variable i: coef * i + base + off,
+// where @base is a register available in the preheader, if any
+struct Affine {
+    long coef = 0;
+    int base = -1;
+    long off = 0;
+    bool scaled = false;  // multiplied on the way
+};
+
+class LoopOptimizer {
+public:
+    LoopOptimizer(IRFunction &f, const OptOptions &opts) : f(f), opts(opts) {}
+    LoopStats run();
+private:
+    IRFunction &f;
+    const OptOptions &opts;
+    std::unique_ptr<CFG> cfg;
+    std::unique_ptr<DomTree> dom;
+    std::unique_ptr<LoopForest> forest;
+    std::vector<char> promotable;
+    // For each register, the block defining it, and the slot it's the
+    // address of, if any
+    std::vector<int> def_block, slot_of_reg;
+    // The constants and addresses, which can be computed again anywhere
+    std::unordered_map<int, IRInstr> cheap;
+    // The blocks of the loop at hand, in reverse postorder and marked with
+    // the number of the loop, and where each register defined in them is
+    std::vector<int> blocks, mark;
+    int current = 0;
+    std::unordered_map<int, std::pair<int, int>> def_at;
+    // The copies of cheap registers made in the preheader
+    std::unordered_map<int, int> copies;
+    LoopStats st;
+
+    void analyze();
+    bool add_preheaders();
+    void enter(const Loop &l);
+    void index_defs();
+    bool in_loop(int b) const {
+        return b >= 0 && b < (int)mark.size() && mark[b] == current;
+    }
+    bool defined_in_loop(int r) const { return in_loop(def_block[r]); }
+    const IRInstr *def_of(int r) const;
+    bool is_const(int r, long &v) const;
+    int preheader(const Loop &l) const;
+    int latch(const Loop &l) const;
+
+    int new_reg();
+    int emit(int b, IRInstr i);
+    int emit(int b, IROp op, int x, int y);
+    int constant(int b, long v);
+    int available(int r, int p);
+
+    void hoist(const Loop &l);
+    std::vector<Induction> inductions(const Loop &l);
+    void reduce(const Loop &l);
+    void reduce(const Induction &iv, int p, int c, int h);
+    long trip_count(const Loop &l, const IRInstr &br, int p);
+    bool unroll(const Loop &l, const std::vector<char> &escaping,
+                std::vector<std::pair<IRBlock *, IRBlock *>> &placed);
+};
+
+void LoopOptimizer::analyze() {
+    cfg = std::make_unique<CFG>(f);
+    dom = std::make_unique<DomTree>(*cfg);
+    forest = std::make_unique<LoopForest>(*cfg, *dom);
+    promotable = promotable_slots(f);
+    def_block.assign(f.nregs, -1);
+    slot_of_reg.assign(f.nregs, -1);
+    cheap.clear();
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.dst < 0) continue;
+            def_block[i.dst] = b->id;
+            if (i.op == IR_LOCAL) slot_of_reg[i.dst] = i.imm;
+            if (i.op == IR_CONST || i.op == IR_LOCAL || i.op == IR_GLOBAL)
+                cheap.emplace(i.dst, i);
+        }
+    }
+    mark.assign(cfg->size(), 0);
+}
+
+// Give each loop a preheader, unless the one edge entering it comes from a
+// block with no other successor. Returns whether any was added.
+bool LoopOptimizer::add_preheaders() {
+    size_t n = f.blocks.size();
+    std::vector<std::pair<IRBlock *, IRBlock *>> placed;
+    std::vector<int> entering;
+    for (auto &l: forest->loops) {
+        int h = l->header;
+        entering.clear();
+        for (int p: cfg->preds[h]) {
+            if (!dom->dominates(h, p)) entering.push_back(p);
+        }
+        // A loop around the entry would take the parameters along
+        if (h == 0 || (entering.size() == 1 &&
+                       cfg->succs[entering[0]].size() == 1))
+            continue;
+        auto header = f.blocks[h].get();
+        auto pre = f.new_block();
+        pre->loop_depth = std::max(header->loop_depth - 1, 0);
+        IRInstr jmp(IR_JMP);
+        jmp.targets = {header};
+        pre->instrs.push_back(std::move(jmp));
+        for (int p: entering) {
+            for (auto &t: f.blocks[p]->terminator().targets) {
+                if (t == header) t = pre;
+            }
+        }
+        placed.emplace_back(pre, header);
+    }
+    if (placed.empty()) return false;
+    place_blocks(f, n, placed);
+    return true;
+}
+
+void LoopOptimizer::enter(const Loop &l) {
+    current++;
+    blocks.clear();
+    std::vector<const Loop *> work{&l};
+    while (!work.empty()) {
+        auto loop = work.back();
+        work.pop_back();
+        blocks.insert(blocks.end(), loop->blocks.begin(), loop->blocks.end());
+        work.insert(work.end(), loop->children.begin(), loop->children.end());
+    }
+    for (int b: blocks) mark[b] = current;
+    std::sort(blocks.begin(), blocks.end(), [&](int a, int b) {
+        return cfg->rpo_index[a] < cfg->rpo_index[b];
+    });
+    copies.clear();
+}
+
+void LoopOptimizer::index_defs() {
+    def_at.clear();
+    for (int b: blocks) {
+        auto &instrs = f.blocks[b]->instrs;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            if (instrs[k].dst >= 0) def_at[instrs[k].dst] = {b, (int)k};
+        }
+    }
+}
+
+// The instruction in the loop defining @r, if any
+const IRInstr *LoopOptimizer::def_of(int r) const {
+    auto it = def_at.find(r);
+    if (it == def_at.end()) return NULL;
+    return &f.blocks[it->second.first]->instrs[it->second.second];
+}
+
+bool LoopOptimizer::is_const(int r, long &v) const {
+    auto it = cheap.find(r);
+    if (it == cheap.end() || it->second.op != IR_CONST) return false;
+    v = it->second.imm;
+    return true;
+}
+
+// The block all edges entering @l come from, jumping nowhere else, or -1
+int LoopOptimizer::preheader(const Loop &l) const {
+    int pre = -1;
+    for (int p: cfg->preds[l.header]) {
+        if (dom->dominates(l.header, p)) continue;
+        if (pre >= 0 || cfg->succs[p].size() != 1) return -1;
+        pre = p;
+    }
+    return pre;
+}
+
+// The block with the one back edge of @l, or -1
+int LoopOptimizer::latch(const Loop &l) const {
+    int latch = -1;
+    for (int p: cfg->preds[l.header]) {
+        if (!dom->dominates(l.header, p)) continue;
+        if (latch >= 0) return -1;
+        latch = p;
+    }
+    return latch;
+}
+
+int LoopOptimizer::new_reg() {
+    def_block.push_back(-1);
+    slot_of_reg.push_back(-1);
+    return f.new_reg();
+}
+
+// Add @i to the end of block @b, before its terminator, returning its
+// destination
+int LoopOptimizer::emit(int b, IRInstr i) {
+    auto &instrs = f.blocks[b]->instrs;
+    int dst = i.dst;
+    if (dst >= 0) {
+        def_block[dst] = b;
+        if (i.op == IR_LOCAL) slot_of_reg[dst] = i.imm;
+        if (i.op == IR_CONST || i.op == IR_LOCAL || i.op == IR_GLOBAL)
+            cheap.emplace(dst, i);
+    }
+    instrs.insert(instrs.end() - 1, std::move(i));
+    return dst;
+}
+
+int LoopOptimizer::emit(int b, IROp op, int x, int y) {
+    IRInstr i(op);
+    i.dst = new_reg();
+    i.args = {x, y};
+    return emit(b, std::move(i));
+}
+
+int LoopOptimizer::constant(int b, long v) {
+    IRInstr i(IR_CONST);
+    i.dst = new_reg();
+    i.imm = v;
+    return emit(b, std::move(i));
+}
+
+// @r, or if it's a constant or address computed in the loop, a copy of it
+// made in the preheader @p
+int LoopOptimizer::available(int r, int p) {
+    if (!defined_in_loop(r)) return r;
+    auto it = copies.find(r);
+    if (it != copies.end()) return it->second;
+    IRInstr i = cheap.at(r);
+    i.dst = new_reg();
+    int d = emit(p, std::move(i));
+    copies[r] = d;
+    return d;
+}
+
+// Move the invariant computations of @l to its preheader. The constants
+// and addresses are left in place, as the backends fold them into the
+// instructions using them; those hoisted get copies of them.
+void LoopOptimizer::hoist(const Loop &l) {
+    int p = preheader(l);
+    if (p < 0) return;
+    // The local variables stored to in the loop, and the stores and calls
+    // that may write to anything else
+    std::vector<char> stored(f.slots.size());
+    std::vector<const IRInstr *> writes;
+    bool calls = false;
+    for (int b: blocks) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.op == IR_CALL) {
+                calls = true;
+            } else if (i.op == IR_VSTORE) {
+                writes.push_back(&i);
+            } else if (i.op == IR_STORE) {
+                int s = slot_of_reg[i.args[0]];
+                if (s >= 0 && promotable[s])
+                    stored[s] = true;
+                else
+                    writes.push_back(&i);
+            }
+        }
+    }
+    // The loads they may write to, found before anything moves
+    std::unordered_set<int> clobbered;
+    if (calls || !writes.empty()) {
+        AliasAnalysis aa(f, opts.strict_aliasing);
+        for (int b: blocks) {
+            for (auto &i: f.blocks[b]->instrs) {
+                if (i.op != IR_LOAD) continue;
+                bool c = calls && aa.call_may_access(i);
+                for (size_t k = 0; k < writes.size() && !c; k++)
+                    c = aa.may_alias(i, *writes[k]);
+                if (c) clobbered.insert(i.dst);
+            }
+        }
+        st.alias.queries += aa.stats.queries;
+        st.alias.cached += aa.stats.cached;
+        st.alias.disjoint += aa.stats.disjoint;
+    }
+    auto invariant = [&](int r) {
+        return !defined_in_loop(r) || cheap.count(r);
+    };
+    auto can_hoist = [&](const IRInstr &i) {
+        switch (i.op) {
+        case IR_COPY:
+        case IR_ADD: case IR_SUB: case IR_MUL:
+        case IR_AND: case IR_OR: case IR_XOR:
+        case IR_SHL: case IR_SHR: case IR_SAR:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT:
+        case IR_GE: case IR_ULT: case IR_ULE: case IR_UGT: case IR_UGE:
+        case IR_NEG: case IR_NOT: case IR_SEXT: case IR_ZEXT:
+        case IR_SELECT:
+            break;
+        case IR_LOAD: {
+            // Only from where it can't trap, as it may not have run
+            int s = slot_of_reg[i.args[0]];
+            if (s >= 0 && promotable[s]) return !stored[s];
+            auto d = cheap.find(i.args[0]);
+            if (d == cheap.end() || d->second.op == IR_CONST ||
+                clobbered.count(i.dst))
+                return false;
+            break;
+        }
+        // Division is left where it is, in case it's guarded against a
+        // zero divisor
+        default:
+            return false;
+        }
+        for (int a: i.args) {
+            if (!invariant(a)) return false;
+        }
+        return true;
+    };
+    std::vector<IRInstr> hoisted;
+    for (int b: blocks) {
+        auto &instrs = f.blocks[b]->instrs;
+        size_t n = 0;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            if (can_hoist(instrs[k])) {
+                def_block[instrs[k].dst] = p;
+                hoisted.push_back(std::move(instrs[k]));
+                continue;
+            }
+            if (n != k) instrs[n] = std::move(instrs[k]);
+            n++;
+        }
+        instrs.resize(n, IRInstr(IR_RET));
+    }
+    for (auto &i: hoisted) {
+        for (auto &a: i.args) a = available(a, p);
+        emit(p, std::move(i));
+        st.hoisted++;
+    }
+}
+
+// The induction variables of @l: the int and long local variables stored
+// to once in the loop, in a block run in every iteration, with the value
+// loaded from them earlier in the iteration plus or minus a constant
+std::vector<Induction> LoopOptimizer::inductions(const Loop &l) {
+    std::vector<Induction> ivs;
+    index_defs();
+    int c = latch(l);
+    if (c < 0) return ivs;
+    std::unordered_map<int, int> nstores;
+    std::vector<std::pair<int, int>> stores;
+    for (int b: blocks) {
+        auto &instrs = f.blocks[b]->instrs;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            if (instrs[k].op != IR_STORE) continue;
+            int s = slot_of_reg[instrs[k].args[0]];
+            if (s < 0 || !promotable[s]) continue;
+            if (nstores[s]++ == 0) stores.emplace_back(b, k);
+        }
+    }
+    for (auto &at: stores) {
+        auto &store = f.blocks[at.first]->instrs[at.second];
+        int s = slot_of_reg[store.args[0]];
+        if (nstores[s] != 1 || !dom->dominates(at.first, c) ||
+            forest->loop_of(at.first) != &l)
+            continue;
+        auto d = def_of(store.args[1]);
+        if (store.size == 4) {
+            if (!d || d->op != IR_SEXT || d->size != 4) continue;
+            d = def_of(d->args[0]);
+        } else if (store.size != 8) {
+            continue;
+        }
+        long step;
+        int x;
+        if (!d || (d->op != IR_ADD && d->op != IR_SUB)) continue;
+        if (is_const(d->args[1], step)) {
+            x = d->args[0];
+            if (d->op == IR_SUB) step = mul(step, -1);
+        } else if (d->op == IR_ADD && is_const(d->args[0], step)) {
+            x = d->args[1];
+        } else {
+            continue;
+        }
+        auto load = def_of(x);
+        if (step == 0 || !load || load->op != IR_LOAD ||
+            slot_of_reg[load->args[0]] != s)
+            continue;
+        // Loaded before the store in the same iteration
+        auto pos = def_at[x];
+        if (pos.first == at.first ? pos.second > at.second
+                                  : !dom->dominates(pos.first, at.first))
+            continue;
+        ivs.push_back({s, step, load->is_signed, at.first, at.second});
+    }
+    return ivs;
+}
+
+void LoopOptimizer::reduce(const Loop &l) {
+    int p = preheader(l), c = latch(l), h = l.header;
+    if (p < 0 || c < 0 || cfg->preds[h].size() != 2) return;
+    // Each reduction adds phis to the header, so find them again
+    for (size_t n = 0;; n++) {
+        auto ivs = inductions(l);
+        if (n >= ivs.size()) break;
+        reduce(ivs[n], p, c, h);
+    }
+}
+
+// Carry the addresses computed from @iv in the loop with preheader @p,
+// latch @c and header @h in registers of their own
+void LoopOptimizer::reduce(const Induction &iv, int p, int c, int h) {
+    // Whether the instruction at @b, @k comes before the store stepping the
+    // variable in an iteration, or after it
+    auto before = [&](int b, int k) {
+        return b == iv.block ? k < iv.index
+                             : b != iv.block && dom->dominates(b, iv.block);
+    };
+    auto after = [&](int b, int k) {
+        return b == iv.block ? k > iv.index : dom->dominates(iv.block, b);
+    };
+    std::unordered_map<int, Affine> affine;
+    auto operand = [&](int r, Affine &a) {
+        auto it = affine.find(r);
+        if (it != affine.end()) {
+            a = it->second;
+            return true;
+        }
+        if (defined_in_loop(r) && !cheap.count(r)) return false;
+        a = Affine();
+        if (!is_const(r, a.off)) a.base = available(r, p);
+        return true;
+    };
+    auto is_number = [](const Affine &a) {
+        return a.coef == 0 && a.base < 0;
+    };
+    // Multiply @a by the constant @k, the base in the preheader
+    auto scale = [&](Affine &a, long k) {
+        a.coef = mul(a.coef, k);
+        a.off = mul(a.off, k);
+        if (a.base >= 0 && k != 1)
+            a.base = emit(p, IR_MUL, a.base, constant(p, k));
+        a.scaled = true;
+    };
+
+    std::vector<std::pair<int, int>> found;
+    for (int b: blocks) {
+        auto &instrs = f.blocks[b]->instrs;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            auto &i = instrs[k];
+            Affine a, y;
+            bool ok = false;
+            long v;
+            switch (i.op) {
+            case IR_LOAD:
+                if (slot_of_reg[i.args[0]] != iv.slot ||
+                    i.is_signed != iv.is_signed)
+                    break;
+                a.coef = 1;
+                if (after(b, k)) a.off = iv.step;
+                ok = before(b, k) || after(b, k);
+                break;
+            case IR_COPY:
+                ok = operand(i.args[0], a);
+                break;
+            case IR_SEXT:
+                // Of int arithmetic on the variable, which doesn't overflow
+                ok = i.size == 4 && operand(i.args[0], a) && a.coef != 0;
+                break;
+            case IR_ADD:
+            case IR_SUB:
+                if (!operand(i.args[0], a) || !operand(i.args[1], y)) break;
+                if (i.op == IR_SUB) {
+                    y.coef = mul(y.coef, -1);
+                    y.off = mul(y.off, -1);
+                    if (y.base >= 0) {
+                        IRInstr neg(IR_NEG);
+                        neg.dst = new_reg();
+                        neg.args = {y.base};
+                        y.base = emit(p, std::move(neg));
+                    }
+                }
+                a.coef = add(a.coef, y.coef);
+                a.off = add(a.off, y.off);
+                if (a.base < 0)
+                    a.base = y.base;
+                else if (y.base >= 0)
+                    a.base = emit(p, IR_ADD, a.base, y.base);
+                a.scaled = a.scaled || y.scaled;
+                ok = true;
+                break;
+            case IR_MUL:
+                if (!operand(i.args[0], a) || !operand(i.args[1], y)) break;
+                if (is_number(a)) std::swap(a, y);
+                if (!is_number(y)) break;
+                scale(a, y.off);
+                ok = true;
+                break;
+            case IR_SHL:
+                if (!operand(i.args[0], a) || !is_const(i.args[1], v) ||
+                    v < 0 || v > 32)
+                    break;
+                scale(a, 1L << v);
+                ok = true;
+                break;
+            default:
+                break;
+            }
+            if (ok && a.coef != 0) {
+                affine[i.dst] = a;
+                found.emplace_back(b, k);
+            }
+        }
+    }
+
+    // The addresses used other than to compute more of them
+    std::unordered_set<int> used;
+    for (int b: blocks) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.dst >= 0 && affine.count(i.dst)) continue;
+            for (int a: i.args) {
+                if (affine.count(a)) used.insert(a);
+            }
+        }
+    }
+    int first = -1;  // the value of the variable entering the loop
+    std::vector<IRInstr> phis;
+    for (auto &at: found) {
+        // Emitting to the latch may move the instructions of the loop
+        int dst = f.blocks[at.first]->instrs[at.second].dst;
+        auto &a = affine[dst];
+        if (!a.scaled || a.base < 0 || !used.count(dst)) continue;
+        if (first < 0) {
+            IRInstr local(IR_LOCAL);
+            local.dst = new_reg();
+            local.imm = iv.slot;
+            IRInstr load(IR_LOAD);
+            load.dst = new_reg();
+            load.args = {emit(p, std::move(local))};
+            load.size = f.slots[iv.slot].size;
+            load.is_signed = iv.is_signed;
+            first = emit(p, std::move(load));
+        }
+        int init = first;
+        if (a.coef != 1) init = emit(p, IR_MUL, init, constant(p, a.coef));
+        init = emit(p, IR_ADD, init, a.base);
+        if (a.off) init = emit(p, IR_ADD, init, constant(p, a.off));
+        IRInstr phi(IR_PHI);
+        phi.dst = new_reg();
+        int next = emit(c, IR_ADD, phi.dst,
+                        constant(c, mul(a.coef, iv.step)));
+        phi.args = {init, next};
+        phi.targets = {f.blocks[p].get(), f.blocks[c].get()};
+        auto &i = f.blocks[at.first]->instrs[at.second];
+        i = IRInstr(IR_COPY);
+        i.dst = dst;
+        i.args = {phi.dst};
+        def_block[phi.dst] = h;
+        phis.push_back(std::move(phi));
+        st.reduced++;
+    }
+    auto &instrs = f.blocks[h]->instrs;
+    instrs.insert(instrs.begin(), phis.begin(), phis.end());
+}
+
+// The number of iterations of @l, tested by @br in its header, if it's
+// known: an induction variable is compared with a constant, and a
+// constant is stored to it last thing in the preheader @p. Else -1.
+long LoopOptimizer::trip_count(const Loop &l, const IRInstr &br, int p) {
+    auto ivs = inductions(l);
+    auto cmp = def_of(br.args[0]);
+    if (!cmp || def_at[br.args[0]].first != l.header ||
+        !is_comparison(cmp->op))
+        return -1;
+    IROp op = cmp->op;
+    int x = cmp->args[0];
+    long n;
+    if (!is_const(cmp->args[1], n)) {
+        x = cmp->args[1];
+        op = swap_comparison(op);
+        if (!is_const(cmp->args[0], n)) return -1;
+    }
+    auto load = def_of(x);
+    if (!load || load->op != IR_LOAD) return -1;
+    auto pos = def_at[x];
+    const Induction *iv = NULL;
+    for (auto &v: ivs) {
+        if (v.slot == slot_of_reg[load->args[0]]) iv = &v;
+    }
+    // Tested before being stepped
+    if (!iv || load->is_signed != iv->is_signed ||
+        (pos.first == iv->block ? pos.second > iv->index
+                                : !dom->dominates(pos.first, iv->block)))
+        return -1;
+    auto &pre = f.blocks[p]->instrs;
+    auto store = pre.rbegin();
+    while (store != pre.rend() &&
+           (store->op != IR_STORE || slot_of_reg[store->args[0]] != iv->slot))
+        ++store;
+    long init;
+    if (store == pre.rend() || !is_const(store->args[1], init)) return -1;
+    int size = f.slots[iv->slot].size;
+    init = extend(init, size, iv->is_signed);
+    long step = iv->step;
+    // Small enough for the arithmetic below not to overflow
+    for (long v: {init, n, step}) {
+        if (v < INT_MIN || v > INT_MAX) return -1;
+    }
+    long trips = count_trips(op, init, n, step);
+    if (trips < 0) return -1;
+    long last = init + trips * step;
+    if (size == 4 && (iv->is_signed ? last != (int)last : last < 0))
+        return -1;
+    bool is_unsigned = op >= IR_ULT && op <= IR_UGE;
+    if (is_unsigned && (std::min(init, last) < 0 || n < 0)) return -1;
+    return trips;
+}
+
+// Unroll the innermost loop @l, if it has a known trip count, placing the
+// copies of its blocks after it. The registers defined in the loop and
+// used outside of it are @escaping.
+bool LoopOptimizer::unroll(
+        const Loop &l, const std::vector<char> &escaping,
+        std::vector<std::pair<IRBlock *, IRBlock *>> &placed) {
+    int h = l.header, p = preheader(l), c = latch(l);
+    if (p < 0 || c < 0 || c == h || cfg->preds[h].size() != 2) return false;
+    auto header = f.blocks[h].get(), latch_block = f.blocks[c].get();
+    auto &br = header->terminator();
+    if (br.op != IR_BR || latch_block->terminator().op != IR_JMP) return false;
+    bool first_in = in_loop(br.targets[0]->id);
+    if (first_in == in_loop(br.targets[1]->id)) return false;
+    auto body = br.targets[first_in ? 0 : 1];
+
+    // Only the header of the last copy is left to exit the loop, so the
+    // values from the rest must stay in it
+    int size = 0;
+    for (int b: blocks) {
+        auto &instrs = f.blocks[b]->instrs;
+        size += instrs.size();
+        if (b == h) continue;
+        for (auto &i: instrs) {
+            if (i.dst >= 0 && escaping[i.dst]) return false;
+        }
+        for (auto t: instrs.back().targets) {
+            if (!in_loop(t->id) && t->has_phis()) return false;
+        }
+    }
+    long trips = trip_count(l, br, p);
+    int factor = 0;
+    for (long d = std::min<long>(opts.unroll_factor, trips); d >= 2; d--) {
+        if (trips % d == 0 && d * size <= MAX_UNROLLED_SIZE) {
+            factor = d;
+            break;
+        }
+    }
+    if (!factor) return false;
+
+    std::vector<int> order(blocks);
+    std::sort(order.begin(), order.end());
+    IRBlock *anchor = NULL;
+    if (order.back() + 1 < cfg->size()) anchor = f.blocks[order.back() + 1].get();
+    std::vector<std::unordered_map<IRBlock *, IRBlock *>> block_maps(factor);
+    std::vector<std::unordered_map<int, int>> reg_maps(factor);
+    for (int k = 1; k < factor; k++) {
+        for (int b: order) {
+            auto nb = f.new_block();
+            nb->loop_depth = f.blocks[b]->loop_depth;
+            block_maps[k][f.blocks[b].get()] = nb;
+            placed.emplace_back(nb, anchor);
+            for (auto &i: f.blocks[b]->instrs) {
+                if (i.dst >= 0) reg_maps[k][i.dst] = new_reg();
+            }
+        }
+    }
+    // The loop now runs a factor-th of the times, and so does each copy
+    for (int b: order) {
+        auto from = f.blocks[b].get();
+        if (from->count < 0) continue;
+        from->count /= factor;
+        for (int k = 1; k < factor; k++)
+            block_maps[k][from]->count = from->count;
+    }
+    auto reg_in = [&](int k, int r) {
+        auto it = reg_maps[k].find(r);
+        return it == reg_maps[k].end() ? r : it->second;
+    };
+    auto block_in = [&](int k, IRBlock *b) {
+        auto it = block_maps[k].find(b);
+        return it == block_maps[k].end() ? b : it->second;
+    };
+    // Each copy goes on from the one before, whose latch gives the values
+    // of the phis, without testing the condition again
+    for (int k = 1; k < factor; k++) {
+        auto next = k + 1 < factor ? block_maps[k + 1][header] : header;
+        for (int b: order) {
+            auto from = f.blocks[b].get();
+            auto to = block_maps[k][from];
+            for (auto &i: from->instrs) {
+                IRInstr copy = i;
+                if (i.op == IR_PHI) {
+                    copy = IRInstr(IR_COPY);
+                    copy.size = i.size;
+                    copy.width = i.width;
+                    for (size_t j = 0; j < i.args.size(); j++) {
+                        if (i.targets[j] == latch_block)
+                            copy.args = {reg_in(k - 1, i.args[j])};
+                    }
+                } else if (from == header && i.is_terminator()) {
+                    copy = IRInstr(IR_JMP);
+                    copy.targets = {block_in(k, body)};
+                } else {
+                    for (auto &a: copy.args) a = reg_in(k, a);
+                    for (auto &t: copy.targets)
+                        t = t == header ? next : block_in(k, t);
+                }
+                if (i.dst >= 0) copy.dst = reg_in(k, i.dst);
+                to->instrs.push_back(std::move(copy));
+            }
+        }
+    }
+    for (auto &t: latch_block->terminator().targets) {
+        if (t == header) t = block_maps[1][header];
+    }
+    for (auto &i: header->instrs) {
+        if (i.op != IR_PHI) break;
+        for (size_t j = 0; j < i.args.size(); j++) {
+            if (i.targets[j] != latch_block) continue;
+            i.args[j] = reg_in(factor - 1, i.args[j]);
+            i.targets[j] = block_maps[factor - 1][latch_block];
+        }
+    }
+    return true;
+}
+
+LoopStats LoopOptimizer::run() {
+    analyze();
+    if (forest->loops.empty()) return st;
+    if (add_preheaders()) analyze();
+    for (auto &l: forest->loops) {
+        enter(*l);
+        if (opts.licm) hoist(*l);
+        if (opts.strength_reduce) reduce(*l);
+    }
+    if (!opts.unroll_loops || opts.unroll_factor < 2) return st;
+
+    std::vector<char> escaping(f.nregs);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            for (int a: i.args) {
+                int d = def_block[a];
+                if (d >= 0 && forest->loop_of(d) != forest->loop_of(b->id))
+                    escaping[a] = true;
+            }
+        }
+    }
+    size_t n = f.blocks.size();
+    std::vector<std::pair<IRBlock *, IRBlock *>> placed;
+    for (auto &l: forest->loops) {
+        if (!l->children.empty()) continue;
+        enter(*l);
+        if (unroll(*l, escaping, placed)) st.unrolled++;
+    }
+    if (!placed.empty()) place_blocks(f, n, placed);
+    return st;
+}
+
+}
+
+LoopStats optimize_loops(IRFunction &f, const OptOptions &opts) {
+    return LoopOptimizer(f, opts).run();
+}
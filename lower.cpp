@@ -0,0 +1,1306 @@
+#include "lower.hpp"
+#include "decl.hpp"
+#include "expr.hpp"
+#include "stmt.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+void put_int(std::string &data, long offset, long v, int size) {
+    for (int i = 0; i < size; i++)
+        data[offset + i] = (char)(v >> (i * 8));
+}
+
+}
+
+std::string unescape(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '\\' || i + 1 == s.size()) {
+            out += s[i];
+            continue;
+        }
+        char c = s[++i];
+        switch (c) {
+        case 'a': out += '\a'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'v': out += '\v'; break;
+        case 'x': {
+            int v = 0;
+            while (i + 1 < s.size() && isxdigit(s[i + 1])) {
+                char d = s[++i];
+                v = v * 16 + (isdigit(d) ? d - '0' : (d | 0x20) - 'a' + 10);
+            }
+            out += (char)v;
+            break;
+        }
+        default:
+            if (c >= '0' && c <= '7') {
+                int v = c - '0';
+                for (int n = 1; n < 3 && i + 1 < s.size() &&
+                        s[i + 1] >= '0' && s[i + 1] <= '7'; n++)
+                    v = v * 8 + s[++i] - '0';
+                out += (char)v;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+const Type *type_of_spec(const Token &spec) {
+    switch (spec.type) {
+    case TOK_T_VOID:     return Type::void_type();
+    case TOK_T_CHAR:     return Type::char_type();
+    case TOK_T_SHORT:    return Type::short_type();
+    case TOK_T_SIGNED:
+    case TOK_T_INT:      return Type::int_type();
+    case TOK_T_UNSIGNED: return Type::uint_type();
+    case TOK_T_LONG:     return Type::long_type();
+    case TOK_T_FLOAT:    return Type::float_type();
+    case TOK_T_DOUBLE:   return Type::double_type();
+    default:             return Type::int_type();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Lowering
+
+void Lowering::error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "mycc: error: ");
+    if (func) fprintf(stderr, "in function '%s': ", func->name.c_str());
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    failed = true;
+}
+
+void Lowering::declare(const std::string &name, const Symbol &sym) {
+    if (name.empty()) return;
+    auto &scope = scopes.back();
+    auto it = scope.find(name);
+    if (it != scope.end()) {
+        // Redeclaring a function or a global is fine, as long as it's the
+        // same kind of thing. We don't check that the types are compatible.
+        if (it->second.kind == Symbol::LOCAL || sym.kind == Symbol::LOCAL) {
+            error("redeclaration of '%s'", name.c_str());
+            return;
+        }
+        // A completed array type replaces an incomplete one
+        if (sym.type->is_array() && sym.type->len < 0) return;
+    }
+    scope[name] = sym;
+}
+
+const Symbol *Lowering::lookup(const std::string &name) {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+        auto sym = it->find(name);
+        if (sym != it->end()) return &sym->second;
+    }
+    return NULL;
+}
+
+void Lowering::define_function(const std::string &name) {
+    if (!function_bodies.insert(name).second)
+        error("redefinition of '%s'", name.c_str());
+}
+
+void Lowering::begin_function(const std::string &name, const Type *type) {
+    func = new IRFunction(name, type);
+    block = func->new_block();
+    labels.clear();
+    owner = name;
+    nstrings = 0;
+}
+
+void Lowering::end_function() {
+    if (!block->is_terminated()) {
+        // Falling off the end of main returns 0. For other functions the
+        // value is undefined, but returning 0 doesn't hurt.
+        if (func->type->base->is_void()) {
+            emit(IR_RET);
+        } else {
+            int zero = emit_const(0);
+            emit(IR_RET).args = {zero};
+        }
+    }
+    for (auto &l: labels) {
+        if (!l.second.defined)
+            error("label '%s' used but not defined", l.first.c_str());
+    }
+    module.funcs.emplace_back(func);
+    func = NULL;
+    block = NULL;
+}
+
+void Lowering::define_global(const std::string &name, const Type *type,
+                             ExprAST *init) {
+    if (type->is_array() && type->len < 0 && !init) {
+        error("array size missing in '%s'", name.c_str());
+        return;
+    }
+    IRGlobal g;
+    g.name = name;
+    g.size = type->size();
+    g.align = type->align();
+    owner = name;
+    nstrings = 0;
+    if (init) {
+        g.is_zero = false;
+        g.data.assign(g.size, '\0');
+        if (!init->init_static(*this, type, g)) {
+            error("initializer of '%s' is not a constant", name.c_str());
+            return;
+        }
+        // The initializer may have completed an array type
+        if (type->is_array() && type->len < 0)
+            type = Type::array_of(type->base, g.size / type->base->size());
+    }
+    declare(name, {Symbol::GLOBAL, type, 0});
+
+    auto it = global_index.find(name);
+    if (it == global_index.end()) {
+        global_index[name] = module.globals.size();
+        module.globals.emplace_back(std::move(g));
+    } else if (init) {
+        auto &old = module.globals[it->second];
+        if (!old.is_zero) {
+            error("redefinition of '%s'", name.c_str());
+            return;
+        }
+        old = std::move(g);
+    }
+}
+
+int Lowering::local_var(const Type *type) {
+    return func->new_slot(type->size(), type->align());
+}
+
+IRBlock *Lowering::new_block() {
+    auto b = func->new_block();
+    b->loop_depth = loop_depth;
+    return b;
+}
+
+IRBlock *Lowering::label_block(const std::string &name, bool define) {
+    auto it = labels.find(name);
+    if (it == labels.end())
+        it = labels.emplace(name, Label{new_block(), false}).first;
+    if (define) {
+        if (it->second.defined)
+            error("duplicate label '%s'", name.c_str());
+        it->second.defined = true;
+    }
+    return it->second.block;
+}
+
+void Lowering::enter_loop(IRBlock *brk, IRBlock *cont) {
+    break_targets.push_back(brk);
+    continue_targets.push_back(cont);
+    if (cont) loop_depth++;
+}
+
+void Lowering::leave_loop() {
+    if (continue_targets.back()) loop_depth--;
+    break_targets.pop_back();
+    continue_targets.pop_back();
+}
+
+IRBlock *Lowering::break_target() {
+    return break_targets.empty() ? NULL : break_targets.back();
+}
+
+IRBlock *Lowering::continue_target() {
+    for (auto it = continue_targets.rbegin(); it != continue_targets.rend();
+         ++it) {
+        if (*it) return *it;
+    }
+    return NULL;
+}
+
+IRInstr *Lowering::switch_head() {
+    return switches.empty() ? NULL : &switches.back()->terminator();
+}
+
+IRInstr &Lowering::emit(IROp op) {
+    // Code following a jump is unreachable, but it still needs a block
+    if (block->is_terminated()) block = new_block();
+    block->instrs.emplace_back(op);
+    return block->instrs.back();
+}
+
+int Lowering::emit_const(long v) {
+    auto &i = emit(IR_CONST);
+    i.dst = func->new_reg();
+    i.imm = v;
+    return i.dst;
+}
+
+int Lowering::emit_unary(IROp op, int a, int size) {
+    auto &i = emit(op);
+    i.dst = func->new_reg();
+    i.args = {a};
+    i.size = size;
+    return i.dst;
+}
+
+int Lowering::emit_binary(IROp op, int a, int b) {
+    auto &i = emit(op);
+    i.dst = func->new_reg();
+    i.args = {a, b};
+    return i.dst;
+}
+
+int Lowering::emit_load(int addr, const Type *type) {
+    auto &i = emit(IR_LOAD);
+    i.dst = func->new_reg();
+    i.args = {addr};
+    i.size = type->size();
+    i.is_signed = type->is_signed();
+    return i.dst;
+}
+
+void Lowering::emit_store(int addr, int v, const Type *type) {
+    auto &i = emit(IR_STORE);
+    i.args = {addr, v};
+    i.size = type->size();
+}
+
+void Lowering::emit_jmp(IRBlock *target) {
+    emit(IR_JMP).targets = {target};
+}
+
+void Lowering::emit_br(int cond, IRBlock *then_block, IRBlock *else_block) {
+    auto &i = emit(IR_BR);
+    i.args = {cond};
+    i.targets = {then_block, else_block};
+}
+
+std::string Lowering::string_literal(const std::string &lexeme) {
+    IRGlobal g;
+    g.name = ".L.str." + owner + "." + std::to_string(nstrings++);
+    g.data = unescape(lexeme) + '\0';
+    g.size = g.data.size();
+    g.align = 1;
+    g.is_static = true;
+    g.is_string = true;
+    g.is_zero = false;
+    auto name = g.name;
+    if (func)
+        func->strings.emplace_back(std::move(g));
+    else
+        module.globals.emplace_back(std::move(g));
+    return name;
+}
+
+int Lowering::normalize(int reg, const Type *type) {
+    switch (type->kind) {
+    case TY_CHAR:  return emit_unary(IR_SEXT, reg, 1);
+    case TY_SHORT: return emit_unary(IR_SEXT, reg, 2);
+    case TY_INT:   return emit_unary(IR_SEXT, reg, 4);
+    case TY_UINT:  return emit_unary(IR_ZEXT, reg, 4);
+    default:       return reg;
+    }
+}
+
+Value Lowering::rvalue(Value lv) {
+    if (lv.type->is_array())
+        return {lv.reg, Type::pointer_to(lv.type->base)};
+    if (lv.type->is_func())
+        return {lv.reg, Type::pointer_to(lv.type)};
+    if (lv.type->is_float()) {
+        error("floating point types are not supported");
+        return zero();
+    }
+    return {emit_load(lv.reg, lv.type), lv.type};
+}
+
+Value Lowering::convert(Value v, const Type *type) {
+    if (type->is_void()) return {-1, type};
+    if (!v.type->is_scalar() || !type->is_scalar()) {
+        error("cannot convert '%s' to '%s'",
+              v.type->str().c_str(), type->str().c_str());
+        return {emit_const(0), type};
+    }
+    // The value doesn't change if every value of the source type is also
+    // one of the destination type, whose normalization is then a no-op.
+    const Type *from = v.type;
+    if (from == type || type->size() == 8) return {v.reg, type};
+    if (from->is_signed() == type->is_signed() &&
+        from->size() <= type->size())
+        return {v.reg, type};
+    if (!from->is_signed() && from->size() < type->size())
+        return {v.reg, type};
+    return {normalize(v.reg, type), type};
+}
+
+Value Lowering::to_bool(Value v) {
+    if (!v.type->is_scalar()) {
+        error("scalar required");
+        return zero();
+    }
+    // A comparison just made already is
+    auto &instrs = block->instrs;
+    if (!instrs.empty() && instrs.back().dst == v.reg &&
+        is_comparison(instrs.back().op))
+        return {v.reg, Type::int_type()};
+    return {emit_binary(IR_NE, v.reg, emit_const(0)), Type::int_type()};
+}
+
+const Type *Lowering::arith_type(const Type *a, const Type *b) {
+    if (a->kind == TY_LONG || b->kind == TY_LONG) return Type::long_type();
+    if (a->kind == TY_UINT || b->kind == TY_UINT) return Type::uint_type();
+    return Type::int_type();
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Declarations
+
+const Type *Declarator::declare(Lowering &L, const Type *base,
+                                DeclInfo &info) {
+    for (int i = 0; i < ptr_level; i++)
+        base = Type::pointer_to(base);
+    return decl->declare(L, base, info);
+}
+
+const Type *VarDecl::declare(Lowering &, const Type *base, DeclInfo &info) {
+    info.name = name;
+    return base;
+}
+
+const Type *ArrayDecl::declare(Lowering &L, const Type *base,
+                               DeclInfo &info) {
+    long len = -1;
+    if (dim && (!dim->eval_const(len) || len < 0)) {
+        L.error("array size is not a non-negative constant");
+        len = 1;
+    }
+    if (base->is_func() || base->is_void()) {
+        L.error("invalid array element type '%s'", base->str().c_str());
+        base = Type::int_type();
+    }
+    return name->declare(L, Type::array_of(base, len), info);
+}
+
+const Type *FuncDecl::declare(Lowering &L, const Type *base,
+                              DeclInfo &info) {
+    std::vector<const Type *> types;
+    if (params) {
+        for (auto &p: *params) {
+            std::string pname;
+            auto t = p->declare(L, pname);
+            // "(void)" is an empty parameter list
+            if (t->is_void() && params->size() == 1 && pname.empty()) break;
+            types.push_back(t);
+        }
+    }
+    if (base->is_func() || base->is_array()) {
+        L.error("invalid function return type '%s'", base->str().c_str());
+        base = Type::int_type();
+    }
+    info.params = params.get();
+    return name->declare(L, Type::func_returning(base, std::move(types),
+                                                 is_variadic, params != NULL),
+                         info);
+}
+
+const Type *ParamDeclAST::declare(Lowering &L, std::string &name) {
+    auto t = type_of_spec(get_type());
+    if (decl) {
+        DeclInfo info;
+        t = decl->declare(L, t, info);
+        name = info.name;
+    }
+    if (t->is_array()) return Type::pointer_to(t->base);
+    if (t->is_func()) return Type::pointer_to(t);
+    return t;
+}
+
+void FuncDeclAST::declare(Lowering &L) {
+    DeclInfo info;
+    auto type = decl->declare(L, type_of_spec(get_type()), info);
+    if (!type->is_func()) return;
+    L.declare(info.name, {Symbol::GLOBAL, type, 0});
+    L.define_function(info.name);
+}
+
+void FuncDeclAST::lower(Lowering &L) {
+    DeclInfo info;
+    auto type = decl->declare(L, type_of_spec(get_type()), info);
+    if (!type->is_func()) {
+        L.error("'%s' is not a function", info.name.c_str());
+        return;
+    }
+    L.declare(info.name, {Symbol::GLOBAL, type, 0});
+    L.define_function(info.name);
+    L.begin_function(info.name, type);
+    L.push_scope();
+    // Parameters are copied into locals on entry, like any other variable
+    for (size_t i = 0; i < type->params.size(); i++) {
+        std::string pname;
+        auto ptype = (*info.params)[i]->declare(L, pname);
+        if (ptype->is_float()) {
+            L.error("floating point types are not supported");
+            continue;
+        }
+        int slot = L.local_var(ptype);
+        auto &param = L.emit(IR_PARAM);
+        param.dst = L.func->new_reg();
+        param.imm = i;
+        int v = L.normalize(param.dst, ptype);
+        auto &addr = L.emit(IR_LOCAL);
+        addr.dst = L.func->new_reg();
+        addr.imm = slot;
+        L.emit_store(addr.dst, v, ptype);
+        L.declare(pname, {Symbol::LOCAL, ptype, slot});
+    }
+    body->lower(L);
+    L.pop_scope();
+    L.end_function();
+}
+
+void InitDecl::lower(Lowering &L, const Type *base) {
+    DeclInfo info;
+    auto type = decl->declare(L, base, info);
+    if (type->is_func()) {
+        if (init) L.error("function '%s' is initialized", info.name.c_str());
+        L.declare(info.name, {Symbol::GLOBAL, type, 0});
+        return;
+    }
+    if (type->is_void() || type->is_float()) {
+        L.error("variable '%s' has unsupported type '%s'",
+                info.name.c_str(), type->str().c_str());
+        return;
+    }
+    if (L.at_file_scope()) {
+        L.define_global(info.name, type, init.get());
+        return;
+    }
+
+    // A char array may be initialized with a string literal, which also
+    // determines its size if it's not given. Reuse the code for static
+    // initializers to get at the bytes.
+    if (type->is_array() && init) {
+        IRGlobal g;
+        g.size = type->len < 0 ? 0 : type->size();
+        g.data.assign(g.size, '\0');
+        if (!init->init_static(L, type, g)) {
+            L.error("invalid initializer for array '%s'", info.name.c_str());
+            return;
+        }
+        if (type->len < 0)
+            type = Type::array_of(type->base, g.size);
+        int slot = L.local_var(type);
+        L.declare(info.name, {Symbol::LOCAL, type, slot});
+        for (long off = 0; off < g.size; off += 8) {
+            long n = std::min(8L, g.size - off);
+            while (n & (n - 1)) n--;  // 1, 2, 4 or 8 bytes at a time
+            long v = 0;
+            for (long i = n - 1; i >= 0; i--)
+                v = v << 8 | (unsigned char)g.data[off + i];
+            auto &a = L.emit(IR_LOCAL);
+            int base_reg = a.dst = L.func->new_reg();
+            a.imm = slot;
+            int addr = L.emit_binary(IR_ADD, base_reg, L.emit_const(off));
+            int val = L.emit_const(v);
+            auto &st = L.emit(IR_STORE);
+            st.args = {addr, val};
+            st.size = n;
+            off -= 8 - n;
+        }
+        return;
+    }
+    if (type->is_array() && type->len < 0) {
+        L.error("array size missing in '%s'", info.name.c_str());
+        return;
+    }
+    int slot = L.local_var(type);
+    // The variable is in scope in its own initializer
+    L.declare(info.name, {Symbol::LOCAL, type, slot});
+    if (init) {
+        auto v = L.convert(init->lower(L), type);
+        auto &a = L.emit(IR_LOCAL);
+        a.dst = L.func->new_reg();
+        a.imm = slot;
+        L.emit_store(a.dst, v.reg, type);
+    }
+}
+
+void DeclAST::lower(Lowering &L) {
+    auto base = type_of_spec(get_type());
+    for (auto &d: *decl) d.lower(L, base);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Statements
+
+void LabelStmtAST::lower(Lowering &L) {
+    IRBlock *b;
+    if (type == LABEL) {
+        b = L.label_block(*label, true);
+    } else {
+        auto head = L.switch_head();
+        if (!head) {
+            L.error("%s label not within a switch statement",
+                    type == CASE ? "case" : "default");
+            stmt->lower(L);
+            return;
+        }
+        b = L.new_block();
+        if (type == DEFAULT) {
+            if (head->targets[0]) L.error("multiple default labels");
+            head->targets[0] = b;
+        } else {
+            long v = 0;
+            if (!case_exp->eval_const(v))
+                L.error("case label is not an integer constant");
+            for (long c: head->cases) {
+                if (c == v) L.error("duplicate case value %ld", v);
+            }
+            head->cases.push_back(v);
+            head->targets.push_back(b);
+        }
+    }
+    L.emit_jmp(b);
+    L.set_block(b);
+    stmt->lower(L);
+}
+
+void ExprStmtAST::lower(Lowering &L) {
+    e->lower(L);
+}
+
+void BlockStmtAST::lower(Lowering &L) {
+    L.push_scope();
+    for (auto &d: *decls) d->lower(L);
+    for (auto &s: *stmts) s->lower(L);
+    L.pop_scope();
+}
+
+void IfStmtAST::lower(Lowering &L) {
+    auto then_block = L.new_block();
+    auto else_block = else_branch ? L.new_block() : NULL;
+    auto join = L.new_block();
+    cond->lower_cond(L, then_block, else_block ? else_block : join,
+                     "in if condition");
+    L.set_block(then_block);
+    then_branch->lower(L);
+    L.emit_jmp(join);
+    if (else_block) {
+        L.set_block(else_block);
+        else_branch->lower(L);
+        L.emit_jmp(join);
+    }
+    L.set_block(join);
+}
+
+void SwitchStmtAST::lower(Lowering &L) {
+    auto c = cond->lower(L);
+    if (!c.type->is_integer()) {
+        L.error("switch quantity is not an integer");
+        c = L.zero();
+    }
+    // Cases are compared against the promoted value, so convert them to the
+    // same type when the switch is complete.
+    auto type = L.arith_type(c.type, Type::int_type());
+    c = L.convert(c, type);
+    auto &sw = L.emit(IR_SWITCH);
+    sw.args = {c.reg};
+    sw.targets = {NULL};
+    auto head = L.current();
+    auto exit = L.new_block();
+    L.enter_switch(head);
+    L.enter_loop(exit, NULL);
+    L.set_block(L.new_block());  // unreachable unless labeled
+    body->lower(L);
+    L.emit_jmp(exit);
+    L.leave_loop();
+    L.leave_switch();
+    auto &term = head->terminator();
+    if (!term.targets[0]) term.targets[0] = exit;
+    for (auto &v: term.cases) {
+        if (type->kind == TY_INT) v = (int)v;
+        else if (type->kind == TY_UINT) v = (unsigned)v;
+    }
+    L.set_block(exit);
+}
+
+void ForStmtAST::lower(Lowering &L) {
+    if (init) init->lower(L);
+    auto exit = L.new_block();
+    auto next = L.new_block();
+    L.enter_loop(exit, next);
+    next->loop_depth++;
+    auto head = L.new_block();
+    auto body_block = L.new_block();
+    L.emit_jmp(head);
+    L.set_block(head);
+    if (cond) {
+        cond->lower_cond(L, body_block, exit, "in for condition");
+    } else {
+        L.emit_jmp(body_block);
+    }
+    L.set_block(body_block);
+    body->lower(L);
+    L.emit_jmp(next);
+    L.set_block(next);
+    if (incr) incr->lower(L);
+    L.emit_jmp(head);
+    L.leave_loop();
+    L.set_block(exit);
+}
+
+void WhileStmtAST::lower(Lowering &L) {
+    auto exit = L.new_block();
+    auto head = L.new_block();
+    L.enter_loop(exit, head);
+    head->loop_depth++;
+    auto body_block = L.new_block();
+    L.emit_jmp(head);
+    L.set_block(head);
+    cond->lower_cond(L, body_block, exit, "in while condition");
+    L.set_block(body_block);
+    body->lower(L);
+    L.emit_jmp(head);
+    L.leave_loop();
+    L.set_block(exit);
+}
+
+void DoStmtAST::lower(Lowering &L) {
+    auto exit = L.new_block();
+    auto next = L.new_block();
+    L.enter_loop(exit, next);
+    next->loop_depth++;
+    auto body_block = L.new_block();
+    L.emit_jmp(body_block);
+    L.set_block(body_block);
+    body->lower(L);
+    L.emit_jmp(next);
+    L.set_block(next);
+    cond->lower_cond(L, body_block, exit, "in do condition");
+    L.leave_loop();
+    L.set_block(exit);
+}
+
+void JumpStmtAST::lower(Lowering &L) {
+    IRBlock *target = NULL;
+    switch (type) {
+    case GOTO:
+        target = L.label_block(*label, false);
+        break;
+    case CONTINUE:
+        target = L.continue_target();
+        if (!target) L.error("continue statement not within a loop");
+        break;
+    case BREAK:
+        target = L.break_target();
+        if (!target) L.error("break statement not within loop or switch");
+        break;
+    }
+    if (target) L.emit_jmp(target);
+}
+
+void ReturnStmtAST::lower(Lowering &L) {
+    auto ret_type = L.func->type->base;
+    if (e && ret_type->is_void()) {
+        L.error("return with a value in function returning void");
+        e->lower(L);
+        L.emit(IR_RET);
+    } else if (e) {
+        auto v = L.convert(e->lower(L), ret_type);
+        L.emit(IR_RET).args = {v.reg};
+    } else {
+        L.emit(IR_RET);
+    }
+}
+
+void EmptyStmtAST::lower(Lowering &) {}
+
+////////////////////////////////////////////////////////////////////////////
+// Expressions
+
+Value ExprAST::lower_addr(Lowering &L) {
+    L.error("lvalue required");
+    return {L.emit_const(0), Type::int_type()};
+}
+
+Value ExprAST::lower_callee(Lowering &L) {
+    return lower(L);
+}
+
+void ExprAST::lower_cond(Lowering &L, IRBlock *then_block,
+                         IRBlock *else_block, const char *context) {
+    auto c = lower(L);
+    if (!c.type->is_scalar()) L.error("scalar required %s", context);
+    L.emit_br(c.reg, then_block, else_block);
+}
+
+bool ExprAST::init_static(Lowering &L, const Type *type, IRGlobal &g) {
+    long v;
+    if (type->is_array()) return false;
+    if (eval_const(v)) {
+        put_int(g.data, 0, v, type->size());
+        return true;
+    }
+    std::string sym;
+    if (type->size() == 8 && static_addr(L, sym)) {
+        // Arrays and functions decay to their address
+        auto s = L.lookup(sym);
+        if (s->type->is_array() || s->type->is_func()) {
+            g.relocs.push_back({0, sym, 0});
+            return true;
+        }
+    }
+    return false;
+}
+
+Value VarExprAST::lower_addr(Lowering &L) {
+    auto sym = L.lookup(*name);
+    if (!sym) {
+        L.error("'%s' undeclared", name->c_str());
+        return {L.emit_const(0), Type::int_type()};
+    }
+    auto &i = L.emit(sym->kind == Symbol::LOCAL ? IR_LOCAL : IR_GLOBAL);
+    i.dst = L.func->new_reg();
+    if (sym->kind == Symbol::LOCAL)
+        i.imm = sym->slot;
+    else
+        i.sym = *name;
+    return {i.dst, sym->type};
+}
+
+Value VarExprAST::lower(Lowering &L) {
+    return L.rvalue(lower_addr(L));
+}
+
+Value VarExprAST::lower_callee(Lowering &L) {
+    if (!L.lookup(*name)) {
+        // Implicit declaration as "int name()", in the outermost scope
+        fprintf(stderr, "mycc: warning: implicit declaration of function "
+                "'%s'\n", name->c_str());
+        auto type = Type::func_returning(Type::int_type(), {}, false, false);
+        L.declare(*name, {Symbol::GLOBAL, type, 0});
+    }
+    return lower(L);
+}
+
+bool VarExprAST::static_addr(Lowering &L, std::string &sym) {
+    auto s = L.lookup(*name);
+    if (!s || s->kind != Symbol::GLOBAL) return false;
+    sym = *name;
+    return true;
+}
+
+Value NumberExprAST::lower(Lowering &L) {
+    return {L.emit_const(v), fits_int(v) ? Type::int_type()
+                                         : Type::long_type()};
+}
+
+bool NumberExprAST::eval_const(long &v) {
+    v = this->v;
+    return true;
+}
+
+Value StringExprAST::lower(Lowering &L) {
+    auto name = L.string_literal(str);
+    auto &i = L.emit(IR_GLOBAL);
+    i.dst = L.func->new_reg();
+    i.sym = name;
+    return {i.dst, Type::pointer_to(Type::char_type())};
+}
+
+bool StringExprAST::init_static(Lowering &L, const Type *type, IRGlobal &g) {
+    if (type->is_array()) {
+        if (type->base->kind != TY_CHAR) return false;
+        auto s = unescape(str);
+        if (type->len < 0) {
+            g.size = s.size() + 1;
+            g.data.assign(g.size, '\0');
+        }
+        g.data.replace(0, std::min(s.size(), (size_t)g.size), s, 0,
+                       std::min(s.size(), (size_t)g.size));
+        return true;
+    }
+    if (!type->is_pointer()) return false;
+    g.relocs.push_back({0, L.string_literal(str), 0});
+    return true;
+}
+
+Value IndexExprAst::lower_addr(Lowering &L) {
+    auto b = base->lower(L);
+    auto i = index->lower(L);
+    if (i.type->is_pointer()) std::swap(b, i);
+    if (!b.type->is_pointer() || !i.type->is_integer()) {
+        L.error("subscripted value is neither array nor pointer");
+        return {L.emit_const(0), Type::int_type()};
+    }
+    auto elem = b.type->base;
+    i = L.convert(i, Type::long_type());
+    int off = i.reg;
+    if (elem->size() != 1)
+        off = L.emit_binary(IR_MUL, i.reg, L.emit_const(elem->size()));
+    return {L.emit_binary(IR_ADD, b.reg, off), elem};
+}
+
+Value IndexExprAst::lower(Lowering &L) {
+    return L.rvalue(lower_addr(L));
+}
+
+Value CallExprAST::lower(Lowering &L) {
+    std::string sym;
+    Value f = func->lower_callee(L);
+    if (!f.type->is_pointer() || !f.type->base->is_func()) {
+        L.error("called object is not a function");
+        return L.zero();
+    }
+    auto ftype = f.type->base;
+    size_t nargs = args ? args->size() : 0;
+    if (ftype->has_proto) {
+        if (nargs < ftype->params.size() ||
+            (nargs > ftype->params.size() && !ftype->is_variadic))
+            L.error("wrong number of arguments to function");
+    }
+    std::vector<int> regs;
+    for (size_t i = 0; i < nargs; i++) {
+        auto a = (*args)[i]->lower(L);
+        if (ftype->has_proto && i < ftype->params.size())
+            a = L.convert(a, ftype->params[i]);
+        else if (!a.type->is_scalar())
+            L.error("invalid argument type '%s'", a.type->str().c_str());
+        regs.push_back(a.reg);
+    }
+    // Calls to functions known by name are direct. The address computed
+    // above is then dead, and left for the optimizer to clean up.
+    auto s = func->static_addr(L, sym) ? L.lookup(sym) : NULL;
+    auto &call = L.emit(IR_CALL);
+    if (s && s->type->is_func()) {
+        call.sym = sym;
+    } else {
+        call.args.push_back(f.reg);
+    }
+    call.args.insert(call.args.end(), regs.begin(), regs.end());
+    call.is_variadic = ftype->is_variadic || !ftype->has_proto;
+    auto ret = ftype->base;
+    if (ret->is_void()) return {-1, ret};
+    call.dst = L.func->new_reg();
+    // Only the low bits of narrow return values are defined by the ABI
+    return {L.normalize(call.dst, ret), ret};
+}
+
+Value UnaryExprAST::lower_addr(Lowering &L) {
+    if (token.type != TOK_STAR) return ExprAST::lower_addr(L);
+    auto p = exp->lower(L);
+    if (!p.type->is_pointer() || p.type->base->is_void()) {
+        L.error("invalid type argument of unary '*'");
+        return {L.emit_const(0), Type::int_type()};
+    }
+    return {p.reg, p.type->base};
+}
+
+Value UnaryExprAST::lower(Lowering &L) {
+    switch (token.type) {
+    case TOK_STAR:
+        return L.rvalue(lower_addr(L));
+    case TOK_AND: {
+        auto lv = exp->lower_addr(L);
+        return {lv.reg, Type::pointer_to(lv.type)};
+    }
+    case TOK_INCR:
+    case TOK_DECR: {
+        auto lv = exp->lower_addr(L);
+        if (!lv.type->is_scalar()) {
+            L.error("invalid operand to '%s'", token.lexeme.c_str());
+            return L.zero();
+        }
+        int old = L.emit_load(lv.reg, lv.type);
+        long step = lv.type->is_pointer() ? lv.type->base->size() : 1;
+        int v = L.emit_binary(token.type == TOK_INCR ? IR_ADD : IR_SUB,
+                              old, L.emit_const(step));
+        v = L.normalize(v, lv.type);
+        L.emit_store(lv.reg, v, lv.type);
+        return {postfix ? old : v, lv.type};
+    }
+    default:
+        break;
+    }
+    auto v = exp->lower(L);
+    if (token.type == TOK_BANG) {
+        if (!v.type->is_scalar()) L.error("scalar required for '!'");
+        return {L.emit_binary(IR_EQ, v.reg, L.emit_const(0)),
+                Type::int_type()};
+    }
+    if (!v.type->is_integer()) {
+        L.error("invalid operand to unary '%s'", token.lexeme.c_str());
+        return L.zero();
+    }
+    auto type = L.arith_type(v.type, Type::int_type());
+    v = L.convert(v, type);
+    switch (token.type) {
+    case TOK_MINUS:
+        return {L.normalize(L.emit_unary(IR_NEG, v.reg), type), type};
+    case TOK_TILDE:
+        return {L.normalize(L.emit_unary(IR_NOT, v.reg), type), type};
+    default:  // TOK_PLUS
+        return v;
+    }
+}
+
+void UnaryExprAST::lower_cond(Lowering &L, IRBlock *then_block,
+                              IRBlock *else_block, const char *context) {
+    if (token.type == TOK_BANG)
+        exp->lower_cond(L, else_block, then_block, "for '!'");
+    else
+        ExprAST::lower_cond(L, then_block, else_block, context);
+}
+
+int UnaryExprAST::speculation_cost() {
+    switch (token.type) {
+    case TOK_MINUS:
+    case TOK_PLUS:
+    case TOK_TILDE:
+    case TOK_BANG: {
+        int n = exp->speculation_cost();
+        return n < 0 ? -1 : n + 1;
+    }
+    default:
+        return -1;
+    }
+}
+
+bool UnaryExprAST::eval_const(long &v) {
+    if (postfix || !exp->eval_const(v)) return false;
+    switch (token.type) {
+    case TOK_MINUS: v = -v; return true;
+    case TOK_PLUS:  return true;
+    case TOK_TILDE: v = ~v; return true;
+    case TOK_BANG:  v = !v; return true;
+    default:        return false;
+    }
+}
+
+bool UnaryExprAST::init_static(Lowering &L, const Type *type, IRGlobal &g) {
+    std::string sym;
+    if (token.type == TOK_AND && type->size() == 8 &&
+        exp->static_addr(L, sym)) {
+        g.relocs.push_back({0, sym, 0});
+        return true;
+    }
+    return ExprAST::init_static(L, type, g);
+}
+
+namespace
+{
+
+IROp arith_op(TokenType t, bool is_signed) {
+    switch (t) {
+    case TOK_PLUS:   return IR_ADD;
+    case TOK_MINUS:  return IR_SUB;
+    case TOK_STAR:   return IR_MUL;
+    case TOK_SLASH:  return is_signed ? IR_DIV : IR_UDIV;
+    case TOK_MOD:    return is_signed ? IR_MOD : IR_UMOD;
+    case TOK_AND:    return IR_AND;
+    case TOK_OR:     return IR_OR;
+    case TOK_XOR:    return IR_XOR;
+    case TOK_LSHIFT: return IR_SHL;
+    case TOK_RSHIFT: return is_signed ? IR_SAR : IR_SHR;
+    case TOK_EQ:     return IR_EQ;
+    case TOK_NE:     return IR_NE;
+    case TOK_LT:     return is_signed ? IR_LT : IR_ULT;
+    case TOK_LE:     return is_signed ? IR_LE : IR_ULE;
+    case TOK_GT:     return is_signed ? IR_GT : IR_UGT;
+    default:         return is_signed ? IR_GE : IR_UGE;
+    }
+}
+
+bool is_comparison(TokenType t) {
+    return t >= TOK_LT && t <= TOK_NE;
+}
+
+// The most instructions evaluated for nothing to avoid a branch: those of
+// the right side of && and ||, or of both arms of ?:, one of which would
+// have been evaluated anyway
+const int max_speculated = 6;
+
+// Whether code of speculation cost @cost is evaluated unconditionally in
+// place of a branch around it
+bool speculate(Lowering &L, int cost) {
+    return L.if_conversion && cost >= 0 && cost <= max_speculated;
+}
+
+// The type of a conditional expression with arms of types @t and @e
+const Type *conditional_type(Lowering &L, const Type *t, const Type *e) {
+    if (t->is_void() || e->is_void()) return Type::void_type();
+    if (t->is_integer() && e->is_integer()) return L.arith_type(t, e);
+    if (t->is_pointer()) return t;
+    if (e->is_pointer()) return e;
+    L.error("type mismatch in conditional expression");
+    return Type::int_type();
+}
+
+}
+
+Value BinaryExprAST::lower(Lowering &L) {
+    auto op = token.type;
+    if (op == TOK_ASSIGN) {
+        auto lv = LHS->lower_addr(L);
+        if (lv.type->is_array() || lv.type->is_func()) {
+            L.error("assignment to expression with array or function type");
+            return L.zero();
+        }
+        auto v = L.convert(RHS->lower(L), lv.type);
+        L.emit_store(lv.reg, v.reg, lv.type);
+        return v;
+    }
+    if (op == TOK_AND_AND || op == TOK_OR_OR) {
+        // Both sides as 0 or 1, combined without a branch
+        if (speculate(L, RHS->speculation_cost())) {
+            auto l = L.to_bool(LHS->lower(L));
+            auto r = L.to_bool(RHS->lower(L));
+            return {L.emit_binary(op == TOK_AND_AND ? IR_AND : IR_OR,
+                                  l.reg, r.reg),
+                    Type::int_type()};
+        }
+        // The result is kept in a temporary, since the IR only allows one
+        // definition of a register.
+        int slot = L.local_var(Type::int_type());
+        auto &a = L.emit(IR_LOCAL);
+        a.dst = L.func->new_reg();
+        a.imm = slot;
+        int addr = a.dst;
+        auto true_block = L.new_block();
+        auto false_block = L.new_block();
+        auto join = L.new_block();
+        lower_cond(L, true_block, false_block,
+                   op == TOK_AND_AND ? "for '&&'" : "for '||'");
+        L.set_block(true_block);
+        L.emit_store(addr, L.emit_const(1), Type::int_type());
+        L.emit_jmp(join);
+        L.set_block(false_block);
+        L.emit_store(addr, L.emit_const(0), Type::int_type());
+        L.emit_jmp(join);
+        L.set_block(join);
+        return {L.emit_load(addr, Type::int_type()), Type::int_type()};
+    }
+
+    auto l = LHS->lower(L);
+    auto r = RHS->lower(L);
+    if (!l.type->is_scalar() || !r.type->is_scalar()) {
+        L.error("invalid operands to binary '%s'", token.lexeme.c_str());
+        return L.zero();
+    }
+    // Pointer arithmetic
+    if (op == TOK_PLUS && r.type->is_pointer()) std::swap(l, r);
+    if ((op == TOK_PLUS || op == TOK_MINUS) && l.type->is_pointer()) {
+        long size = l.type->base->size();
+        if (r.type->is_pointer()) {
+            if (op == TOK_PLUS) {
+                L.error("invalid operands to binary '+'");
+                return L.zero();
+            }
+            int diff = L.emit_binary(IR_SUB, l.reg, r.reg);
+            if (size != 1)
+                diff = L.emit_binary(IR_DIV, diff, L.emit_const(size));
+            return {diff, Type::long_type()};
+        }
+        r = L.convert(r, Type::long_type());
+        int off = r.reg;
+        if (size != 1)
+            off = L.emit_binary(IR_MUL, off, L.emit_const(size));
+        return {L.emit_binary(op == TOK_PLUS ? IR_ADD : IR_SUB, l.reg, off),
+                l.type};
+    }
+    if (is_comparison(op)) {
+        bool is_signed = true;
+        if (l.type->is_pointer() || r.type->is_pointer()) {
+            is_signed = false;
+        } else {
+            auto type = L.arith_type(l.type, r.type);
+            l = L.convert(l, type);
+            r = L.convert(r, type);
+            is_signed = type->is_signed();
+        }
+        return {L.emit_binary(arith_op(op, is_signed), l.reg, r.reg),
+                Type::int_type()};
+    }
+    if (!l.type->is_integer() || !r.type->is_integer()) {
+        L.error("invalid operands to binary '%s'", token.lexeme.c_str());
+        return L.zero();
+    }
+    const Type *type;
+    if (op == TOK_LSHIFT || op == TOK_RSHIFT) {
+        type = L.arith_type(l.type, Type::int_type());
+        r = L.convert(r, Type::int_type());
+    } else {
+        type = L.arith_type(l.type, r.type);
+        r = L.convert(r, type);
+    }
+    l = L.convert(l, type);
+    int v = L.emit_binary(arith_op(op, type->is_signed()), l.reg, r.reg);
+    switch (op) {
+    case TOK_PLUS:
+    case TOK_MINUS:
+    case TOK_STAR:
+    case TOK_LSHIFT:
+        v = L.normalize(v, type);
+        break;
+    default:
+        break;
+    }
+    return {v, type};
+}
+
+void BinaryExprAST::lower_cond(Lowering &L, IRBlock *then_block,
+                               IRBlock *else_block, const char *context) {
+    if (token.type != TOK_AND_AND && token.type != TOK_OR_OR) {
+        ExprAST::lower_cond(L, then_block, else_block, context);
+        return;
+    }
+    // The left side decides on its own one way, otherwise the right does
+    auto rhs_block = L.new_block();
+    if (token.type == TOK_AND_AND)
+        LHS->lower_cond(L, rhs_block, else_block, context);
+    else
+        LHS->lower_cond(L, then_block, rhs_block, context);
+    L.set_block(rhs_block);
+    RHS->lower_cond(L, then_block, else_block, context);
+}
+
+int BinaryExprAST::speculation_cost() {
+    switch (token.type) {
+    case TOK_ASSIGN:
+    case TOK_SLASH:
+    case TOK_MOD:
+        return -1;
+    default:
+        break;
+    }
+    int l = LHS->speculation_cost(), r = RHS->speculation_cost();
+    if (l < 0 || r < 0) return -1;
+    // Turning both sides of && and || to 0 or 1 takes two more
+    return l + r + (token.type == TOK_AND_AND || token.type == TOK_OR_OR
+                    ? 3 : 1);
+}
+
+bool BinaryExprAST::eval_const(long &v) {
+    long a, b;
+    if (token.type == TOK_ASSIGN) return false;
+    if (!LHS->eval_const(a) || !RHS->eval_const(b)) return false;
+    switch (token.type) {
+    case TOK_PLUS:    v = a + b; break;
+    case TOK_MINUS:   v = a - b; break;
+    case TOK_STAR:    v = a * b; break;
+    case TOK_SLASH:   if (!b) return false; v = a / b; break;
+    case TOK_MOD:     if (!b) return false; v = a % b; break;
+    case TOK_AND:     v = a & b; break;
+    case TOK_OR:      v = a | b; break;
+    case TOK_XOR:     v = a ^ b; break;
+    case TOK_LSHIFT:  v = a << b; break;
+    case TOK_RSHIFT:  v = a >> b; break;
+    case TOK_EQ:      v = a == b; break;
+    case TOK_NE:      v = a != b; break;
+    case TOK_LT:      v = a < b; break;
+    case TOK_LE:      v = a <= b; break;
+    case TOK_GT:      v = a > b; break;
+    case TOK_GE:      v = a >= b; break;
+    case TOK_AND_AND: v = a && b; break;
+    case TOK_OR_OR:   v = a || b; break;
+    default:          return false;
+    }
+    return true;
+}
+
+Value TernaryExprAST::lower(Lowering &L) {
+    int t_cost = then_expr->speculation_cost();
+    int e_cost = else_expr->speculation_cost();
+    if (speculate(L, t_cost < 0 || e_cost < 0 ? -1 : t_cost + e_cost)) {
+        // Both arms, and a select of one
+        auto c = cond->lower(L);
+        if (!c.type->is_scalar()) L.error("scalar required in conditional");
+        auto t = then_expr->lower(L);
+        auto e = else_expr->lower(L);
+        type = conditional_type(L, t.type, e.type);
+        t = L.convert(t, type);
+        e = L.convert(e, type);
+        auto &sel = L.emit(IR_SELECT);
+        sel.dst = L.func->new_reg();
+        sel.args = {c.reg, t.reg, e.reg};
+        return {sel.dst, type};
+    }
+    auto then_block = L.new_block();
+    auto else_block = L.new_block();
+    auto join = L.new_block();
+    cond->lower_cond(L, then_block, else_block, "in conditional");
+
+    // We only know the type of the result once both arms are lowered, so
+    // store each arm as a long and convert after the join.
+    int slot = L.local_var(Type::long_type());
+    L.set_block(then_block);
+    auto t = then_expr->lower(L);
+    auto then_end = L.current();
+    L.set_block(else_block);
+    auto e = else_expr->lower(L);
+    auto else_end = L.current();
+
+    type = conditional_type(L, t.type, e.type);
+    auto store_arm = [&](IRBlock *end, Value v) {
+        L.set_block(end);
+        if (!type->is_void()) {
+            v = L.convert(v, type);
+            auto &a = L.emit(IR_LOCAL);
+            a.dst = L.func->new_reg();
+            a.imm = slot;
+            L.emit_store(a.dst, v.reg, Type::long_type());
+        }
+        L.emit_jmp(join);
+    };
+    store_arm(then_end, t);
+    store_arm(else_end, e);
+    L.set_block(join);
+    if (type->is_void()) return {-1, type};
+    auto &a = L.emit(IR_LOCAL);
+    a.dst = L.func->new_reg();
+    a.imm = slot;
+    return {L.emit_load(a.dst, Type::long_type()), type};
+}
+
+void TernaryExprAST::lower_cond(Lowering &L, IRBlock *then_block,
+                                IRBlock *else_block, const char *context) {
+    // Each arm branches on its own
+    auto then_arm = L.new_block();
+    auto else_arm = L.new_block();
+    cond->lower_cond(L, then_arm, else_arm, "in conditional");
+    L.set_block(then_arm);
+    then_expr->lower_cond(L, then_block, else_block, context);
+    L.set_block(else_arm);
+    else_expr->lower_cond(L, then_block, else_block, context);
+}
+
+int TernaryExprAST::speculation_cost() {
+    int c = cond->speculation_cost();
+    int t = then_expr->speculation_cost();
+    int e = else_expr->speculation_cost();
+    if (c < 0 || t < 0 || e < 0) return -1;
+    return c + t + e + 1;
+}
+
+bool TernaryExprAST::eval_const(long &v) {
+    long c;
+    if (!cond->eval_const(c)) return false;
+    return c ? then_expr->eval_const(v) : else_expr->eval_const(v);
+}
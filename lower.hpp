@@ -0,0 +1,122 @@
+#ifndef LOWER_HPP
+#define LOWER_HPP
+#include "ir.hpp"
+#include "scan.hpp"
+#include "types.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+class ExprAST;
+
+// An rvalue is a register holding a (normalized) value of @type. For an
+// lvalue, as returned by ExprAST::lower_addr, @reg holds the address of an
+// object of @type instead.
+struct Value {
+    int reg;
+    const Type *type;
+};
+
+struct Symbol {
+    enum Kind {
+        LOCAL,
+        GLOBAL,
+    };
+    Kind kind;
+    const Type *type;
+    int slot;  // LOCAL only
+};
+
+// Lowering holds the state needed to translate the AST of a translation unit
+// into an IRModule. The AST nodes drive the translation through their lower()
+// methods, calling back into this class to emit instructions and to resolve
+// names.
+class Lowering {
+public:
+    IRModule &module;
+    IRFunction *func = NULL;
+    bool failed = false;
+    // Evaluate the arms of ?: and the right side of && and || both ways
+    // when that's cheap and safe, choosing with selects instead of
+    // branching. Set from OptOptions::if_conversion.
+    bool if_conversion = true;
+
+    Lowering(IRModule &module) : module(module) { push_scope(); }
+
+    void error(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    // Scopes
+    void push_scope() { scopes.emplace_back(); }
+    void pop_scope() { scopes.pop_back(); }
+    void declare(const std::string &name, const Symbol &sym);
+    const Symbol *lookup(const std::string &name);
+    bool at_file_scope() { return func == NULL; }
+
+    // Functions and globals
+    // Note that @name has a body, which it can have only one of
+    void define_function(const std::string &name);
+    void begin_function(const std::string &name, const Type *type);
+    void end_function();
+    void define_global(const std::string &name, const Type *type,
+                       ExprAST *init);
+    int local_var(const Type *type);
+
+    // Blocks and control flow
+    IRBlock *current() { return block; }
+    IRBlock *new_block();
+    void set_block(IRBlock *b) { block = b; }
+    IRBlock *label_block(const std::string &name, bool define);
+    // @cont is NULL for a switch, which only is a target for break
+    void enter_loop(IRBlock *brk, IRBlock *cont);
+    void leave_loop();
+    IRBlock *break_target();
+    IRBlock *continue_target();
+    // @head is the block ending in the IR_SWITCH of the statement
+    void enter_switch(IRBlock *head) { switches.push_back(head); }
+    IRInstr *switch_head();
+    void leave_switch() { switches.pop_back(); }
+
+    // Instructions
+    IRInstr &emit(IROp op);
+    int emit_const(long v);
+    int emit_unary(IROp op, int a, int size = 8);
+    int emit_binary(IROp op, int a, int b);
+    int emit_load(int addr, const Type *type);
+    void emit_store(int addr, int v, const Type *type);
+    void emit_jmp(IRBlock *target);
+    void emit_br(int cond, IRBlock *then_block, IRBlock *else_block);
+    // Create the data for a string literal, return its symbol
+    std::string string_literal(const std::string &lexeme);
+
+    // Conversions
+    int normalize(int reg, const Type *type);
+    Value rvalue(Value lv);
+    Value convert(Value v, const Type *type);
+    Value to_bool(Value v);
+    const Type *arith_type(const Type *a, const Type *b);
+    Value zero() { return {emit_const(0), Type::int_type()}; }
+private:
+    IRBlock *block = NULL;
+    std::vector<std::unordered_map<std::string, Symbol>> scopes;
+    std::unordered_map<std::string, size_t> global_index;
+    std::unordered_set<std::string> function_bodies;
+    struct Label {
+        IRBlock *block;
+        bool defined;
+    };
+    std::unordered_map<std::string, Label> labels;
+    std::vector<IRBlock *> break_targets;
+    std::vector<IRBlock *> continue_targets;
+    std::vector<IRBlock *> switches;
+    int loop_depth = 0;
+    // String literals are named after the function or variable using them
+    std::string owner;
+    int nstrings = 0;
+};
+
+const Type *type_of_spec(const Token &spec);
+// Decode the escape sequences of a string literal as it appears in the
+// source. The scanner hands us the characters between the quotes verbatim.
+std::string unescape(const std::string &s);
+#endif
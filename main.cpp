@@ -1,13 +1,31 @@
+#include "cache.hpp"
+#include "cfg.hpp"
+#include "codegen.hpp"
+#include "dataflow.hpp"
 #include "decl.hpp"
+#include "document.hpp"
+#include "interp.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "lower.hpp"
+#include "onepass.hpp"
+#include "opt.hpp"
 #include "parse.hpp"
 #include "scan.hpp"
+#include "scanthread.hpp"
 #include "stmt.hpp"
+#include "stream.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <getopt.h>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <sys/resource.h>
 #include <vector>
 
 namespace
@@ -24,20 +42,328 @@ std::unique_ptr<std::string> read_file(const char *name) {
     }
 }
 
+void usage() {
+    fprintf(stderr,
+            "Usage: mycc [options] <program> [-- <arguments>]\n"
+            "Without options, print the syntax tree of the program.\n"
+            "  -S            Compile to assembly\n"
+            "  -c            Compile to an object file\n"
+            "  -o <file>     Write output to <file>, or stdout if it's -\n"
+            "  -j <n>        Compile functions on <n> threads\n"
+            "  -f<opt>, -fno-<opt>\n"
+            "                Turn an optimization on or off: inline, sccp\n"
+            "                (constant propagation), gvn (value numbering),\n"
+            "                licm (loop invariant code motion),\n"
+            "                strength-reduce, unroll-loops, vectorize,\n"
+            "                mem2reg (locals in registers),\n"
+            "                strict-aliasing (type-based alias analysis),\n"
+            "                optimize-sibling-calls (tail calls),\n"
+            "                if-conversion (cmov and setcc for cheap ?:,\n"
+            "                && and ||) or peephole (machine code cleanup);\n"
+            "                all are on by default\n"
+            "  -fprofile-generate[=<file>]\n"
+            "                Count the runs of each block of the program,\n"
+            "                adding them up in <file> (default <program>\n"
+            "                with .prof for .c, in the current directory)\n"
+            "  -fprofile-use[=<file>]\n"
+            "                Lay out the blocks, inline and order switch\n"
+            "                cases by the counts in <file>\n"
+            "  -finline-limit=<n>\n"
+            "                Inline functions adding at most n instructions,\n"
+            "                more in loops (default 40)\n"
+            "  -funroll-factor=<n>\n"
+            "                Unroll loops into at most n copies (default 4)\n"
+            "  -msse2, -mavx2\n"
+            "                Vectorize loops with 16-byte SSE2 vectors (the\n"
+            "                default) or 32-byte AVX2 vectors\n"
+            "  -O0-fast      With -S, -c or --run: generate code while parsing,\n"
+            "                without an IR, for compile speed\n"
+            "  --cache-dir <dir>\n"
+            "                With -S or -c: keep the code of each function in\n"
+            "                <dir>, and reuse it while the function and what\n"
+            "                it depends on are unchanged\n"
+            "  --edits <file>\n"
+            "                Apply the edits in <file> to the program after\n"
+            "                parsing it, parsing again only what they change.\n"
+            "                Each line is <offset> <bytes removed> <text\n"
+            "                inserted>, with \\n for newlines; with --stats,\n"
+            "                print how long they took\n"
+            "  --inline-report\n"
+            "                Print the calls inlined and not inlined, and why\n"
+            "  --interp[=ast]\n"
+            "                Run the program with <arguments> in the bytecode\n"
+            "                interpreter, or by walking the syntax tree\n"
+            "  --print-cfg   Print the dominators, dominance frontiers and\n"
+            "                loops of each function\n"
+            "  --print-dataflow\n"
+            "                Print the live registers and reaching stores\n"
+            "                of each block, and loads of uninitialized\n"
+            "                variables, with -fmem2reg off\n"
+            "  --print-ir    Print the intermediate representation\n"
+            "  --run         Compile the program in memory and run it with\n"
+            "                <arguments>\n"
+            "  --scan-thread Scan the program on a thread of its own while\n"
+            "                parsing it, which only pays with a CPU free\n"
+            "                for it\n"
+            "  --stats       Print dead code and register allocation\n"
+            "                statistics, and with -S or -c the most memory\n"
+            "                used and how long parsing took\n"
+            "  --stream      With -S or -c: compile each function as soon\n"
+            "                as it's parsed, then free it, never holding\n"
+            "                the syntax tree or the IR of the whole program;\n"
+            "                only functions defined before a call are\n"
+            "                inlined there\n"
+            "  --tail-call-report\n"
+            "                Print the calls in tail position made jumps, and\n"
+            "                why the others weren't\n");
+    exit(1);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: mycc <program>\n");
+enum Mode {
+    PRINT_AST,
+    PRINT_IR,
+    PRINT_CFG,
+    PRINT_DATAFLOW,
+    ASSEMBLY,
+    RUN,
+    INTERP,
+};
+
+// The profile of @program, by default <program> without the directory and
+// the .c, with .prof
+std::string profile_path(const OptOptions &opts, const char *program) {
+    if (!opts.profile_path.empty()) return opts.profile_path;
+    std::string name = program;
+    name = name.substr(name.rfind('/') + 1);
+    if (name.size() > 2 && name.compare(name.size() - 2, 2, ".c") == 0)
+        name.resize(name.size() - 2);
+    return name + ".prof";
+}
+
+// Apply the edits in the file @path to @doc, printing how long they took
+// with @stats. Returns false on errors, which have been reported; those
+// parsing, as when typing, only matter after the last edit.
+bool apply_edits(Document &doc, const char *path, bool stats) {
+    auto edits = read_file(path);
+    if (!edits) {
+        fprintf(stderr, "mycc: %s: No such file or directory\n", path);
+        return false;
+    }
+    typedef std::chrono::duration<double, std::micro> Micros;
+    double total = 0, longest = 0;
+    std::istringstream lines(*edits);
+    std::string line;
+    bool parsed = true;
+    while (std::getline(lines, line)) {
+        size_t offset, removed;
+        int n = 0;
+        if (sscanf(line.c_str(), "%zu %zu%n", &offset, &removed, &n) < 2 ||
+            offset > doc.text().size() ||
+            removed > doc.text().size() - offset) {
+            fprintf(stderr, "mycc: %s: bad edit '%s'\n", path, line.c_str());
+            return false;
+        }
+        std::string text;
+        for (size_t k = n + (line[n] == ' '); k < line.size(); k++) {
+            char c = line[k];
+            if (c == '\\' && k + 1 < line.size()) {
+                c = line[++k];
+                if (c == 'n') c = '\n';
+                else if (c == 't') c = '\t';
+            }
+            text += c;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        parsed = doc.edit(offset, removed, text);
+        double took = Micros(std::chrono::steady_clock::now() - begin).count();
+        total += took;
+        longest = std::max(longest, took);
+    }
+    if (stats && doc.stats.edits > 0) {
+        fprintf(stderr, "edits: %d in %.1f us on average, %.1f us at most; "
+                "%ld tokens scanned and %ld declarations parsed again\n",
+                doc.stats.edits, total / doc.stats.edits, longest,
+                doc.stats.relexed, doc.stats.reparsed);
+    }
+    return parsed;
+}
+
+void print_peak_memory() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "memory: %ld KB at most\n", usage.ru_maxrss);
+}
+
+// stdout for - as well as none
+FILE *open_output(const char *output) {
+    FILE *out = stdout;
+    if (output && strcmp(output, "-") != 0 && !(out = fopen(output, "w"))) {
+        perror(output);
         exit(1);
     }
-    auto src = read_file(argv[1]);
+    return out;
+}
+
+void write_output(const char *output, const std::string &text) {
+    FILE *out = open_output(output);
+    fwrite(text.data(), 1, text.size(), out);
+    if (out != stdout) fclose(out);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    auto start = std::chrono::steady_clock::now();
+    enum {
+        OPT_CACHE_DIR = 256,
+        OPT_EDITS,
+        OPT_INLINE_REPORT,
+        OPT_INTERP,
+        OPT_PRINT_CFG,
+        OPT_PRINT_DATAFLOW,
+        OPT_PRINT_IR,
+        OPT_RUN,
+        OPT_SCAN_THREAD,
+        OPT_STATS,
+        OPT_STREAM,
+        OPT_TAIL_CALL_REPORT,
+    };
+    static const option long_options[] = {
+        {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+        {"edits", required_argument, NULL, OPT_EDITS},
+        {"inline-report", no_argument, NULL, OPT_INLINE_REPORT},
+        {"interp", optional_argument, NULL, OPT_INTERP},
+        {"print-cfg", no_argument, NULL, OPT_PRINT_CFG},
+        {"print-dataflow", no_argument, NULL, OPT_PRINT_DATAFLOW},
+        {"print-ir", no_argument, NULL, OPT_PRINT_IR},
+        {"run", no_argument, NULL, OPT_RUN},
+        {"scan-thread", no_argument, NULL, OPT_SCAN_THREAD},
+        {"stats", no_argument, NULL, OPT_STATS},
+        {"stream", no_argument, NULL, OPT_STREAM},
+        {"tail-call-report", no_argument, NULL, OPT_TAIL_CALL_REPORT},
+        {NULL, 0, NULL, 0},
+    };
+    Mode mode = PRINT_AST;
+    const char *output = NULL;
+    const char *cache_dir = NULL;
+    const char *edits = NULL;
+    // The options changing the code, as given, for the cache
+    std::string settings;
+    CodegenOptions opts;
+    OptOptions opt_opts;
+    bool walk_ast = false;
+    bool one_pass = false;
+    bool stream = false;
+    bool scan_thread = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "Sco:O:j:f:m:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'S':
+            mode = ASSEMBLY;
+            break;
+        case 'c':
+            mode = ASSEMBLY;
+            opts.object = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'j':
+            opts.jobs = atoi(optarg);
+            if (opts.jobs < 1) usage();
+            break;
+        case 'f':
+            if (!parse_opt_flag(opt_opts, optarg)) usage();
+            settings = settings + "-f" + optarg + " ";
+            break;
+        case 'm':
+            settings = settings + "-m" + optarg + " ";
+            if (strcmp(optarg, "sse2") == 0)
+                opt_opts.vector_width = 16;
+            else if (strcmp(optarg, "avx2") == 0)
+                opt_opts.vector_width = 32;
+            else
+                usage();
+            break;
+        case 'O':
+            // Only the one-pass compiler is selected this way for now
+            if (strcmp(optarg, "0-fast") != 0) usage();
+            one_pass = true;
+            break;
+        case OPT_CACHE_DIR:
+            cache_dir = optarg;
+            break;
+        case OPT_EDITS:
+            edits = optarg;
+            break;
+        case OPT_INLINE_REPORT:
+            opt_opts.inline_report = true;
+            break;
+        case OPT_INTERP:
+            mode = INTERP;
+            if (optarg && strcmp(optarg, "ast") == 0)
+                walk_ast = true;
+            else if (optarg && strcmp(optarg, "bytecode") != 0)
+                usage();
+            break;
+        case OPT_PRINT_CFG:
+            mode = PRINT_CFG;
+            break;
+        case OPT_PRINT_DATAFLOW:
+            mode = PRINT_DATAFLOW;
+            break;
+        case OPT_PRINT_IR:
+            mode = PRINT_IR;
+            break;
+        case OPT_RUN:
+            mode = RUN;
+            break;
+        case OPT_SCAN_THREAD:
+            scan_thread = true;
+            break;
+        case OPT_STATS:
+            opts.stats = true;
+            opt_opts.stats = true;
+            break;
+        case OPT_STREAM:
+            stream = true;
+            break;
+        case OPT_TAIL_CALL_REPORT:
+            opt_opts.tail_call_report = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    bool takes_args = mode == RUN || mode == INTERP;
+    if (takes_args ? optind >= argc : optind != argc - 1) usage();
+    if (one_pass && (edits || (mode != ASSEMBLY && mode != RUN))) usage();
+    // Both scan on their own
+    if (scan_thread && (one_pass || edits)) usage();
+    if (opt_opts.profile_generate && opt_opts.profile_use) usage();
+    // The profile is of the whole program
+    if (stream && (mode != ASSEMBLY || one_pass || cache_dir || edits ||
+                   opt_opts.profile_generate || opt_opts.profile_use))
+        usage();
+    const char *name = argv[optind];
+    auto src = read_file(name);
     if (!src) {
-        fprintf(stderr, "mycc: %s: No such file or directory\n", argv[1]);
+        fprintf(stderr, "mycc: %s: No such file or directory\n", name);
         exit(1);
     }
     Scanner scanner(src->c_str());
-    Parser parser(scanner);
+    if (one_pass) {
+        MModule module;
+        if (!compile_one_pass(scanner, module)) exit(1);
+        if (mode == RUN)
+            return run_module(module, opts, argc - optind, argv + optind,
+                              start);
+        write_output(output, codegen_module(module, opts));
+        return 0;
+    }
+    std::unique_ptr<ScannerThread> thread;
+    if (scan_thread) thread = std::make_unique<ScannerThread>(src->c_str());
+    Parser parser = thread ? Parser(*thread) : Parser(scanner);
 #if 0
     for (;;) {
         auto token = scanner.scan();
@@ -50,13 +376,123 @@ int main(int argc, char *argv[]) {
         }
     }
 #endif
-    auto decls = parser.parse_translation_unit();
-    if (decls) {
+    // Nothing needs the whole syntax tree for these
+    if (mode == PRINT_AST && !edits) {
+        bool parsed = parser.parse_translation_unit(
+            [](std::unique_ptr<ExtDeclAST> decl, const SourceRange &) {
+                decl->print(0);
+                return true;
+            });
+        if (!parsed) {
+            fprintf(stderr, "Parse error\n");
+            exit(1);
+        }
+        return 0;
+    }
+    if (stream) {
+        opts.peephole = opt_opts.peephole;
+        FILE *out = open_output(output);
+        bool compiled = compile_streaming(parser, opt_opts, opts, out);
+        if (out != stdout) fclose(out);
+        if (!compiled && output) remove(output);
+        if (compiled && opts.stats) print_peak_memory();
+        return compiled ? 0 : 1;
+    }
+    std::unique_ptr<Parser::ExtDeclList> decls;
+    std::vector<SourceRange> ranges;
+    if (edits) {
+        auto parse_start = std::chrono::steady_clock::now();
+        Document doc;
+        bool parsed = doc.parse(*src);
+        if (opts.stats) {
+            std::chrono::duration<double, std::micro> took =
+                std::chrono::steady_clock::now() - parse_start;
+            fprintf(stderr, "edits: parsed the program in %.1f us\n",
+                    took.count());
+        }
+        if (parsed && apply_edits(doc, edits, opts.stats)) {
+            *src = doc.text();
+            ranges = doc.ranges();
+            decls = std::make_unique<Parser::ExtDeclList>(
+                std::move(doc.decls));
+        }
+    } else {
+        auto parse_start = std::chrono::steady_clock::now();
+        decls = parser.parse_translation_unit();
+        ranges = parser.ranges;
+        if (opts.stats && mode == ASSEMBLY) {
+            std::chrono::duration<double, std::milli> took =
+                std::chrono::steady_clock::now() - parse_start;
+            fprintf(stderr, "parser: parsed the program in %.1f ms\n",
+                    took.count());
+        }
+    }
+    if (!decls) {
+        fprintf(stderr, "Parse error\n");
+        exit(1);
+    }
+    if (mode == PRINT_AST) {
         for (auto &decl: *decls) {
             decl->print(0);
         }
+        return 0;
     }
-    else {
-        fprintf(stderr, "Parse error\n");
+
+    opts.peephole = opt_opts.peephole;
+    // Instrumented code and reports cover the whole program, and so
+    // aren't cached
+    if (mode == ASSEMBLY && cache_dir && !opt_opts.profile_generate &&
+        !opt_opts.inline_report && !opt_opts.tail_call_report) {
+        std::string text;
+        if (opt_opts.profile_use)
+            opt_opts.profile_path = profile_path(opt_opts, name);
+        if (!compile_cached(cache_dir, settings, src->c_str(), ranges,
+                            *decls, opt_opts, opts, text))
+            exit(1);
+        write_output(output, text);
+        if (opts.stats) print_peak_memory();
+        return 0;
+    }
+    IRModule module;
+    Lowering lowering(module);
+    lowering.if_conversion = opt_opts.if_conversion;
+    for (auto &decl: *decls) {
+        decl->lower(lowering);
+    }
+    if (lowering.failed) exit(1);
+    // Before any optimization, so both see the functions as lowered
+    if (opt_opts.profile_generate)
+        instrument_module(module, profile_path(opt_opts, name));
+    else if (opt_opts.profile_use)
+        read_profile(module, profile_path(opt_opts, name));
+    if (mode == INTERP) opt_opts.vectorize = false;
+    // The stores and loads of the locals are what the reaching stores and
+    // the uninitialized variables are found from, so they're kept
+    if (mode == PRINT_DATAFLOW) opt_opts.mem2reg = false;
+    optimize_module(module, opt_opts);
+    if (mode == RUN) {
+        // The program sees its source file as argv[0]
+        return run_module(module, opts, argc - optind, argv + optind, start);
+    }
+    if (mode == INTERP) {
+        if (walk_ast)
+            return evaluate_program(*decls, module, argc - optind,
+                                    argv + optind);
+        return run_bytecode(module, opts.stats, argc - optind, argv + optind);
+    }
+
+    if (mode == ASSEMBLY) {
+        write_output(output, codegen_module(module, opts));
+        if (opts.stats) print_peak_memory();
+        return 0;
+    }
+    FILE *out = open_output(output);
+    if (mode == PRINT_CFG) {
+        for (auto &f: module.funcs) print_cfg(*f, out, opts.stats);
+    } else if (mode == PRINT_DATAFLOW) {
+        for (auto &f: module.funcs) print_dataflow(*f, out, opts.stats);
+    } else {
+        module.print(out);
     }
+    if (out != stdout) fclose(out);
 }
@@ -0,0 +1,2201 @@
+#include "onepass.hpp"
+#include "codegen.hpp"
+#include "ir.hpp"
+#include "lower.hpp"
+#include "parse.hpp"
+#include "scan.hpp"
+#include "types.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#define ARRAY_LEN(a) (sizeof a / sizeof a[0])
+#define consume(expected_type, msg) ({ \
+    if (prev.type != expected_type) {  \
+        fprintf(stderr, msg);          \
+        return false;                  \
+    }                                  \
+    advance();                         \
+})
+
+// The compiler mirrors Parser: the precedences of infix_precedence() drive
+// the expressions and the same dispatch table the statements, but each
+// action generates code instead of returning a node. Values computed by
+// expressions are kept on a value stack, and only moved to registers when
+// an instruction needs them there, so constants and variables end up as
+// immediate and memory operands. Jumps to code that isn't generated yet are
+// patched when their label is placed.
+//
+// The functions are built as MFunctions with physical registers, so they
+// go through the same frame lowering and output as the rest of the backend.
+
+namespace
+{
+
+void put_int(std::string &data, long offset, long v, int size) {
+    for (int i = 0; i < size; i++)
+        data[offset + i] = (char)(v >> (i * 8));
+}
+
+long normalize_const(long v, const Type *type) {
+    switch (type->kind) {
+    case TY_CHAR:  return (signed char)v;
+    case TY_SHORT: return (short)v;
+    case TY_INT:   return (int)v;
+    case TY_UINT:  return (unsigned)v;
+    default:       return v;
+    }
+}
+
+const Type *arith_type(const Type *a, const Type *b) {
+    if (a->kind == TY_LONG || b->kind == TY_LONG) return Type::long_type();
+    if (a->kind == TY_UINT || b->kind == TY_UINT) return Type::uint_type();
+    return Type::int_type();
+}
+
+// Whether converting a value of @from to @to leaves it unchanged, as every
+// value of @from is also one of @to
+bool same_value(const Type *from, const Type *to) {
+    if (from == to || to->size() == 8) return true;
+    if (from->is_signed() == to->is_signed() && from->size() <= to->size())
+        return true;
+    return !from->is_signed() && from->size() < to->size();
+}
+
+bool is_comparison(TokenType t) {
+    return t >= TOK_LT && t <= TOK_NE;
+}
+
+CondCode cond_code(TokenType t, bool is_signed) {
+    switch (t) {
+    case TOK_EQ: return CC_E;
+    case TOK_NE: return CC_NE;
+    case TOK_LT: return is_signed ? CC_L : CC_B;
+    case TOK_LE: return is_signed ? CC_LE : CC_BE;
+    case TOK_GT: return is_signed ? CC_G : CC_A;
+    default:     return is_signed ? CC_GE : CC_AE;
+    }
+}
+
+// Registers given to the values on the stack. They're all caller-saved,
+// so no function has to save any.
+const int pool[] = {RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11};
+
+struct SValue {
+    enum Kind {
+        CONST,  // @imm
+        REG,    // @reg
+        LOCAL,  // the address of frame slot @slot
+        SYM,    // the address of @sym
+        TEMP,   // a register spilled to frame slot @slot
+        FLAGS,  // the result of a comparison, true if @cc holds
+        VOID,
+    };
+    Kind kind;
+    const Type *type;
+    // The value is the object of @type at the address above instead
+    bool lval = false;
+    long imm = 0;
+    int reg = 0;
+    int slot = 0;
+    CondCode cc = CC_E;
+    const std::string *sym = NULL;
+
+    static SValue make_const(long v, const Type *type) {
+        SValue s; s.kind = CONST; s.type = type; s.imm = v; return s;
+    }
+    static SValue make_reg(int r, const Type *type) {
+        SValue s; s.kind = REG; s.type = type; s.reg = r; return s;
+    }
+};
+
+struct Symbol {
+    enum Kind {
+        LOCAL,
+        GLOBAL,
+    };
+    Kind kind;
+    const Type *type;
+    int slot;                 // LOCAL only
+    const std::string *name;  // GLOBAL only
+};
+
+// A jump target. Jumps to a label that isn't placed yet are recorded, and
+// patched when it is.
+struct Label {
+    MBlock *block = NULL;
+    std::vector<std::pair<MBlock *, size_t>> fixups;
+};
+
+// One step in deriving the type of a declarator, applied to the type
+// specifier in order
+struct Derivation {
+    enum Kind {
+        POINTER,
+        ARRAY,
+        FUNC,
+    };
+    Kind kind;
+    long len = -1;
+    // FUNC only
+    std::vector<const Type *> params;
+    std::vector<std::string> names;
+    bool is_variadic = false;
+    bool has_proto = true;
+
+    Derivation(Kind kind) : kind(kind) {}
+};
+
+class OnePass {
+public:
+    OnePass(Scanner &scanner, MModule &out) : scanner(scanner), out(out) {
+        advance();
+        push_scope();
+    }
+    bool run();
+private:
+    Scanner &scanner;
+    MModule &out;
+    Token prev;
+    bool failed = false;
+
+    void advance() { prev = scanner.scan(); }
+    bool match(TokenType type) {
+        if (prev.type == type) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+    void error(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    ////////////////////////////////////////////////////////////////////////
+    // Names
+
+    std::vector<std::unordered_map<std::string, Symbol>> scopes;
+    std::unordered_map<std::string, size_t> global_index;
+    std::unordered_set<std::string> function_bodies;
+    // Symbol names referenced by values, which need a stable address
+    std::unordered_set<std::string> names;
+    // String literals are named after the function or variable using them
+    std::string owner;
+    int nstrings = 0;
+
+    void push_scope() { scopes.emplace_back(); }
+    void pop_scope() { scopes.pop_back(); }
+    void declare(const std::string &name, const Symbol &sym);
+    void declare_global(const std::string &name, const Type *type);
+    const Symbol *lookup(const std::string &name);
+    const std::string *intern(const std::string &s) {
+        return &*names.insert(s).first;
+    }
+    const std::string *string_literal(const std::string &lexeme);
+
+    ////////////////////////////////////////////////////////////////////////
+    // Code generation
+
+    std::unique_ptr<MFunction> mf;
+    MBlock *mb = NULL;
+    const Type *func_type = NULL;
+    std::vector<SValue> vstack;
+    std::vector<int> free_temps;
+    // Instructions at file scope, where only constants may be computed,
+    // are dropped, and set @needs_code
+    MInstr discard{M_RET};
+    bool needs_code = false;
+
+    struct GotoLabel {
+        Label label;
+        bool defined = false;
+    };
+    std::unordered_map<std::string, GotoLabel> labels;
+    // @continues has NULL for a switch, which only is a target for break
+    std::vector<Label *> breaks;
+    std::vector<Label *> continues;
+    struct Switch {
+        int slot;
+        const Type *type;
+        std::vector<std::pair<long, MBlock *>> cases;
+        MBlock *default_block = NULL;
+    };
+    std::vector<Switch *> switches;
+
+    bool at_file_scope() { return !mf; }
+    MInstr &emit(MOpcode op, int size = 8);
+    void emit2(MOpcode op, MOperand src, MOperand dst, int size = 8) {
+        emit(op, size).ops = {src, dst};
+    }
+    void emit_mov(MOperand src, MOperand dst, int size = 8) {
+        emit2(M_MOV, src, dst, size);
+    }
+    static MOperand reg(int r) { return MOperand::make_reg(r); }
+    static MOperand imm(long v) { return MOperand::make_imm(v); }
+    void jump(MOpcode op, CondCode cc, Label &l);
+    void jump(Label &l) { jump(M_JMP, CC_E, l); }
+    void place(Label &l);
+    bool is_terminated();
+
+    // The value stack. References to its entries are invalidated by
+    // vpush(), and only by it.
+    SValue &vtop() { return vstack.back(); }
+    void vpush(const SValue &v);
+    void vpop();
+    void vswap() { std::swap(vstack[vstack.size() - 2], vtop()); }
+    void release(SValue &v);
+
+    // Registers and temporaries
+    bool in_use(int r);
+    int get_reg(unsigned exclude = 0);
+    void take_reg(int r, unsigned exclude);
+    void spill(SValue &v);
+    void save_regs(size_t n);
+    int new_temp();
+
+    // Values
+    void decay(SValue &v);
+    void load(MOperand src, const Type *type, int dst);
+    int gv(SValue &v, int want = -1, unsigned exclude = 0);
+    MOperand operand(SValue &v, bool allow_imm, unsigned exclude = 0);
+    MOperand address(SValue &v, unsigned exclude = 0);
+    MOperand store_operand(SValue &v, int size, unsigned exclude);
+    void normalize(int r, const Type *type);
+    void convert(SValue &v, const Type *type);
+    CondCode test(SValue &v);
+    void jump_if(bool when, Label &l, const char *what);
+    bool const_value(long &v);
+
+    // Operations on the top of the stack
+    void gen_binary(TokenType op);
+    void gen_arith(TokenType op, const Type *type);
+    void gen_div(bool is_mod, bool is_signed);
+    void gen_shift(MOpcode op);
+    void gen_compare(TokenType op, bool is_signed);
+    void gen_assign();
+    void gen_unary(TokenType op);
+    void gen_deref();
+    void gen_incdec(TokenType op, bool postfix);
+    void gen_call(size_t base, const Type *ftype, bool direct);
+
+    ////////////////////////////////////////////////////////////////////////
+    // Parsing
+
+    Token parse_type_spec();
+    bool parse_external_decl();
+    bool parse_data_decl(const Type *base, std::vector<Derivation> &ds,
+                         std::string &name);
+    bool parse_declarator(std::vector<Derivation> &ds, std::string &name);
+    bool parse_params(Derivation &d);
+    const Type *derive(const Type *base, const std::vector<Derivation> &ds,
+                       const Derivation **func);
+    bool init_decl(const Type *base, const std::vector<Derivation> &ds,
+                   const std::string &name);
+    bool define_global(const std::string &name, const Type *type);
+    bool static_init(const Type *type, IRGlobal &g, bool &ok);
+    bool define_local(const std::string &name, const Type *type);
+    bool function(const std::string &name, const Type *type,
+                  const Derivation *d);
+
+    bool parse_stmt();
+    bool parse_expr(int prec);
+    bool parse_infix(int prec);
+    void push_variable(const std::string &name);
+
+    bool variable();
+    bool number();
+    bool string();
+    bool grouping();
+    bool index();
+    bool call();
+    bool unary();
+    bool binary();
+    bool logical(TokenType op, int prec);
+    bool ternary();
+    bool postfix();
+
+    bool label_stmt();
+    bool case_stmt();
+    bool default_stmt();
+    bool block_stmt();
+    bool if_stmt();
+    bool switch_stmt();
+    bool for_stmt();
+    bool while_stmt();
+    bool do_stmt();
+    bool goto_stmt();
+    bool continue_stmt();
+    bool break_stmt();
+    bool return_stmt();
+    bool empty_stmt();
+
+    using Prefix = bool (OnePass::*)();
+    using Infix  = bool (OnePass::*)();
+    // How each token starts an expression and goes on with one, their
+    // precedence being infix_precedence()
+    struct ExprRule {
+        Prefix prefix;
+        Infix  infix;
+    };
+    const ExprRule *get_expr_rule(TokenType type) {
+        return type < ARRAY_LEN(expr_rules) ? &expr_rules[type] : NULL;
+    }
+    int get_expr_precedence() {
+        auto rule = get_expr_rule(prev.type);
+        return rule && rule->infix ? infix_precedence(prev.type) : 0;
+    }
+    static constexpr ExprRule expr_rules[] = {
+    /* IDENT     */ {&OnePass::variable, NULL},
+    /* INT_CONST */ {&OnePass::number, NULL},
+    /* STRING    */ {&OnePass::string, NULL},
+    /* LPAREN    */ {&OnePass::grouping, &OnePass::call},
+    /* RPAREN    */ {NULL, NULL},
+    /* LBRACKET  */ {NULL, &OnePass::index},
+    /* RBRACKET  */ {NULL, NULL},
+    /* INCR      */ {&OnePass::unary, &OnePass::postfix},
+    /* DECR      */ {&OnePass::unary, &OnePass::postfix},
+    /* TILDE     */ {&OnePass::unary, NULL},
+    /* BANG      */ {&OnePass::unary, NULL},
+    /* SIZEOF    */ {NULL, NULL},
+    /* STAR      */ {&OnePass::unary, &OnePass::binary},
+    /* SLASH     */ {NULL, &OnePass::binary},
+    /* MOD       */ {NULL, &OnePass::binary},
+    /* PLUS      */ {&OnePass::unary, &OnePass::binary},
+    /* MINUS     */ {&OnePass::unary, &OnePass::binary},
+    /* LSHIFT    */ {NULL, &OnePass::binary},
+    /* RSHIFT    */ {NULL, &OnePass::binary},
+    /* LT        */ {NULL, &OnePass::binary},
+    /* GT        */ {NULL, &OnePass::binary},
+    /* LE        */ {NULL, &OnePass::binary},
+    /* GE        */ {NULL, &OnePass::binary},
+    /* EQ        */ {NULL, &OnePass::binary},
+    /* NE        */ {NULL, &OnePass::binary},
+    /* AND       */ {&OnePass::unary, &OnePass::binary},
+    /* XOR       */ {NULL, &OnePass::binary},
+    /* OR        */ {NULL, &OnePass::binary},
+    /* AND_AND   */ {NULL, &OnePass::binary},
+    /* OR_OR     */ {NULL, &OnePass::binary},
+    /* QUERY     */ {NULL, &OnePass::ternary},
+    /* COLON     */ {NULL, NULL},
+    /* ASSIGN    */ {NULL, &OnePass::binary},
+    /* COMMA     */ {NULL, NULL},
+    };
+
+    using StmtParser = bool (OnePass::*)();
+    StmtParser get_stmt_parser(TokenType type) {
+        size_t idx = type - TOK_K_CASE;
+        return idx < ARRAY_LEN(stmt_parsers) ? stmt_parsers[idx] : NULL;
+    }
+    static constexpr StmtParser stmt_parsers[] = {
+        &OnePass::case_stmt,
+        &OnePass::default_stmt,
+        &OnePass::if_stmt,
+        NULL,  // else
+        &OnePass::switch_stmt,
+        &OnePass::for_stmt,
+        &OnePass::while_stmt,
+        &OnePass::do_stmt,
+        &OnePass::goto_stmt,
+        &OnePass::continue_stmt,
+        &OnePass::break_stmt,
+        &OnePass::return_stmt,
+        &OnePass::block_stmt,
+        NULL, // '}'
+        &OnePass::empty_stmt,
+    };
+};
+
+void OnePass::error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "mycc: error: ");
+    if (mf) fprintf(stderr, "in function '%s': ", mf->name.c_str());
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    failed = true;
+}
+
+bool OnePass::run() {
+    while (prev.type != TOK_EOF) {
+        if (!parse_external_decl()) {
+            fprintf(stderr, "Parse error\n");
+            return false;
+        }
+    }
+    return !failed;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Names
+
+void OnePass::declare(const std::string &name, const Symbol &sym) {
+    if (name.empty()) return;
+    auto &scope = scopes.back();
+    auto it = scope.find(name);
+    if (it != scope.end()) {
+        if (it->second.kind == Symbol::LOCAL || sym.kind == Symbol::LOCAL) {
+            error("redeclaration of '%s'", name.c_str());
+            return;
+        }
+        // A completed array type replaces an incomplete one
+        if (sym.type->is_array() && sym.type->len < 0) return;
+    }
+    scope[name] = sym;
+}
+
+void OnePass::declare_global(const std::string &name, const Type *type) {
+    declare(name, {Symbol::GLOBAL, type, 0, intern(name)});
+}
+
+const Symbol *OnePass::lookup(const std::string &name) {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+        auto sym = it->find(name);
+        if (sym != it->end()) return &sym->second;
+    }
+    return NULL;
+}
+
+const std::string *OnePass::string_literal(const std::string &lexeme) {
+    IRGlobal g;
+    g.name = ".L.str." + owner + "." + std::to_string(nstrings++);
+    g.data = unescape(lexeme) + '\0';
+    g.size = g.data.size();
+    g.align = 1;
+    g.is_static = true;
+    g.is_string = true;
+    g.is_zero = false;
+    auto name = intern(g.name);
+    out.globals.emplace_back(std::move(g));
+    return name;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Code generation
+
+MInstr &OnePass::emit(MOpcode op, int size) {
+    if (!mb) {
+        needs_code = true;
+        discard = MInstr(op, size);
+        return discard;
+    }
+    mb->instrs.emplace_back(op, size);
+    return mb->instrs.back();
+}
+
+void OnePass::jump(MOpcode op, CondCode cc, Label &l) {
+    auto &j = emit(op);
+    j.cc = cc;
+    j.ops = {MOperand::make_block(l.block)};
+    if (!l.block && mb) l.fixups.emplace_back(mb, mb->instrs.size() - 1);
+}
+
+void OnePass::place(Label &l) {
+    if (!mf) return;
+    // A jump to the very next instruction is dropped
+    if (!l.fixups.empty() && l.fixups.back().first == mb &&
+        l.fixups.back().second + 1 == mb->instrs.size() &&
+        mb->instrs.back().op == M_JMP) {
+        mb->instrs.pop_back();
+        l.fixups.pop_back();
+    }
+    // Labels placed together share a block. The entry block can't be a
+    // target, the prologue goes there.
+    if (!mb->instrs.empty() || mb == mf->blocks[0].get())
+        mb = mf->new_block();
+    l.block = mb;
+    for (auto &f: l.fixups) f.first->instrs[f.second].ops[0].block = mb;
+    l.fixups.clear();
+}
+
+bool OnePass::is_terminated() {
+    return !mb->instrs.empty() && (mb->instrs.back().op == M_RET ||
+                                   mb->instrs.back().op == M_JMP);
+}
+
+void OnePass::vpush(const SValue &v) {
+    // Only the top of the stack may live in the flags, since most
+    // instructions clobber them
+    if (!vstack.empty() && vtop().kind == SValue::FLAGS) gv(vtop());
+    vstack.push_back(v);
+}
+
+void OnePass::vpop() {
+    release(vtop());
+    vstack.pop_back();
+}
+
+void OnePass::release(SValue &v) {
+    if (v.kind == SValue::TEMP) free_temps.push_back(v.slot);
+    v.kind = SValue::VOID;
+}
+
+bool OnePass::in_use(int r) {
+    for (auto &v: vstack) {
+        if (v.kind == SValue::REG && v.reg == r) return true;
+    }
+    return false;
+}
+
+// A free register, not in @exclude. When they're all taken, the value
+// deepest in the stack is spilled.
+int OnePass::get_reg(unsigned exclude) {
+    for (int r: pool) {
+        if (!(exclude >> r & 1) && !in_use(r)) return r;
+    }
+    for (auto &v: vstack) {
+        if (v.kind == SValue::REG && !(exclude >> v.reg & 1)) {
+            int r = v.reg;
+            spill(v);
+            return r;
+        }
+    }
+    return pool[0];
+}
+
+// Free @r for an instruction that needs its value there, moving the value
+// in it to another register not in @exclude
+void OnePass::take_reg(int r, unsigned exclude) {
+    for (auto &v: vstack) {
+        if (v.kind == SValue::REG && v.reg == r) {
+            int n = get_reg(exclude | 1u << r);
+            emit_mov(reg(r), reg(n));
+            v.reg = n;
+            return;
+        }
+    }
+}
+
+void OnePass::spill(SValue &v) {
+    int slot = new_temp();
+    emit_mov(reg(v.reg), MOperand::make_slot(slot));
+    v.kind = SValue::TEMP;
+    v.slot = slot;
+}
+
+// Spill the registers of the first @n values, before a call or code that
+// joins control flow, so that the state of the stack is the same along
+// every path
+void OnePass::save_regs(size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        if (vstack[k].kind == SValue::REG) spill(vstack[k]);
+    }
+}
+
+int OnePass::new_temp() {
+    if (!mf) return 0;
+    if (free_temps.empty()) return mf->new_slot(8, 8);
+    int slot = free_temps.back();
+    free_temps.pop_back();
+    return slot;
+}
+
+void OnePass::decay(SValue &v) {
+    if (!v.lval) return;
+    if (v.type->is_array()) {
+        v.lval = false;
+        v.type = Type::pointer_to(v.type->base);
+    } else if (v.type->is_func()) {
+        v.lval = false;
+        v.type = Type::pointer_to(v.type);
+    } else if (v.type->is_float()) {
+        error("floating point types are not supported");
+        release(v);
+        v = SValue::make_const(0, Type::int_type());
+    }
+}
+
+void OnePass::load(MOperand src, const Type *type, int dst) {
+    int size = type->size();
+    if (size == 8 || (size == 4 && !type->is_signed())) {
+        emit_mov(src, reg(dst), size);
+    } else {
+        auto &ext = emit(type->is_signed() ? M_MOVSX : M_MOVZX);
+        ext.src_size = size;
+        ext.ops = {src, reg(dst)};
+    }
+}
+
+// Move @v into a register, @want if it's not negative, or any register not
+// in @exclude. Returns the register.
+int OnePass::gv(SValue &v, int want, unsigned exclude) {
+    decay(v);
+    bool in_reg = v.kind == SValue::REG;
+    if (in_reg && !v.lval &&
+        (want < 0 ? !(exclude >> v.reg & 1) : v.reg == want))
+        return v.reg;
+    int dst;
+    if (want >= 0) {
+        if (!in_reg || v.reg != want)
+            take_reg(want, exclude | (in_reg ? 1u << v.reg : 0));
+        dst = want;
+    } else if (in_reg && !(exclude >> v.reg & 1)) {
+        dst = v.reg;
+    } else {
+        dst = get_reg(exclude | (in_reg ? 1u << v.reg : 0));
+    }
+    switch (v.kind) {
+    case SValue::CONST:
+        emit_mov(imm(v.imm), reg(dst));
+        break;
+    case SValue::REG:
+        if (v.lval)
+            load(MOperand::make_mem(v.reg, 0), v.type, dst);
+        else
+            emit_mov(reg(v.reg), reg(dst));
+        break;
+    case SValue::LOCAL:
+        if (v.lval)
+            load(MOperand::make_slot(v.slot), v.type, dst);
+        else
+            emit2(M_LEA, MOperand::make_slot(v.slot), reg(dst));
+        break;
+    case SValue::SYM:
+        if (v.lval)
+            load(MOperand::make_rip(*v.sym), v.type, dst);
+        else
+            emit2(M_LEA, MOperand::make_rip(*v.sym), reg(dst));
+        break;
+    case SValue::TEMP:
+        emit_mov(MOperand::make_slot(v.slot), reg(dst));
+        free_temps.push_back(v.slot);
+        if (v.lval) load(MOperand::make_mem(dst, 0), v.type, dst);
+        break;
+    case SValue::FLAGS: {
+        auto &set = emit(M_SETCC, 1);
+        set.cc = v.cc;
+        set.ops = {reg(dst)};
+        auto &ext = emit(M_MOVZX);
+        ext.src_size = 1;
+        ext.ops = {reg(dst), reg(dst)};
+        break;
+    }
+    case SValue::VOID:
+        error("void value not ignored as it ought to be");
+        emit_mov(imm(0), reg(dst));
+        v.type = Type::int_type();
+        break;
+    }
+    v.kind = SValue::REG;
+    v.reg = dst;
+    v.lval = false;
+    return dst;
+}
+
+// @v as the source operand of an instruction: an immediate if allowed,
+// the variable itself if it's a full register wide, else a register
+MOperand OnePass::operand(SValue &v, bool allow_imm, unsigned exclude) {
+    decay(v);
+    if (v.kind == SValue::CONST && allow_imm && fits_int(v.imm))
+        return imm(v.imm);
+    if (v.lval && v.type->size() == 8 && v.kind != SValue::TEMP)
+        return address(v, exclude);
+    return reg(gv(v, -1, exclude));
+}
+
+// The memory operand of the lvalue @v
+MOperand OnePass::address(SValue &v, unsigned exclude) {
+    switch (v.kind) {
+    case SValue::LOCAL:
+        return MOperand::make_slot(v.slot);
+    case SValue::SYM:
+        return MOperand::make_rip(*v.sym);
+    case SValue::TEMP: {
+        int r = get_reg(exclude);
+        emit_mov(MOperand::make_slot(v.slot), reg(r));
+        free_temps.push_back(v.slot);
+        v.kind = SValue::REG;
+        v.reg = r;
+        break;
+    }
+    case SValue::REG:
+        break;
+    default: {
+        auto type = v.type;
+        v.lval = false;
+        gv(v, -1, exclude);
+        v.lval = true;
+        v.type = type;
+        break;
+    }
+    }
+    return MOperand::make_mem(v.reg, 0);
+}
+
+// @v as the source of a store of @size bytes
+MOperand OnePass::store_operand(SValue &v, int size, unsigned exclude) {
+    decay(v);
+    if (v.kind == SValue::CONST && fits_int(v.imm)) {
+        // Only the low bits are stored, and the immediate is sign extended
+        long c = v.imm;
+        if (size < 8) c = (long)(c << (64 - size * 8)) >> (64 - size * 8);
+        return imm(c);
+    }
+    return reg(gv(v, -1, exclude));
+}
+
+void OnePass::normalize(int r, const Type *type) {
+    switch (type->kind) {
+    case TY_CHAR:
+    case TY_SHORT:
+    case TY_INT: {
+        auto &ext = emit(M_MOVSX);
+        ext.src_size = type->size();
+        ext.ops = {reg(r), reg(r)};
+        break;
+    }
+    case TY_UINT:
+        // Writing a 32-bit register clears the upper half
+        emit_mov(reg(r), reg(r), 4);
+        break;
+    default:
+        break;
+    }
+}
+
+void OnePass::convert(SValue &v, const Type *type) {
+    if (type->is_void()) {
+        release(v);
+        v.type = type;
+        return;
+    }
+    decay(v);
+    if (v.kind == SValue::VOID || !v.type->is_scalar() ||
+        !type->is_scalar()) {
+        error("cannot convert '%s' to '%s'",
+              v.type->str().c_str(), type->str().c_str());
+        release(v);
+        v = SValue::make_const(0, type);
+        return;
+    }
+    bool same = same_value(v.type, type);
+    if (v.kind == SValue::CONST) {
+        v.imm = normalize_const(v.imm, type);
+    } else if (v.lval || !same) {
+        // An lvalue is loaded with its own type first
+        int r = gv(v);
+        if (!same) normalize(r, type);
+    }
+    v.type = type;
+}
+
+// Compare @v against zero, returning the condition for it being nonzero
+CondCode OnePass::test(SValue &v) {
+    if (v.kind == SValue::FLAGS) return v.cc;
+    auto o = operand(v, false);
+    if (o.kind == MOperand::REG)
+        emit2(M_TEST, o, o);
+    else
+        emit2(M_CMP, imm(0), o);
+    return CC_NE;
+}
+
+// Pop the top of the stack, jumping to @l if its truth value is @when
+void OnePass::jump_if(bool when, Label &l, const char *what) {
+    auto &v = vtop();
+    decay(v);
+    if (v.kind == SValue::VOID || !v.type->is_scalar())
+        error("scalar required in %s", what);
+    if (v.kind == SValue::CONST) {
+        bool taken = (v.imm != 0) == when;
+        vpop();
+        if (taken) jump(l);
+        return;
+    }
+    CondCode cc = test(v);
+    vpop();
+    jump(M_JCC, when ? cc : invert_cc(cc), l);
+}
+
+// Pop a constant off the stack, returning false if it's not one
+bool OnePass::const_value(long &v) {
+    bool ok = vtop().kind == SValue::CONST;
+    v = vtop().imm;
+    vpop();
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Operations
+
+void OnePass::gen_binary(TokenType op) {
+    if (op == TOK_ASSIGN) {
+        gen_assign();
+        return;
+    }
+    size_t n = vstack.size();
+    decay(vstack[n - 2]);
+    decay(vstack[n - 1]);
+    auto *l = &vstack[n - 2], *r = &vstack[n - 1];
+    if (r->kind == SValue::FLAGS) gv(*r);
+    if (l->kind == SValue::VOID || r->kind == SValue::VOID ||
+        !l->type->is_scalar() || !r->type->is_scalar()) {
+        error("invalid operands to binary '%s'", prev.lexeme.c_str());
+        vpop();
+        release(vtop());
+        vtop() = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    // Pointer arithmetic
+    if (op == TOK_PLUS && r->type->is_pointer()) vswap();
+    if ((op == TOK_PLUS || op == TOK_MINUS) && l->type->is_pointer()) {
+        auto ptype = l->type;
+        long size = ptype->base->size();
+        if (r->type->is_pointer()) {
+            if (op == TOK_PLUS) {
+                error("invalid operands to binary '+'");
+                vpop();
+                return;
+            }
+            gen_arith(TOK_MINUS, Type::long_type());
+            if (size != 1) {
+                vpush(SValue::make_const(size, Type::long_type()));
+                gen_arith(TOK_SLASH, Type::long_type());
+            }
+            return;
+        }
+        convert(*r, Type::long_type());
+        if (size != 1) {
+            vpush(SValue::make_const(size, Type::long_type()));
+            gen_arith(TOK_STAR, Type::long_type());
+        }
+        gen_arith(op, ptype);
+        return;
+    }
+    if (is_comparison(op)) {
+        bool is_signed = true;
+        if (l->type->is_pointer() || r->type->is_pointer()) {
+            is_signed = false;
+        } else {
+            auto type = arith_type(l->type, r->type);
+            convert(*l, type);
+            convert(*r, type);
+            is_signed = type->is_signed();
+        }
+        gen_compare(op, is_signed);
+        return;
+    }
+    if (!l->type->is_integer() || !r->type->is_integer()) {
+        error("invalid operands to binary '%s'", prev.lexeme.c_str());
+        vpop();
+        release(vtop());
+        vtop() = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    const Type *type;
+    if (op == TOK_LSHIFT || op == TOK_RSHIFT) {
+        type = arith_type(l->type, Type::int_type());
+        convert(*r, Type::int_type());
+    } else {
+        type = arith_type(l->type, r->type);
+        convert(*r, type);
+    }
+    convert(*l, type);
+    gen_arith(op, type);
+}
+
+// The arithmetic operation @op on the two values on top of the stack, which
+// already have the type of the result
+void OnePass::gen_arith(TokenType op, const Type *type) {
+    size_t n = vstack.size();
+    auto *l = &vstack[n - 2], *r = &vstack[n - 1];
+    if (l->kind == SValue::CONST && r->kind == SValue::CONST) {
+        long a = l->imm, b = r->imm, v;
+        bool ok = true;
+        switch (op) {
+        case TOK_PLUS:   v = a + b; break;
+        case TOK_MINUS:  v = a - b; break;
+        case TOK_STAR:   v = a * b; break;
+        case TOK_AND:    v = a & b; break;
+        case TOK_OR:     v = a | b; break;
+        case TOK_XOR:    v = a ^ b; break;
+        case TOK_LSHIFT: v = a << (b & 63); break;
+        case TOK_RSHIFT:
+            v = type->is_signed() ? a >> (b & 63)
+                                  : (long)((unsigned long)a >> (b & 63));
+            break;
+        default:
+            // Division by zero is left for run time
+            ok = b != 0 && !(b == -1 && a == -a);
+            if (ok) v = op == TOK_SLASH ? a / b : a % b;
+            break;
+        }
+        if (ok) {
+            vpop();
+            vtop().imm = normalize_const(v, type);
+            vtop().type = type;
+            return;
+        }
+    }
+    switch (op) {
+    case TOK_SLASH:
+    case TOK_MOD:
+        gen_div(op == TOK_MOD, type->is_signed());
+        break;
+    case TOK_LSHIFT:
+        gen_shift(M_SHL);
+        break;
+    case TOK_RSHIFT:
+        gen_shift(type->is_signed() ? M_SAR : M_SHR);
+        break;
+    default: {
+        MOpcode mop = op == TOK_PLUS ? M_ADD : op == TOK_MINUS ? M_SUB
+                    : op == TOK_STAR ? M_IMUL : op == TOK_AND ? M_AND
+                    : op == TOK_OR ? M_OR : M_XOR;
+        // Put a constant operand second so it can be an immediate
+        if (op != TOK_MINUS && l->kind == SValue::CONST) vswap();
+        unsigned ex = r->kind == SValue::REG ? 1u << r->reg : 0;
+        int dst = gv(*l, -1, ex);
+        emit2(mop, operand(*r, true, 1u << dst), reg(dst));
+        vpop();
+        break;
+    }
+    }
+    auto &v = vtop();
+    v.type = type;
+    if (op == TOK_PLUS || op == TOK_MINUS || op == TOK_STAR ||
+        op == TOK_LSHIFT)
+        normalize(v.reg, type);
+}
+
+void OnePass::gen_div(bool is_mod, bool is_signed) {
+    size_t n = vstack.size();
+    auto &l = vstack[n - 2], &r = vstack[n - 1];
+    unsigned fixed = 1u << RAX | 1u << RDX;
+    int d = gv(r, -1, fixed);
+    gv(l, RAX, 1u << RDX | 1u << d);
+    take_reg(RDX, 1u << RAX | 1u << d);
+    if (is_signed)
+        emit(M_CQO);
+    else
+        emit2(M_XOR, reg(RDX), reg(RDX), 4);
+    emit(is_signed ? M_IDIV : M_DIV).ops = {reg(d)};
+    vpop();
+    vtop().reg = is_mod ? RDX : RAX;
+}
+
+void OnePass::gen_shift(MOpcode op) {
+    size_t n = vstack.size();
+    auto &l = vstack[n - 2], &r = vstack[n - 1];
+    if (r.kind == SValue::CONST) {
+        int dst = gv(l);
+        emit2(op, imm(r.imm & 63), reg(dst));
+    } else {
+        gv(r, RCX);
+        int dst = gv(l, -1, 1u << RCX);
+        emit2(op, reg(RCX), reg(dst));
+    }
+    vpop();
+}
+
+void OnePass::gen_compare(TokenType op, bool is_signed) {
+    size_t n = vstack.size();
+    auto *l = &vstack[n - 2], *r = &vstack[n - 1];
+    if (l->kind == SValue::CONST && r->kind == SValue::CONST) {
+        long a = l->imm, b = r->imm;
+        bool v;
+        if (!is_signed) {
+            a ^= 1L << 63;
+            b ^= 1L << 63;
+        }
+        switch (op) {
+        case TOK_EQ: v = a == b; break;
+        case TOK_NE: v = a != b; break;
+        case TOK_LT: v = a < b; break;
+        case TOK_LE: v = a <= b; break;
+        case TOK_GT: v = a > b; break;
+        default:     v = a >= b; break;
+        }
+        vpop();
+        vtop() = SValue::make_const(v, Type::int_type());
+        return;
+    }
+    // Compare against a constant operand second, as an immediate
+    if (l->kind == SValue::CONST) {
+        vswap();
+        switch (op) {
+        case TOK_LT: op = TOK_GT; break;
+        case TOK_LE: op = TOK_GE; break;
+        case TOK_GT: op = TOK_LT; break;
+        case TOK_GE: op = TOK_LE; break;
+        default:     break;
+        }
+    }
+    unsigned ex = r->kind == SValue::REG ? 1u << r->reg : 0;
+    int a = gv(*l, -1, ex);
+    emit2(M_CMP, operand(*r, true, 1u << a), reg(a));
+    vpop();
+    auto &v = vtop();
+    v.kind = SValue::FLAGS;
+    v.cc = cond_code(op, is_signed);
+    v.type = Type::int_type();
+}
+
+void OnePass::gen_assign() {
+    size_t n = vstack.size();
+    auto &l = vstack[n - 2], &r = vstack[n - 1];
+    if (!l.lval) {
+        error("lvalue required");
+        vswap();
+        vpop();
+        return;
+    }
+    if (l.type->is_array() || l.type->is_func()) {
+        error("assignment to expression with array or function type");
+        vswap();
+        vpop();
+        return;
+    }
+    convert(r, l.type);
+    int size = l.type->size();
+    auto src = store_operand(r, size, l.kind == SValue::REG ? 1u << l.reg : 0);
+    auto mem = address(l, src.kind == MOperand::REG ? 1u << src.reg : 0);
+    emit_mov(src, mem, size);
+    // The value of an assignment is the value stored
+    vswap();
+    vpop();
+}
+
+void OnePass::gen_unary(TokenType op) {
+    auto &v = vtop();
+    switch (op) {
+    case TOK_STAR:
+        gen_deref();
+        return;
+    case TOK_AND:
+        if (!v.lval) {
+            error("lvalue required");
+            release(v);
+            v = SValue::make_const(0, Type::int_type());
+            return;
+        }
+        v.lval = false;
+        v.type = Type::pointer_to(v.type);
+        return;
+    case TOK_INCR:
+    case TOK_DECR:
+        gen_incdec(op, false);
+        return;
+    default:
+        break;
+    }
+    decay(v);
+    if (op == TOK_BANG) {
+        if (v.kind == SValue::VOID || !v.type->is_scalar())
+            error("scalar required for '!'");
+        if (v.kind == SValue::CONST) {
+            v = SValue::make_const(!v.imm, Type::int_type());
+            return;
+        }
+        CondCode cc = test(v);
+        release(v);
+        v.kind = SValue::FLAGS;
+        v.cc = invert_cc(cc);
+        v.type = Type::int_type();
+        return;
+    }
+    if (v.kind == SValue::VOID || !v.type->is_integer()) {
+        error("invalid operand to unary '%s'",
+              op == TOK_MINUS ? "-" : op == TOK_TILDE ? "~" : "+");
+        release(v);
+        v = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    auto type = arith_type(v.type, Type::int_type());
+    convert(v, type);
+    if (op == TOK_PLUS) return;
+    if (v.kind == SValue::CONST) {
+        v.imm = normalize_const(op == TOK_MINUS ? -v.imm : ~v.imm, type);
+        return;
+    }
+    int r = gv(v);
+    emit(op == TOK_MINUS ? M_NEG : M_NOT).ops = {reg(r)};
+    normalize(r, type);
+}
+
+void OnePass::gen_deref() {
+    auto &v = vtop();
+    decay(v);
+    if (v.kind == SValue::VOID || !v.type->is_pointer() ||
+        v.type->base->is_void()) {
+        error("invalid type argument of unary '*'");
+        release(v);
+        v = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    // An address that's not computed yet doesn't need a register
+    if (v.lval || v.kind == SValue::CONST || v.kind == SValue::FLAGS)
+        gv(v);
+    v.lval = true;
+    v.type = v.type->base;
+}
+
+void OnePass::gen_incdec(TokenType op, bool postfix) {
+    auto &v = vtop();
+    const char *name = op == TOK_INCR ? "++" : "--";
+    if (!v.lval) {
+        error("lvalue required");
+        release(v);
+        v = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    if (!v.type->is_scalar()) {
+        error("invalid operand to '%s'", name);
+        release(v);
+        v = SValue::make_const(0, Type::int_type());
+        return;
+    }
+    auto type = v.type;
+    long step = type->is_pointer() ? type->base->size() : 1;
+    auto mem = address(v);
+    unsigned ex = v.kind == SValue::REG ? 1u << v.reg : 0;
+    int old = get_reg(ex);
+    load(mem, type, old);
+    int r = old;
+    if (postfix) {
+        r = get_reg(ex | 1u << old);
+        emit_mov(reg(old), reg(r));
+    }
+    emit2(op == TOK_INCR ? M_ADD : M_SUB, imm(step), reg(r));
+    normalize(r, type);
+    emit_mov(reg(r), mem, type->size());
+    release(v);
+    v = SValue::make_reg(old, type);
+}
+
+// Call the function at vstack[@base], with the arguments above it
+void OnePass::gen_call(size_t base, const Type *ftype, bool direct) {
+    if (vtop().kind == SValue::FLAGS) gv(vtop());
+    // Everything that's not an argument lives through the call in memory
+    save_regs(base);
+    size_t nargs = vstack.size() - base - 1;
+    int nstack = nargs > 6 ? nargs - 6 : 0;
+    // Stack arguments are pushed right to left, keeping %rsp 16-byte
+    // aligned at the call.
+    if (nstack % 2)
+        emit2(M_SUB, imm(8), reg(RSP));
+    for (size_t k = nargs; k-- > 6;) {
+        auto &a = vtop();
+        decay(a);
+        if (a.kind == SValue::CONST && fits_int(a.imm))
+            emit(M_PUSH).ops = {imm(a.imm)};
+        else
+            emit(M_PUSH).ops = {reg(gv(a))};
+        vpop();
+    }
+    int nregs = std::min(nargs, (size_t)6);
+    unsigned used = 0;
+    for (int k = 0; k < nregs; k++) {
+        gv(vstack[base + 1 + k], arg_regs[k], used);
+        used |= 1u << arg_regs[k];
+    }
+    auto target = direct ? MOperand::make_sym(*vstack[base].sym)
+                         : reg(gv(vstack[base], R11, used));
+    bool is_variadic = ftype->is_variadic || !ftype->has_proto;
+    // %al holds the number of vector registers used by a variadic call
+    if (is_variadic)
+        emit_mov(imm(0), reg(RAX), 4);
+    auto &call = emit(M_CALL);
+    call.ops = {target};
+    call.nargs = nregs;
+    call.is_variadic = is_variadic;
+    if (mf) mf->has_calls = true;
+    if (nstack)
+        emit2(M_ADD, imm((nstack + nstack % 2) * 8), reg(RSP));
+    while (vstack.size() > base) vpop();
+    auto ret = ftype->base;
+    SValue v;
+    if (ret->is_void()) {
+        v.kind = SValue::VOID;
+        v.type = ret;
+    } else {
+        // Only the low bits of narrow return values are defined by the ABI
+        normalize(RAX, ret);
+        v = SValue::make_reg(RAX, ret);
+    }
+    vpush(v);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Declarations
+
+Token OnePass::parse_type_spec() {
+    Token type;
+    switch (prev.type) {
+    case TOK_T_VOID:
+    case TOK_T_CHAR:
+    case TOK_T_SHORT:
+    case TOK_T_INT:
+    case TOK_T_LONG:
+    case TOK_T_FLOAT:
+    case TOK_T_DOUBLE:
+    case TOK_T_SIGNED:
+    case TOK_T_UNSIGNED:
+        type = prev;
+        advance();
+        return type;
+    default:
+        return {TOK_ERR, ""};
+    }
+}
+
+bool OnePass::parse_external_decl() {
+    Token spec = parse_type_spec();
+    if (spec.type == TOK_ERR) {
+        fprintf(stderr, "Expect type specifier\n");
+        return false;
+    }
+    auto base = type_of_spec(spec);
+    std::vector<Derivation> ds;
+    std::string name;
+    if (!parse_declarator(ds, name)) return false;
+    if (match(TOK_LBRACE)) {
+        const Derivation *d = NULL;
+        auto type = derive(base, ds, &d);
+        if (!type->is_func()) {
+            error("'%s' is not a function", name.c_str());
+            type = Type::func_returning(Type::int_type(), {}, false, false);
+            d = NULL;
+        }
+        return function(name, type, d);
+    }
+    return parse_data_decl(base, ds, name);
+}
+
+bool OnePass::parse_data_decl(const Type *base, std::vector<Derivation> &ds,
+                              std::string &name) {
+    for (;;) {
+        if (!init_decl(base, ds, name)) return false;
+        if (match(TOK_COMMA)) {
+            ds.clear();
+            name.clear();
+            if (!parse_declarator(ds, name)) return false;
+        } else if (match(TOK_SEMICOLON)) {
+            return true;
+        } else {
+            fprintf(stderr, "Expect ',' or ';'\n");
+            return false;
+        }
+    }
+}
+
+// Parse a declarator into the derivations applied to the type specifier,
+// in order. The pointers bind most loosely, then the suffixes from right to
+// left, and a parenthesized declarator is applied last.
+bool OnePass::parse_declarator(std::vector<Derivation> &ds,
+                               std::string &name) {
+    int ptr_level = 0;
+    while (match(TOK_STAR)) {
+        ptr_level++;
+    }
+    std::vector<Derivation> inner, suffixes;
+    if (prev.type == TOK_IDENT) {
+        name = prev.lexeme;
+        advance();
+    } else if (match(TOK_LPAREN)) {
+        if (!parse_declarator(inner, name)) return false;
+        consume(TOK_RPAREN, "Expect ')'\n");
+    } else {
+        fprintf(stderr, "Expect identifier or '('\n");
+        return false;
+    }
+    while (prev.type == TOK_LBRACKET || prev.type == TOK_LPAREN) {
+        if (match(TOK_LBRACKET)) {
+            Derivation d(Derivation::ARRAY);
+            if (!match(TOK_RBRACKET)) {
+                if (!parse_expr(2)) return false;
+                consume(TOK_RBRACKET, "Expect ']'\n");
+                if (!const_value(d.len) || d.len < 0) {
+                    error("array size is not a non-negative constant");
+                    d.len = 1;
+                }
+            }
+            suffixes.push_back(std::move(d));
+        } else if (match(TOK_LPAREN)) {
+            Derivation d(Derivation::FUNC);
+            if (!parse_params(d)) return false;
+            suffixes.push_back(std::move(d));
+        }
+    }
+    for (int i = 0; i < ptr_level; i++)
+        ds.emplace_back(Derivation::POINTER);
+    std::move(suffixes.rbegin(), suffixes.rend(), std::back_inserter(ds));
+    std::move(inner.begin(), inner.end(), std::back_inserter(ds));
+    return true;
+}
+
+bool OnePass::parse_params(Derivation &d) {
+    if (match(TOK_RPAREN)) {
+        d.has_proto = false;
+        return true;
+    }
+    do {
+        if (!d.params.empty() && match(TOK_ELLIPSIS)) {
+            d.is_variadic = true;
+            break;
+        }
+        Token spec = parse_type_spec();
+        if (spec.type == TOK_ERR) {
+            fprintf(stderr, "Expect type specifier\n");
+            return false;
+        }
+        auto t = type_of_spec(spec);
+        std::string name;
+        if (prev.type != TOK_COMMA && prev.type != TOK_RPAREN) {
+            std::vector<Derivation> ds;
+            if (!parse_declarator(ds, name)) return false;
+            t = derive(t, ds, NULL);
+        }
+        if (t->is_array()) t = Type::pointer_to(t->base);
+        else if (t->is_func()) t = Type::pointer_to(t);
+        d.params.push_back(t);
+        d.names.push_back(std::move(name));
+    } while (match(TOK_COMMA));
+    consume(TOK_RPAREN, "Expect ')'\n");
+    // "(void)" is an empty parameter list
+    if (d.params.size() == 1 && d.params[0]->is_void() && d.names[0].empty()) {
+        d.params.clear();
+        d.names.clear();
+    }
+    return true;
+}
+
+// The type @ds derive from @base. @func is set to the derivation of the
+// function type applied last, which has the names of the parameters.
+const Type *OnePass::derive(const Type *base,
+                            const std::vector<Derivation> &ds,
+                            const Derivation **func) {
+    for (auto &d: ds) {
+        switch (d.kind) {
+        case Derivation::POINTER:
+            base = Type::pointer_to(base);
+            break;
+        case Derivation::ARRAY:
+            if (base->is_func() || base->is_void()) {
+                error("invalid array element type '%s'", base->str().c_str());
+                base = Type::int_type();
+            }
+            base = Type::array_of(base, d.len);
+            break;
+        case Derivation::FUNC:
+            if (base->is_func() || base->is_array()) {
+                error("invalid function return type '%s'",
+                      base->str().c_str());
+                base = Type::int_type();
+            }
+            base = Type::func_returning(base,
+                                        std::vector<const Type *>(d.params),
+                                        d.is_variadic, d.has_proto);
+            if (func) *func = &d;
+            break;
+        }
+    }
+    return base;
+}
+
+bool OnePass::init_decl(const Type *base, const std::vector<Derivation> &ds,
+                        const std::string &name) {
+    auto type = derive(base, ds, NULL);
+    if (type->is_func() || type->is_void() || type->is_float()) {
+        if (type->is_func()) {
+            declare_global(name, type);
+            if (prev.type == TOK_ASSIGN)
+                error("function '%s' is initialized", name.c_str());
+        } else {
+            error("variable '%s' has unsupported type '%s'",
+                  name.c_str(), type->str().c_str());
+        }
+        if (match(TOK_ASSIGN)) {
+            if (!parse_expr(1)) return false;
+            vpop();
+        }
+        return true;
+    }
+    if (at_file_scope()) return define_global(name, type);
+    return define_local(name, type);
+}
+
+bool OnePass::define_global(const std::string &name, const Type *type) {
+    IRGlobal g;
+    g.name = name;
+    g.size = type->size();
+    g.align = type->align();
+    owner = name;
+    nstrings = 0;
+    if (match(TOK_ASSIGN)) {
+        g.is_zero = false;
+        g.data.assign(g.size, '\0');
+        bool ok;
+        if (!static_init(type, g, ok)) return false;
+        if (!ok) {
+            error("initializer of '%s' is not a constant", name.c_str());
+            return true;
+        }
+        // The initializer may have completed an array type
+        if (type->is_array() && type->len < 0)
+            type = Type::array_of(type->base, g.size / type->base->size());
+    } else if (type->is_array() && type->len < 0) {
+        error("array size missing in '%s'", name.c_str());
+        return true;
+    }
+    declare_global(name, type);
+
+    auto it = global_index.find(name);
+    if (it == global_index.end()) {
+        global_index[name] = out.globals.size();
+        out.globals.emplace_back(std::move(g));
+    } else if (!g.is_zero) {
+        auto &old = out.globals[it->second];
+        if (!old.is_zero) {
+            error("redefinition of '%s'", name.c_str());
+            return true;
+        }
+        old = std::move(g);
+    }
+    return true;
+}
+
+// Parse the initializer of a global of @type into @g. @ok is set false if
+// it's not a constant.
+bool OnePass::static_init(const Type *type, IRGlobal &g, bool &ok) {
+    ok = false;
+    if (type->is_array()) {
+        // Only a string literal can initialize an array
+        if (prev.type != TOK_STRING || type->base->kind != TY_CHAR) {
+            if (!parse_expr(1)) return false;
+            vpop();
+            return true;
+        }
+        auto s = unescape(prev.lexeme);
+        advance();
+        if (type->len < 0) {
+            g.size = s.size() + 1;
+            g.data.assign(g.size, '\0');
+        }
+        size_t n = std::min(s.size(), (size_t)g.size);
+        g.data.replace(0, n, s, 0, n);
+        ok = true;
+        return true;
+    }
+    needs_code = false;
+    if (!parse_expr(1)) return false;
+    auto &v = vtop();
+    decay(v);
+    if (!needs_code && !v.lval) {
+        if (v.kind == SValue::CONST) {
+            put_int(g.data, 0, v.imm, type->size());
+            ok = true;
+        } else if (v.kind == SValue::SYM && type->size() == 8) {
+            g.relocs.push_back({0, *v.sym, 0});
+            ok = true;
+        }
+    }
+    vpop();
+    return true;
+}
+
+bool OnePass::define_local(const std::string &name, const Type *type) {
+    // A char array may be initialized with a string literal, which also
+    // determines its size if it's not given
+    if (type->is_array() && match(TOK_ASSIGN)) {
+        if (prev.type != TOK_STRING || type->base->kind != TY_CHAR) {
+            error("invalid initializer for array '%s'", name.c_str());
+            if (!parse_expr(1)) return false;
+            vpop();
+            return true;
+        }
+        auto data = unescape(prev.lexeme);
+        advance();
+        if (type->len < 0)
+            type = Type::array_of(type->base, data.size() + 1);
+        long size = type->size();
+        data.resize(size, '\0');
+        int slot = mf->new_slot(size, type->align());
+        declare(name, {Symbol::LOCAL, type, slot, NULL});
+        for (long off = 0; off < size; off += 8) {
+            long n = std::min(8L, size - off);
+            while (n & (n - 1)) n--;  // 1, 2, 4 or 8 bytes at a time
+            long v = 0;
+            for (long i = n - 1; i >= 0; i--)
+                v = v << 8 | (unsigned char)data[off + i];
+            SValue c = SValue::make_const(v, Type::long_type());
+            emit_mov(store_operand(c, n, 0),
+                     MOperand::make_slot(slot, off), n);
+            off -= 8 - n;
+        }
+        return true;
+    }
+    if (type->is_array() && type->len < 0) {
+        error("array size missing in '%s'", name.c_str());
+        return true;
+    }
+    int slot = mf->new_slot(type->size(), type->align());
+    // The variable is in scope in its own initializer
+    declare(name, {Symbol::LOCAL, type, slot, NULL});
+    if (match(TOK_ASSIGN)) {
+        if (!parse_expr(1)) return false;
+        convert(vtop(), type);
+        emit_mov(store_operand(vtop(), type->size(), 0),
+                 MOperand::make_slot(slot), type->size());
+        vpop();
+    }
+    return true;
+}
+
+bool OnePass::function(const std::string &name, const Type *type,
+                       const Derivation *d) {
+    declare_global(name, type);
+    if (!function_bodies.insert(name).second)
+        error("redefinition of '%s'", name.c_str());
+    mf = std::make_unique<MFunction>();
+    mf->name = name;
+    mb = mf->new_block();
+    func_type = type;
+    owner = name;
+    nstrings = 0;
+    labels.clear();
+    free_temps.clear();
+    push_scope();
+    // Parameters are copied into locals on entry, like any other variable
+    for (size_t i = 0; i < type->params.size(); i++) {
+        auto ptype = type->params[i];
+        if (ptype->is_float()) {
+            error("floating point types are not supported");
+            continue;
+        }
+        int slot = mf->new_slot(ptype->size(), ptype->align());
+        auto src = reg(i < 6 ? arg_regs[i] : RAX);
+        if (i >= 6) emit_mov(MOperand::make_arg(i - 6), src);
+        emit_mov(src, MOperand::make_slot(slot), ptype->size());
+        declare(d ? d->names[i] : "", {Symbol::LOCAL, ptype, slot, NULL});
+    }
+    if (!block_stmt()) return false;
+    pop_scope();
+    if (!is_terminated()) {
+        // Falling off the end of main returns 0. For other functions the
+        // value is undefined, but returning 0 doesn't hurt.
+        bool has_value = !type->base->is_void();
+        if (has_value) emit_mov(imm(0), reg(RAX), 4);
+        emit(M_RET).nargs = has_value;
+    }
+    for (auto &l: labels) {
+        if (!l.second.defined)
+            error("label '%s' used but not defined", l.first.c_str());
+    }
+    lower_frame(*mf);
+    out.funcs.push_back(std::move(mf));
+    mb = NULL;
+    func_type = NULL;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Statements
+
+bool OnePass::parse_stmt() {
+    StmtParser parser = get_stmt_parser(prev.type);
+    if (!parser) {
+        if (prev.type == TOK_IDENT) return label_stmt();
+        if (!parse_expr(0)) return false;
+        consume(TOK_SEMICOLON, "Expect ';'\n");
+        vpop();
+        return true;
+    } else {
+        advance();
+        return std::invoke(parser, *this);
+    }
+}
+
+bool OnePass::label_stmt() {
+    auto name = prev.lexeme;
+    advance();
+    if (match(TOK_COLON)) {
+        auto &l = labels[name];
+        if (l.defined)
+            error("duplicate label '%s'", name.c_str());
+        else
+            place(l.label);
+        l.defined = true;
+        return parse_stmt();
+    }
+    push_variable(name);
+    if (!parse_infix(0)) return false;
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    vpop();
+    return true;
+}
+
+bool OnePass::case_stmt() {
+    if (!parse_expr(2)) return false;
+    consume(TOK_COLON, "Expect ':'\n");
+    long v;
+    bool is_const = const_value(v);
+    if (switches.empty()) {
+        error("case label not within a switch statement");
+        return parse_stmt();
+    }
+    auto sw = switches.back();
+    if (!is_const) error("case label is not an integer constant");
+    // Cases are compared against the promoted value of the switch
+    v = normalize_const(v, sw->type);
+    for (auto &c: sw->cases) {
+        if (c.first == v) error("duplicate case value %ld", v);
+    }
+    Label l;
+    place(l);
+    sw->cases.emplace_back(v, l.block);
+    return parse_stmt();
+}
+
+bool OnePass::default_stmt() {
+    consume(TOK_COLON, "Expect ':'\n");
+    if (switches.empty()) {
+        error("default label not within a switch statement");
+        return parse_stmt();
+    }
+    auto sw = switches.back();
+    if (sw->default_block) error("multiple default labels");
+    Label l;
+    place(l);
+    sw->default_block = l.block;
+    return parse_stmt();
+}
+
+bool OnePass::block_stmt() {
+    push_scope();
+    while (prev.type != TOK_RBRACE) {
+        Token spec = parse_type_spec();
+        if (spec.type == TOK_ERR) break;
+        std::vector<Derivation> ds;
+        std::string name;
+        if (!parse_declarator(ds, name)) return false;
+        if (!parse_data_decl(type_of_spec(spec), ds, name)) return false;
+    }
+    while (prev.type != TOK_RBRACE) {
+        if (!parse_stmt()) return false;
+    }
+    advance();  // '}'
+    pop_scope();
+    return true;
+}
+
+bool OnePass::if_stmt() {
+    consume(TOK_LPAREN, "Expect '('\n");
+    if (!parse_expr(0)) return false;
+    consume(TOK_RPAREN, "Expect ')'\n");
+    Label else_label;
+    jump_if(false, else_label, "if condition");
+    if (!parse_stmt()) return false;
+    if (match(TOK_K_ELSE)) {
+        Label join;
+        jump(join);
+        place(else_label);
+        if (!parse_stmt()) return false;
+        place(join);
+    } else {
+        place(else_label);
+    }
+    return true;
+}
+
+// The body of a switch is generated first, behind a jump to the comparisons
+// with the cases, which are only known at the end
+bool OnePass::switch_stmt() {
+    consume(TOK_LPAREN, "Expect '('\n");
+    if (!parse_expr(0)) return false;
+    consume(TOK_RPAREN, "Expect ')'\n");
+    auto &c = vtop();
+    decay(c);
+    if (c.kind == SValue::VOID || !c.type->is_integer()) {
+        error("switch quantity is not an integer");
+        release(c);
+        c = SValue::make_const(0, Type::int_type());
+    }
+    Switch sw;
+    sw.type = arith_type(c.type, Type::int_type());
+    convert(c, sw.type);
+    sw.slot = mf->new_slot(8, 8);
+    emit_mov(store_operand(c, 8, 0), MOperand::make_slot(sw.slot));
+    vpop();
+    Label dispatch, exit;
+    jump(dispatch);
+    switches.push_back(&sw);
+    breaks.push_back(&exit);
+    continues.push_back(NULL);
+    bool ok = parse_stmt();
+    switches.pop_back();
+    breaks.pop_back();
+    continues.pop_back();
+    if (!ok) return false;
+    jump(exit);
+    place(dispatch);
+    int r = get_reg();
+    emit_mov(MOperand::make_slot(sw.slot), reg(r));
+    for (auto &k: sw.cases) {
+        if (fits_int(k.first)) {
+            emit2(M_CMP, imm(k.first), reg(r));
+        } else {
+            int t = get_reg(1u << r);
+            emit_mov(imm(k.first), reg(t));
+            emit2(M_CMP, reg(t), reg(r));
+        }
+        auto &j = emit(M_JCC);
+        j.cc = CC_E;
+        j.ops = {MOperand::make_block(k.second)};
+    }
+    if (sw.default_block)
+        emit(M_JMP).ops = {MOperand::make_block(sw.default_block)};
+    place(exit);
+    return true;
+}
+
+// The increment is generated before the body, where it's parsed, and
+// jumped around
+bool OnePass::for_stmt() {
+    consume(TOK_LPAREN, "Expect '('\n");
+    if (!match(TOK_SEMICOLON)) {
+        if (!parse_expr(0)) return false;
+        consume(TOK_SEMICOLON, "Expect ';'\n");
+        vpop();
+    }
+    Label head, body, next, exit;
+    place(head);
+    if (!match(TOK_SEMICOLON)) {
+        if (!parse_expr(0)) return false;
+        consume(TOK_SEMICOLON, "Expect ';'\n");
+        jump_if(false, exit, "for condition");
+    }
+    Label *cont = &head;
+    if (!match(TOK_RPAREN)) {
+        jump(body);
+        place(next);
+        if (!parse_expr(0)) return false;
+        consume(TOK_RPAREN, "Expect ')'\n");
+        vpop();
+        jump(head);
+        cont = &next;
+    }
+    place(body);
+    breaks.push_back(&exit);
+    continues.push_back(cont);
+    bool ok = parse_stmt();
+    breaks.pop_back();
+    continues.pop_back();
+    if (!ok) return false;
+    jump(*cont);
+    place(exit);
+    return true;
+}
+
+bool OnePass::while_stmt() {
+    consume(TOK_LPAREN, "Expect '('\n");
+    Label head, exit;
+    place(head);
+    if (!parse_expr(0)) return false;
+    consume(TOK_RPAREN, "Expect ')'\n");
+    jump_if(false, exit, "while condition");
+    breaks.push_back(&exit);
+    continues.push_back(&head);
+    bool ok = parse_stmt();
+    breaks.pop_back();
+    continues.pop_back();
+    if (!ok) return false;
+    jump(head);
+    place(exit);
+    return true;
+}
+
+bool OnePass::do_stmt() {
+    Label body, next, exit;
+    place(body);
+    breaks.push_back(&exit);
+    continues.push_back(&next);
+    bool ok = parse_stmt();
+    breaks.pop_back();
+    continues.pop_back();
+    if (!ok) return false;
+    place(next);
+    consume(TOK_K_WHILE, "Expect 'while'\n");
+    consume(TOK_LPAREN, "Expect '('\n");
+    if (!parse_expr(0)) return false;
+    consume(TOK_RPAREN, "Expect ')'\n");
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    jump_if(true, body, "do condition");
+    place(exit);
+    return true;
+}
+
+bool OnePass::goto_stmt() {
+    if (prev.type != TOK_IDENT) {
+        fprintf(stderr, "Expect identifier\n");
+        return false;
+    }
+    auto &l = labels[prev.lexeme];
+    advance();
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    jump(l.label);
+    return true;
+}
+
+bool OnePass::continue_stmt() {
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    for (auto it = continues.rbegin(); it != continues.rend(); ++it) {
+        if (*it) {
+            jump(**it);
+            return true;
+        }
+    }
+    error("continue statement not within a loop");
+    return true;
+}
+
+bool OnePass::break_stmt() {
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    if (breaks.empty())
+        error("break statement not within loop or switch");
+    else
+        jump(*breaks.back());
+    return true;
+}
+
+bool OnePass::return_stmt() {
+    auto ret_type = func_type->base;
+    if (match(TOK_SEMICOLON)) {
+        emit(M_RET);
+        return true;
+    }
+    if (!parse_expr(0)) return false;
+    consume(TOK_SEMICOLON, "Expect ';'\n");
+    if (ret_type->is_void()) {
+        error("return with a value in function returning void");
+        vpop();
+        emit(M_RET);
+        return true;
+    }
+    convert(vtop(), ret_type);
+    gv(vtop(), RAX);
+    vpop();
+    emit(M_RET).nargs = 1;
+    return true;
+}
+
+bool OnePass::empty_stmt() {
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Expressions
+
+bool OnePass::parse_expr(int prec) {
+    auto rule = get_expr_rule(prev.type);
+    auto prefix_fn = rule ? rule->prefix : NULL;
+    if (!prefix_fn) {
+        fprintf(stderr, "Expect expression\n");
+        return false;
+    }
+    if (!std::invoke(prefix_fn, *this)) return false;
+    return parse_infix(prec);
+}
+
+bool OnePass::parse_infix(int prec) {
+    while (prec < get_expr_precedence()) {
+        auto infix_fn = get_expr_rule(prev.type)->infix;
+        if (!std::invoke(infix_fn, *this)) return false;
+    }
+    return true;
+}
+
+void OnePass::push_variable(const std::string &name) {
+    auto sym = lookup(name);
+    if (!sym && prev.type == TOK_LPAREN) {
+        // Implicit declaration as "int name()", in the outermost scope
+        fprintf(stderr, "mycc: warning: implicit declaration of function "
+                "'%s'\n", name.c_str());
+        auto type = Type::func_returning(Type::int_type(), {}, false, false);
+        scopes.front()[name] = {Symbol::GLOBAL, type, 0, intern(name)};
+        sym = lookup(name);
+    }
+    if (!sym) {
+        error("'%s' undeclared", name.c_str());
+        vpush(SValue::make_const(0, Type::int_type()));
+        return;
+    }
+    SValue v;
+    v.type = sym->type;
+    v.lval = true;
+    if (sym->kind == Symbol::LOCAL) {
+        v.kind = SValue::LOCAL;
+        v.slot = sym->slot;
+    } else {
+        v.kind = SValue::SYM;
+        v.sym = sym->name;
+    }
+    vpush(v);
+}
+
+bool OnePass::variable() {
+    auto name = prev.lexeme;
+    advance();
+    push_variable(name);
+    return true;
+}
+
+bool OnePass::number() {
+    long v = std::stol(prev.lexeme);
+    advance();
+    vpush(SValue::make_const(v, fits_int(v) ? Type::int_type()
+                                            : Type::long_type()));
+    return true;
+}
+
+bool OnePass::string() {
+    SValue v;
+    v.kind = SValue::SYM;
+    v.type = Type::pointer_to(Type::char_type());
+    v.sym = string_literal(prev.lexeme);
+    advance();
+    vpush(v);
+    return true;
+}
+
+bool OnePass::grouping() {
+    advance();  // '('
+    if (!parse_expr(0)) return false;
+    consume(TOK_RPAREN, "Expect ')'\n");
+    return true;
+}
+
+bool OnePass::index() {
+    advance();  // '['
+    if (!parse_expr(0)) return false;
+    consume(TOK_RBRACKET, "Expect ']'\n");
+    size_t n = vstack.size();
+    decay(vstack[n - 2]);
+    decay(vstack[n - 1]);
+    if (vtop().type->is_pointer()) vswap();
+    if (!vstack[n - 2].type->is_pointer() || !vtop().type->is_integer()) {
+        error("subscripted value is neither array nor pointer");
+        vpop();
+        release(vtop());
+        vtop() = SValue::make_const(0, Type::int_type());
+        return true;
+    }
+    gen_binary(TOK_PLUS);
+    gen_deref();
+    return true;
+}
+
+bool OnePass::call() {
+    advance();  // '('
+    size_t base = vstack.size() - 1;
+    auto &f = vtop();
+    // Calls to functions known by name are direct
+    bool direct = f.kind == SValue::SYM && f.lval && f.type->is_func();
+    decay(f);
+    const Type *ftype = NULL;
+    if (f.kind != SValue::VOID && f.type->is_pointer() &&
+        f.type->base->is_func())
+        ftype = f.type->base;
+    else
+        error("called object is not a function");
+    size_t nargs = 0;
+    if (!match(TOK_RPAREN)) {
+        do {
+            if (!parse_expr(1)) return false;  // until ','
+            auto &a = vtop();
+            decay(a);
+            if (ftype && ftype->has_proto && nargs < ftype->params.size())
+                convert(a, ftype->params[nargs]);
+            else if (a.kind == SValue::VOID || !a.type->is_scalar())
+                error("invalid argument type '%s'", a.type->str().c_str());
+            nargs++;
+        } while (match(TOK_COMMA));
+        consume(TOK_RPAREN, "Expect ')'\n");
+    }
+    if (!ftype) {
+        while (vstack.size() > base) vpop();
+        vpush(SValue::make_const(0, Type::int_type()));
+        return true;
+    }
+    if (ftype->has_proto) {
+        if (nargs < ftype->params.size() ||
+            (nargs > ftype->params.size() && !ftype->is_variadic))
+            error("wrong number of arguments to function");
+    }
+    gen_call(base, ftype, direct);
+    return true;
+}
+
+bool OnePass::unary() {
+    auto op = prev.type;
+    advance();
+    if (!parse_expr(13)) return false;  // until '*', '/' or '%'
+    gen_unary(op);
+    return true;
+}
+
+bool OnePass::binary() {
+    // Assignment is right associative, so its RHS is parsed with a lower
+    // minimum precedence, as in Parser::binary().
+    auto op = prev.type;
+    int prec = get_expr_precedence() - (op == TOK_ASSIGN ? 1 : 0);
+    auto lexeme = prev.lexeme;
+    advance();
+    if (op == TOK_AND_AND || op == TOK_OR_OR) return logical(op, prec);
+    if (!parse_expr(prec)) return false;
+    // For the error messages
+    prev.lexeme.swap(lexeme);
+    gen_binary(op);
+    prev.lexeme.swap(lexeme);
+    return true;
+}
+
+// The result of '&&' and '||' is computed in %rax along both paths
+bool OnePass::logical(TokenType op, int prec) {
+    bool is_or = op == TOK_OR_OR;
+    auto &l = vtop();
+    decay(l);
+    if (l.kind == SValue::VOID || !l.type->is_scalar())
+        error("scalar required");
+    if (l.kind == SValue::CONST) {
+        bool value = l.imm != 0;
+        vpop();
+        if (value == is_or) {
+            // The right operand is not evaluated. At file scope there's no
+            // code to skip. Registers it might spill are saved first, as
+            // the spill code isn't run.
+            Label skip;
+            save_regs(vstack.size());
+            if (mb) jump(skip);
+            if (!parse_expr(prec)) return false;
+            vpop();
+            place(skip);
+            vpush(SValue::make_const(value, Type::int_type()));
+            return true;
+        }
+        if (!parse_expr(prec)) return false;
+        auto &r = vtop();
+        decay(r);
+        if (r.kind == SValue::VOID || !r.type->is_scalar())
+            error("scalar required");
+        if (r.kind == SValue::CONST) {
+            r = SValue::make_const(r.imm != 0, Type::int_type());
+            return true;
+        }
+        CondCode cc = test(r);
+        release(r);
+        r.kind = SValue::FLAGS;
+        r.cc = cc;
+        r.type = Type::int_type();
+        return true;
+    }
+    save_regs(vstack.size() - 1);
+    Label skip, join;
+    jump_if(is_or, skip, "'&&' or '||'");
+    if (!parse_expr(prec)) return false;
+    auto &r = vtop();
+    decay(r);
+    if (r.kind == SValue::VOID || !r.type->is_scalar())
+        error("scalar required");
+    if (r.kind != SValue::CONST) {
+        CondCode cc = test(r);
+        release(r);
+        r.kind = SValue::FLAGS;
+        r.cc = cc;
+    } else {
+        r.imm = r.imm != 0;
+    }
+    gv(r, RAX);
+    vpop();
+    jump(join);
+    place(skip);
+    emit_mov(imm(is_or), reg(RAX), 4);
+    place(join);
+    vpush(SValue::make_reg(RAX, Type::int_type()));
+    return true;
+}
+
+// The arms leave their value in %rax. The type of the result is only known
+// after both are parsed, so the first arm jumps to a conversion of its
+// value generated after the second, if it needs one.
+bool OnePass::ternary() {
+    advance();  // '?'
+    auto &c = vtop();
+    decay(c);
+    if (c.kind == SValue::VOID || !c.type->is_scalar())
+        error("scalar required in conditional");
+    save_regs(vstack.size() - 1);
+    Label else_label, fixup, join;
+    jump_if(false, else_label, "conditional");
+
+    if (!parse_expr(0)) return false;
+    auto &t = vtop();
+    decay(t);
+    auto then_type = t.type;
+    if (!then_type->is_void()) gv(t, RAX);
+    vpop();
+    jump(fixup);
+    consume(TOK_COLON, "Expect ':'\n");
+
+    place(else_label);
+    if (!parse_expr(infix_precedence(TOK_QUERY) - 1)) return false;
+    auto &e = vtop();
+    decay(e);
+    const Type *type;
+    if (then_type->is_void() || e.type->is_void()) {
+        type = Type::void_type();
+    } else if (then_type->is_integer() && e.type->is_integer()) {
+        type = arith_type(then_type, e.type);
+    } else if (then_type->is_pointer()) {
+        type = then_type;
+    } else if (e.type->is_pointer()) {
+        type = e.type;
+    } else {
+        error("type mismatch in conditional expression");
+        type = Type::int_type();
+    }
+    if (type->is_void()) {
+        vpop();
+        place(fixup);
+        SValue v;
+        v.kind = SValue::VOID;
+        v.type = type;
+        vpush(v);
+        return true;
+    }
+    convert(e, type);
+    gv(e, RAX);
+    vpop();
+    if (!same_value(then_type, type)) {
+        jump(join);
+        place(fixup);
+        vpush(SValue::make_reg(RAX, then_type));
+        convert(vtop(), type);
+        vpop();
+        place(join);
+    } else {
+        place(fixup);
+    }
+    vpush(SValue::make_reg(RAX, type));
+    return true;
+}
+
+bool OnePass::postfix() {
+    auto op = prev.type;
+    advance();
+    gen_incdec(op, true);
+    return true;
+}
+
+}
+
+bool compile_one_pass(Scanner &scanner, MModule &out) {
+    return OnePass(scanner, out).run();
+}
@@ -0,0 +1,12 @@
+#ifndef ONEPASS_HPP
+#define ONEPASS_HPP
+#include "codegen.hpp"
+#include "scan.hpp"
+
+// Compile the translation unit read by @scanner straight to machine code,
+// for -O0-fast. Like tcc, the parser generates code as it recognizes each
+// construct, keeping expression results on a value stack: there is no
+// syntax tree, no IR and no register allocation, and the code is only as
+// good as that allows. Returns false after reporting any errors.
+bool compile_one_pass(Scanner &scanner, MModule &out);
+#endif
@@ -0,0 +1,227 @@
+#include "ir.hpp"
+#include "opt.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+
+struct Flag {
+    const char *name;
+    bool OptOptions::*on;
+};
+
+const Flag flags[] = {
+    {"inline", &OptOptions::inline_functions},
+    {"sccp", &OptOptions::sccp},
+    {"gvn", &OptOptions::gvn},
+    {"licm", &OptOptions::licm},
+    {"strength-reduce", &OptOptions::strength_reduce},
+    {"unroll-loops", &OptOptions::unroll_loops},
+    {"vectorize", &OptOptions::vectorize},
+    {"mem2reg", &OptOptions::mem2reg},
+    {"strict-aliasing", &OptOptions::strict_aliasing},
+    {"optimize-sibling-calls", &OptOptions::tail_calls},
+    {"if-conversion", &OptOptions::if_conversion},
+    {"peephole", &OptOptions::peephole},
+};
+
+// Options taking a number, as -f<name>=<n>
+struct Param {
+    const char *name;
+    int OptOptions::*value;
+    int min, max;
+};
+
+const Param params[] = {
+    {"inline-limit", &OptOptions::inline_limit, 0, 1000},
+    {"unroll-factor", &OptOptions::unroll_factor, 1, 64},
+};
+
+// Options taking the path of the profile, as -f<name>[=<path>]
+const Flag profile_options[] = {
+    {"profile-generate", &OptOptions::profile_generate},
+    {"profile-use", &OptOptions::profile_use},
+};
+
+// Drop the string literals of @f no longer referenced, returning how many
+int remove_unused_strings(IRFunction &f) {
+    // String literals are only referenced from their function
+    std::unordered_set<std::string> used;
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op == IR_GLOBAL) used.insert(i.sym);
+        }
+    }
+    size_t n = 0;
+    for (size_t k = 0; k < f.strings.size(); k++) {
+        if (!used.count(f.strings[k].name)) continue;
+        if (n != k) f.strings[n] = std::move(f.strings[k]);
+        n++;
+    }
+    int removed = f.strings.size() - n;
+    f.strings.resize(n);
+    return removed;
+}
+
+}
+
+bool parse_opt_flag(OptOptions &opts, const char *name) {
+    for (auto &option: profile_options) {
+        size_t n = strlen(option.name);
+        if (strncmp(name, option.name, n) != 0 ||
+            (name[n] && name[n] != '='))
+            continue;
+        if (name[n] == '=' && !name[n + 1]) return false;
+        opts.*option.on = true;
+        if (name[n]) opts.profile_path = name + n + 1;
+        return true;
+    }
+    for (auto &param: params) {
+        size_t n = strlen(param.name);
+        if (strncmp(name, param.name, n) != 0 || name[n] != '=') continue;
+        char *end;
+        long v = strtol(name + n + 1, &end, 10);
+        if (end == name + n + 1 || *end || v < param.min || v > param.max)
+            return false;
+        opts.*param.value = v;
+        return true;
+    }
+    bool on = strncmp(name, "no-", 3) != 0;
+    if (!on) name += 3;
+    for (auto &flag: flags) {
+        if (strcmp(name, flag.name) == 0) {
+            opts.*flag.on = on;
+            return true;
+        }
+    }
+    return false;
+}
+
+void optimize_module(
+    IRModule &m, const OptOptions &opts,
+    const std::function<void(IRModule &)> &after_inlining) {
+    SCCPStats folded;
+    GVNStats numbered;
+    TailCallStats tails;
+    LoopStats looped;
+    VectorStats vectorized;
+    DCEStats total;
+    PromoteStats promoted;
+    AliasStats aliased;
+    LayoutStats laid_out;
+    // First, so the passes over each function see the bodies inlined
+    auto inlined = inline_functions(m, opts);
+    if (after_inlining) after_inlining(m);
+    // The blocks and instructions as lowered, as seen by the dead code
+    // elimination and as finally left
+    int nblocks[3] = {}, ninstrs[3] = {}, nstrings = 0;
+    auto count = [&](const IRFunction &f, int k) {
+        nblocks[k] += f.blocks.size();
+        for (auto &b: f.blocks) ninstrs[k] += b->instrs.size();
+    };
+    for (auto &f: m.funcs) {
+        count(*f, 0);
+        SCCPStats sc;
+        GVNStats vn;
+        // The loops made of recursion are then optimized like any other
+        auto tc = optimize_tail_calls(*f, opts);
+        if (opts.sccp) sc = propagate_constants(*f);
+        if (opts.gvn) vn = number_values(*f, opts);
+        // Before the other loop optimizations, which then also apply to
+        // the vector loops
+        auto vc = vectorize_loops(*f, opts);
+        auto lp = optimize_loops(*f, opts);
+        // Last, as the loop optimizations and the vectorizer find their
+        // counters and sums among the slots
+        PromoteStats pr;
+        if (opts.mem2reg) pr = promote_slots(*f);
+        count(*f, 1);
+        auto st = eliminate_dead_code(*f);
+        lower_phis(*f);
+        // Last, once the blocks are all there
+        auto ly = layout_blocks(*f);
+        count(*f, 2);
+        nstrings += remove_unused_strings(*f);
+        if (opts.stats) {
+            fprintf(stderr, "%s: folded %d constants, %d branches; %d "
+                    "redundant computations, %d loads; vectorized %d, "
+                    "hoisted %d, reduced %d, unrolled %d loops; promoted %d "
+                    "of %d locals; removed %d blocks, %d instructions, %d "
+                    "constant branches\n",
+                    f->name.c_str(), sc.constants, sc.branches, vn.exprs,
+                    vn.loads, vc.loops, lp.hoisted, lp.reduced, lp.unrolled,
+                    pr.slots, pr.locals, st.blocks, st.instrs, st.branches);
+        }
+        folded.constants += sc.constants;
+        folded.branches += sc.branches;
+        folded.blocks += sc.blocks;
+        numbered.exprs += vn.exprs;
+        numbered.loads += vn.loads;
+        for (auto &a: {vn.alias, lp.alias}) {
+            aliased.queries += a.queries;
+            aliased.cached += a.cached;
+            aliased.disjoint += a.disjoint;
+        }
+        tails.loops += tc.loops;
+        tails.jumps += tc.jumps;
+        looped.hoisted += lp.hoisted;
+        looped.reduced += lp.reduced;
+        looped.unrolled += lp.unrolled;
+        vectorized.loops += vc.loops;
+        vectorized.checks += vc.checks;
+        promoted.locals += pr.locals;
+        promoted.slots += pr.slots;
+        promoted.phis += pr.phis;
+        for (int k = 0; k < 2; k++) {
+            promoted.loads[k] += pr.loads[k];
+            promoted.stores[k] += pr.stores[k];
+        }
+        laid_out.functions += ly.functions;
+        laid_out.moved += ly.moved;
+        laid_out.cold += ly.cold;
+        laid_out.switches += ly.switches;
+        total.blocks += st.blocks;
+        total.instrs += st.instrs;
+        total.branches += st.branches;
+    }
+    if (opts.stats) {
+        fprintf(stderr, "inliner: inlined %d calls, left %d\n",
+                inlined.inlined, inlined.rejected);
+        fprintf(stderr, "tail calls: %d made loops, %d made jumps\n",
+                tails.loops, tails.jumps);
+        fprintf(stderr, "constant propagation: folded %d constants, %d "
+                "branches, %d blocks never run\n", folded.constants,
+                folded.branches, folded.blocks);
+        fprintf(stderr, "value numbering: %d redundant computations, %d "
+                "redundant loads\n", numbered.exprs, numbered.loads);
+        fprintf(stderr, "alias analysis: %d queries, %d from the cache, %d "
+                "found not to alias\n", aliased.queries, aliased.cached,
+                aliased.disjoint);
+        fprintf(stderr, "loops: hoisted %d invariants, reduced %d "
+                "multiplications, unrolled %d loops\n", looped.hoisted,
+                looped.reduced, looped.unrolled);
+        fprintf(stderr, "vectorizer: vectorized %d loops, %d overlap checks "
+                "at run time\n", vectorized.loops, vectorized.checks);
+        fprintf(stderr, "mem2reg: promoted %d of %d locals with %d phis; "
+                "loads %d -> %d, stores %d -> %d\n", promoted.slots,
+                promoted.locals, promoted.phis, promoted.loads[0],
+                promoted.loads[1], promoted.stores[0], promoted.stores[1]);
+        fprintf(stderr, "dead code: removed %d of %d blocks, %d of %d "
+                "instructions, %d string literals\n", total.blocks, nblocks[1],
+                total.instrs, ninstrs[1], nstrings);
+        if (laid_out.functions) {
+            fprintf(stderr, "layout: %d functions with a profile, %d blocks "
+                    "moved, %d never run at the end, %d switches "
+                    "reordered\n", laid_out.functions, laid_out.moved,
+                    laid_out.cold, laid_out.switches);
+        }
+        fprintf(stderr, "ir: %d blocks, %d instructions lowered; %d blocks, "
+                "%d instructions optimized\n", nblocks[0], ninstrs[0],
+                nblocks[2], ninstrs[2]);
+    }
+}
@@ -0,0 +1,220 @@
+#ifndef OPT_HPP
+#define OPT_HPP
+#include "ir.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+struct OptOptions;
+
+// Transformations of the IR, run between the lowering and any of the
+// backends.
+
+struct InlineStats {
+    int inlined = 0;   // calls replaced by the bodies of their callees
+    int rejected = 0;  // calls to functions of the module left alone
+};
+
+struct TailCallStats {
+    int loops = 0;  // calls of the function itself made jumps to its start
+    int jumps = 0;  // calls of other functions left to the backend to jump
+};
+
+struct DCEStats {
+    int blocks = 0;    // blocks removed, unreachable or merged
+    int instrs = 0;    // instructions removed, including the above
+    int branches = 0;  // conditional branches on constants made jumps
+};
+
+struct SCCPStats {
+    int constants = 0;  // instructions replaced by the constants they give
+    int branches = 0;   // conditional branches with one way taken made jumps
+    int blocks = 0;     // blocks found never to run
+};
+
+// Find the registers and local variables holding constants, following
+// only the branches that can be taken, and replace the instructions giving
+// them with IR_CONST. Branches that can only go one way become jumps.
+SCCPStats propagate_constants(IRFunction &f);
+
+// What the passes asked of AliasAnalysis
+struct AliasStats {
+    int queries = 0;
+    int cached = 0;    // answered from the cache
+    int disjoint = 0;  // found not to alias
+};
+
+struct GVNStats {
+    int exprs = 0;  // computations found redundant
+    int loads = 0;  // loads found redundant
+    AliasStats alias;
+};
+
+// Give the uses of each pure computation, and each load with no store or
+// call since the same load that may write to it, the register already
+// holding its value, if one was computed in a dominating block. The
+// redundant instructions are left for the dead code elimination to
+// remove.
+GVNStats number_values(IRFunction &f, const OptOptions &opts);
+
+struct LoopStats {
+    int hoisted = 0;   // invariant computations and loads moved out
+    int reduced = 0;   // addresses computed from counters made counters
+    int unrolled = 0;  // loops unrolled
+    AliasStats alias;
+};
+
+struct VectorStats {
+    int loops = 0;   // loops vectorized
+    int checks = 0;  // overlaps of arrays tested for at run time
+};
+
+// Remove the blocks that can't be reached from the entry, and the
+// instructions whose results are never used. Jumps to blocks doing nothing
+// but jump again are redirected, and blocks only entered from the end of
+// another are merged into it.
+DCEStats eliminate_dead_code(IRFunction &f);
+
+struct PromoteStats {
+    int locals = 0;  // slots of the function
+    int slots = 0;   // slots made registers
+    int phis = 0;    // phis added for them
+    // Loads and stores of the function before and after
+    int loads[2] = {}, stores[2] = {};
+};
+
+// Make registers of the local variables SlotSSA tracks, whose addresses
+// don't escape, replacing their loads with the values stored and with phis
+// where different ones meet. The slots are dropped.
+PromoteStats promote_slots(IRFunction &f);
+
+struct LayoutStats {
+    int functions = 0;  // functions with a profile
+    int moved = 0;      // blocks placed elsewhere
+    int cold = 0;       // blocks never run, placed at the end
+    int switches = 0;   // switches with their cases reordered
+};
+
+// Add counters of the runs of each block to the functions of @m, and a
+// function writing them to @path, or adding them to those there, called
+// before main returns and before each call of exit()
+void instrument_module(IRModule &m, const std::string &path);
+
+// Set IRBlock::count for the functions of @m found in the profile at
+// @path, as written by a program instrumented by the above, and which
+// match it. A missing or damaged profile is warned about, then ignored.
+void read_profile(IRModule &m, const std::string &path);
+
+// Order the blocks of @f, if it has a profile, so that each is followed by
+// its most frequent successor, with the blocks never run at the end, and
+// compare the cases of switches most often taken first
+LayoutStats layout_blocks(IRFunction &f);
+
+// Replace the phis added by the optimizations with copies to a register of
+// each phi at the end of its predecessors, and from it at the phi. The
+// registers of the phis are then assigned once in each predecessor.
+void lower_phis(IRFunction &f);
+
+// Which of the above optimize_module() runs, set with -f<name> and
+// -fno-<name>. The dead code elimination always runs.
+struct OptOptions {
+    bool inline_functions = true;
+    bool tail_calls = true;
+    // The most instructions a function inlined outside of loops may add,
+    // set with -finline-limit=<n>. Calls in loops allow two or three times
+    // as many.
+    int inline_limit = 40;
+    bool sccp = true;
+    bool gvn = true;
+    bool licm = true;
+    bool strength_reduce = true;
+    bool unroll_loops = true;
+    // The most copies of a loop body unrolling makes, set with
+    // -funroll-factor=<n>
+    int unroll_factor = 4;
+    bool vectorize = true;
+    // The size of the vectors in bytes, 16 for SSE2 and 32 for AVX2, set
+    // with -msse2 and -mavx2. The interpreters can't run vector
+    // instructions, so they turn off the vectorizer.
+    int vector_width = 16;
+    bool mem2reg = true;
+    // Take accesses through pointers of different sizes, but for char, to
+    // be to different objects, as C's aliasing rules allow
+    bool strict_aliasing = true;
+    // Lower ?: with cheap arms, and && and || with a cheap right side, to
+    // selects and setcc instead of branches. The lowering does this, not
+    // optimize_module(), and is told by the driver.
+    bool if_conversion = true;
+    // Instrument the program, with -fprofile-generate, or read the
+    // profile it wrote, with -fprofile-use, from @profile_path, given as
+    // -fprofile-generate=<path>; the driver does both. With a profile,
+    // calls never run aren't inlined and the hot ones get more room.
+    bool profile_generate = false;
+    bool profile_use = false;
+    std::string profile_path;
+    // Clean up the machine code after register allocation, see
+    // optimize_peephole(). Passed on to the backend by the driver.
+    bool peephole = true;
+    // Print what was folded and removed to stderr
+    bool stats = false;
+    // Print each call considered for inlining to stderr, and why it was
+    // or wasn't inlined
+    bool inline_report = false;
+    // Print each call in tail position to stderr, and what became of it
+    bool tail_call_report = false;
+};
+
+// Replace the direct calls in @m to the functions defined in it with the
+// bodies of the callees, where they're small enough for @opts, working
+// from the leaves of the call graph up. Recursive calls are left alone.
+InlineStats inline_functions(IRModule &m, const OptOptions &opts);
+
+// The functions of a module compiled a function at a time that are small
+// enough to be inlined into those after them, as they were once their own
+// calls were inlined
+struct EarlierFunctions {
+    std::vector<std::unique_ptr<IRFunction>> funcs;
+    std::unordered_map<std::string, IRFunction *> by_name;
+};
+
+// Inline into @f the calls to the functions of @earlier, defined before
+// it, as inline_functions() would, then keep a copy of @f in @earlier if
+// it's small enough. Calls to functions defined later are left alone, as
+// are those to functions calling @f, directly or through those of
+// @earlier; a cycle through functions not kept goes unseen.
+InlineStats inline_earlier(IRFunction &f, EarlierFunctions &earlier,
+                           const OptOptions &opts);
+
+// Turn the calls of @f returning their result right away into jumps: to
+// the start of @f for calls of itself, and to the callee for the others,
+// which are marked for the backend. The parameters of a function calling
+// itself this way are kept in new slots.
+TailCallStats optimize_tail_calls(IRFunction &f, const OptOptions &opts);
+
+// Move the computations that don't change in the loops of @f out of them,
+// replace multiplications of loop counters indexing arrays by addresses
+// stepped along with the counters, and unroll small loops with known trip
+// counts, as enabled by @opts. The addresses are carried around the loops
+// by phis.
+LoopStats optimize_loops(IRFunction &f, const OptOptions &opts);
+
+// Turn the innermost loops of @f stepping through arrays one element at a
+// time into loops doing opts.vector_width bytes of elements at once, the
+// original loops doing the rest. The arrays a loop stores to must not
+// overlap with the others in ways that would change what's loaded; what
+// isn't known at compile time is tested before entering the vector loop.
+VectorStats vectorize_loops(IRFunction &f, const OptOptions &opts);
+
+// Parse the name of a -f option, returning false if there's no such
+// option
+bool parse_opt_flag(OptOptions &opts, const char *name);
+
+// Run the above on all functions of @m, then drop the string literals no
+// longer referenced. @after_inlining, if given, is called once the calls
+// are inlined, before the passes over each function; it may remove the
+// functions of @m that aren't needed anymore.
+void optimize_module(
+    IRModule &m, const OptOptions &opts,
+    const std::function<void(IRModule &)> &after_inlining = NULL);
+#endif
@@ -40,12 +40,24 @@ Token Parser::parse_type_spec() {
 
 std::unique_ptr<Parser::ExtDeclList> Parser::parse_translation_unit() {
     auto decls = std::make_unique<ExtDeclList>();
+    bool parsed = parse_translation_unit(
+        [&](std::unique_ptr<ExtDeclAST> decl, const SourceRange &range) {
+            decls->emplace_back(std::move(decl));
+            ranges.push_back(range);
+            return true;
+        });
+    if (!parsed) return NULL;
+    return decls;
+}
+
+bool Parser::parse_translation_unit(const Handler &handle) {
     while (prev.type != TOK_EOF) {
+        size_t begin = prev.offset;
         auto decl = parse_external_decl();
-        if (!decl) return NULL;
-        decls->emplace_back(std::move(decl));
+        if (!decl || !handle(std::move(decl), {begin, prev.offset}))
+            return false;
     }
-    return decls;
+    return true;
 }
 
 std::unique_ptr<ExtDeclAST> Parser::parse_external_decl() {
@@ -471,7 +483,7 @@ std::unique_ptr<ExprAST> Parser::ternary(std::unique_ptr<ExprAST> e) {
     auto then_expr = parse_expr(0);
     if (!then_expr) return NULL;
     consume(TOK_COLON, "Expect ':'\n");
-    auto else_expr = parse_expr(2);
+    auto else_expr = parse_expr(infix_precedence(TOK_QUERY) - 1);
     if (!else_expr) return NULL;
     return std::make_unique<TernaryExprAST>(std::move(e), std::move(then_expr),
                                             std::move(else_expr));
@@ -483,6 +495,46 @@ std::unique_ptr<ExprAST> Parser::postfix(std::unique_ptr<ExprAST> e) {
     return std::make_unique<UnaryExprAST>(true, token, std::move(e));
 }
 
+int infix_precedence(TokenType type) {
+    static const int precedence[] = {
+    /* IDENT     */ 0,
+    /* INT_CONST */ 0,
+    /* STRING    */ 0,
+    /* LPAREN    */ 14,
+    /* RPAREN    */ 0,
+    /* LBRACKET  */ 14,
+    /* RBRACKET  */ 0,
+    /* INCR      */ 14,
+    /* DECR      */ 14,
+    /* TILDE     */ 0,
+    /* BANG      */ 0,
+    /* SIZEOF    */ 0,
+    /* STAR      */ 13,
+    /* SLASH     */ 13,
+    /* MOD       */ 13,
+    /* PLUS      */ 12,
+    /* MINUS     */ 12,
+    /* LSHIFT    */ 11,
+    /* RSHIFT    */ 11,
+    /* LT        */ 10,
+    /* GT        */ 10,
+    /* LE        */ 10,
+    /* GE        */ 10,
+    /* EQ        */ 9,
+    /* NE        */ 9,
+    /* AND       */ 8,
+    /* XOR       */ 7,
+    /* OR        */ 6,
+    /* AND_AND   */ 5,
+    /* OR_OR     */ 4,
+    /* QUERY     */ 3,
+    /* COLON     */ 0,
+    /* ASSIGN    */ 2,
+    /* COMMA     */ 1,
+    };
+    return type < ARRAY_LEN(precedence) ? precedence[type] : 0;
+}
+
 const Parser::ExprRule *Parser::get_expr_rule(TokenType type) {
     return type < ARRAY_LEN(expr_rules) ? &expr_rules[type] : NULL;
 }
@@ -2,6 +2,7 @@
 #define PARSE_HPP
 #include "scan.hpp"
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <vector>
 class ExprAST;
@@ -12,17 +13,49 @@ class ParamDeclAST;
 class Declarator;
 class DirectDecl;
 
+// The bytes of the source an external declaration was parsed from, from
+// its first token up to the token after it
+struct SourceRange {
+    size_t begin, end;
+};
+
+// How tightly @type binds as an infix operator, the higher the tighter, 0
+// for a token that isn't one. Both Parser and the -O0-fast compiler parse
+// expressions by it.
+int infix_precedence(TokenType type);
+
+// Where a Parser takes its tokens from, other than a Scanner. After
+// TOK_EOF, next() keeps returning it.
+class TokenSource {
+public:
+    virtual ~TokenSource() {}
+    virtual Token next() = 0;
+};
+
 class Parser {
 public:
-    Parser(Scanner &scanner) : scanner(scanner) { advance(); }
+    Parser(Scanner &scanner) : scanner(&scanner) { advance(); }
+    Parser(TokenSource &source) : source(&source) { advance(); }
 
     using ExtDeclList = std::vector<std::unique_ptr<ExtDeclAST>>;
     std::unique_ptr<ExtDeclList> parse_translation_unit();
+    // The range of each declaration returned by parse_translation_unit()
+    std::vector<SourceRange> ranges;
+    // Parse the translation unit a declaration at a time, handing each to
+    // @handle with its range as soon as it's parsed, so it can be freed
+    // before the next. Returns false on errors, which have been reported,
+    // or as soon as @handle does.
+    using Handler = std::function<bool(std::unique_ptr<ExtDeclAST>,
+                                       const SourceRange &)>;
+    bool parse_translation_unit(const Handler &handle);
+    // Parse the next external declaration alone, returning NULL on errors
+    std::unique_ptr<ExtDeclAST> parse_external_decl();
 private:
-    Scanner &scanner;
+    Scanner *scanner = NULL;
+    TokenSource *source = NULL;
     Token prev;
 
-    void advance() { prev = scanner.scan(); }
+    void advance() { prev = scanner ? scanner->scan() : source->next(); }
     bool match(TokenType type) {
         if (prev.type == type) {
             advance();
@@ -32,7 +65,6 @@ private:
     }
 
     Token parse_type_spec();
-    std::unique_ptr<ExtDeclAST> parse_external_decl();
     std::unique_ptr<DeclAST> parse_data_decl(
             Token type, std::unique_ptr<Declarator>);
     std::unique_ptr<ParamDeclAST> parse_param_decl();
@@ -73,51 +105,52 @@ private:
     using Prefix = std::unique_ptr<ExprAST> (Parser::*)();
     using Infix  = std::unique_ptr<ExprAST> (Parser::*)(
             std::unique_ptr<ExprAST>);
+    // How each token starts an expression and goes on with one, their
+    // precedence being infix_precedence()
     struct ExprRule {
         Prefix prefix;
         Infix  infix;
-        int    prec;
     };
     const ExprRule *get_expr_rule(TokenType type);
     int get_expr_precedence() {
         auto rule = get_expr_rule(prev.type);
-        return rule && rule->infix ? rule->prec : 0;
+        return rule && rule->infix ? infix_precedence(prev.type) : 0;
     }
     static constexpr ExprRule expr_rules[] = {
-    /* IDENT     */ {&Parser::variable, NULL, 0},
-    /* INT_CONST */ {&Parser::number, NULL, 0},
-    /* STRING    */ {&Parser::string, NULL, 0},
-    /* LPAREN    */ {&Parser::grouping, &Parser::call, 14},
-    /* RPAREN    */ {NULL, NULL, 0},
-    /* LBRACKET  */ {NULL, &Parser::index, 14},
-    /* RBRACKET  */ {NULL, NULL, 0},
-    /* INCR      */ {&Parser::unary, &Parser::postfix, 14},
-    /* DECR      */ {&Parser::unary, &Parser::postfix, 14},
-    /* TILDE     */ {&Parser::unary, NULL, 0},
-    /* BANG      */ {&Parser::unary, NULL, 0},
-    /* SIZEOF    */ {NULL, NULL, 0},
-    /* STAR      */ {&Parser::unary, &Parser::binary, 13},
-    /* SLASH     */ {NULL, &Parser::binary, 13},
-    /* MOD       */ {NULL, &Parser::binary, 13},
-    /* PLUS      */ {&Parser::unary, &Parser::binary, 12},
-    /* MINUS     */ {&Parser::unary, &Parser::binary, 12},
-    /* LSHIFT    */ {NULL, &Parser::binary, 11},
-    /* RSHIFT    */ {NULL, &Parser::binary, 11},
-    /* LT        */ {NULL, &Parser::binary, 10},
-    /* GT        */ {NULL, &Parser::binary, 10},
-    /* LE        */ {NULL, &Parser::binary, 10},
-    /* GE        */ {NULL, &Parser::binary, 10},
-    /* EQ        */ {NULL, &Parser::binary, 9},
-    /* NE        */ {NULL, &Parser::binary, 9},
-    /* AND       */ {&Parser::unary, &Parser::binary, 8},
-    /* XOR       */ {NULL, &Parser::binary, 7},
-    /* OR        */ {NULL, &Parser::binary, 6},
-    /* AND_AND   */ {NULL, &Parser::binary, 5},
-    /* OR_OR     */ {NULL, &Parser::binary, 4},
-    /* QUERY     */ {NULL, &Parser::ternary, 3},
-    /* COLON     */ {NULL, NULL, 0},
-    /* ASSIGN    */ {NULL, &Parser::binary, 2},
-    /* COMMA     */ {NULL, NULL, 1},
+    /* IDENT     */ {&Parser::variable, NULL},
+    /* INT_CONST */ {&Parser::number, NULL},
+    /* STRING    */ {&Parser::string, NULL},
+    /* LPAREN    */ {&Parser::grouping, &Parser::call},
+    /* RPAREN    */ {NULL, NULL},
+    /* LBRACKET  */ {NULL, &Parser::index},
+    /* RBRACKET  */ {NULL, NULL},
+    /* INCR      */ {&Parser::unary, &Parser::postfix},
+    /* DECR      */ {&Parser::unary, &Parser::postfix},
+    /* TILDE     */ {&Parser::unary, NULL},
+    /* BANG      */ {&Parser::unary, NULL},
+    /* SIZEOF    */ {NULL, NULL},
+    /* STAR      */ {&Parser::unary, &Parser::binary},
+    /* SLASH     */ {NULL, &Parser::binary},
+    /* MOD       */ {NULL, &Parser::binary},
+    /* PLUS      */ {&Parser::unary, &Parser::binary},
+    /* MINUS     */ {&Parser::unary, &Parser::binary},
+    /* LSHIFT    */ {NULL, &Parser::binary},
+    /* RSHIFT    */ {NULL, &Parser::binary},
+    /* LT        */ {NULL, &Parser::binary},
+    /* GT        */ {NULL, &Parser::binary},
+    /* LE        */ {NULL, &Parser::binary},
+    /* GE        */ {NULL, &Parser::binary},
+    /* EQ        */ {NULL, &Parser::binary},
+    /* NE        */ {NULL, &Parser::binary},
+    /* AND       */ {&Parser::unary, &Parser::binary},
+    /* XOR       */ {NULL, &Parser::binary},
+    /* OR        */ {NULL, &Parser::binary},
+    /* AND_AND   */ {NULL, &Parser::binary},
+    /* OR_OR     */ {NULL, &Parser::binary},
+    /* QUERY     */ {NULL, &Parser::ternary},
+    /* COLON     */ {NULL, NULL},
+    /* ASSIGN    */ {NULL, &Parser::binary},
+    /* COMMA     */ {NULL, NULL},
     };
 
     using StmtParser = std::unique_ptr<StmtAST> (Parser::*)();
@@ -0,0 +1,420 @@
+#include "codegen.hpp"
+#include "x86.hpp"
+#include <algorithm>
+#include <vector>
+
+// Rewrites of short sequences of the final instructions of a function,
+// after register allocation and frame lowering, cleaning up what the
+// earlier steps leave behind when each of them only looks at its own
+// part. Each rule of the table below looks at the instruction at one
+// position of a block, and the few around it, and rewrites them in place
+// if they match. The rules are tried at every position until none
+// matches anywhere; blocks no longer jumped to or fallen into are removed
+// along the way.
+//
+// The flags never live across blocks: every jcc, setcc and cmov follows
+// the instruction setting the flags for it in the same block. Rules
+// adding or removing instructions writing the flags check that nothing
+// reads them before the next one that does.
+
+namespace
+{
+
+class Peephole {
+public:
+    Peephole(MFunction &mf) : mf(mf) {}
+    PeepholeStats run();
+
+    MFunction &mf;
+    // The blocks of the function in order, and the position of each
+    std::vector<int> position;
+
+    MBlock *next_block(const MBlock *b) {
+        size_t k = position[b->id] + 1;
+        return k < mf.blocks.size() ? mf.blocks[k].get() : NULL;
+    }
+private:
+    PeepholeStats st;
+
+    bool apply_rules();
+    bool remove_unreached();
+    void number_blocks();
+};
+
+bool same(const MOperand &a, const MOperand &b) {
+    return a.kind == b.kind && a.reg == b.reg && a.imm == b.imm &&
+           a.sym == b.sym && a.block == b.block;
+}
+
+bool is_imm(const MOperand &o, long v) {
+    return o.kind == MOperand::IMM && o.imm == v;
+}
+
+bool reads_flags(const MInstr &i) {
+    return i.op == M_JCC || i.op == M_SETCC || i.op == M_CMOV;
+}
+
+// Whether @i certainly sets or clobbers the flags. A shift by %cl leaves
+// them alone when the count is 0, and so does one by an immediate 0.
+bool writes_flags(const MInstr &i) {
+    switch (i.op) {
+    case M_ADD:
+    case M_SUB:
+    case M_IMUL:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+    case M_NEG:
+    case M_CMP:
+    case M_TEST:
+    case M_IDIV:
+    case M_DIV:
+    case M_CALL:
+        return true;
+    case M_SHL:
+    case M_SHR:
+    case M_SAR:
+        return i.ops[0].kind == MOperand::IMM && (i.ops[0].imm & 63);
+    default:
+        return false;
+    }
+}
+
+// Whether the flags are dead before instruction @k of @b
+bool flags_dead(const MBlock &b, size_t k) {
+    for (; k < b.instrs.size(); k++) {
+        if (reads_flags(b.instrs[k])) return false;
+        if (writes_flags(b.instrs[k])) return true;
+    }
+    return true;
+}
+
+// Whether register @r is dead before instruction @k of @b: overwritten in
+// the block before being read. Writes of less than 4 bytes keep the rest.
+bool reg_dead(const MBlock &b, size_t k, int r) {
+    std::vector<int> regs;
+    for (; k < b.instrs.size(); k++) {
+        auto &i = b.instrs[k];
+        regs.clear();
+        i.uses(regs);
+        if (std::find(regs.begin(), regs.end(), r) != regs.end())
+            return false;
+        regs.clear();
+        i.defs(regs);
+        if (i.size >= 4 && std::find(regs.begin(), regs.end(), r) !=
+                               regs.end())
+            return true;
+    }
+    return false;
+}
+
+void erase(MBlock &b, size_t k, size_t n = 1) {
+    b.instrs.erase(b.instrs.begin() + k, b.instrs.begin() + k + n);
+}
+
+// The rules, each given the pass, a block and a position in it, returning
+// whether it rewrote anything
+
+// movq %rax, %rax
+bool self_move(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if (i.op != M_MOV || i.size != 8 || i.ops[0].kind != MOperand::REG ||
+        !same(i.ops[0], i.ops[1]))
+        return false;
+    erase(b, k);
+    return true;
+}
+
+// movq %rax, 8(%rsp); movq 8(%rsp), %rax: the second moves nothing. Only
+// 8-byte moves, as smaller ones to a register clear the upper bits.
+bool move_back(Peephole &, MBlock &b, size_t k) {
+    if (k + 1 >= b.instrs.size()) return false;
+    auto &i = b.instrs[k], &j = b.instrs[k + 1];
+    if (i.op != M_MOV || j.op != M_MOV || i.size != 8 || j.size != 8 ||
+        !same(i.ops[0], j.ops[1]) || !same(i.ops[1], j.ops[0]))
+        return false;
+    auto &from = i.ops[0], &to = i.ops[1];
+    if (from.kind == MOperand::IMM || (from.is_mem() && to.is_mem()))
+        return false;
+    // Not if the first changed the address of the second
+    if (to.kind == MOperand::REG && from.kind == MOperand::MEM &&
+        from.reg == to.reg)
+        return false;
+    erase(b, k + 1);
+    return true;
+}
+
+// pushq %rax; popq %rcx becomes a move, or nothing for the same register
+bool push_pop(Peephole &, MBlock &b, size_t k) {
+    if (k + 1 >= b.instrs.size()) return false;
+    auto &i = b.instrs[k], &j = b.instrs[k + 1];
+    if (i.op != M_PUSH || j.op != M_POP) return false;
+    if (same(i.ops[0], j.ops[0])) {
+        erase(b, k, 2);
+        return true;
+    }
+    MInstr mov(M_MOV);
+    mov.ops = {i.ops[0], j.ops[0]};
+    erase(b, k);
+    b.instrs[k] = mov;
+    return true;
+}
+
+// andq $4, %rax; testq %rax, %rax: the and already set the flags the test
+// does. Additions and subtractions set the zero flag the same, but not the
+// others, so only equality may be tested on their result.
+bool redundant_test(Peephole &, MBlock &b, size_t k) {
+    if (k == 0) return false;
+    auto &t = b.instrs[k], &p = b.instrs[k - 1];
+    bool is_test = t.op == M_TEST && t.ops[0].kind == MOperand::REG &&
+                   same(t.ops[0], t.ops[1]);
+    bool is_cmp = t.op == M_CMP && is_imm(t.ops[0], 0) &&
+                  t.ops[1].kind == MOperand::REG;
+    if ((!is_test && !is_cmp) || p.size != t.size ||
+        !same(p.ops.back(), t.ops[1]))
+        return false;
+    bool equality_only;
+    switch (p.op) {
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+        equality_only = false;
+        break;
+    case M_ADD:
+    case M_SUB:
+    case M_NEG:
+        equality_only = true;
+        break;
+    default:
+        return false;
+    }
+    for (size_t j = k + 1; j < b.instrs.size(); j++) {
+        auto &i = b.instrs[j];
+        if (reads_flags(i) && equality_only && i.cc != CC_E && i.cc != CC_NE)
+            return false;
+        if (writes_flags(i)) break;
+    }
+    erase(b, k);
+    return true;
+}
+
+// cmpq $0, %rax becomes testq %rax, %rax, setting the same flags in a
+// byte less
+bool compare_zero(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if (i.op != M_CMP || !is_imm(i.ops[0], 0) ||
+        i.ops[1].kind != MOperand::REG)
+        return false;
+    i.op = M_TEST;
+    i.ops[0] = i.ops[1];
+    return true;
+}
+
+// movq $0, %rax becomes xorl %eax, %eax, where the flags don't matter
+bool zero_register(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if (i.op != M_MOV || i.size < 4 || !is_imm(i.ops[0], 0) ||
+        i.ops[1].kind != MOperand::REG || i.ops[1].reg >= NUM_GPRS ||
+        !flags_dead(b, k + 1))
+        return false;
+    i.op = M_XOR;
+    i.size = 4;
+    i.ops[0] = i.ops[1];
+    return true;
+}
+
+// addq $0, %rax, where the flags don't matter
+bool add_zero(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if ((i.op != M_ADD && i.op != M_SUB) || !is_imm(i.ops[0], 0) ||
+        !flags_dead(b, k + 1))
+        return false;
+    erase(b, k);
+    return true;
+}
+
+// A register computed and overwritten before anything reads it, like the
+// addresses of direct calls and those folded into memory operands
+bool dead_def(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    switch (i.op) {
+    case M_MOV:
+    case M_MOVSX:
+    case M_MOVZX:
+    case M_LEA:
+    case M_NOT:
+        break;
+    case M_ADD:
+    case M_SUB:
+    case M_IMUL:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+    case M_SHL:
+    case M_SHR:
+    case M_SAR:
+    case M_NEG:
+        if (!flags_dead(b, k + 1)) return false;
+        break;
+    default:
+        return false;
+    }
+    auto &dst = i.ops.back();
+    if (dst.kind != MOperand::REG || dst.reg >= NUM_GPRS ||
+        dst.reg == RSP || dst.reg == RBP || !reg_dead(b, k + 1, dst.reg))
+        return false;
+    erase(b, k);
+    return true;
+}
+
+// jmp to the block right after
+bool jump_to_next(Peephole &p, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if (i.op != M_JMP || k + 1 != b.instrs.size() ||
+        i.ops[0].block != p.next_block(&b))
+        return false;
+    erase(b, k);
+    return true;
+}
+
+// jcc over a jmp, to the block right after: the opposite jcc to where
+// the jmp went
+bool branch_over_jump(Peephole &p, MBlock &b, size_t k) {
+    if (k + 2 != b.instrs.size()) return false;
+    auto &i = b.instrs[k], &j = b.instrs[k + 1];
+    if (i.op != M_JCC || j.op != M_JMP ||
+        i.ops[0].block != p.next_block(&b))
+        return false;
+    i.cc = invert_cc(i.cc);
+    i.ops[0] = j.ops[0];
+    erase(b, k + 1);
+    return true;
+}
+
+// A jump to a block starting with a jmp goes where that one does. Cycles
+// of such blocks are left alone.
+bool thread_jump(Peephole &, MBlock &b, size_t k) {
+    auto &i = b.instrs[k];
+    if (!i.is_jump()) return false;
+    std::vector<MBlock *> seen;
+    auto target = i.ops[0].block;
+    while (!target->instrs.empty() && target->instrs[0].op == M_JMP) {
+        if (std::find(seen.begin(), seen.end(), target) != seen.end())
+            return false;
+        seen.push_back(target);
+        target = target->instrs[0].ops[0].block;
+    }
+    if (target == i.ops[0].block) return false;
+    i.ops[0].block = target;
+    return true;
+}
+
+struct Rule {
+    const char *name;
+    bool (*apply)(Peephole &p, MBlock &b, size_t k);
+};
+
+const Rule rules[] = {
+    {"self move", self_move},
+    {"move back", move_back},
+    {"push pop", push_pop},
+    {"redundant test", redundant_test},
+    {"compare zero", compare_zero},
+    {"zero register", zero_register},
+    {"add zero", add_zero},
+    {"dead def", dead_def},
+    {"jump to next", jump_to_next},
+    {"branch over jump", branch_over_jump},
+    {"thread jump", thread_jump},
+};
+
+void Peephole::number_blocks() {
+    position.clear();
+    for (size_t k = 0; k < mf.blocks.size(); k++) {
+        int id = mf.blocks[k]->id;
+        if ((size_t)id >= position.size()) position.resize(id + 1);
+        position[id] = k;
+    }
+}
+
+// One pass of the rules over the function, returning whether any matched
+bool Peephole::apply_rules() {
+    bool changed = false;
+    for (auto &b: mf.blocks) {
+        for (size_t k = 0; k < b->instrs.size();) {
+            bool fired = false;
+            for (auto &r: rules) {
+                if (k < b->instrs.size() && r.apply(*this, *b, k)) {
+                    fired = true;
+                    st.rewrites++;
+                }
+            }
+            // Try again where the rewrite may have made another match
+            if (fired)
+                k = k > 0 ? k - 1 : 0;
+            else
+                k++;
+            changed |= fired;
+        }
+    }
+    return changed;
+}
+
+// Remove the blocks neither jumped to nor fallen into from another
+bool Peephole::remove_unreached() {
+    std::vector<char> reached(position.size());
+    std::vector<MBlock *> work = {mf.blocks[0].get()};
+    reached[mf.blocks[0]->id] = true;
+    auto reach = [&](MBlock *b) {
+        if (b && !reached[b->id]) {
+            reached[b->id] = true;
+            work.push_back(b);
+        }
+    };
+    while (!work.empty()) {
+        auto b = work.back();
+        work.pop_back();
+        for (auto &i: b->instrs) {
+            if (i.is_jump()) reach(i.ops[0].block);
+        }
+        auto op = b->instrs.empty() ? M_CALL : b->instrs.back().op;
+        if (op != M_JMP && op != M_RET && op != M_TAILCALL)
+            reach(next_block(b));
+    }
+    size_t n = mf.blocks.size();
+    mf.blocks.erase(std::remove_if(mf.blocks.begin(), mf.blocks.end(),
+                                   [&](const std::unique_ptr<MBlock> &b) {
+                                       return !reached[b->id];
+                                   }),
+                    mf.blocks.end());
+    st.blocks += n - mf.blocks.size();
+    number_blocks();
+    return mf.blocks.size() != n;
+}
+
+PeepholeStats Peephole::run() {
+    number_blocks();
+    bool changed = true;
+    while (changed) {
+        changed = apply_rules();
+        changed |= remove_unreached();
+    }
+    // The successors now include the blocks fallen into
+    for (auto &b: mf.blocks) {
+        b->succs.clear();
+        for (auto &i: b->instrs) {
+            if (i.is_jump()) b->succs.push_back(i.ops[0].block);
+        }
+        auto op = b->instrs.empty() ? M_CALL : b->instrs.back().op;
+        auto next = next_block(b.get());
+        if (next && op != M_JMP && op != M_RET && op != M_TAILCALL)
+            b->succs.push_back(next);
+    }
+    return st;
+}
+
+}
+
+PeepholeStats optimize_peephole(MFunction &mf) {
+    return Peephole(mf).run();
+}
@@ -0,0 +1,353 @@
+#include "cfg.hpp"
+#include "decl.hpp"
+#include "ir.hpp"
+#include "lower.hpp"
+#include "opt.hpp"
+#include "parse.hpp"
+#include "scan.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Profile-guided optimization. An instrumented program counts how often
+// each block of each function runs, in one array of counters for the
+// module, and writes them out before it exits: when main returns or exit()
+// is called. The file holds longs:
+//
+//   magic, number of functions,
+//   for each function: hash of its name, checksum of its CFG, blocks,
+//   the counters of all the blocks, function after function.
+//
+// A run finding a file with the same header, written by the same program,
+// adds its counts to those already there, so the profile covers all the
+// runs since the program was last built. The counts of the edges are
+// derived from those of the blocks: all of a block ending in a jump goes
+// to its target, and an edge out of a branch is counted as the lesser of
+// the counts of its ends, which is exact for the targets that have no
+// other way in.
+//
+// Reading the profile back, a function matches by its name and checksum,
+// so it's only used for code lowered the same way as when it was taken.
+// The counts are kept in IRBlock::count, passed on to the copies of
+// inlined and unrolled blocks; blocks the passes add otherwise are taken
+// to run as often as their immediate dominator.
+
+namespace
+{
+
+const long magic = 0x6c75636370726f66;  // "luccprof"
+const char *counters = "__lucc_profile_counts";
+const char *header = "__lucc_profile_header";
+const char *writer = "__lucc_profile_write";
+
+// FNV-1a, in 63 bits to stay a positive long
+struct Hash {
+    unsigned long h = 14695981039346656037ul;
+    void add(unsigned long v) {
+        for (int k = 0; k < 8; k++) {
+            h ^= (v >> k * 8) & 0xff;
+            h *= 1099511628211ul;
+        }
+    }
+    long value() const { return h >> 1; }
+};
+
+long name_hash(const std::string &name) {
+    Hash h;
+    for (char c: name) h.add((unsigned char)c);
+    return h.value();
+}
+
+// The shape of the CFG of @f as lowered, which the counters are laid out
+// by
+long checksum(const IRFunction &f) {
+    Hash h;
+    h.add(f.blocks.size());
+    for (auto &b: f.blocks) {
+        h.add(b->instrs.size());
+        if (!b->is_terminated()) continue;
+        auto &t = b->instrs.back();
+        h.add(t.op);
+        for (auto target: t.targets) h.add(target->id);
+        for (long c: t.cases) h.add(c);
+    }
+    return h.value();
+}
+
+// Add one to counter #k at the start of @b
+void count_block(IRFunction &f, IRBlock &b, long k) {
+    std::vector<IRInstr> add;
+    auto emit = [&](IROp op) -> IRInstr & {
+        add.emplace_back(op);
+        if (op != IR_STORE) add.back().dst = f.new_reg();
+        return add.back();
+    };
+    auto &base = emit(IR_GLOBAL);
+    base.sym = counters;
+    int array = base.dst;
+    auto &offset = emit(IR_CONST);
+    offset.imm = k * 8;
+    int index = offset.dst;
+    auto &addr = emit(IR_ADD);
+    addr.args = {array, index};
+    int at = addr.dst;
+    int old = emit(IR_LOAD).dst;
+    add.back().args = {at};
+    auto &one = emit(IR_CONST);
+    one.imm = 1;
+    int inc = one.dst;
+    auto &sum = emit(IR_ADD);
+    sum.args = {old, inc};
+    int v = sum.dst;
+    emit(IR_STORE).args = {at, v};
+    b.instrs.insert(b.instrs.begin(), add.begin(), add.end());
+}
+
+// Call the writer before each return of main and each call of exit()
+void call_writer(IRFunction &f) {
+    bool is_main = f.name == "main";
+    for (auto &b: f.blocks) {
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            auto &i = b->instrs[k];
+            if (!(is_main && i.op == IR_RET) &&
+                !(i.op == IR_CALL && i.sym == "exit"))
+                continue;
+            IRInstr call(IR_CALL);
+            call.sym = writer;
+            b->instrs.insert(b->instrs.begin() + k, std::move(call));
+            k++;
+        }
+    }
+}
+
+// The writer, in C. It only runs once, for a main calling exit() or
+// itself.
+std::string writer_source(const std::string &path, size_t nheader,
+                          long ncounters) {
+    std::string quoted;
+    for (char c: path) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    const char *text =
+        "long %1$s[%4$ld];\n"
+        "long %2$s[%5$zu];\n"
+        "long __lucc_profile_old[%6$ld];\n"
+        "long __lucc_profile_done;\n"
+        "char *fopen(char *path, char *mode);\n"
+        "long fread(long *data, long size, long n, char *file);\n"
+        "long fwrite(long *data, long size, long n, char *file);\n"
+        "int fclose(char *file);\n"
+        "void %3$s() {\n"
+        "    char *file;\n"
+        "    long i;\n"
+        "    if (__lucc_profile_done) return;\n"
+        "    __lucc_profile_done = 1;\n"
+        "    file = fopen(\"%7$s\", \"rb\");\n"
+        "    if (file) {\n"
+        "        i = fread(__lucc_profile_old, 8, %6$ld, file);\n"
+        "        if (i == %6$ld) {\n"
+        "            i = 0;\n"
+        "            while (i < %5$zu &&\n"
+        "                   __lucc_profile_old[i] == %2$s[i])\n"
+        "                i++;\n"
+        "            if (i == %5$zu) {\n"
+        "                for (i = 0; i < %4$ld; i++)\n"
+        "                    %1$s[i] = %1$s[i] + "
+        "__lucc_profile_old[%5$zu + i];\n"
+        "            }\n"
+        "        }\n"
+        "        fclose(file);\n"
+        "    }\n"
+        "    file = fopen(\"%7$s\", \"wb\");\n"
+        "    if (file) {\n"
+        "        fwrite(%2$s, 8, %5$zu, file);\n"
+        "        fwrite(%1$s, 8, %4$ld, file);\n"
+        "        fclose(file);\n"
+        "    }\n"
+        "}\n";
+    long total = nheader + ncounters;
+    int n = snprintf(NULL, 0, text, counters, header, writer, ncounters,
+                     nheader, total, quoted.c_str());
+    std::string source(n, '\0');
+    snprintf(&source[0], n + 1, text, counters, header, writer, ncounters,
+             nheader, total, quoted.c_str());
+    return source;
+}
+
+}
+
+void instrument_module(IRModule &m, const std::string &path) {
+    std::vector<long> words = {magic, (long)m.funcs.size()};
+    long n = 0;
+    for (auto &f: m.funcs) {
+        words.push_back(name_hash(f->name));
+        words.push_back(checksum(*f));
+        words.push_back(f->blocks.size());
+        for (auto &b: f->blocks) count_block(*f, *b, n++);
+        call_writer(*f);
+    }
+    // The writer is lowered on its own, so nothing it declares clashes
+    // with the program
+    auto source = writer_source(path, words.size(), n);
+    Scanner scanner(source.c_str());
+    Parser parser(scanner);
+    auto decls = parser.parse_translation_unit();
+    Lowering lowering(m);
+    for (auto &decl: *decls) decl->lower(lowering);
+    for (auto &g: m.globals) {
+        if (g.name != header) continue;
+        g.is_zero = false;
+        g.data.assign((const char *)words.data(), words.size() * 8);
+    }
+}
+
+void read_profile(IRModule &m, const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        fprintf(stderr, "mycc: warning: %s: no profile, run the program "
+                "built with -fprofile-generate first\n", path.c_str());
+        return;
+    }
+    std::ostringstream buf;
+    buf << file.rdbuf();
+    std::string data = buf.str();
+    std::vector<long> words(data.size() / 8);
+    memcpy(words.data(), data.data(), words.size() * 8);
+    size_t nfuncs = words.size() >= 2 ? words[1] : 0;
+    size_t nheader = 2 + 3 * nfuncs;
+    size_t ncounters = 0;
+    bool valid = words.size() >= 2 && words[0] == magic &&
+                 nfuncs < words.size() && nheader <= words.size();
+    for (size_t k = 0; valid && k < nfuncs; k++)
+        ncounters += words[2 + 3 * k + 2];
+    if (!valid || data.size() != (nheader + ncounters) * 8) {
+        fprintf(stderr, "mycc: warning: %s: not a profile\n", path.c_str());
+        return;
+    }
+    // The number of each function by the hash of its name, and where its
+    // counters start
+    std::unordered_map<long, size_t> functions;
+    std::vector<size_t> start(nfuncs);
+    for (size_t k = 0, at = nheader; k < nfuncs; k++) {
+        functions[words[2 + 3 * k]] = k;
+        start[k] = at;
+        at += words[2 + 3 * k + 2];
+    }
+    for (auto &f: m.funcs) {
+        auto it = functions.find(name_hash(f->name));
+        if (it == functions.end()) continue;
+        size_t k = it->second;
+        if (words[2 + 3 * k + 1] != checksum(*f) ||
+            (size_t)words[2 + 3 * k + 2] != f->blocks.size()) {
+            fprintf(stderr, "mycc: warning: %s: the profile of %s doesn't "
+                    "match its code, ignored\n", path.c_str(),
+                    f->name.c_str());
+            continue;
+        }
+        for (auto &b: f->blocks) b->count = words[start[k] + b->id];
+    }
+}
+
+LayoutStats layout_blocks(IRFunction &f) {
+    LayoutStats st;
+    bool profiled = false;
+    for (auto &b: f.blocks) profiled |= b->count >= 0;
+    if (!profiled) return st;
+    st.functions = 1;
+    CFG cfg(f);
+    DomTree dom(cfg);
+    int n = cfg.size();
+    std::vector<long> count(n);
+    for (int b: cfg.rpo) {
+        count[b] = f.blocks[b]->count;
+        if (count[b] >= 0) continue;
+        int d = dom.idom[b];
+        count[b] = d >= 0 ? count[d] : 1;
+    }
+
+    // The hottest cases of a switch are compared first
+    for (auto &b: f.blocks) {
+        if (!b->is_terminated() || b->terminator().op != IR_SWITCH) continue;
+        auto &s = b->terminator();
+        std::vector<size_t> order(s.cases.size());
+        for (size_t k = 0; k < order.size(); k++) order[k] = k;
+        std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+            return count[s.targets[x + 1]->id] > count[s.targets[y + 1]->id];
+        });
+        std::vector<long> cases;
+        std::vector<IRBlock *> targets = {s.targets[0]};
+        for (size_t k: order) {
+            cases.push_back(s.cases[k]);
+            targets.push_back(s.targets[k + 1]);
+        }
+        if (cases == s.cases) continue;
+        s.cases = std::move(cases);
+        s.targets = std::move(targets);
+        st.switches++;
+    }
+
+    // Chain the blocks along the edges, hottest first, so each block is
+    // followed by its likeliest successor where that isn't taken yet. A
+    // block never run only goes after another such block.
+    struct Edge {
+        long weight;
+        int from, to;
+    };
+    std::vector<Edge> edges;
+    for (int b = 0; b < n; b++) {
+        for (int t: cfg.succs[b]) {
+            long w = std::min(count[b], count[t]);
+            if (w > 0 || count[b] == 0) edges.push_back({w, b, t});
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(),
+                     [](const Edge &a, const Edge &b) {
+                         return a.weight > b.weight;
+                     });
+    std::vector<std::vector<int>> chains(n);
+    std::vector<int> chain_of(n);
+    for (int b = 0; b < n; b++) {
+        chains[b] = {b};
+        chain_of[b] = b;
+    }
+    for (auto &e: edges) {
+        int a = chain_of[e.from], c = chain_of[e.to];
+        if (e.to == 0 || a == c || chains[a].back() != e.from ||
+            chains[c].front() != e.to)
+            continue;
+        for (int b: chains[c]) chain_of[b] = a;
+        chains[a].insert(chains[a].end(), chains[c].begin(),
+                         chains[c].end());
+        chains[c].clear();
+    }
+
+    // The chains go in their original order, but for those never run,
+    // which go to the end
+    std::vector<int> order;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int b = 0; b < n; b++) {
+            if (chains[b].empty()) continue;
+            long hottest = 0;
+            for (int c: chains[b]) hottest = std::max(hottest, count[c]);
+            bool cold = hottest == 0 && b != 0;
+            if (cold != (pass == 1)) continue;
+            order.insert(order.end(), chains[b].begin(), chains[b].end());
+            if (cold) st.cold += chains[b].size();
+        }
+    }
+    std::vector<std::unique_ptr<IRBlock>> blocks(n);
+    for (int k = 0; k < n; k++) {
+        st.moved += order[k] != k;
+        blocks[k] = std::move(f.blocks[order[k]]);
+        blocks[k]->id = k;
+    }
+    f.blocks = std::move(blocks);
+    return st;
+}
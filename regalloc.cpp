@@ -0,0 +1,686 @@
+#include "bitvec.hpp"
+#include "cfg.hpp"
+#include "codegen.hpp"
+#include "dataflow.hpp"
+#include "x86.hpp"
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+// Linear scan register allocation, after Wimmer and Mössenböck, "Optimized
+// Interval Splitting in a Linear Scan Register Allocator".
+//
+// Instructions are numbered in block order, instruction i reading its
+// operands at position 2i and writing its results at 2i+1. The lifetime of
+// each virtual register is an interval made of ranges of positions, which
+// may have holes. Physical registers used by the instruction selector, for
+// arguments, return values, division and shifts, and the registers clobbered
+// by calls, get fixed intervals that other intervals must not overlap.
+//
+// Intervals are visited in order of their start. An interval gets the
+// register that stays free the longest, and is split where that register
+// is needed again; the rest is allocated later. When no register is free,
+// the intervals in the register that's cheapest to evict are split and
+// their rest spilled, unless the current interval itself is cheaper. The
+// cost of an interval is the number of its uses, each weighted by the loop
+// depth. A spilled interval stays in its stack slot for the rest of its
+// lifetime, and its uses go through the scratch registers %r11 and %r10,
+// which are never allocated.
+//
+// Virtual registers holding vectors are allocated the same way from the
+// vector registers, with %xmm15 and %xmm14 as their scratch registers.
+// Intervals of one kind never get the registers of the other, so the two
+// are allocated side by side.
+//
+// Finally, moves are inserted where an interval was split in the middle of
+// a block, and on control flow edges where a register lives in different
+// places at the end of the predecessor and at the start of the successor.
+
+namespace
+{
+
+const int scratch_regs[2] = {R11, R10};
+const int vector_scratch_regs[2] = {XMM15, XMM14};
+
+// Caller-saved registers come first, so values that aren't live across a
+// call don't make the function save a callee-saved register.
+const std::vector<int> alloc_regs = {
+    RAX, RCX, RDX, RSI, RDI, R8, R9, RBX, R12, R13, R14, R15,
+};
+const std::vector<int> vector_alloc_regs = {
+    XMM0, XMM0 + 1, XMM0 + 2, XMM0 + 3, XMM0 + 4, XMM0 + 5, XMM0 + 6,
+    XMM0 + 7, XMM0 + 8, XMM0 + 9, XMM0 + 10, XMM0 + 11, XMM0 + 12, XMM0 + 13,
+};
+
+bool is_allocatable(int r) {
+    if (r >= XMM0) return r < XMM14;
+    for (int a: alloc_regs) {
+        if (a == r) return true;
+    }
+    return false;
+}
+
+struct Range {
+    int from, to;  // [from, to)
+};
+
+struct UsePos {
+    int pos;
+    double weight;
+};
+
+struct Interval {
+    int vreg;
+    std::vector<Range> ranges;
+    std::vector<UsePos> uses;
+    int reg = -1;          // assigned physical register
+    bool spilled = false;  // lives in the stack slot of @vreg instead
+
+    int start() const { return ranges.front().from; }
+    int end() const { return ranges.back().to; }
+    bool covers(int pos) const {
+        for (auto &r: ranges) {
+            if (pos < r.from) return false;
+            if (pos < r.to) return true;
+        }
+        return false;
+    }
+    // The first position covered by both intervals, or INT_MAX
+    int intersect(const Interval &o) const {
+        // Skip the ranges of @o before this interval, there may be many in a
+        // fixed interval
+        int from = start();
+        size_t i = 0;
+        size_t j = std::lower_bound(o.ranges.begin(), o.ranges.end(), from,
+                                    [](const Range &r, int p) {
+                                        return r.to <= p;
+                                    }) - o.ranges.begin();
+        while (i < ranges.size() && j < o.ranges.size()) {
+            if (ranges[i].to <= o.ranges[j].from) i++;
+            else if (o.ranges[j].to <= ranges[i].from) j++;
+            else return std::max(ranges[i].from, o.ranges[j].from);
+        }
+        return INT_MAX;
+    }
+    // Sum of the weights of the uses at or after @pos
+    double cost(int pos) const {
+        double c = 0;
+        for (auto &u: uses) {
+            if (u.pos >= pos) c += u.weight;
+        }
+        return c;
+    }
+    // During construction the ranges are built backwards, and kept in
+    // reverse order until finish() is called.
+    void add_range(int from, int to) {
+        if (!ranges.empty() && ranges.back().from <= to) {
+            ranges.back().from = std::min(ranges.back().from, from);
+            ranges.back().to = std::max(ranges.back().to, to);
+        } else {
+            ranges.push_back({from, to});
+        }
+    }
+    void finish() {
+        std::reverse(ranges.begin(), ranges.end());
+        std::reverse(uses.begin(), uses.end());
+    }
+};
+
+struct Location {
+    int reg;   // -1 if in the stack slot
+    int slot;
+};
+
+// A move of a virtual register from one location to another, of a vector
+// of @width bytes if it's not 0
+struct Move {
+    MOperand from, to;
+    int width;
+};
+
+struct IntervalOrder {
+    bool operator()(const Interval *a, const Interval *b) const {
+        return a->start() > b->start();
+    }
+};
+
+class LinearScan {
+public:
+    LinearScan(MFunction &mf) : mf(mf) {}
+    RegAllocStats run();
+private:
+    MFunction &mf;
+    RegAllocStats stats;
+    std::vector<int> block_from, block_to;
+    std::vector<BitVector> live_in;
+    std::vector<std::unique_ptr<Interval>> storage;
+    // The pieces of each virtual register, sorted by start after allocation
+    std::vector<std::vector<Interval *>> pieces;
+    Interval fixed[NUM_REGS];
+    // The register or virtual register each virtual register would like to
+    // share a register with, to make a move redundant
+    std::vector<int> hints;
+    std::vector<int> slots;
+
+    std::priority_queue<Interval *, std::vector<Interval *>, IntervalOrder>
+        unhandled;
+    std::vector<Interval *> active, inactive;
+
+    static int vindex(int r) { return r - FIRST_VREG; }
+    // The registers @vreg can be allocated to
+    const std::vector<int> &regs_for(int vreg) const {
+        return mf.width(vreg) ? vector_alloc_regs : alloc_regs;
+    }
+    void number_instructions();
+    void compute_liveness();
+    void build_intervals();
+    int split_pos(int pos);
+    Interval *split(Interval *it, int pos);
+    void spill(Interval *it);
+    bool try_allocate_free(Interval *cur);
+    void allocate_blocked(Interval *cur);
+    void allocate();
+    Interval *piece_at(int vreg, int pos);
+    Location location(const Interval *it);
+    MOperand operand(const Location &l);
+    void parallel_move(std::vector<Move> moves, std::vector<MInstr> &out);
+    void rewrite();
+    void resolve();
+};
+
+void LinearScan::number_instructions() {
+    int pos = 0;
+    for (auto &b: mf.blocks) {
+        block_from.push_back(pos);
+        pos += 2 * b->instrs.size();
+        block_to.push_back(pos);
+    }
+}
+
+void LinearScan::compute_liveness() {
+    size_t n = mf.blocks.size();
+    DataflowProblem p(DataflowProblem::BACKWARD, DataflowProblem::UNION, n,
+                      mf.nvregs);
+    auto &gen = p.gen, &kill = p.kill;
+    std::vector<int> uses, defs;
+    for (size_t k = 0; k < n; k++) {
+        for (auto &i: mf.blocks[k]->instrs) {
+            uses.clear();
+            defs.clear();
+            i.uses(uses);
+            i.defs(defs);
+            for (int r: uses) {
+                if (r >= FIRST_VREG && !kill[k].test(vindex(r)))
+                    gen[k].set(vindex(r));
+            }
+            for (int r: defs) {
+                if (r >= FIRST_VREG) kill[k].set(vindex(r));
+            }
+        }
+    }
+    std::vector<std::vector<int>> succs(n);
+    for (size_t k = 0; k < n; k++) {
+        for (auto s: mf.blocks[k]->succs) succs[k].push_back(s->id);
+    }
+    live_in = solve_dataflow(CFG(std::move(succs)), p).in;
+}
+
+void LinearScan::build_intervals() {
+    pieces.resize(mf.nvregs);
+    for (int v = 0; v < mf.nvregs; v++) {
+        storage.push_back(std::make_unique<Interval>());
+        storage.back()->vreg = FIRST_VREG + v;
+        pieces[v].push_back(storage.back().get());
+    }
+    for (int r = 0; r < NUM_REGS; r++) fixed[r].vreg = r;
+    hints.assign(mf.nvregs, -1);
+
+    auto interval = [&](int r) -> Interval & {
+        return r >= FIRST_VREG ? *pieces[vindex(r)][0] : fixed[r];
+    };
+    // Physical registers are never live across blocks
+    BitVector live(FIRST_VREG + mf.nvregs), live_out(mf.nvregs);
+    std::vector<int> uses, defs;
+    for (size_t k = mf.blocks.size(); k-- > 0;) {
+        auto &b = *mf.blocks[k];
+        int from = block_from[k], to = block_to[k];
+        double weight = 1;
+        for (int d = 0; d < b.loop_depth && d < 8; d++) weight *= 10;
+        live.clear();
+        live_out.clear();
+        for (auto s: b.succs) live_out |= live_in[s->id];
+        live_out.for_each([&](int v) {
+            live.set(FIRST_VREG + v);
+            pieces[v][0]->add_range(from, to);
+        });
+        for (size_t n = b.instrs.size(); n-- > 0;) {
+            auto &i = b.instrs[n];
+            int pos = from + 2 * n;
+            uses.clear();
+            defs.clear();
+            i.uses(uses);
+            i.defs(defs);
+            for (int r: defs) {
+                if (r < FIRST_VREG && !is_allocatable(r)) continue;
+                auto &it = interval(r);
+                if (live.test(r) && !it.ranges.empty())
+                    it.ranges.back().from = pos + 1;
+                else
+                    it.add_range(pos + 1, pos + 2);
+                it.uses.push_back({pos + 1, weight});
+                live.reset(r);
+            }
+            for (int r: uses) {
+                if (r < FIRST_VREG && !is_allocatable(r)) continue;
+                auto &it = interval(r);
+                it.add_range(from, pos + 1);
+                if (it.uses.empty() || it.uses.back().pos != pos)
+                    it.uses.push_back({pos, weight});
+                live.set(r);
+            }
+            if (((i.op == M_MOV && i.size == 8) || i.op == M_VMOV) &&
+                i.ops[0].is_reg() && i.ops[1].is_reg()) {
+                int src = i.ops[0].reg, dst = i.ops[1].reg;
+                if (dst >= FIRST_VREG) hints[vindex(dst)] = src;
+                else if (src >= FIRST_VREG) hints[vindex(src)] = dst;
+            }
+        }
+    }
+    for (auto &p: pieces) p[0]->finish();
+    for (auto &f: fixed) f.finish();
+}
+
+// Splits happen before an instruction, so that the operands read and written
+// by it are in the same place. Moves can't be inserted between the jumps at
+// the end of a block, as they wouldn't be executed on all paths.
+int LinearScan::split_pos(int pos) {
+    pos &= ~1;
+    auto it = std::upper_bound(block_from.begin(), block_from.end(), pos);
+    size_t k = it - block_from.begin() - 1;
+    auto &instrs = mf.blocks[k]->instrs;
+    size_t first_jump = instrs.size();
+    while (first_jump > 0 && instrs[first_jump - 1].is_jump()) first_jump--;
+    return std::min(pos, block_from[k] + 2 * (int)first_jump);
+}
+
+// Split @it at @pos, which must be strictly inside of it, returning the part
+// from @pos on.
+Interval *LinearScan::split(Interval *it, int pos) {
+    storage.push_back(std::make_unique<Interval>());
+    auto child = storage.back().get();
+    child->vreg = it->vreg;
+    auto r = std::lower_bound(it->ranges.begin(), it->ranges.end(), pos,
+                              [](const Range &r, int p) { return r.to <= p; });
+    if (r->from < pos) {
+        child->ranges.push_back({pos, r->to});
+        r->to = pos;
+        ++r;
+    }
+    child->ranges.insert(child->ranges.end(), r, it->ranges.end());
+    it->ranges.erase(r, it->ranges.end());
+    auto u = std::lower_bound(it->uses.begin(), it->uses.end(), pos,
+                              [](const UsePos &u, int p) { return u.pos < p; });
+    child->uses.assign(u, it->uses.end());
+    it->uses.erase(u, it->uses.end());
+    pieces[vindex(it->vreg)].push_back(child);
+    stats.splits++;
+    return child;
+}
+
+void LinearScan::spill(Interval *it) {
+    it->reg = -1;
+    it->spilled = true;
+    int &s = slots[vindex(it->vreg)];
+    if (s < 0) {
+        int width = mf.width(it->vreg);
+        s = width ? mf.new_slot(width, 16) : mf.new_slot(8, 8);
+        stats.spilled++;
+    }
+}
+
+bool LinearScan::try_allocate_free(Interval *cur) {
+    auto &regs = regs_for(cur->vreg);
+    int free_until[NUM_REGS];
+    for (int r: regs) free_until[r] = cur->intersect(fixed[r]);
+    for (auto it: active) free_until[it->reg] = 0;
+    for (auto it: inactive) {
+        int &f = free_until[it->reg];
+        f = std::min(f, cur->intersect(*it));
+    }
+
+    int reg = regs[0];
+    for (int r: regs) {
+        if (free_until[r] > free_until[reg]) reg = r;
+    }
+    // Prefer the register of a move source or destination, if it's free for
+    // the whole interval
+    int hint = hints[vindex(cur->vreg)];
+    if (hint >= FIRST_VREG) {
+        auto h = piece_at(hint, cur->start() - 1);
+        hint = h ? h->reg : -1;
+    }
+    if (hint >= 0 && is_allocatable(hint) &&
+        is_vector_reg(hint) == is_vector_reg(reg) &&
+        free_until[hint] >= cur->end())
+        reg = hint;
+
+    if (free_until[reg] >= cur->end()) {
+        cur->reg = reg;
+        return true;
+    }
+    int pos = split_pos(free_until[reg]);
+    if (pos <= cur->start()) return false;
+    cur->reg = reg;
+    unhandled.push(split(cur, pos));
+    return true;
+}
+
+void LinearScan::allocate_blocked(Interval *cur) {
+    auto &regs = regs_for(cur->vreg);
+    double cost[NUM_REGS] = {};
+    int block_pos[NUM_REGS];
+    for (int r: regs) block_pos[r] = cur->intersect(fixed[r]);
+    for (auto it: active) cost[it->reg] += it->cost(cur->start());
+    for (auto it: inactive) {
+        if (cur->intersect(*it) != INT_MAX)
+            cost[it->reg] += it->cost(cur->start());
+    }
+
+    int reg = -1;
+    for (int r: regs) {
+        if (split_pos(block_pos[r]) <= cur->start()) continue;
+        if (reg < 0 || cost[r] < cost[reg]) reg = r;
+    }
+    if (reg < 0 || cur->cost(0) <= cost[reg]) {
+        spill(cur);
+        return;
+    }
+
+    // Evict the intervals in the register from the current position on
+    int pos = split_pos(cur->start());
+    auto evict = [&](std::vector<Interval *> &v, bool all) {
+        for (size_t k = 0; k < v.size();) {
+            auto it = v[k];
+            if (it->reg != reg || (!all && cur->intersect(*it) == INT_MAX)) {
+                k++;
+                continue;
+            }
+            if (pos <= it->start()) {
+                spill(it);
+            } else if (pos < it->end()) {
+                spill(split(it, pos));
+                k++;
+                continue;
+            }
+            v.erase(v.begin() + k);
+        }
+    };
+    evict(active, true);
+    evict(inactive, false);
+
+    cur->reg = reg;
+    if (block_pos[reg] < cur->end())
+        unhandled.push(split(cur, split_pos(block_pos[reg])));
+}
+
+void LinearScan::allocate() {
+    slots.assign(mf.nvregs, -1);
+    for (auto &p: pieces) {
+        if (!p[0]->ranges.empty()) unhandled.push(p[0]);
+    }
+    while (!unhandled.empty()) {
+        auto cur = unhandled.top();
+        unhandled.pop();
+        int pos = cur->start();
+        for (size_t k = 0; k < active.size();) {
+            auto it = active[k];
+            if (it->end() <= pos) {
+                active.erase(active.begin() + k);
+            } else if (!it->covers(pos)) {
+                inactive.push_back(it);
+                active.erase(active.begin() + k);
+            } else {
+                k++;
+            }
+        }
+        for (size_t k = 0; k < inactive.size();) {
+            auto it = inactive[k];
+            if (it->end() <= pos) {
+                inactive.erase(inactive.begin() + k);
+            } else if (it->covers(pos)) {
+                active.push_back(it);
+                inactive.erase(inactive.begin() + k);
+            } else {
+                k++;
+            }
+        }
+        if (!try_allocate_free(cur)) allocate_blocked(cur);
+        if (cur->reg >= 0) active.push_back(cur);
+    }
+    // Only intervals with ranges are ever split
+    for (auto &p: pieces) {
+        std::sort(p.begin(), p.end(), [](Interval *a, Interval *b) {
+            return a->start() < b->start();
+        });
+    }
+}
+
+Interval *LinearScan::piece_at(int vreg, int pos) {
+    for (auto it: pieces[vindex(vreg)]) {
+        if (!it->ranges.empty() && it->covers(pos)) return it;
+    }
+    return NULL;
+}
+
+Location LinearScan::location(const Interval *it) {
+    return {it->reg, it->spilled ? slots[vindex(it->vreg)] : -1};
+}
+
+MOperand LinearScan::operand(const Location &l) {
+    return l.reg >= 0 ? MOperand::make_reg(l.reg)
+                      : MOperand::make_slot(l.slot);
+}
+
+// Emit moves that conceptually happen at the same time. Each destination is
+// written only after it has been read as a source; cycles are broken by
+// going through a scratch register.
+void LinearScan::parallel_move(std::vector<Move> moves,
+                               std::vector<MInstr> &out) {
+    auto same = [](const MOperand &a, const MOperand &b) {
+        return a.kind == b.kind && a.reg == b.reg;
+    };
+    while (!moves.empty()) {
+        size_t k = 0;
+        for (; k < moves.size(); k++) {
+            bool blocked = false;
+            for (size_t j = 0; j < moves.size(); j++) {
+                if (j != k && same(moves[j].from, moves[k].to))
+                    blocked = true;
+            }
+            if (!blocked) break;
+        }
+        auto &m = moves[k == moves.size() ? 0 : k];
+        MInstr mov(m.width ? M_VMOV : M_MOV, m.width ? m.width : 8);
+        if (k == moves.size()) {
+            auto scratch = MOperand::make_reg(
+                m.width ? vector_scratch_regs[0] : scratch_regs[0]);
+            mov.ops = {m.from, scratch};
+            m.from = scratch;
+        } else {
+            mov.ops = {m.from, m.to};
+            moves.erase(moves.begin() + k);
+        }
+        if (mov.ops[0].kind == MOperand::SLOT) stats.reloads++;
+        else if (mov.ops[1].kind == MOperand::SLOT) stats.stores++;
+        else stats.moves++;
+        out.push_back(mov);
+    }
+}
+
+void LinearScan::rewrite() {
+    // Moves where an interval was split in the middle of a block
+    std::map<int, std::vector<Move>> split_moves;
+    for (auto &p: pieces) {
+        for (size_t k = 1; k < p.size(); k++) {
+            if (p[k]->ranges.empty()) continue;
+            int pos = p[k]->start();
+            if (std::binary_search(block_from.begin(), block_from.end(), pos))
+                continue;
+            if (!p[k - 1]->covers(pos - 1)) continue;
+            auto from = operand(location(p[k - 1]));
+            auto to = operand(location(p[k]));
+            if (from.kind != to.kind || from.reg != to.reg)
+                split_moves[pos].push_back({from, to, mf.width(p[k]->vreg)});
+        }
+    }
+
+    std::vector<int> uses, defs;
+    for (size_t k = 0; k < mf.blocks.size(); k++) {
+        auto &b = *mf.blocks[k];
+        std::vector<MInstr> out;
+        for (size_t n = 0; n < b.instrs.size(); n++) {
+            int pos = block_from[k] + 2 * n;
+            auto m = split_moves.find(pos);
+            if (m != split_moves.end()) parallel_move(m->second, out);
+
+            MInstr ins = b.instrs[n];
+            uses.clear();
+            defs.clear();
+            ins.uses(uses);
+            ins.defs(defs);
+            int spilled[2], scratch[2];
+            int nspilled = 0;
+            for (auto &o: ins.ops) {
+                if (!o.uses_reg() || o.reg < FIRST_VREG) continue;
+                auto it = piece_at(o.reg, pos);
+                if (!it) it = piece_at(o.reg, pos + 1);
+                if (it->reg >= 0) {
+                    o.reg = it->reg;
+                    continue;
+                }
+                int j = 0;
+                while (j < nspilled && spilled[j] != o.reg) j++;
+                if (j == nspilled) {
+                    scratch[j] = mf.width(o.reg) ? vector_scratch_regs[j]
+                                                 : scratch_regs[j];
+                    spilled[nspilled++] = o.reg;
+                }
+                o.reg = scratch[j];
+            }
+            for (int j = 0; j < nspilled; j++) {
+                if (std::find(uses.begin(), uses.end(), spilled[j]) ==
+                    uses.end())
+                    continue;
+                int width = mf.width(spilled[j]);
+                MInstr load(width ? M_VMOV : M_MOV, width ? width : 8);
+                load.ops = {MOperand::make_slot(slots[vindex(spilled[j])]),
+                            MOperand::make_reg(scratch[j])};
+                out.push_back(load);
+                stats.reloads++;
+            }
+            // Moves between the same register are left over from coalescing
+            if (((ins.op == M_MOV && ins.size == 8) || ins.op == M_VMOV) &&
+                ins.ops[0].is_reg() && ins.ops[1].is_reg() &&
+                ins.ops[0].reg == ins.ops[1].reg) {
+                stats.coalesced++;
+                continue;
+            }
+            out.push_back(ins);
+            for (int j = 0; j < nspilled; j++) {
+                if (std::find(defs.begin(), defs.end(), spilled[j]) ==
+                    defs.end())
+                    continue;
+                int width = mf.width(spilled[j]);
+                MInstr store(width ? M_VMOV : M_MOV, width ? width : 8);
+                store.ops = {MOperand::make_reg(scratch[j]),
+                             MOperand::make_slot(slots[vindex(spilled[j])])};
+                out.push_back(store);
+                stats.stores++;
+            }
+        }
+        b.instrs = std::move(out);
+    }
+}
+
+// Insert the moves needed on each control flow edge. They go at the end of
+// the predecessor if it has a single successor, or else at the start of the
+// successor if it has a single predecessor. Other edges are split with a new
+// block.
+void LinearScan::resolve() {
+    size_t nblocks = mf.blocks.size();
+    std::vector<int> npreds(nblocks);
+    for (auto &b: mf.blocks) {
+        for (auto s: b->succs) npreds[s->id]++;
+    }
+    std::vector<std::vector<Move>> at_start(nblocks);
+    for (size_t k = 0; k < nblocks; k++) {
+        auto b = mf.blocks[k].get();
+        std::vector<Move> at_end;
+        for (size_t j = 0; j < b->instrs.size(); j++) {
+            auto &jmp = b->instrs[j];
+            if (!jmp.is_jump()) continue;
+            auto s = jmp.ops[0].block;
+            std::vector<Move> moves;
+            live_in[s->id].for_each([&](int v) {
+                auto from = piece_at(FIRST_VREG + v, block_to[k] - 1);
+                auto to = piece_at(FIRST_VREG + v, block_from[s->id]);
+                auto a = operand(location(from)), c = operand(location(to));
+                if (a.kind != c.kind || a.reg != c.reg)
+                    moves.push_back({a, c, mf.width(FIRST_VREG + v)});
+            });
+            if (moves.empty()) continue;
+            if (b->succs.size() == 1) {
+                at_end = std::move(moves);
+            } else if (npreds[s->id] == 1) {
+                at_start[s->id] = std::move(moves);
+            } else {
+                auto nb = mf.new_block();
+                nb->loop_depth = s->loop_depth;
+                parallel_move(std::move(moves), nb->instrs);
+                nb->instrs.emplace_back(M_JMP);
+                nb->instrs.back().ops = {MOperand::make_block(s)};
+                nb->succs.push_back(s);
+                jmp.ops[0].block = nb;
+                *std::find(b->succs.begin(), b->succs.end(), s) = nb;
+            }
+        }
+        if (!at_end.empty()) {
+            // Before the jumps ending the block
+            auto &v = b->instrs;
+            size_t n = v.size();
+            while (n > 0 && v[n - 1].is_jump()) n--;
+            std::vector<MInstr> moves;
+            parallel_move(std::move(at_end), moves);
+            v.insert(v.begin() + n, moves.begin(), moves.end());
+        }
+    }
+    for (size_t k = 0; k < nblocks; k++) {
+        if (at_start[k].empty()) continue;
+        auto &v = mf.blocks[k]->instrs;
+        std::vector<MInstr> moves;
+        parallel_move(std::move(at_start[k]), moves);
+        v.insert(v.begin(), moves.begin(), moves.end());
+    }
+}
+
+RegAllocStats LinearScan::run() {
+    stats.vregs = mf.nvregs;
+    number_instructions();
+    compute_liveness();
+    build_intervals();
+    allocate();
+    rewrite();
+    // The edge moves are found by position, so this must come after the
+    // rewrite, which doesn't know about the blocks added for split edges.
+    resolve();
+    return stats;
+}
+
+}
+
+RegAllocStats allocate_registers(MFunction &mf) {
+    return LinearScan(mf).run();
+}
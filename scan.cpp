@@ -1,5 +1,6 @@
 #include "scan.hpp"
 #include <cctype>
+#include <cstring>
 #include <unordered_map>
 #include <utility>
 
@@ -68,6 +69,12 @@ const std::unordered_map<std::string, TokenType> keywords = {
 }  // namespace
 
 Token Scanner::scan() {
+    Token token = next();
+    token.offset = beg - src;
+    return token;
+}
+
+Token Scanner::next() {
     skip_whitespace();
     char c = advance();
     if (isalpha_(c)) return tok_ident();
@@ -80,7 +87,13 @@ Token Scanner::scan() {
     TOK_CASE1(']', TOK_RBRACKET)
     TOK_CASE1('~', TOK_TILDE)
     TOK_CASE1('*', TOK_STAR)
-    TOK_CASE1('/', TOK_SLASH)
+    case '/':
+        // The rest of the source, as the comment never ends
+        if (peek() == '*') {
+            end += strlen(end);
+            return {TOK_ERR, "?UNTERMINATED_COMMENT"};
+        }
+        return {TOK_SLASH, CUR_LEX};
     TOK_CASE1('%', TOK_MOD)
     TOK_CASE2('+', TOK_PLUS,  '+', TOK_INCR)
     TOK_CASE2('-', TOK_MINUS, '-', TOK_DECR)
@@ -144,9 +157,23 @@ Token Scanner::tok_ellipsis() {
     }
 }
 
+// Comments included. One left open stops before its '/', for next() to
+// report.
 void Scanner::skip_whitespace() {
-    while (peek() != '\0' && isspace(peek()))
-        advance();
+    for (;;) {
+        if (peek() != '\0' && isspace(peek())) {
+            advance();
+        } else if (peek() == '/' && end[1] == '/') {
+            while (peek() != '\0' && peek() != '\n')
+                advance();
+        } else if (peek() == '/' && end[1] == '*') {
+            const char *close = strstr(end + 2, "*/");
+            if (!close) break;
+            end = close + 2;
+        } else {
+            break;
+        }
+    }
     beg = end;
 }
 
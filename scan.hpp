@@ -1,5 +1,6 @@
 #ifndef SCAN_HPP
 #define SCAN_HPP
+#include <cstddef>
 #include <string>
 
 enum TokenType {
@@ -88,13 +89,17 @@ enum TokenType {
 struct Token {
     TokenType type;
     std::string lexeme;
+    size_t offset = 0;  // where it starts in the source
 };
 
 class Scanner {
 public:
-    Scanner(const char *src) : beg(src), end(src) {}
+    // Scan @src from the byte at @at, which starts a token or whitespace
+    Scanner(const char *src, size_t at = 0)
+        : src(src), beg(src + at), end(src + at) {}
     Token scan();
 private:
+    Token next();
     void skip_whitespace();
     char advance();
     char peek() { return *end; }
@@ -103,6 +108,6 @@ private:
     Token tok_number();
     Token tok_string();
     Token tok_ellipsis();
-    const char *beg, *end;
+    const char *src, *beg, *end;
 };
 #endif
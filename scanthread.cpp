@@ -0,0 +1,48 @@
+#include "scanthread.hpp"
+#include <utility>
+
+ScannerThread::ScannerThread(const char *src)
+    : thread(&ScannerThread::scan, this, src) {}
+
+ScannerThread::~ScannerThread() {
+    stop.store(true, std::memory_order_relaxed);
+    thread.join();
+}
+
+void ScannerThread::scan(const char *src) {
+    Scanner scanner(src);
+    std::vector<Token> filled;
+    size_t pushed = 0, tail_seen = 0;
+    bool more = true;
+    while (more) {
+        // The tokens left in it were moved out by the parser
+        filled.clear();
+        do {
+            filled.push_back(scanner.scan());
+            more = filled.back().type != TOK_EOF;
+        } while (more && filled.size() < batch_size);
+        while (pushed - tail_seen == nslots) {
+            if (stop.load(std::memory_order_relaxed)) return;
+            std::this_thread::yield();
+            tail_seen = tail.load(std::memory_order_acquire);
+        }
+        slots[pushed % nslots].swap(filled);
+        head.store(++pushed, std::memory_order_release);
+    }
+}
+
+Token ScannerThread::next() {
+    if (at == batch.size()) {
+        size_t taken = tail.load(std::memory_order_relaxed);
+        while (head_seen == taken) {
+            head_seen = head.load(std::memory_order_acquire);
+            if (head_seen == taken) std::this_thread::yield();
+        }
+        batch.swap(slots[taken % nslots]);
+        tail.store(taken + 1, std::memory_order_release);
+        at = 0;
+    }
+    // TOK_EOF ends the last batch, and is returned from then on
+    if (batch[at].type == TOK_EOF) return batch[at];
+    return std::move(batch[at++]);
+}
@@ -0,0 +1,45 @@
+#ifndef SCANTHREAD_HPP
+#define SCANTHREAD_HPP
+#include "parse.hpp"
+#include "scan.hpp"
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// The tokens of a source scanned on a thread of its own while the parser
+// takes them, so the two overlap. The scanner hands them over in batches
+// through a ring of a few slots, with no lock: the scanning thread is the
+// only one filling slots and moving @head, the parser the only one
+// emptying them and moving @tail. Each side waits, yielding, while the
+// ring is full or empty, so the scanner never gets more than the ring
+// ahead. A batch taken swaps places with the one the parser is done with,
+// whose storage the scanner then reuses.
+class ScannerThread : public TokenSource {
+public:
+    explicit ScannerThread(const char *src);
+    ~ScannerThread();
+    ScannerThread(const ScannerThread &) = delete;
+    ScannerThread &operator=(const ScannerThread &) = delete;
+    Token next() override;
+private:
+    static const size_t batch_size = 256;
+    static const size_t nslots = 8;
+
+    std::vector<Token> slots[nslots];
+    // The batches filled and emptied, only ever growing, each on a cache
+    // line of its own
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    // Set to have the scanner give up, when the parser stops early
+    std::atomic<bool> stop{false};
+    // The parser's: the batch being taken from, the next token in it and
+    // the last value of @head seen
+    alignas(64) std::vector<Token> batch;
+    size_t at = 0;
+    size_t head_seen = 0;
+    std::thread thread;
+
+    void scan(const char *src);
+};
+#endif
@@ -0,0 +1,352 @@
+#include "cfg.hpp"
+#include "ir.hpp"
+#include "opt.hpp"
+#include "ssa.hpp"
+#include <utility>
+#include <vector>
+
+// Sparse conditional constant propagation, after Wegman and Zadeck,
+// "Constant Propagation with Conditional Branches". Every value starts out
+// unknown and only goes down, to a constant and then to varying, as the
+// blocks found executable are evaluated. Only the edges taken by branches
+// on what's known so far are followed, so values coming in from code that
+// never runs don't spoil the constants at the joins.
+//
+// The values are those of the registers, and of the versions of the local
+// variables given by SlotSSA, which carry the constants stored to them over
+// to their loads, through the phis where they meet.
+
+namespace
+{
+
+struct Value {
+    enum State { UNKNOWN, CONSTANT, VARYING };
+    State state = UNKNOWN;
+    long imm = 0;
+
+    static Value constant(long imm) { return {CONSTANT, imm}; }
+    static Value varying() { return {VARYING, 0}; }
+    bool operator==(const Value &o) const {
+        return state == o.state && (state != CONSTANT || imm == o.imm);
+    }
+    bool operator!=(const Value &o) const { return !(*this == o); }
+};
+
+Value meet(Value a, Value b) {
+    if (a.state == Value::UNKNOWN) return b;
+    if (b.state == Value::UNKNOWN) return a;
+    if (a == b) return a;
+    return Value::varying();
+}
+
+long add(long a, long b) { return (unsigned long)a + (unsigned long)b; }
+long sub(long a, long b) { return (unsigned long)a - (unsigned long)b; }
+long mul(long a, long b) { return (unsigned long)a * (unsigned long)b; }
+
+// Evaluate an arithmetic, comparison or extension on constants the way the
+// generated code would, or give varying if it would trap
+Value fold(const IRInstr &i, long a, long b) {
+    typedef unsigned long ulong;
+    switch (i.op) {
+    case IR_ADD: return Value::constant(add(a, b));
+    case IR_SUB: return Value::constant(sub(a, b));
+    case IR_MUL: return Value::constant(mul(a, b));
+    case IR_DIV:
+    case IR_MOD:
+        if (b == 0 || (b == -1 && a == (long)((ulong)1 << 63)))
+            return Value::varying();
+        return Value::constant(i.op == IR_DIV ? a / b : a % b);
+    case IR_UDIV:
+    case IR_UMOD:
+        if (b == 0) return Value::varying();
+        return Value::constant(i.op == IR_UDIV ? (ulong)a / (ulong)b
+                                               : (ulong)a % (ulong)b);
+    case IR_AND: return Value::constant(a & b);
+    case IR_OR: return Value::constant(a | b);
+    case IR_XOR: return Value::constant(a ^ b);
+    case IR_SHL: return Value::constant((ulong)a << (b & 63));
+    case IR_SHR: return Value::constant((ulong)a >> (b & 63));
+    case IR_SAR: return Value::constant(a >> (b & 63));
+    case IR_EQ: return Value::constant(a == b);
+    case IR_NE: return Value::constant(a != b);
+    case IR_LT: return Value::constant(a < b);
+    case IR_LE: return Value::constant(a <= b);
+    case IR_GT: return Value::constant(a > b);
+    case IR_GE: return Value::constant(a >= b);
+    case IR_ULT: return Value::constant((ulong)a < (ulong)b);
+    case IR_ULE: return Value::constant((ulong)a <= (ulong)b);
+    case IR_UGT: return Value::constant((ulong)a > (ulong)b);
+    case IR_UGE: return Value::constant((ulong)a >= (ulong)b);
+    case IR_NEG: return Value::constant(sub(0, a));
+    case IR_NOT: return Value::constant(~a);
+    case IR_SEXT: return Value::constant(extend(a, i.size, true));
+    case IR_ZEXT: return Value::constant(extend(a, i.size, false));
+    default: return Value::varying();
+    }
+}
+
+class SCCP {
+public:
+    SCCP(IRFunction &f)
+        : f(f), cfg(f), dom(cfg), ssa(f, cfg, dom), regs(f.nregs),
+          versions(ssa.versions.size()), executed(cfg.size()),
+          taken(cfg.size()), users(f.nregs), readers(versions.size()),
+          phi_users(versions.size()) {}
+    SCCPStats run();
+private:
+    IRFunction &f;
+    CFG cfg;
+    DomTree dom;
+    SlotSSA ssa;
+    std::vector<Value> regs, versions;
+    std::vector<char> executed;
+    // For each block, which of the edges from its predecessors are taken
+    std::vector<std::vector<char>> taken;
+    // Where each register and version is used, as a block and an index
+    std::vector<std::vector<std::pair<int, int>>> users, readers;
+    std::vector<std::vector<int>> phi_users;
+    // Edges to follow, as a block and the index of a successor, and the
+    // registers and versions, numbered after the registers, that went down
+    std::vector<std::pair<int, int>> edges;
+    std::vector<int> changed;
+
+    void set_reg(int r, Value v);
+    void set_version(int v, Value x);
+    void take(int b, IRBlock *target);
+    void visit(int b, int k);
+    void visit_phi(int p);
+};
+
+void SCCP::set_reg(int r, Value v) {
+    if (regs[r] == v) return;
+    regs[r] = meet(regs[r], v);
+    changed.push_back(r);
+}
+
+void SCCP::set_version(int v, Value x) {
+    if (versions[v] == x) return;
+    versions[v] = meet(versions[v], x);
+    changed.push_back(f.nregs + v);
+}
+
+void SCCP::take(int b, IRBlock *target) {
+    auto &succs = cfg.succs[b];
+    for (size_t j = 0; j < succs.size(); j++) {
+        if (succs[j] == target->id) {
+            edges.emplace_back(b, j);
+            return;
+        }
+    }
+}
+
+void SCCP::visit(int b, int k) {
+    auto &i = f.blocks[b]->instrs[k];
+    auto arg = [&](int n) { return regs[i.args[n]]; };
+    int v = ssa.version_at[b][k];
+    switch (i.op) {
+    case IR_CONST:
+        set_reg(i.dst, Value::constant(i.imm));
+        break;
+    case IR_COPY:
+        set_reg(i.dst, arg(0));
+        break;
+    case IR_LOAD:
+        if (v < 0) {
+            set_reg(i.dst, Value::varying());
+        } else if (versions[v].state == Value::CONSTANT) {
+            set_reg(i.dst, Value::constant(
+                               extend(versions[v].imm, i.size, i.is_signed)));
+        } else {
+            set_reg(i.dst, versions[v]);
+        }
+        break;
+    case IR_STORE:
+        // The version keeps the bytes stored, the loads extend them
+        if (v >= 0) {
+            auto x = arg(1);
+            if (x.state == Value::CONSTANT)
+                x.imm = extend(x.imm, i.size, false);
+            set_version(v, x);
+        }
+        break;
+    case IR_PARAM:
+    case IR_LOCAL:
+    case IR_GLOBAL:
+        set_reg(i.dst, Value::varying());
+        break;
+    case IR_CALL:
+        if (i.dst >= 0) set_reg(i.dst, Value::varying());
+        break;
+    case IR_JMP:
+        take(b, i.targets[0]);
+        break;
+    case IR_BR:
+        if (arg(0).state == Value::CONSTANT) {
+            take(b, i.targets[arg(0).imm ? 0 : 1]);
+        } else if (arg(0).state == Value::VARYING) {
+            take(b, i.targets[0]);
+            take(b, i.targets[1]);
+        }
+        break;
+    case IR_SWITCH:
+        if (arg(0).state == Value::CONSTANT) {
+            auto target = i.targets[0];
+            for (size_t n = 0; n < i.cases.size(); n++) {
+                if (i.cases[n] == arg(0).imm) {
+                    target = i.targets[n + 1];
+                    break;
+                }
+            }
+            take(b, target);
+        } else if (arg(0).state == Value::VARYING) {
+            for (size_t j = 0; j < cfg.succs[b].size(); j++)
+                edges.emplace_back(b, j);
+        }
+        break;
+    case IR_RET:
+        break;
+    case IR_SELECT: {
+        // A known condition picks its arm, otherwise both may be the value
+        Value c = arg(0);
+        if (c.state == Value::CONSTANT)
+            set_reg(i.dst, arg(c.imm ? 1 : 2));
+        else if (c.state == Value::VARYING)
+            set_reg(i.dst, meet(arg(1), arg(2)));
+        break;
+    }
+    default: {
+        // Arithmetic, comparisons and extensions
+        Value a = arg(0), c = i.args.size() > 1 ? arg(1) : a;
+        if (a.state == Value::VARYING || c.state == Value::VARYING)
+            set_reg(i.dst, Value::varying());
+        else if (a.state == Value::CONSTANT && c.state == Value::CONSTANT)
+            set_reg(i.dst, fold(i, a.imm, c.imm));
+        break;
+    }
+    }
+}
+
+void SCCP::visit_phi(int p) {
+    auto &phi = ssa.phis[p];
+    // The entry is also entered with the variables undefined
+    Value x = phi.block == 0 ? Value::varying() : Value();
+    for (size_t k = 0; k < phi.args.size(); k++) {
+        if (taken[phi.block][k]) x = meet(x, versions[phi.args[k]]);
+    }
+    set_version(phi.version, x);
+}
+
+SCCPStats SCCP::run() {
+    SCCPStats st;
+    for (auto &b: f.blocks) {
+        taken[b->id].assign(cfg.preds[b->id].size(), false);
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            for (int a: b->instrs[k].args) users[a].emplace_back(b->id, k);
+        }
+    }
+    for (int b: cfg.rpo) {
+        auto &instrs = f.blocks[b]->instrs;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            int v = ssa.version_at[b][k];
+            if (v >= 0 && instrs[k].op == IR_LOAD)
+                readers[v].emplace_back(b, k);
+        }
+    }
+    for (size_t p = 0; p < ssa.phis.size(); p++) {
+        for (int v: ssa.phis[p].args) {
+            if (v >= 0) phi_users[v].push_back(p);
+        }
+    }
+    // Variables read before being set may hold anything
+    for (size_t v = 0; v < versions.size(); v++) {
+        if (ssa.is_undefined(v)) versions[v] = Value::varying();
+    }
+
+    auto visit_block = [&](int b) {
+        for (size_t k = 0; k < f.blocks[b]->instrs.size(); k++) visit(b, k);
+    };
+    executed[0] = true;
+    visit_block(0);
+    while (!edges.empty() || !changed.empty()) {
+        while (!edges.empty()) {
+            auto e = edges.back();
+            edges.pop_back();
+            int t = cfg.succs[e.first][e.second];
+            int k = cfg.pred_index[e.first][e.second];
+            if (taken[t][k]) continue;
+            taken[t][k] = true;
+            for (int p: ssa.phis_of_block[t]) visit_phi(p);
+            if (!executed[t]) {
+                executed[t] = true;
+                visit_block(t);
+            }
+        }
+        while (!changed.empty()) {
+            int n = changed.back();
+            changed.pop_back();
+            if (n < f.nregs) {
+                for (auto u: users[n]) {
+                    if (executed[u.first]) visit(u.first, u.second);
+                }
+                continue;
+            }
+            n -= f.nregs;
+            for (auto u: readers[n]) {
+                if (executed[u.first]) visit(u.first, u.second);
+            }
+            for (int p: phi_users[n]) {
+                if (executed[ssa.phis[p].block]) visit_phi(p);
+            }
+        }
+    }
+
+    // Replace what was found constant, and branches with a single edge
+    // taken. The blocks never executed are left unreachable, for the dead
+    // code elimination to remove.
+    for (auto &b: f.blocks) {
+        if (!executed[b->id]) {
+            st.blocks++;
+            continue;
+        }
+        for (auto &i: b->instrs) {
+            if (i.op == IR_SELECT &&
+                regs[i.args[0]].state == Value::CONSTANT) {
+                int arm = i.args[regs[i.args[0]].imm ? 1 : 2];
+                i.op = IR_COPY;
+                i.args = {arm};
+            }
+            if (i.dst < 0 || i.op == IR_CONST || i.has_side_effects() ||
+                regs[i.dst].state != Value::CONSTANT)
+                continue;
+            long imm = regs[i.dst].imm;
+            int dst = i.dst;
+            i = IRInstr(IR_CONST);
+            i.dst = dst;
+            i.imm = imm;
+            st.constants++;
+        }
+        if (!b->is_terminated()) continue;
+        auto &t = b->terminator();
+        if (t.op != IR_BR && t.op != IR_SWITCH) continue;
+        IRBlock *target = NULL;
+        int ntaken = 0;
+        for (size_t j = 0; j < cfg.succs[b->id].size(); j++) {
+            int s = cfg.succs[b->id][j];
+            if (taken[s][cfg.pred_index[b->id][j]]) {
+                target = f.blocks[s].get();
+                ntaken++;
+            }
+        }
+        if (ntaken != 1) continue;
+        t = IRInstr(IR_JMP);
+        t.targets = {target};
+        st.branches++;
+    }
+    return st;
+}
+
+}
+
+SCCPStats propagate_constants(IRFunction &f) {
+    return SCCP(f).run();
+}
@@ -0,0 +1,385 @@
+#include "ssa.hpp"
+#include "cfg.hpp"
+#include "ir.hpp"
+#include "opt.hpp"
+#include <utility>
+#include <vector>
+
+std::vector<char> promotable_slots(const IRFunction &f) {
+    std::vector<char> promotable(f.slots.size(), true);
+    std::vector<int> slot_of_reg(f.nregs, -1);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op == IR_LOCAL) slot_of_reg[i.dst] = i.imm;
+        }
+    }
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (f.slots[s].size > 8) promotable[s] = false;
+    }
+    // Any other use of an address lets it escape, and a load or store of
+    // part of the slot can't be given a single version
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            for (size_t k = 0; k < i.args.size(); k++) {
+                int s = slot_of_reg[i.args[k]];
+                if (s < 0) continue;
+                bool access = k == 0 && (i.op == IR_LOAD || i.op == IR_STORE);
+                if (!access || i.size != f.slots[s].size) promotable[s] = false;
+            }
+        }
+    }
+    return promotable;
+}
+
+SlotSSA::SlotSSA(const IRFunction &f, const CFG &cfg, const DomTree &dom)
+    : promotable(promotable_slots(f)), phis_of_block(cfg.size()),
+      version_at(cfg.size()) {
+    std::vector<int> slot_of_reg(f.nregs, -1);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op == IR_LOCAL) slot_of_reg[i.dst] = i.imm;
+        }
+    }
+    auto slot_accessed = [&](const IRInstr &i) {
+        if (i.op != IR_LOAD && i.op != IR_STORE) return -1;
+        int s = slot_of_reg[i.args[0]];
+        return s >= 0 && promotable[s] ? s : -1;
+    };
+
+    // The blocks storing to each slot, the entry defining them all
+    std::vector<std::vector<int>> def_blocks(f.slots.size());
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (promotable[s]) def_blocks[s].push_back(0);
+    }
+    for (int b: cfg.rpo) {
+        for (auto &i: f.blocks[b]->instrs) {
+            int s = i.op == IR_STORE ? slot_accessed(i) : -1;
+            if (s >= 0 && def_blocks[s].back() != b) def_blocks[s].push_back(b);
+        }
+    }
+
+    // Phis on the iterated frontiers. Each of them defines the slot too, so
+    // its own frontier needs phis as well.
+    auto df = dom.frontiers(cfg);
+    std::vector<int> has_phi(cfg.size(), -1), queued(cfg.size(), -1);
+    std::vector<int> work;
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (!promotable[s]) continue;
+        work = def_blocks[s];
+        for (int b: work) queued[b] = s;
+        while (!work.empty()) {
+            int b = work.back();
+            work.pop_back();
+            for (int d: df[b]) {
+                if (has_phi[d] == (int)s) continue;
+                has_phi[d] = s;
+                phis_of_block[d].push_back(phis.size());
+                phis.push_back({(int)s, d, (int)versions.size(),
+                                std::vector<int>(cfg.preds[d].size(), -1)});
+                versions.push_back({(int)s});
+                versions.back().phi = phis.size() - 1;
+                if (queued[d] != (int)s) {
+                    queued[d] = s;
+                    work.push_back(d);
+                }
+            }
+        }
+    }
+
+    // Rename walking the dominator tree, with the current version of each
+    // slot on top of its stack, and each block's pushes recorded to be
+    // popped on the way back up
+    std::vector<std::vector<int>> current(f.slots.size());
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (!promotable[s]) continue;
+        current[s].push_back(versions.size());
+        versions.push_back({(int)s});
+    }
+    std::vector<int> pushed;
+    std::vector<std::pair<int, size_t>> stack;
+    std::vector<size_t> marks;
+    auto enter = [&](int b) {
+        marks.push_back(pushed.size());
+        for (int p: phis_of_block[b]) {
+            current[phis[p].slot].push_back(phis[p].version);
+            pushed.push_back(phis[p].slot);
+        }
+        auto &instrs = f.blocks[b]->instrs;
+        version_at[b].assign(instrs.size(), -1);
+        for (size_t k = 0; k < instrs.size(); k++) {
+            int s = slot_accessed(instrs[k]);
+            if (s < 0) continue;
+            if (instrs[k].op == IR_LOAD) {
+                version_at[b][k] = current[s].back();
+                continue;
+            }
+            version_at[b][k] = versions.size();
+            current[s].push_back(versions.size());
+            pushed.push_back(s);
+            versions.push_back({s, b, (int)k});
+        }
+        for (size_t j = 0; j < cfg.succs[b].size(); j++) {
+            int t = cfg.succs[b][j];
+            for (int p: phis_of_block[t])
+                phis[p].args[cfg.pred_index[b][j]] =
+                    current[phis[p].slot].back();
+        }
+        stack.emplace_back(b, 0);
+    };
+    enter(0);
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        int b = top.first;
+        if (top.second < dom.children[b].size()) {
+            enter(dom.children[b][top.second++]);
+            continue;
+        }
+        for (size_t n = marks.back(); pushed.size() > n; pushed.pop_back())
+            current[pushed.back()].pop_back();
+        marks.pop_back();
+        stack.pop_back();
+    }
+}
+
+namespace
+{
+
+// Whether the value @d computes is already what a load of @size bytes,
+// extended per @is_signed, would give back after storing it
+bool is_normalized(const IRInstr *d, int size, bool is_signed) {
+    if (size == 8) return true;
+    if (!d) return false;
+    switch (d->op) {
+    case IR_CONST:
+        return extend(d->imm, size, is_signed) == d->imm;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_ULT:
+    case IR_ULE:
+    case IR_UGT:
+    case IR_UGE:
+        return true;
+    case IR_SEXT:
+        return is_signed && d->size <= size;
+    case IR_ZEXT:
+        return d->size < size || (d->size == size && !is_signed);
+    case IR_LOAD:
+        if (d->size < size) return !d->is_signed || is_signed;
+        return d->size == size && d->is_signed == is_signed;
+    default:
+        return false;
+    }
+}
+
+int count_memory_ops(const IRFunction &f, IROp op) {
+    int n = 0;
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) n += i.op == op;
+    }
+    return n;
+}
+
+}
+
+// The loads of each promoted slot are replaced by the register holding the
+// version they read, which is the value stored, a phi, or 0 for reads
+// before any store. Only the phis some load needs, directly or through
+// other phis, are added. A value stored to a slot narrower than 8 bytes
+// that a load wouldn't give back as is gets extended where it was stored.
+PromoteStats promote_slots(IRFunction &f) {
+    PromoteStats st;
+    st.loads[0] = count_memory_ops(f, IR_LOAD);
+    st.stores[0] = count_memory_ops(f, IR_STORE);
+    st.loads[1] = st.loads[0];
+    st.stores[1] = st.stores[0];
+    st.locals = f.slots.size();
+    CFG cfg(f);
+    // The phis of the entry would need a value for entering the function
+    if (!cfg.preds[0].empty()) return st;
+    DomTree dom(cfg);
+    SlotSSA ssa(f, cfg, dom);
+
+    std::vector<int> slot_of_reg(f.nregs, -1);
+    std::vector<const IRInstr *> def(f.nregs);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.dst >= 0) def[i.dst] = &i;
+            if (i.op == IR_LOCAL) slot_of_reg[i.dst] = i.imm;
+        }
+    }
+    // The slots promoted are those loaded with the same extension
+    // everywhere, and their loads' extension
+    std::vector<char> promote = ssa.promotable;
+    std::vector<int> sign(f.slots.size(), -1);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            int s = i.op == IR_LOAD ? slot_of_reg[i.args[0]] : -1;
+            if (s < 0 || !promote[s]) continue;
+            if (sign[s] >= 0 && sign[s] != i.is_signed) promote[s] = false;
+            sign[s] = i.is_signed;
+        }
+    }
+
+    // The phis needed, from the versions loaded back through the phis, and
+    // the stores of values to be extended
+    std::vector<char> needed(ssa.versions.size()), extended(needed.size());
+    std::vector<int> work;
+    for (int b: cfg.rpo) {
+        auto &instrs = f.blocks[b]->instrs;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            auto &i = instrs[k];
+            int v = ssa.version_at[b][k];
+            if (v < 0) continue;
+            int s = ssa.versions[v].slot;
+            if (!promote[s]) continue;
+            if (i.op == IR_STORE) {
+                extended[v] = sign[s] >= 0 &&
+                              !is_normalized(def[i.args[1]], i.size, sign[s]);
+            } else if (!needed[v]) {
+                needed[v] = true;
+                work.push_back(v);
+            }
+        }
+    }
+    while (!work.empty()) {
+        int v = work.back();
+        work.pop_back();
+        if (ssa.versions[v].phi < 0) continue;
+        for (int a: ssa.phis[ssa.versions[v].phi].args) {
+            if (a >= 0 && !needed[a]) {
+                needed[a] = true;
+                work.push_back(a);
+            }
+        }
+    }
+
+    // The register holding each version, and what each load is replaced
+    // by, both possibly the result of a load replaced in turn
+    std::vector<int> reg_of(ssa.versions.size(), -1);
+    std::vector<int> replaced(f.nregs, -1);
+    int undefined = -1;
+    auto version_reg = [&](int v) {
+        if (v >= 0 && !ssa.is_undefined(v)) return reg_of[v];
+        if (undefined < 0) undefined = f.new_reg();
+        return undefined;
+    };
+    for (auto &p: ssa.phis) {
+        if (needed[p.version]) reg_of[p.version] = f.new_reg();
+    }
+    for (int b: cfg.rpo) {
+        auto &instrs = f.blocks[b]->instrs;
+        std::vector<IRInstr> out;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            auto &i = instrs[k];
+            int v = ssa.version_at[b][k];
+            if (v < 0 || !promote[ssa.versions[v].slot]) {
+                out.push_back(std::move(i));
+                continue;
+            }
+            int s = ssa.versions[v].slot;
+            if (i.op == IR_LOAD) {
+                replaced[i.dst] = version_reg(v);
+                st.loads[1]--;
+                continue;
+            }
+            st.stores[1]--;
+            if (!extended[v]) {
+                reg_of[v] = i.args[1];
+                continue;
+            }
+            IRInstr ext(sign[s] ? IR_SEXT : IR_ZEXT);
+            ext.dst = f.new_reg();
+            ext.size = i.size;
+            ext.args = {i.args[1]};
+            reg_of[v] = ext.dst;
+            out.push_back(std::move(ext));
+        }
+        instrs = std::move(out);
+    }
+
+    for (auto &p: ssa.phis) {
+        if (!needed[p.version]) continue;
+        IRInstr phi(IR_PHI);
+        phi.dst = reg_of[p.version];
+        for (size_t k = 0; k < p.args.size(); k++) {
+            phi.args.push_back(version_reg(p.args[k]));
+            phi.targets.push_back(f.blocks[cfg.preds[p.block][k]].get());
+        }
+        auto &instrs = f.blocks[p.block]->instrs;
+        instrs.insert(instrs.begin(), std::move(phi));
+        st.phis++;
+    }
+    if (undefined >= 0) {
+        IRInstr zero(IR_CONST);
+        zero.dst = undefined;
+        auto &instrs = f.entry()->instrs;
+        instrs.insert(instrs.begin(), std::move(zero));
+    }
+
+    // Rename the uses of the loads, and drop the addresses of the slots
+    // promoted, numbering the others again
+    std::vector<int> renumbered(f.slots.size(), -1);
+    std::vector<IRSlot> slots;
+    for (size_t s = 0; s < f.slots.size(); s++) {
+        if (promote[s]) {
+            st.slots++;
+            continue;
+        }
+        renumbered[s] = slots.size();
+        slots.push_back(f.slots[s]);
+    }
+    f.slots = std::move(slots);
+    replaced.resize(f.nregs, -1);
+    auto find = [&](int r) {
+        while (replaced[r] >= 0) r = replaced[r];
+        return r;
+    };
+    for (auto &b: f.blocks) {
+        auto &instrs = b->instrs;
+        size_t n = 0;
+        for (size_t k = 0; k < instrs.size(); k++) {
+            auto &i = instrs[k];
+            if (i.op == IR_LOCAL) {
+                if (renumbered[i.imm] < 0) continue;
+                i.imm = renumbered[i.imm];
+            }
+            for (auto &a: i.args) a = find(a);
+            if (n != k) instrs[n] = std::move(i);
+            n++;
+        }
+        instrs.resize(n, IRInstr(IR_RET));
+    }
+    return st;
+}
+
+void lower_phis(IRFunction &f) {
+    // The copies to insert at the end of each block
+    std::vector<std::vector<IRInstr>> copies(f.blocks.size());
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.op != IR_PHI) break;
+            // Through a register of its own, so a copy for one phi can't
+            // overwrite what the copy for another reads
+            int t = f.new_reg();
+            IRInstr copy(IR_COPY);
+            copy.size = i.size;
+            copy.width = i.width;
+            for (size_t k = 0; k < i.args.size(); k++) {
+                copy.dst = t;
+                copy.args = {i.args[k]};
+                copies[i.targets[k]->id].push_back(copy);
+            }
+            copy.dst = i.dst;
+            copy.args = {t};
+            i = std::move(copy);
+        }
+    }
+    for (auto &b: f.blocks) {
+        auto &v = copies[b->id];
+        b->instrs.insert(b->instrs.end() - 1, v.begin(), v.end());
+    }
+}
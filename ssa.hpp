@@ -0,0 +1,49 @@
+#ifndef SSA_HPP
+#define SSA_HPP
+#include <vector>
+class CFG;
+class DomTree;
+class IRFunction;
+
+// Which slots of @f are only ever loaded and stored whole, right at their
+// address. Their address doesn't escape, so nothing else can change them.
+std::vector<char> promotable_slots(const IRFunction &f);
+
+// The SSA form of the local variables of a function, worked out without
+// rewriting it. Registers are already assigned once; this numbers the
+// values of the slots in the same way, for the slots only ever loaded and
+// stored whole right at their address. Each store defines a version of its
+// slot, as does the entry, with the undefined value, and each phi at the
+// joins where different versions meet. Phis are placed on the iterated
+// dominance frontiers of the stores, and each load is matched with the
+// version it reads on a walk of the dominator tree.
+class SlotSSA {
+public:
+    SlotSSA(const IRFunction &f, const CFG &cfg, const DomTree &dom);
+
+    struct Version {
+        int slot;
+        // The store defining the version, if any
+        int block = -1, index = -1;
+        int phi = -1;  // the phi defining it, if any
+    };
+    struct Phi {
+        int slot, block, version;
+        // The version coming in from each of cfg.preds[block]
+        std::vector<int> args;
+    };
+
+    std::vector<char> promotable;  // for each slot
+    std::vector<Version> versions;
+    std::vector<Phi> phis;
+    std::vector<std::vector<int>> phis_of_block;
+    // For each instruction of each block, the version a load of a
+    // promotable slot reads, or a store to one defines, else -1. Blocks not
+    // reached from the entry have none.
+    std::vector<std::vector<int>> version_at;
+
+    bool is_undefined(int v) const {
+        return versions[v].block < 0 && versions[v].phi < 0;
+    }
+};
+#endif
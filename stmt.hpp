@@ -9,8 +9,19 @@
 
 class StmtAST {
 public:
+    // How a statement run by the AST evaluator completed
+    enum Completion {
+        NORMAL,
+        BREAK,
+        CONTINUE,
+        RETURN,
+        // Left for the function body to be looked through for the label
+        GOTO,
+    };
     virtual ~StmtAST() = default;
     virtual void print(int level) = 0;
+    virtual void lower(Lowering &L) = 0;
+    virtual Completion exec(Evaluator &E) = 0;
 };
 
 class LabelStmtAST : public StmtAST {
@@ -32,6 +43,8 @@ public:
         : type(type), label(std::move(label))
         , case_exp(std::move(case_exp)), stmt(std::move(stmt)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class ExprStmtAST : public StmtAST {
@@ -39,6 +52,8 @@ class ExprStmtAST : public StmtAST {
 public:
     ExprStmtAST(std::unique_ptr<ExprAST> e) : e(std::move(e)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class BlockStmtAST : public StmtAST {
@@ -53,6 +68,8 @@ public:
                  std::unique_ptr<StmtList> stmts)
         : decls(std::move(decls)), stmts(std::move(stmts)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class IfStmtAST : public StmtAST {
@@ -67,6 +84,8 @@ public:
         , then_branch(std::move(then_branch))
         , else_branch(std::move(else_branch)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class SwitchStmtAST : public StmtAST {
@@ -77,6 +96,8 @@ public:
                   std::unique_ptr<StmtAST> body)
         : cond(std::move(cond)), body(std::move(body)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class ForStmtAST : public StmtAST {
@@ -92,6 +113,8 @@ public:
         : init(std::move(init)), cond(std::move(cond))
         , incr(std::move(incr)), body(std::move(body)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class WhileStmtAST : public StmtAST {
@@ -102,6 +125,8 @@ public:
                  std::unique_ptr<StmtAST> body)
         : cond(std::move(cond)), body(std::move(body)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class DoStmtAST : public StmtAST {
@@ -112,6 +137,8 @@ public:
               std::unique_ptr<StmtAST> body)
         : cond(std::move(cond)), body(std::move(body)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class JumpStmtAST : public StmtAST {
@@ -128,6 +155,8 @@ public:
     JumpStmtAST(JumpType type, std::unique_ptr<std::string> label)
         : type(type), label(std::move(label)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class ReturnStmtAST : public StmtAST {
@@ -135,10 +164,14 @@ class ReturnStmtAST : public StmtAST {
 public:
     ReturnStmtAST(std::unique_ptr<ExprAST> e) : e(std::move(e)) {}
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 
 class EmptyStmtAST : public StmtAST {
 public:
     void print(int level) override;
+    void lower(Lowering &L) override;
+    Completion exec(Evaluator &E) override;
 };
 #endif
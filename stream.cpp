@@ -0,0 +1,58 @@
+#include "stream.hpp"
+#include "decl.hpp"
+#include "ir.hpp"
+#include "lower.hpp"
+#include <memory>
+#include <string>
+#include <utility>
+
+bool compile_streaming(Parser &parser, const OptOptions &opt_opts,
+                       const CodegenOptions &opts, FILE *out) {
+    // The functions are inlined into as they're lowered, leaving the
+    // passes over each to optimize_module()
+    OptOptions passes = opt_opts;
+    passes.inline_functions = false;
+    // Its statistics would be of each batch
+    passes.stats = false;
+    IRModule module;
+    Lowering lowering(module);
+    lowering.if_conversion = opt_opts.if_conversion;
+    EarlierFunctions earlier;
+    ModuleEmitter emitter(opts);
+    auto write = [&](const std::string &text) {
+        fwrite(text.data(), 1, text.size(), out);
+    };
+    // Enough functions for each thread to have a few
+    IRModule batch;
+    size_t batch_size = opts.jobs * 8;
+    auto compile_batch = [&]() {
+        optimize_module(batch, passes);
+        for (auto &c: compile_module(batch, opts)) emitter.add_function(c);
+        batch.funcs.clear();
+        write(emitter.take());
+    };
+
+    bool parsed = parser.parse_translation_unit(
+        [&](std::unique_ptr<ExtDeclAST> decl, const SourceRange &) {
+            decl->lower(lowering);
+            // The rest is only lowered for its errors
+            if (lowering.failed) {
+                module.funcs.clear();
+                return true;
+            }
+            for (auto &f: module.funcs) {
+                inline_earlier(*f, earlier, opt_opts);
+                batch.funcs.push_back(std::move(f));
+            }
+            module.funcs.clear();
+            if (batch.funcs.size() >= batch_size) compile_batch();
+            return true;
+        });
+    if (!parsed) fprintf(stderr, "Parse error\n");
+    if (!parsed || lowering.failed) return false;
+    compile_batch();
+    // Only complete once all their declarations are seen
+    for (auto &g: module.globals) emitter.add_global(g);
+    write(emitter.finish());
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+#include "codegen.hpp"
+#include "opt.hpp"
+#include "parse.hpp"
+#include <cstdio>
+
+// Compilation of a translation unit while it's parsed, in memory that
+// grows with the length of its source but hardly otherwise. Each external
+// declaration is lowered as soon as it's parsed and then freed, and its
+// function inlined into, optimized and compiled a few functions later, on
+// opts.jobs threads, its IR then freed too. The assembly is written out
+// as it's made; an object file still holds the code until the end.
+//
+// What's kept is what the declarations after need: the names declared,
+// the globals, written out at the end, and copies of the functions small
+// enough to be inlined. Only the functions defined before a call can be
+// inlined there, so the code may differ from that of optimize_module(),
+// which also inlines those defined after. With opts.stats, only the
+// statistics of each function are printed, those of the whole module
+// taking all of it.
+
+// Compile what @parser parses to assembly or an object file in @out, as
+// optimize_module() and codegen_module() would, but for the above.
+// Returns false on errors, which have been reported.
+bool compile_streaming(Parser &parser, const OptOptions &opt_opts,
+                       const CodegenOptions &opts, FILE *out);
+#endif
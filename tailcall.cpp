@@ -0,0 +1,199 @@
+#include "ir.hpp"
+#include "opt.hpp"
+#include "types.hpp"
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+// Calls in tail position, right before a return of their result. A call
+// of the function itself becomes a jump back to its start, with the
+// arguments taking the place of the parameters: the parameters are read
+// from new slots, stored on entry and again at each such call. Other calls
+// are marked for the backend to leave the frame and jump to the callee,
+// which then returns straight to our caller.
+//
+// Either way the frame is gone or reused by the time the callee runs, so
+// nothing may be done after the call, and no address of a local variable
+// may have been handed out, where the callee could reach it.
+
+namespace
+{
+
+// The most arguments passed in registers; the backend can't jump to a
+// callee expecting some on the stack, which the caller pops
+const size_t max_reg_args = 6;
+
+// Whether the address of a local variable of @f gets anywhere other than
+// the loads and stores through it
+bool locals_escape(const IRFunction &f) {
+    std::vector<char> is_addr(f.nregs);
+    bool changed = true;
+    // Registers are assigned once but may be used above their definition
+    // in loops, so this runs to a fixed point
+    while (changed) {
+        changed = false;
+        for (auto &b: f.blocks) {
+            for (auto &i: b->instrs) {
+                bool tainted = i.op == IR_LOCAL;
+                for (size_t k = 0; k < i.args.size(); k++) {
+                    if (!is_addr[i.args[k]]) continue;
+                    switch (i.op) {
+                    case IR_LOAD:
+                    case IR_BR:
+                    case IR_SWITCH:
+                        break;
+                    case IR_STORE:
+                        if (k == 1) return true;
+                        break;
+                    case IR_CALL:
+                    case IR_RET:
+                        return true;
+                    default:
+                        tainted = true;
+                    }
+                }
+                if (tainted && i.dst >= 0 && !is_addr[i.dst]) {
+                    is_addr[i.dst] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// The call in tail position at the end of @b, if any: the call, then only
+// copies and extensions of its result to at least the size returned by
+// @f, which leave the bits our caller looks at alone, and the return
+int tail_call(const IRFunction &f, const IRBlock &b) {
+    auto &instrs = b.instrs;
+    if (instrs.size() < 2 || instrs.back().op != IR_RET) return -1;
+    auto ret = f.type->base;
+    int v = instrs.back().args.empty() ? -1 : instrs.back().args[0];
+    int k = instrs.size() - 2;
+    for (; k > 0 && instrs[k].op != IR_CALL; k--) {
+        auto &i = instrs[k];
+        if (v < 0 || i.dst != v) return -1;
+        if (i.op != IR_COPY &&
+            ((i.op != IR_SEXT && i.op != IR_ZEXT) || i.size < ret->size()))
+            return -1;
+        v = i.args[0];
+    }
+    auto &call = instrs[k];
+    if (call.op != IR_CALL || call.sym.empty() || (v >= 0 && call.dst != v))
+        return -1;
+    return k;
+}
+
+// Turn the calls of @f to itself at the instructions @sites into jumps to
+// its start
+void make_loop(IRFunction &f,
+               const std::vector<std::pair<IRBlock *, int>> &sites) {
+    size_t nparams = f.type->params.size();
+    std::vector<int> slots;
+    for (size_t k = 0; k < nparams; k++) slots.push_back(f.new_slot(8, 8));
+    auto start = f.entry();
+    auto local = [&](IRBlock *b, int slot) {
+        IRInstr i(IR_LOCAL);
+        i.dst = f.new_reg();
+        i.imm = slots[slot];
+        b->instrs.push_back(std::move(i));
+        return b->instrs.back().dst;
+    };
+    auto store = [&](IRBlock *b, int slot, int v) {
+        int addr = local(b, slot);
+        IRInstr i(IR_STORE);
+        i.args = {addr, v};
+        b->instrs.push_back(std::move(i));
+    };
+    auto jump = [&](IRBlock *b) {
+        IRInstr i(IR_JMP);
+        i.targets = {start};
+        b->instrs.push_back(std::move(i));
+    };
+
+    // The parameters as passed go to the slots in a new entry
+    auto entry = f.new_block();
+    for (size_t k = 0; k < nparams; k++) {
+        IRInstr param(IR_PARAM);
+        param.dst = f.new_reg();
+        param.imm = k;
+        entry->instrs.push_back(std::move(param));
+        store(entry, k, entry->instrs.back().dst);
+    }
+    jump(entry);
+    for (auto &s: sites) {
+        auto b = s.first;
+        auto args = b->instrs[s.second].args;
+        b->instrs.erase(b->instrs.begin() + s.second, b->instrs.end());
+        for (size_t k = 0; k < nparams; k++) store(b, k, args[k]);
+        jump(b);
+    }
+    // Then read from them wherever the parameters were
+    for (auto &b: f.blocks) {
+        if (b.get() == entry) continue;
+        for (size_t k = 0; k < b->instrs.size(); k++) {
+            auto &i = b->instrs[k];
+            if (i.op != IR_PARAM) continue;
+            IRInstr load(IR_LOAD);
+            load.dst = i.dst;
+            IRInstr addr(IR_LOCAL);
+            addr.dst = f.new_reg();
+            addr.imm = slots[i.imm];
+            load.args = {addr.dst};
+            b->instrs[k] = std::move(load);
+            b->instrs.insert(b->instrs.begin() + k, std::move(addr));
+        }
+    }
+
+    for (size_t k = f.blocks.size() - 1; k > 0; k--)
+        std::swap(f.blocks[k], f.blocks[k - 1]);
+    for (size_t k = 0; k < f.blocks.size(); k++) f.blocks[k]->id = k;
+}
+
+}
+
+TailCallStats optimize_tail_calls(IRFunction &f, const OptOptions &opts) {
+    TailCallStats st;
+    if (!opts.tail_calls) return st;
+    std::vector<std::pair<IRBlock *, int>> sites, loops;
+    for (auto &b: f.blocks) {
+        int k = tail_call(f, *b);
+        if (k >= 0) sites.emplace_back(b.get(), k);
+    }
+    if (sites.empty()) return st;
+    bool escape = locals_escape(f);
+    for (auto &s: sites) {
+        auto &call = s.first->instrs[s.second];
+        const char *why = NULL;
+        bool self = call.sym == f.name && !f.type->is_variadic &&
+                    call.args.size() == f.type->params.size();
+        if (escape)
+            why = "the address of a local variable is taken";
+        else if (!self && call.args.size() > max_reg_args)
+            why = "arguments passed on the stack";
+        if (opts.tail_call_report) {
+            fprintf(stderr, "%s: tail call to %s ", f.name.c_str(),
+                    call.sym.c_str());
+            if (why)
+                fprintf(stderr, "kept: %s\n", why);
+            else
+                fprintf(stderr, "made a %s\n", self ? "loop" : "jump");
+        }
+        if (why) continue;
+        if (self) {
+            loops.push_back(s);
+            st.loops++;
+            continue;
+        }
+        // The backend expects the return right after the call
+        auto &instrs = s.first->instrs;
+        auto &ret = instrs.back();
+        if (!ret.args.empty()) ret.args = {call.dst};
+        call.is_tail = true;
+        instrs.erase(instrs.begin() + s.second + 1, instrs.end() - 1);
+        st.jumps++;
+    }
+    if (!loops.empty()) make_loop(f, loops);
+    return st;
+}
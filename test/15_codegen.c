@@ -0,0 +1,64 @@
+int printf(char *s, ...);
+int g;
+int garr[10];
+long big = 5000000000;
+char *msg = "hello\tworld";
+int *gp = &g;
+int add(int a, int b) { return a + b; }
+long mul3(long a, long b, long c) { return a * b * c; }
+int many(int a, int b, int c, int d, int e, int f, int h, int i, int j) {
+    return a + 2*b + 3*c + 4*d + 5*e + 6*f + 7*h + 8*i + 9*j;
+}
+unsigned uns(unsigned a) { return a - 1; }
+char ch(int x) { return x; }
+short sh(int x) { return x; }
+int main() {
+    int i;
+    int j;
+    long l;
+    unsigned u;
+    char c;
+    int arr[5];
+    int *p;
+    char s[] = "abcdefghijklmnop";
+    i = 7; j = 3;
+    printf("%d %d %d %d %d\n", i + j, i - j, i * j, i / j, i % j);
+    printf("%d %d %d\n", -i / j, -i % j, i / -j);
+    printf("%d %d %d %d %d\n", i & j, i | j, i ^ j, i << j, i >> 1);
+    printf("%d %d %d %d %d %d\n", i < j, i <= j, i > j, i >= j, i == j, i != j);
+    printf("%d %d %d\n", !i, ~i, -i);
+    l = big;
+    printf("%ld %ld\n", l, l * 3);
+    u = 0;
+    printf("%u %u\n", uns(u), u - 1);
+    printf("%d\n", u - 1 > 5);
+    printf("%d\n", -1 < 0);
+    c = 200;
+    printf("%d %d %d\n", c, ch(300), sh(70000));
+    i = 2147483647;
+    i = i + 1;
+    printf("%d\n", i);
+    printf("%d\n", add(3, 4));
+    printf("%ld\n", mul3(1000, 1000, 1000));
+    printf("%d\n", many(1, 2, 3, 4, 5, 6, 7, 8, 9));
+    for (i = 0; i < 5; i++) arr[i] = i * i;
+    p = arr;
+    printf("%d %d %d\n", arr[4], *(p + 3), p[2]);
+    printf("%ld\n", &arr[4] - &arr[1]);
+    p++;
+    ++p;
+    printf("%d\n", *p++);
+    printf("%d\n", *--p);
+    g = 42;
+    printf("%d %d\n", *gp, garr[3]);
+    garr[3] = 9;
+    printf("%d\n", garr[3]);
+    printf("%s %s\n", msg, s + 3);
+    printf("%d\n", s[0]);
+    i = 5;
+    printf("%d %d\n", i > 3 && i < 10, i < 3 || i > 10);
+    printf("%d\n", i > 3 ? 100 : 200);
+    printf("%d\n", i++);
+    printf("%d\n", i = j = 11);
+    return 3;
+}
@@ -0,0 +1,67 @@
+int printf(char *s, ...);
+int after_return(int x) {
+    return x + 1;
+    printf("never\n");
+    x = x * 2;
+}
+int loops(int n) {
+    int i;
+    int s;
+    s = 0;
+    for (i = 0; i < n; i++) {
+        if (i % 2) {
+            continue;
+            s = s + 100;
+        }
+        if (i > 6) {
+            break;
+            printf("never\n");
+        }
+        s = s + i;
+    }
+    while (0) {
+        printf("never\n");
+    }
+    if (0)
+        printf("never\n");
+    else
+        s = s + 1;
+    return s;
+}
+int jumps(int x) {
+    goto skip;
+    printf("never\n");
+back:
+    return x;
+skip:
+    x = x + 10;
+    goto back;
+unused:
+    printf("never\n");
+    return 0;
+}
+int cases(int x) {
+    switch (x) {
+        return -1;
+    case 1:
+        x = x + 1;
+        break;
+        x = 0;
+    case 2:
+        return 20;
+    default:
+        goto out;
+    }
+    return x;
+out:
+    return 99;
+}
+int spin(int x) {
+    if (x) return x;
+    for (;;);
+}
+int main() {
+    printf("%d %d %d\n", after_return(1), loops(10), jumps(5));
+    printf("%d %d %d %d\n", cases(1), cases(2), cases(3), spin(7));
+    return 0;
+}
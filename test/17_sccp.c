@@ -0,0 +1,58 @@
+int printf(char *s, ...);
+int mode(int x) {
+    int d;
+    int r;
+    d = 2;
+    r = x;
+    if (x > 100) r = r + 1;
+    if (d == 2)
+        r = r * 3;
+    else
+        printf("never\n");
+    switch (d) {
+    case 1:
+        printf("never\n");
+        break;
+    case 2:
+        r = r + 20;
+    case 3:
+        r = r + 300;
+        break;
+    default:
+        printf("never\n");
+    }
+    return r;
+}
+int joins(int n) {
+    int k;
+    int i;
+    int s;
+    k = 5;
+    s = 0;
+    for (i = 0; i < n; i++) {
+        if (k != 5) k = i;
+        s = s + k;
+    }
+    if (n > 3)
+        k = 5;
+    return s + k;
+}
+int narrow() {
+    char c;
+    unsigned u;
+    c = 200;
+    u = 0 - 1;
+    if (c < 0 && u > 0) return c + u / 65536;
+    return 0;
+}
+int maybe(int x) {
+    int y;
+    if (x) y = 7;
+    if (x) return y;
+    return -1;
+}
+int main() {
+    printf("%d %d %d\n", mode(1), mode(200), joins(10));
+    printf("%d %d %d\n", narrow(), maybe(1), maybe(0));
+    return 0;
+}
@@ -0,0 +1,73 @@
+int printf(char *s, ...);
+long a[64];
+int m[8][8];
+int calls;
+int next(int x) {
+    calls++;
+    return x + 1;
+}
+long sum(long *p, int n) {
+    long s;
+    int i;
+    s = 0;
+    for (i = 0; i < n; i++)
+        s = s + p[i];
+    return s;
+}
+int grid(int n) {
+    int i;
+    int j;
+    int s;
+    for (i = 0; i < 8; i++)
+        for (j = 0; j < 8; j++)
+            m[i][j] = i * n + j;
+    s = 0;
+    for (i = 7; i >= 0; i = i - 1)
+        for (j = 0; j != 8; j = j + 2)
+            s = s + m[i][j] * (i + 1);
+    return s;
+}
+int early(int k) {
+    int i;
+    for (i = 0; i < 12; i++) {
+        if (a[i * 2] == k) break;
+        if (i == 3) continue;
+        a[i * 2 + 1] = a[i * 2 + 1] + i;
+    }
+    return i;
+}
+int counted() {
+    int i;
+    int s;
+    s = 0;
+    for (i = 0; i < 10; i = next(i))
+        s = s + i;
+    for (i = 3; i <= 17; i = i + 3)
+        s = s + a[i];
+    return s;
+}
+long backward() {
+    long i;
+    long s;
+    unsigned u;
+    s = 0;
+    for (i = 40; i > 0; i = i - 4)
+        s = s * 3 + a[i - 1];
+    for (u = 0; u < 7; u++)
+        s = s + a[u * 8];
+    return s;
+}
+int main() {
+    int i;
+    int k;
+    for (i = 0; i < 64; i++) a[i] = i * i - 7;
+    printf("%ld %ld\n", sum(a, 64), sum(a + 5, 7));
+    printf("%d %d\n", grid(3), grid(-2));
+    i = early(100);
+    k = early(-7);
+    printf("%d %d %ld\n", i, k, a[9]);
+    k = counted();
+    printf("%d %d %ld\n", k, calls, backward());
+    printf("%d\n", i);
+    return 0;
+}
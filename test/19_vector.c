@@ -0,0 +1,96 @@
+int printf(char *s, ...);
+int a[100];
+int b[100];
+int c[100];
+char s[100];
+char t[100];
+short h[100];
+short g[100];
+long x[100];
+long y[100];
+void add(int *p, int *q, int *r, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        p[i] = q[i] + r[i] * 3 - 7;
+}
+void shift(int *p, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        p[i + 1] = p[i] + 1;
+}
+int dot(short *p, short *q, int n) {
+    int i;
+    short d;
+    d = 0;
+    for (i = 0; i < n; i++)
+        d = d + p[i] * q[i];
+    return d;
+}
+long total(long *p, long n) {
+    long i;
+    long sum;
+    long bits;
+    sum = 5;
+    bits = 0;
+    for (i = 0; i < n; i++) {
+        sum = sum - p[i];
+        bits = bits ^ (p[i] & 255);
+    }
+    return sum * 1000 + bits;
+}
+int chars(int n) {
+    int i;
+    int k;
+    char u;
+    char m;
+    m = 0;
+    for (i = 0; i <= n; i++) {
+        u = s[i] + t[i];
+        t[i] = u | 1;
+        m = m | u;
+    }
+    k = 0;
+    for (i = 0; i < 100; i++)
+        k = k * 7 + t[i];
+    return k + m;
+}
+unsigned scale(int *p, unsigned n, int k) {
+    unsigned i;
+    unsigned sum;
+    sum = 0;
+    for (i = 0; i < n; i++) {
+        p[i] = p[i] * k;
+        sum = sum + p[i];
+    }
+    return sum;
+}
+int main() {
+    int i;
+    int k;
+    for (i = 0; i < 100; i++) {
+        b[i] = i * i - 50;
+        c[i] = 1000 - i * 17;
+        s[i] = i * 5;
+        t[i] = 100 - i * 3;
+        h[i] = i * 311;
+        g[i] = 200 - i;
+        x[i] = i;
+        x[i] = x[i] * 100000007;
+    }
+    add(a, b, c, 99);
+    printf("%d %d %d %d\n", a[0], a[50], a[98], a[99]);
+    add(a + 1, a, c, 20);
+    printf("%d %d %d\n", a[1], a[10], a[21]);
+    add(b, b + 2, c, 50);
+    printf("%d %d %d\n", b[0], b[25], b[49]);
+    shift(c, 30);
+    printf("%d %d %d\n", c[0], c[15], c[30]);
+    shift(c + 40, 0);
+    printf("%d %d\n", dot(h, g, 100), dot(h + 3, g, 37));
+    printf("%ld %ld\n", total(x, 100), total(x + 1, 3));
+    printf("%d\n", chars(70));
+    k = scale(b, 77, -3);
+    printf("%d %d %d\n", k, b[0], b[76]);
+    printf("%u\n", scale(b, 0, 2));
+    return 0;
+}
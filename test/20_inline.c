@@ -0,0 +1,64 @@
+int printf(char *s, ...);
+int table[64];
+int sq(int x) {
+    return x * x;
+}
+int clamp(int x, int lo, int hi) {
+    if (x < lo) return lo;
+    if (x > hi) return hi;
+    return x;
+}
+char low(int x) {
+    return x;
+}
+void put(int i, int v) {
+    table[i & 63] = v;
+}
+int fib(int n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+int even(int n);
+int odd(int n) {
+    return n == 0 ? 0 : even(n - 1);
+}
+int even(int n) {
+    return n == 0 ? 1 : odd(n - 1);
+}
+int hello(int n) {
+    printf("hello %d\n", n);
+    return n + 1;
+}
+int norm(int x) {
+    return clamp(sq(x) - 50, 0, 200);
+}
+int missing(int x) {
+    if (x > 0) return x;
+}
+int big(int x) {
+    int i;
+    int s;
+    s = 0;
+    for (i = 0; i < x; i++) {
+        s = s + i * 3 - (i >> 1);
+        s = s ^ (s << 2);
+        s = s + (s % 7) * (i + x) - sq(i);
+        if (s > 100000) s = s - 99999;
+        if (s < 0) s = -s;
+    }
+    return s;
+}
+int main() {
+    int i;
+    int sum;
+    sum = 0;
+    for (i = 0; i < 30; i++) {
+        sum = sum + norm(i) + low(i * 37);
+        put(i, clamp(i * 9, 20, 100));
+    }
+    printf("%d %d %d %d\n", sum, table[1], table[5], table[29]);
+    printf("%d %d %d\n", fib(15), odd(7), even(10));
+    printf("%d\n", hello(hello(3)));
+    printf("%d %d\n", missing(5), big(50));
+    return 0;
+}
@@ -0,0 +1,67 @@
+int printf(char *s, ...);
+long sum(long n, long acc) {
+    if (n == 0) return acc;
+    return sum(n - 1, acc + n);
+}
+int even(int n);
+int odd(int n) {
+    if (n == 0) return 0;
+    return even(n - 1);
+}
+int even(int n) {
+    if (n == 0) return 1;
+    return odd(n - 1);
+}
+char *text;
+int state_b(int i, int count);
+int state_a(int i, int count) {
+    if (text[i] == 0) return count;
+    if (text[i] == 98) return state_b(i + 1, count + 1);
+    return state_a(i + 1, count);
+}
+int state_b(int i, int count) {
+    if (text[i] == 0) return count;
+    if (text[i] == 97) return state_a(i + 1, count);
+    return state_b(i + 1, count + 1);
+}
+char low(long n, long x) {
+    if (n == 0) return x;
+    return low(n - 1, x + 3);
+}
+int seven(int a, int b, int c, int d, int e, int f, int g) {
+    if (g <= 0) return a + b + c + d + e + f;
+    return seven(b, c, d, e, f, a + 1, g - 1);
+}
+int spill(int a, int b, int c, int d, int e, int f, int g) {
+    return seven(a, b, c, d, e, f, g);
+}
+int deref(int *p, int n) {
+    return *p + n;
+}
+int local(int n) {
+    int x;
+    x = n * 2;
+    return deref(&x, n);
+}
+int total;
+void count(int n) {
+    if (n == 0) return;
+    total = total + n;
+    count(n - 1);
+}
+char buf[2000001];
+int main() {
+    int i;
+    for (i = 0; i < 2000000; i++) buf[i] = i % 7 == 0 ? 97 : 98;
+    text = buf;
+    printf("%ld\n", sum(10000000, 0));
+    printf("%d %d\n", even(10000001), odd(10000001));
+    printf("%d\n", state_a(0, 0));
+    printf("%d\n", low(1000001, 5));
+    printf("%d ", seven(1, 2, 3, 4, 5, 6, 1000000));
+    printf("%d\n", spill(1, 2, 3, 4, 5, 6, 7));
+    printf("%d\n", local(21));
+    count(5000000);
+    printf("%d\n", total);
+    return 0;
+}
@@ -0,0 +1,95 @@
+int printf(char *fmt, ...);
+
+int calls;
+
+int bump(int v) {
+    calls++;
+    return v;
+}
+
+int max(int a, int b) {
+    return a > b ? a : b;
+}
+
+unsigned umin(unsigned a, unsigned b) {
+    return a < b ? a : b;
+}
+
+long sign(long x) {
+    return x < 0 ? -1 : x > 0 ? 1 : 0;
+}
+
+char *pick(char *a, char *b, int first) {
+    return first ? a : b;
+}
+
+int in_range(int x, int lo, int hi) {
+    return x >= lo && x < hi;
+}
+
+int outside(int x, int lo, int hi) {
+    if (!(x >= lo && x < hi) || x == 42)
+        return 1;
+    return 0;
+}
+
+int divides(int n, int d) {
+    return d != 0 && n % d == 0;
+}
+
+int first_zero(int *a, int n) {
+    int i;
+    i = 0;
+    while (i < n && a[i] != 0)
+        i++;
+    return i;
+}
+
+int deref(int *p) {
+    return p && *p > 0 ? *p : -1;
+}
+
+int main() {
+    int a[5];
+    int x;
+    int k;
+    int n;
+    a[0] = 3;
+    a[1] = 7;
+    a[2] = 0;
+    a[3] = 5;
+    a[4] = 0;
+    x = 9;
+    printf("%d %d %u %ld %ld %ld\n", max(3, 8), max(-1, -6),
+           umin(4000000000, 5), sign(-12), sign(0), sign(99));
+    printf("%s %s\n", pick("left", "right", 1), pick("left", "right", 0));
+    printf("%d %d %d %d\n", in_range(0, 0, 5), in_range(5, 0, 5),
+           outside(7, 0, 10), outside(42, 0, 100));
+    printf("%d %d %d\n", divides(12, 4), divides(12, 5), divides(12, 0));
+    printf("%d %d %d\n", first_zero(a, 5), first_zero(a + 3, 1),
+           first_zero(a, 0));
+    printf("%d %d %d\n", deref(&x), deref(a + 2), deref(0));
+
+    calls = 0;
+    n = 0;
+    for (k = 0; k < 10; k++) {
+        n = n + (k & 1 ? bump(k) : 100);
+        if (k > 2 && bump(k) > 6 || k == 0)
+            n++;
+    }
+    printf("%d %d\n", n, calls);
+    k = 0;
+    x = 0 || k++ == 0;
+    x = k > 5 ? k++ : k--;
+    printf("%d %d\n", x, k);
+
+    n = 0;
+    for (k = 0; k < 20; k++) {
+        if (k % 3 == 0 ? k % 2 == 0 : !(k & 4))
+            n = n + k;
+        if (!(k < 5 || k > 15) && !!(k & 1))
+            n = n * 2;
+    }
+    printf("%d\n", n);
+    return 0;
+}
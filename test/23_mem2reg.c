@@ -0,0 +1,106 @@
+int printf(char *fmt, ...);
+
+int fib(int n) {
+    int a;
+    int b;
+    int t;
+    int i;
+    a = 0;
+    b = 1;
+    for (i = 0; i < n; i++) {
+        t = a + b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+int wrap(int n) {
+    char c;
+    unsigned u;
+    short s;
+    int i;
+    c = 100;
+    u = 200;
+    s = 32000;
+    for (i = 0; i < n; i++) {
+        c = c + 50;
+        u = u * 3000000000 + 100;
+        s = s + 1000;
+    }
+    return c * 1000000 + u % 1000 * 1000 + s;
+}
+
+int swaps(int n) {
+    int x;
+    int y;
+    int z;
+    x = 1;
+    y = 2;
+    z = 3;
+    while (n > 0) {
+        int t;
+        t = x;
+        x = y;
+        y = z;
+        z = t;
+        n--;
+    }
+    return x * 100 + y * 10 + z;
+}
+
+int classify(int n) {
+    int r;
+    r = 0;
+    switch (n % 4) {
+    case 0:
+        r = 10;
+        break;
+    case 1:
+        r = 20;
+    case 2:
+        r = r + 5;
+        break;
+    default:
+        r = -1;
+    }
+    if (n < 0)
+        goto negative;
+    return r;
+negative:
+    r = r * 2;
+    return r;
+}
+
+int collatz(long n) {
+    int steps;
+    steps = 0;
+    while (n != 1) {
+        if (n % 2 == 0)
+            n = n / 2;
+        else
+            n = 3 * n + 1;
+        steps++;
+    }
+    return steps;
+}
+
+int address_taken(int n) {
+    int k;
+    int *p;
+    k = n;
+    p = &k;
+    *p = *p + 1;
+    return k;
+}
+
+int main() {
+    int i;
+    printf("%d %d %d\n", fib(10), fib(30), fib(0));
+    printf("%d %d\n", wrap(3), wrap(7));
+    printf("%d %d %d\n", swaps(0), swaps(1), swaps(5));
+    for (i = -3; i < 5; i++)
+        printf("%d ", classify(i));
+    printf("\n%d %d\n", collatz(27), address_taken(41));
+    return 0;
+}
@@ -0,0 +1,94 @@
+int printf(char *fmt, ...);
+
+int g[4];
+int h[4];
+long wide;
+int *saved;
+
+void poke(int v) {
+    *saved = v;
+}
+
+void bump_g(int k) {
+    g[k]++;
+}
+
+int globals(int k) {
+    int a;
+    int b;
+    a = g[0];
+    h[k] = 7;
+    b = g[0];
+    bump_g(0);
+    return a + b + g[0] * 100;
+}
+
+int same_base(int *p) {
+    int a;
+    a = p[0];
+    p[1] = 5;
+    a = a + p[0];
+    p[0] = 9;
+    return a + p[0] + p[1];
+}
+
+int sizes(int *p, long *q) {
+    int a;
+    a = *p;
+    *q = 77;
+    return a + *p;
+}
+
+int escaped(int n) {
+    int x;
+    int y;
+    x = n;
+    y = n;
+    saved = &x;
+    poke(n + 1);
+    return x * 10 + y;
+}
+
+int index_local(int k) {
+    int a[4];
+    int i;
+    int s;
+    for (i = 0; i < 4; i++)
+        a[i] = i * 10;
+    s = a[1];
+    a[k] = 100;
+    return s + a[1];
+}
+
+int hoist(int *p, int n) {
+    int i;
+    int s;
+    s = 0;
+    for (i = 0; i < n; i++) {
+        h[i & 3] = i;
+        s = s + g[1] + p[i];
+    }
+    return s;
+}
+
+int main() {
+    int v[4];
+    int i;
+    v[0] = 1;
+    v[1] = 2;
+    v[2] = 3;
+    v[3] = 4;
+    g[0] = 3;
+    g[1] = 4;
+    printf("%d\n", globals(1));
+    printf("%d\n", globals(2));
+    printf("%d\n", same_base(v));
+    printf("%d\n", sizes(v + 1, &wide));
+    printf("%d\n", escaped(4));
+    printf("%d %d\n", index_local(1), index_local(2));
+    printf("%d\n", hoist(v, 4));
+    for (i = 0; i < 4; i++)
+        printf("%d ", h[i]);
+    printf("\n");
+    return 0;
+}
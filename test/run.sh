@@ -0,0 +1,53 @@
+#!/bin/sh
+# Check what the programs in test/ can't show by themselves: edits replayed
+# with --edits have to leave the program as parsing it after them does, and
+# the tail calls of test/21_tailcall.c have to be made jumps however it's
+# compiled, or it overflows the stack. The assembly is built with $CC.
+#
+# Usage: test/run.sh
+
+cd "$(dirname "$0")/.." || exit 1
+LUCC=${LUCC:-./lucc}
+CC=${CC:-cc}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+# Apply the edits given, one per line, to the source given with --edits,
+# and check the syntax tree and the exit status against those of parsing
+# the source after them, given last
+check_edits() {
+    printf "$1" > "$dir/prog.c"
+    printf "$2" > "$dir/edits"
+    printf "$3" > "$dir/edited.c"
+    "$LUCC" --edits "$dir/edits" "$dir/prog.c" > "$dir/out" 2> /dev/null
+    got=$?
+    "$LUCC" "$dir/edited.c" > "$dir/expected" 2> /dev/null
+    expected=$?
+    if [ $got -ne $expected ] || ! cmp -s "$dir/out" "$dir/expected"; then
+        echo "the edits making '$3' differ from parsing it" >&2
+        status=1
+    fi
+}
+
+# Commenting out a line a byte at a time, the first edit not parsing and
+# inserting a token before the first of a declaration
+check_edits 'int a;\nint b;\n' '0 0 /\n1 0 /\n' '//int a;\nint b;\n'
+check_edits 'int a;\nint b;\n' '7 0 /\n8 0 /\n' 'int a;\n//int b;\n'
+# Typing a declaration at the end, and into an empty source
+check_edits 'int a;\n' '7 0 i\n8 0 n\n9 0 t\n10 0  \n11 0 c\n12 0 ;\n' \
+    'int a;\nint c;'
+check_edits '' '0 0 i\n1 0 n\n2 0 t\n3 0  \n4 0 c\n5 0 ;\n' 'int c;'
+
+expected=$("$LUCC" --run test/21_tailcall.c)
+for flags in "" --stream; do
+    "$LUCC" -S $flags test/21_tailcall.c -o "$dir/tailcall.s" &&
+        "$CC" -o "$dir/tailcall" "$dir/tailcall.s" || exit 1
+    out=$("$dir/tailcall")
+    if [ "$out" != "$expected" ]; then
+        echo "test/21_tailcall.c with -S $flags printed '$out'," \
+            "expected '$expected'" >&2
+        status=1
+    fi
+done
+exit $status
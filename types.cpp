@@ -0,0 +1,124 @@
+#include "types.hpp"
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+std::vector<std::unique_ptr<Type>> &all_types() {
+    static std::vector<std::unique_ptr<Type>> types;
+    return types;
+}
+
+}
+
+#define BASIC_TYPE(fn, kind)                  \
+    const Type *Type::fn() {                  \
+        static const Type *t = [] {           \
+            all_types().emplace_back(new Type(kind)); \
+            return all_types().back().get();  \
+        }();                                  \
+        return t;                             \
+    }
+
+BASIC_TYPE(void_type, TY_VOID)
+BASIC_TYPE(char_type, TY_CHAR)
+BASIC_TYPE(short_type, TY_SHORT)
+BASIC_TYPE(int_type, TY_INT)
+BASIC_TYPE(uint_type, TY_UINT)
+BASIC_TYPE(long_type, TY_LONG)
+BASIC_TYPE(float_type, TY_FLOAT)
+BASIC_TYPE(double_type, TY_DOUBLE)
+
+const Type *Type::pointer_to(const Type *base) {
+    static std::map<const Type *, const Type *> cache;
+    auto &t = cache[base];
+    if (!t) {
+        all_types().emplace_back(new Type(TY_PTR));
+        all_types().back()->base = base;
+        t = all_types().back().get();
+    }
+    return t;
+}
+
+const Type *Type::array_of(const Type *elem, long len) {
+    static std::map<std::pair<const Type *, long>, const Type *> cache;
+    auto &t = cache[{elem, len}];
+    if (!t) {
+        all_types().emplace_back(new Type(TY_ARRAY));
+        all_types().back()->base = elem;
+        all_types().back()->len = len;
+        t = all_types().back().get();
+    }
+    return t;
+}
+
+const Type *Type::func_returning(const Type *ret,
+                                 std::vector<const Type *> &&params,
+                                 bool is_variadic, bool has_proto) {
+    using Key = std::tuple<const Type *, std::vector<const Type *>,
+                           bool, bool>;
+    static std::map<Key, const Type *> cache;
+    auto &t = cache[Key(ret, params, is_variadic, has_proto)];
+    if (!t) {
+        auto ty = new Type(TY_FUNC);
+        ty->base = ret;
+        ty->params = std::move(params);
+        ty->is_variadic = is_variadic;
+        ty->has_proto = has_proto;
+        all_types().emplace_back(ty);
+        t = ty;
+    }
+    return t;
+}
+
+long Type::size() const {
+    switch (kind) {
+    case TY_VOID:   return 1;  // GNU C: arithmetic on void * is bytewise
+    case TY_CHAR:   return 1;
+    case TY_SHORT:  return 2;
+    case TY_INT:
+    case TY_UINT:
+    case TY_FLOAT:  return 4;
+    case TY_LONG:
+    case TY_DOUBLE:
+    case TY_PTR:    return 8;
+    case TY_ARRAY:  return len < 0 ? 0 : len * base->size();
+    case TY_FUNC:   return 1;
+    }
+    return 0;
+}
+
+int Type::align() const {
+    if (kind == TY_ARRAY) return base->align();
+    return size();
+}
+
+std::string Type::str() const {
+    switch (kind) {
+    case TY_VOID:   return "void";
+    case TY_CHAR:   return "char";
+    case TY_SHORT:  return "short";
+    case TY_INT:    return "int";
+    case TY_UINT:   return "unsigned";
+    case TY_LONG:   return "long";
+    case TY_FLOAT:  return "float";
+    case TY_DOUBLE: return "double";
+    case TY_PTR:    return base->str() + " *";
+    case TY_ARRAY:
+        return base->str() + " [" + (len < 0 ? "" : std::to_string(len)) + "]";
+    case TY_FUNC: {
+        std::string s = base->str() + " (";
+        for (size_t i = 0; i < params.size(); i++) {
+            if (i) s += ", ";
+            s += params[i]->str();
+        }
+        if (is_variadic) s += ", ...";
+        return s + ")";
+    }
+    }
+    return "?";
+}
@@ -0,0 +1,67 @@
+#ifndef TYPES_HPP
+#define TYPES_HPP
+#include <string>
+#include <vector>
+
+enum TypeKind {
+    TY_VOID,
+    TY_CHAR,
+    TY_SHORT,
+    TY_INT,
+    TY_UINT,
+    TY_LONG,
+    TY_FLOAT,
+    TY_DOUBLE,
+    TY_PTR,
+    TY_ARRAY,
+    TY_FUNC,
+};
+
+// Types are interned: every distinct type is created exactly once and lives
+// until the program exits, so they can be compared by pointer and shared
+// freely between the AST, the IR and the backend.
+class Type {
+public:
+    TypeKind kind;
+    // Pointee for TY_PTR, element type for TY_ARRAY and return type for
+    // TY_FUNC. NULL for everything else.
+    const Type *base = NULL;
+    // Number of elements of a TY_ARRAY, -1 if the array is incomplete.
+    long len = 0;
+    // Parameter types of a TY_FUNC. A function declared with an empty
+    // parameter list (as opposed to "(void)") has no prototype, and may be
+    // called with any number of arguments.
+    std::vector<const Type *> params;
+    bool is_variadic = false;
+    bool has_proto = true;
+
+    static const Type *void_type();
+    static const Type *char_type();
+    static const Type *short_type();
+    static const Type *int_type();
+    static const Type *uint_type();
+    static const Type *long_type();
+    static const Type *float_type();
+    static const Type *double_type();
+    static const Type *pointer_to(const Type *base);
+    static const Type *array_of(const Type *elem, long len);
+    static const Type *func_returning(const Type *ret,
+                                      std::vector<const Type *> &&params,
+                                      bool is_variadic, bool has_proto);
+
+    long size() const;
+    int align() const;
+    bool is_void() const { return kind == TY_VOID; }
+    bool is_integer() const { return kind >= TY_CHAR && kind <= TY_LONG; }
+    bool is_float() const { return kind == TY_FLOAT || kind == TY_DOUBLE; }
+    bool is_pointer() const { return kind == TY_PTR; }
+    bool is_array() const { return kind == TY_ARRAY; }
+    bool is_func() const { return kind == TY_FUNC; }
+    bool is_scalar() const { return is_integer() || is_pointer(); }
+    // Pointers compare and divide as unsigned quantities
+    bool is_signed() const { return is_integer() && kind != TY_UINT; }
+    std::string str() const;
+private:
+    Type(TypeKind kind) : kind(kind) {}
+};
+#endif
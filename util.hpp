@@ -0,0 +1,15 @@
+#ifndef UTIL_HPP
+#define UTIL_HPP
+
+// Arithmetic shared by the front ends and the backends
+
+// @n rounded up to a multiple of @align
+inline long align_to(long n, long align) {
+    return (n + align - 1) / align * align;
+}
+
+// Whether @v fits in an int, as x86-64 immediates have to
+inline bool fits_int(long v) {
+    return v >= -2147483648L && v <= 2147483647L;
+}
+#endif
@@ -0,0 +1,892 @@
+#include "cfg.hpp"
+#include "ir.hpp"
+#include "opt.hpp"
+#include "ssa.hpp"
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Vectorization of innermost loops like
+//
+//     for (i = 0; i < n; i++) a[i] = b[i] + c[i];
+//
+// The loop must be a straight line of blocks from its header, testing a
+// local variable against an invariant bound, to its latch, and step the
+// variable by one once in every iteration. The arrays are indexed with it
+// times the size of their elements, all of the same size. The elements are
+// combined with additions, subtractions, bitwise operations and
+// multiplications, as far as there are instructions for them, and stored
+// back to arrays or combined into local variables loaded at the start of
+// an iteration and stored at the end: reductions.
+//
+// A vector loop doing as many iterations at once as there are lanes is put
+// in front of the loop. It leaves the counter at the first iteration it
+// can't do whole, and the original loop, left as it is, does the rest. The
+// vector loop is only entered if the arrays stored to don't overlap with
+// the others in a way that would change what's loaded when iterations are
+// done in groups; what isn't known at compile time about that is tested
+// on the way in.
+//
+// Only the low bytes of the lanes are kept, which the arithmetic allowed
+// doesn't look beyond, so the extensions normalizing int arithmetic on the
+// elements are left out. The counter, as in the other loop optimizations,
+// is taken not to overflow.
+
+namespace
+{
+
+enum Kind {
+    UNKNOWN,
+    INVARIANT,  // the same in every iteration
+    INDEX,      // stepped along with the counter
+    VECTOR,     // one for each element
+    RUNNING,    // the value of a reduction, as loaded
+    REDUCED,    // the running value combined with elements
+};
+
+// What a register of the loop holds. An INDEX is coef * i + off plus the
+// sum of the invariant registers in @terms, each multiplied by the number
+// paired with it.
+struct Value {
+    Kind kind = UNKNOWN;
+    long coef = 0;
+    std::vector<std::pair<int, long>> terms;
+    long off = 0;
+    int slot = -1;  // of a reduction
+};
+
+struct Access {
+    bool is_store;
+    Value addr;
+};
+
+// A local variable the elements are combined into with @op, IR_ADD, IR_OR
+// or IR_XOR
+struct Reduction {
+    int slot;
+    IROp op = IR_ADD;
+    bool is_signed = true;
+    // The phi of the vector loop and the value it gets from the latch
+    int acc = -1, next = -1;
+};
+
+long add(long a, long b) { return (unsigned long)a + (unsigned long)b; }
+long mul(long a, long b) { return (unsigned long)a * (unsigned long)b; }
+
+IROp vector_op(IROp op) {
+    switch (op) {
+    case IR_ADD: return IR_VADD;
+    case IR_SUB: return IR_VSUB;
+    case IR_MUL: return IR_VMUL;
+    case IR_AND: return IR_VAND;
+    case IR_OR:  return IR_VOR;
+    default:     return IR_VXOR;
+    }
+}
+
+// Add @k times the terms of @b to those of @a, keeping them sorted
+void add_terms(Value &a, const Value &b, long k) {
+    for (auto &t: b.terms) {
+        auto it = a.terms.begin();
+        while (it != a.terms.end() && it->first < t.first) ++it;
+        if (it != a.terms.end() && it->first == t.first) {
+            it->second = add(it->second, mul(t.second, k));
+            if (!it->second) a.terms.erase(it);
+        } else {
+            a.terms.insert(it, {t.first, mul(t.second, k)});
+        }
+    }
+}
+
+class Vectorizer {
+public:
+    Vectorizer(IRFunction &f, const OptOptions &opts)
+        : f(f), opts(opts), cfg(f), dom(cfg), forest(cfg, dom),
+          promotable(promotable_slots(f)) {}
+    VectorStats run();
+private:
+    IRFunction &f;
+    const OptOptions &opts;
+    CFG cfg;
+    DomTree dom;
+    LoopForest forest;
+    std::vector<char> promotable;
+    // The instruction defining each register, its block, and how many
+    // times it's used
+    std::vector<const IRInstr *> defs;
+    std::vector<int> def_block, nuses;
+    // The blocks added for each loop vectorized, and its header
+    std::vector<std::pair<std::vector<IRBlock *>, IRBlock *>> added;
+    VectorStats st;
+
+    // The loop at hand: its blocks from the header to the latch, its
+    // preheader, the counter with the store stepping it and how it's
+    // tested, and the size of the elements
+    std::vector<int> chain;
+    std::vector<char> in_loop;
+    int pre = -1;
+    // The block between the checks and the vector loop, for the splats
+    IRBlock *vp = NULL;
+    int counter = -1;
+    const IRInstr *load = NULL;
+    const IRInstr *step = NULL;
+    const IRInstr *cmp = NULL;
+    IROp test = IR_LT;
+    int bound = -1;
+    int size = 0;
+    std::unordered_map<int, Value> values;
+    // The local variables stored to in the loop: 'c' the counter, 'r'
+    // reductions, 't' temporaries, stored before they're loaded in an
+    // iteration and not loaded after the loop, '?' anything else
+    std::vector<char> kinds;
+    // The register stored to each temporary or first loaded from each
+    // invariant local, and the loads made the same by that
+    std::unordered_map<int, int> temps, forwarded;
+    std::vector<Access> accesses;
+    std::vector<Reduction> reductions;
+    // The invariants computed in the preheader and the vectors of them,
+    // and the vectors in the vector loop
+    std::unordered_map<int, int> hoisted, splats, vectors;
+    std::vector<std::pair<Value, int>> bases;
+
+    void index();
+    int slot_of(int addr) const;
+    int loaded_slot(int r) const;
+    int resolve(int r) const {
+        auto it = forwarded.find(r);
+        return it == forwarded.end() ? r : it->second;
+    }
+    Value value(int r);
+    bool affine(const IRInstr &i, Value &v);
+    bool classify(const IRInstr &i);
+    bool find_counter(const Loop &l);
+    bool analyze(const Loop &l);
+    const IRInstr *object(const Value &a) const;
+    bool same_base(const Value &a, const Value &b) const;
+    bool independent(std::vector<std::pair<int, int>> &tests);
+
+    int width() const { return opts.vector_width; }
+    int emit(IRBlock *b, IRInstr i);
+    int emit(IRBlock *b, IROp op, int x, int y);
+    int constant(IRBlock *b, long v);
+    int hoist(int r);
+    int base(const Value &a);
+    int vector(int r);
+    int address(IRBlock *b, int iv, const Value &a);
+    void vectorize(const std::vector<std::pair<int, int>> &tests);
+    void place_blocks();
+};
+
+void Vectorizer::index() {
+    defs.assign(f.nregs, NULL);
+    def_block.assign(f.nregs, -1);
+    nuses.assign(f.nregs, 0);
+    for (auto &b: f.blocks) {
+        for (auto &i: b->instrs) {
+            if (i.dst >= 0) {
+                defs[i.dst] = &i;
+                def_block[i.dst] = b->id;
+            }
+            for (int a: i.args) nuses[a]++;
+        }
+    }
+}
+
+// The promotable slot @addr is the address of, or -1
+int Vectorizer::slot_of(int addr) const {
+    auto d = defs[addr];
+    if (!d || d->op != IR_LOCAL || !promotable[d->imm]) return -1;
+    return d->imm;
+}
+
+// The promotable slot @r is loaded from, or -1
+int Vectorizer::loaded_slot(int r) const {
+    auto d = defs[r];
+    return d && d->op == IR_LOAD ? slot_of(d->args[0]) : -1;
+}
+
+Value Vectorizer::value(int r) {
+    r = resolve(r);
+    auto it = values.find(r);
+    if (it != values.end()) return it->second;
+    Value v;
+    if (def_block[r] < 0 || !in_loop[def_block[r]]) v.kind = INVARIANT;
+    return v;
+}
+
+// Work out @i as an INDEX in @v, if it's one
+bool Vectorizer::affine(const IRInstr &i, Value &v) {
+    auto as_index = [&](int r, Value &a) {
+        a = value(r);
+        if (a.kind == INDEX) return true;
+        if (a.kind != INVARIANT) return false;
+        a = Value();
+        r = resolve(r);
+        if (defs[r] && defs[r]->op == IR_CONST)
+            a.off = defs[r]->imm;
+        else
+            a.terms = {{r, 1}};
+        return true;
+    };
+    auto is_number = [](const Value &a) {
+        return a.coef == 0 && a.terms.empty();
+    };
+    Value x, y;
+    switch (i.op) {
+    case IR_COPY:
+        return as_index(i.args[0], v);
+    case IR_SEXT:
+        // Of int arithmetic on the counter, which doesn't overflow
+        return i.size == 4 && as_index(i.args[0], v);
+    case IR_ADD:
+    case IR_SUB: {
+        if (!as_index(i.args[0], x) || !as_index(i.args[1], y)) return false;
+        long k = i.op == IR_SUB ? -1 : 1;
+        v = x;
+        v.coef = add(v.coef, mul(y.coef, k));
+        v.off = add(v.off, mul(y.off, k));
+        add_terms(v, y, k);
+        return true;
+    }
+    case IR_MUL:
+    case IR_SHL: {
+        if (!as_index(i.args[0], x) || !as_index(i.args[1], y)) return false;
+        if (i.op == IR_MUL && is_number(x)) std::swap(x, y);
+        if (!is_number(y)) return false;
+        long k = y.off;
+        if (i.op == IR_SHL) {
+            if (k < 0 || k > 32) return false;
+            k = 1L << k;
+        }
+        v = Value();
+        v.coef = mul(x.coef, k);
+        v.off = mul(x.off, k);
+        add_terms(v, x, k);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Work out what @i computes, returning false if it can't be vectorized
+bool Vectorizer::classify(const IRInstr &i) {
+    Value v;
+    switch (i.op) {
+    case IR_CONST:
+    case IR_LOCAL:
+    case IR_GLOBAL:
+        v.kind = INVARIANT;
+        break;
+    case IR_LOAD: {
+        int s = slot_of(i.args[0]);
+        if (s == counter) {
+            v.kind = INDEX;
+            v.coef = 1;
+        } else if (s >= 0 && !kinds[s]) {
+            // One register for the local, so bases loaded twice compare
+            // equal
+            auto it = temps.find(s);
+            if (it != temps.end()) {
+                forwarded[i.dst] = it->second;
+                return true;
+            }
+            temps[s] = i.dst;
+            v.kind = INVARIANT;
+        } else if (s >= 0 && kinds[s] == 'r') {
+            v.kind = RUNNING;
+            v.slot = s;
+        } else if (s >= 0) {
+            // A temporary, stored earlier in the iteration
+            forwarded[i.dst] = temps.at(s);
+            return true;
+        } else {
+            Value a = value(i.args[0]);
+            if (a.kind != INDEX || a.coef != i.size || a.terms.empty() ||
+                (size && i.size != size))
+                return false;
+            size = i.size;
+            accesses.push_back({false, a});
+            v.kind = VECTOR;
+        }
+        break;
+    }
+    case IR_STORE: {
+        int s = slot_of(i.args[0]);
+        Value x = value(i.args[1]);
+        if (s == counter) return &i == step;
+        if (s >= 0 && kinds[s] == 'r') return x.kind == REDUCED && x.slot == s;
+        if (s >= 0) {
+            temps[s] = resolve(i.args[1]);
+            return x.kind == INVARIANT || x.kind == INDEX ||
+                   x.kind == VECTOR;
+        }
+        Value a = value(i.args[0]);
+        if (a.kind != INDEX || a.coef != i.size || a.terms.empty() ||
+            (size && i.size != size) ||
+            (x.kind != VECTOR && x.kind != INVARIANT))
+            return false;
+        size = i.size;
+        accesses.push_back({true, a});
+        return true;
+    }
+    case IR_COPY:
+    case IR_SEXT:
+    case IR_ZEXT: {
+        Value x = value(i.args[0]);
+        if (x.kind == INVARIANT ||
+            ((x.kind == VECTOR || x.kind == REDUCED) &&
+             (i.op == IR_COPY || i.size >= size))) {
+            v = x;
+        } else if (x.kind == INDEX && affine(i, v)) {
+            v.kind = INDEX;
+        } else {
+            return false;
+        }
+        break;
+    }
+    case IR_ADD: case IR_SUB: case IR_MUL:
+    case IR_AND: case IR_OR: case IR_XOR: case IR_SHL: {
+        Value x = value(i.args[0]), y = value(i.args[1]);
+        Kind a = x.kind, b = y.kind;
+        if (a == RUNNING || a == REDUCED) {
+            // The running value, with elements added, subtracted or
+            // combined the same way as before
+            IROp op = i.op == IR_SUB ? IR_ADD : i.op;
+            Reduction *r = NULL;
+            for (auto &red: reductions) {
+                if (red.slot == x.slot) r = &red;
+            }
+            if (b != VECTOR || (op != IR_ADD && op != IR_OR && op != IR_XOR) ||
+                (a == REDUCED && op != r->op))
+                return false;
+            r->op = op;
+            v.kind = REDUCED;
+            v.slot = x.slot;
+        } else if (b == RUNNING || b == REDUCED) {
+            if (a != VECTOR ||
+                (i.op != IR_ADD && i.op != IR_OR && i.op != IR_XOR))
+                return false;
+            for (auto &red: reductions) {
+                if (red.slot != y.slot) continue;
+                if (b == REDUCED && i.op != red.op) return false;
+                red.op = i.op;
+            }
+            v.kind = REDUCED;
+            v.slot = y.slot;
+        } else if (a == INVARIANT && b == INVARIANT) {
+            v.kind = INVARIANT;
+        } else if ((a == VECTOR || a == INVARIANT) &&
+                   (b == VECTOR || b == INVARIANT)) {
+            // pmullw, and vpmulld with AVX2
+            if (i.op == IR_SHL ||
+                (i.op == IR_MUL && size != 2 &&
+                 (size != 4 || width() != 32)))
+                return false;
+            v.kind = VECTOR;
+        } else if ((a == INDEX || a == INVARIANT) &&
+                   (b == INDEX || b == INVARIANT) && affine(i, v)) {
+            v.kind = INDEX;
+        } else {
+            return false;
+        }
+        break;
+    }
+    case IR_SHR: case IR_SAR: case IR_NEG: case IR_NOT:
+    case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    case IR_ULT: case IR_ULE: case IR_UGT: case IR_UGE: case IR_SELECT:
+        for (int a: i.args) {
+            if (value(a).kind != INVARIANT) return false;
+        }
+        v.kind = INVARIANT;
+        break;
+    default:
+        return false;
+    }
+    // A reduction must only go on to its store
+    if ((v.kind == RUNNING || v.kind == REDUCED) && nuses[i.dst] != 1)
+        return false;
+    values[i.dst] = v;
+    return true;
+}
+
+// Find the counter of @l from the test in its header, and check that it's
+// stepped by one, as "i = i + 1" for int i
+bool Vectorizer::find_counter(const Loop &l) {
+    int h = l.header;
+    auto &br = f.blocks[h]->terminator();
+    cmp = defs[br.args[0]];
+    if (!cmp || def_block[br.args[0]] != h || !is_comparison(cmp->op) ||
+        nuses[br.args[0]] != 1)
+        return false;
+    int x = cmp->args[0];
+    test = cmp->op;
+    bound = cmp->args[1];
+    if (loaded_slot(x) < 0 || def_block[x] != h) {
+        std::swap(x, bound);
+        test = swap_comparison(test);
+    }
+    counter = loaded_slot(x);
+    load = defs[x];
+    if (counter < 0 || def_block[x] != h ||
+        (test != IR_LT && test != IR_LE && test != IR_ULT && test != IR_ULE))
+        return false;
+
+    step = NULL;
+    for (int b: chain) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.op != IR_STORE || slot_of(i.args[0]) != counter) continue;
+            if (step) return false;
+            step = &i;
+        }
+    }
+    if (!step) return false;
+    auto d = defs[step->args[1]];
+    int csize = f.slots[counter].size;
+    if (csize == 4) {
+        if (!d || (d->op != IR_SEXT && d->op != IR_ZEXT) || d->size != 4)
+            return false;
+        d = defs[d->args[0]];
+    } else if (csize != 8) {
+        return false;
+    }
+    if (!d || d->op != IR_ADD) return false;
+    for (int k = 0; k < 2; k++) {
+        auto one = defs[d->args[k]];
+        if (one && one->op == IR_CONST && one->imm == 1 &&
+            loaded_slot(d->args[1 - k]) == counter)
+            return true;
+    }
+    return false;
+}
+
+bool Vectorizer::analyze(const Loop &l) {
+    int h = l.header;
+    if (!l.children.empty() || cfg.preds[h].size() != 2) return false;
+    in_loop.assign(f.blocks.size(), false);
+    for (int b: l.blocks) in_loop[b] = true;
+    auto &br = f.blocks[h]->terminator();
+    if (br.op != IR_BR || !in_loop[br.targets[0]->id] ||
+        in_loop[br.targets[1]->id])
+        return false;
+    chain = {h};
+    for (int b = br.targets[0]->id; b != h;) {
+        auto &t = f.blocks[b]->terminator();
+        if (!in_loop[b] || cfg.preds[b].size() != 1 || t.op != IR_JMP)
+            return false;
+        chain.push_back(b);
+        b = t.targets[0]->id;
+    }
+    if (chain.size() != l.blocks.size()) return false;
+    pre = -1;
+    for (int p: cfg.preds[h]) {
+        if (p != chain.back()) pre = p;
+    }
+    if (pre < 0 || cfg.succs[pre].size() != 1 || !find_counter(l))
+        return false;
+
+    // Sort out the local variables stored to
+    kinds.assign(f.slots.size(), 0);
+    std::vector<int> nloads(f.slots.size());
+    std::vector<char> loaded_first(f.slots.size());
+    for (int b: chain) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.op != IR_LOAD && i.op != IR_STORE) continue;
+            int s = slot_of(i.args[0]);
+            if (s < 0) continue;
+            if (i.op == IR_STORE)
+                kinds[s] = kinds[s] ? '?' : s == counter ? 'c' : 't';
+            else if (!kinds[s])
+                loaded_first[s] = true;
+            else if (kinds[s] == 'c')
+                return false;  // loaded after being stepped
+            nloads[s] += i.op == IR_LOAD;
+        }
+    }
+    for (size_t s = 0; s < kinds.size(); s++) {
+        if (kinds[s] == 't' && loaded_first[s])
+            kinds[s] = nloads[s] == 1 ? 'r' : '?';
+        if (kinds[s] == '?') return false;
+    }
+    for (auto &b: f.blocks) {
+        if (in_loop[b->id]) continue;
+        for (auto &i: b->instrs) {
+            if (i.op == IR_LOAD && slot_of(i.args[0]) >= 0 &&
+                kinds[slot_of(i.args[0])] == 't')
+                return false;
+        }
+    }
+
+    values.clear();
+    temps.clear();
+    forwarded.clear();
+    accesses.clear();
+    reductions.clear();
+    size = 0;
+    for (size_t s = 0; s < kinds.size(); s++) {
+        if (kinds[s] == 'r') reductions.push_back({(int)s});
+    }
+    for (int b: chain) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.is_terminator() || &i == cmp) continue;
+            if (!classify(i)) return false;
+            if (i.op == IR_LOAD && values[i.dst].kind == RUNNING) {
+                for (auto &r: reductions) {
+                    if (r.slot == values[i.dst].slot)
+                        r.is_signed = i.is_signed;
+                }
+            }
+        }
+    }
+    if (!size || value(bound).kind != INVARIANT) return false;
+    bool stores = false;
+    for (auto &a: accesses) stores = stores || a.is_store;
+    for (auto &r: reductions) {
+        if (f.slots[r.slot].size != size) return false;
+    }
+    return stores || !reductions.empty();
+}
+
+// The global or local array an address is into, if known
+const IRInstr *Vectorizer::object(const Value &a) const {
+    if (a.terms.size() != 1 || a.terms[0].second != 1) return NULL;
+    auto d = defs[a.terms[0].first];
+    return d && (d->op == IR_GLOBAL || d->op == IR_LOCAL) ? d : NULL;
+}
+
+// Whether the addresses are known to be into the same array, only
+// differing in their offsets
+bool Vectorizer::same_base(const Value &a, const Value &b) const {
+    if (a.terms == b.terms) return true;
+    auto x = object(a), y = object(b);
+    return x && y && x->op == y->op && x->sym == y->sym && x->imm == y->imm;
+}
+
+// Whether the accesses to memory can be done a vector at a time, as far as
+// is known at compile time. Access x, then access y in an iteration, one of
+// them a store, find an element both get to in the same order when they
+// do it for a vector of iterations at once, as long as y's address is
+// either not above x's, or above it by at least the size of a vector. Pairs
+// of addresses that can't be compared are added to @tests.
+bool Vectorizer::independent(std::vector<std::pair<int, int>> &tests) {
+    long span = (long)width();
+    for (size_t y = 0; y < accesses.size(); y++) {
+        for (size_t x = 0; x < y; x++) {
+            auto &a = accesses[x].addr, &b = accesses[y].addr;
+            if (!accesses[x].is_store && !accesses[y].is_store) continue;
+            if (same_base(a, b)) {
+                long d = b.off - a.off;
+                if (d > 0 && d < span) return false;
+                continue;
+            }
+            auto oa = object(a), ob = object(b);
+            if (oa && ob) continue;  // different arrays
+            bool seen = false;
+            for (auto &t: tests) {
+                auto &c = accesses[t.first].addr, &e = accesses[t.second].addr;
+                if (c.terms == a.terms && c.off == a.off &&
+                    e.terms == b.terms && e.off == b.off)
+                    seen = true;
+            }
+            if (!seen) tests.emplace_back(x, y);
+        }
+    }
+    return true;
+}
+
+// Add @i to the end of @b, before its terminator if it has one
+int Vectorizer::emit(IRBlock *b, IRInstr i) {
+    int dst = i.dst;
+    auto &instrs = b->instrs;
+    if (b->is_terminated())
+        instrs.insert(instrs.end() - 1, std::move(i));
+    else
+        instrs.push_back(std::move(i));
+    return dst;
+}
+
+int Vectorizer::emit(IRBlock *b, IROp op, int x, int y) {
+    IRInstr i(op);
+    i.dst = f.new_reg();
+    i.args = {x, y};
+    if (op >= IR_VADD && op <= IR_VXOR) {
+        i.size = size;
+        i.width = width();
+    }
+    return emit(b, std::move(i));
+}
+
+int Vectorizer::constant(IRBlock *b, long v) {
+    IRInstr i(IR_CONST);
+    i.dst = f.new_reg();
+    i.imm = v;
+    return emit(b, std::move(i));
+}
+
+// The invariant @r, computed in the preheader if it's computed in the loop
+int Vectorizer::hoist(int r) {
+    r = resolve(r);
+    if (def_block[r] < 0 || !in_loop[def_block[r]]) return r;
+    auto it = hoisted.find(r);
+    if (it != hoisted.end()) return it->second;
+    IRInstr i = *defs[r];
+    for (auto &a: i.args) a = hoist(a);
+    i.dst = f.new_reg();
+    int d = emit(f.blocks[pre].get(), std::move(i));
+    return hoisted[r] = d;
+}
+
+// The invariant part of the INDEX @a, computed in the preheader
+int Vectorizer::base(const Value &a) {
+    for (auto &b: bases) {
+        if (b.first.terms == a.terms && b.first.off == a.off) return b.second;
+    }
+    auto p = f.blocks[pre].get();
+    int sum = -1;
+    for (auto &t: a.terms) {
+        int x = hoist(t.first);
+        if (t.second != 1) x = emit(p, IR_MUL, x, constant(p, t.second));
+        sum = sum < 0 ? x : emit(p, IR_ADD, sum, x);
+    }
+    if (a.off) sum = emit(p, IR_ADD, sum, constant(p, a.off));
+    bases.emplace_back(a, sum);
+    return sum;
+}
+
+// The vector of @r in the vector loop, a splat made ahead of the loop if
+// @r is invariant
+int Vectorizer::vector(int r) {
+    r = resolve(r);
+    if (value(r).kind != INVARIANT) return vectors.at(r);
+    auto it = splats.find(r);
+    if (it != splats.end()) return it->second;
+    IRInstr i(IR_VSPLAT);
+    i.dst = f.new_reg();
+    i.args = {hoist(r)};
+    i.size = size;
+    i.width = width();
+    return splats[r] = emit(vp, std::move(i));
+}
+
+// The INDEX @a in block @b, for the counter @iv
+int Vectorizer::address(IRBlock *b, int iv, const Value &a) {
+    int x = iv;
+    if (a.coef != 1) x = emit(b, IR_MUL, x, constant(b, a.coef));
+    return emit(b, IR_ADD, x, base(a));
+}
+
+// Make the vector loop, entered from the preheader if @tests pass, each
+// pair of accesses not overlapping, and the bound leaves room for a vector
+void Vectorizer::vectorize(const std::vector<std::pair<int, int>> &tests) {
+    auto p = f.blocks[pre].get(), header = f.blocks[chain[0]].get();
+    hoisted.clear();
+    splats.clear();
+    vectors.clear();
+    bases.clear();
+    int lanes = width() / size;
+    // The counter can't get above @last at the start of a vector
+    int n = hoist(bound);
+    int last = emit(p, IR_SUB, n, constant(p, lanes - 1));
+    std::vector<int> conds;
+    if (test == IR_ULT || test == IR_ULE)
+        conds.push_back(emit(p, IR_UGE, n, constant(p, lanes - 1)));
+    for (auto &t: tests) {
+        auto &a = accesses[t.first].addr, &b = accesses[t.second].addr;
+        int d = emit(p, IR_SUB, base(b), base(a));
+        d = emit(p, IR_SUB, d, constant(p, 1));
+        conds.push_back(emit(p, IR_UGE, d, constant(p, width() - 1)));
+    }
+
+    // The vector loop gets a preheader of its own, so the checks don't
+    // leave it behind a critical edge
+    vp = f.new_block();
+    auto vh = f.new_block(), vb = f.new_block(), vx = f.new_block();
+    vh->loop_depth = vb->loop_depth = header->loop_depth;
+    vp->loop_depth = vx->loop_depth = p->loop_depth;
+    added.push_back({{vp, vh, vb, vx}, header});
+    int zero = -1;
+    if (!reductions.empty()) {
+        IRInstr i(IR_VSPLAT);
+        i.dst = f.new_reg();
+        i.args = {constant(vp, 0)};
+        i.size = size;
+        i.width = width();
+        zero = emit(vp, std::move(i));
+    }
+    IRInstr enter(IR_JMP);
+    enter.targets = {vh};
+    emit(vp, std::move(enter));
+    if (conds.empty()) {
+        p->terminator().targets = {vp};
+    } else {
+        int ok = conds[0];
+        for (size_t k = 1; k < conds.size(); k++)
+            ok = emit(p, IR_AND, ok, conds[k]);
+        auto &br = p->terminator();
+        br = IRInstr(IR_BR);
+        br.args = {ok};
+        br.targets = {vp, header};
+    }
+
+    for (auto &r: reductions) {
+        IRInstr phi(IR_PHI);
+        phi.dst = r.acc = f.new_reg();
+        phi.size = size;
+        phi.width = width();
+        emit(vh, std::move(phi));
+    }
+    IRInstr iv_load = *load;
+    iv_load.dst = f.new_reg();
+    iv_load.args = {hoist(load->args[0])};
+    int iv = emit(vh, iv_load);
+    IRInstr br(IR_BR);
+    br.args = {emit(vh, test, iv, last)};
+    br.targets = {vb, vx};
+    emit(vh, std::move(br));
+
+    for (int b: chain) {
+        for (auto &i: f.blocks[b]->instrs) {
+            if (i.is_terminator() || &i == cmp || forwarded.count(i.dst))
+                continue;
+            Value v = i.dst >= 0 ? value(i.dst) : Value();
+            switch (i.op) {
+            case IR_LOAD:
+                if (v.kind == RUNNING) {
+                    for (auto &r: reductions) {
+                        if (r.slot == v.slot) vectors[i.dst] = r.acc;
+                    }
+                } else if (v.kind == VECTOR) {
+                    IRInstr vl(IR_VLOAD);
+                    vl.dst = f.new_reg();
+                    vl.args = {address(vb, iv, value(i.args[0]))};
+                    vl.size = size;
+                    vl.width = width();
+                    vectors[i.dst] = emit(vb, std::move(vl));
+                }
+                break;
+            case IR_STORE: {
+                // The addresses of local variables are invariant
+                Value x = value(i.args[1]);
+                if (x.kind == REDUCED) {
+                    for (auto &r: reductions) {
+                        if (r.slot == x.slot) r.next = vector(i.args[1]);
+                    }
+                } else if (value(i.args[0]).kind == INDEX) {
+                    IRInstr vs(IR_VSTORE);
+                    vs.args = {address(vb, iv, value(i.args[0])),
+                               vector(i.args[1])};
+                    vs.size = size;
+                    vs.width = width();
+                    emit(vb, std::move(vs));
+                }
+                break;
+            }
+            case IR_COPY:
+            case IR_SEXT:
+            case IR_ZEXT:
+                if (v.kind == VECTOR || v.kind == REDUCED)
+                    vectors[i.dst] = vector(i.args[0]);
+                break;
+            default:
+                if (v.kind == VECTOR || v.kind == REDUCED) {
+                    vectors[i.dst] = emit(vb, vector_op(i.op),
+                                          vector(i.args[0]),
+                                          vector(i.args[1]));
+                }
+                break;
+            }
+        }
+    }
+    // Step the counter a vector on, normalized as before
+    int next = emit(vb, IR_ADD, iv, constant(vb, lanes));
+    if (f.slots[counter].size == 4) {
+        IRInstr ext(defs[step->args[1]]->op);
+        ext.dst = f.new_reg();
+        ext.args = {next};
+        ext.size = 4;
+        next = emit(vb, std::move(ext));
+    }
+    IRInstr store = *step;
+    store.args = {iv_load.args[0], next};
+    emit(vb, std::move(store));
+    IRInstr back(IR_JMP);
+    back.targets = {vh};
+    emit(vb, std::move(back));
+
+    // Add up the lanes of each reduction on the way out
+    for (auto &r: reductions) {
+        auto &phi = vh->instrs[&r - &reductions[0]];
+        phi.args = {zero, r.next};
+        phi.targets = {vp, vb};
+        IRInstr red(IR_VREDUCE);
+        red.dst = f.new_reg();
+        red.args = {r.acc};
+        red.imm = r.op;
+        red.size = size;
+        red.is_signed = r.is_signed;
+        red.width = width();
+        int lanes_sum = emit(vx, std::move(red));
+        IRInstr local(IR_LOCAL);
+        local.dst = f.new_reg();
+        local.imm = r.slot;
+        int addr = emit(vx, std::move(local));
+        IRInstr old(IR_LOAD);
+        old.dst = f.new_reg();
+        old.args = {addr};
+        old.size = size;
+        old.is_signed = r.is_signed;
+        int x = emit(vx, r.op, emit(vx, old), lanes_sum);
+        if (size < 8) {
+            IRInstr ext(r.is_signed ? IR_SEXT : IR_ZEXT);
+            ext.dst = f.new_reg();
+            ext.args = {x};
+            ext.size = size;
+            x = emit(vx, std::move(ext));
+        }
+        IRInstr st(IR_STORE);
+        st.args = {addr, x};
+        st.size = size;
+        emit(vx, std::move(st));
+    }
+    IRInstr out(IR_JMP);
+    out.targets = {header};
+    emit(vx, std::move(out));
+}
+
+// Put the blocks added for each loop in front of its header and renumber
+// them all
+void Vectorizer::place_blocks() {
+    size_t n = f.blocks.size();
+    for (auto &a: added) n -= a.first.size();
+    std::vector<std::unique_ptr<IRBlock>> blocks;
+    for (size_t k = 0; k < n; k++) {
+        for (auto &a: added) {
+            if (a.second != f.blocks[k].get()) continue;
+            for (auto b: a.first) blocks.push_back(std::move(f.blocks[b->id]));
+        }
+        blocks.push_back(std::move(f.blocks[k]));
+    }
+    f.blocks = std::move(blocks);
+    for (size_t k = 0; k < f.blocks.size(); k++) f.blocks[k]->id = k;
+}
+
+VectorStats Vectorizer::run() {
+    for (auto &l: forest.loops) {
+        index();
+        std::vector<std::pair<int, int>> tests;
+        if (!analyze(*l) || !independent(tests)) continue;
+        vectorize(tests);
+        st.loops++;
+        st.checks += tests.size();
+    }
+    if (!added.empty()) place_blocks();
+    return st;
+}
+
+}
+
+VectorStats vectorize_loops(IRFunction &f, const OptOptions &opts) {
+    if (!opts.vectorize) return VectorStats();
+    return Vectorizer(f, opts).run();
+}
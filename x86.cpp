@@ -0,0 +1,227 @@
+#include "x86.hpp"
+#include <vector>
+
+const int arg_regs[6] = {RDI, RSI, RDX, RCX, R8, R9};
+const int callee_saved_regs[5] = {RBX, R12, R13, R14, R15};
+
+namespace
+{
+
+const int caller_saved_regs[] = {
+    RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11,
+};
+
+const char *const reg_names[][4] = {
+    {"al", "ax", "eax", "rax"},
+    {"cl", "cx", "ecx", "rcx"},
+    {"dl", "dx", "edx", "rdx"},
+    {"bl", "bx", "ebx", "rbx"},
+    {"spl", "sp", "esp", "rsp"},
+    {"bpl", "bp", "ebp", "rbp"},
+    {"sil", "si", "esi", "rsi"},
+    {"dil", "di", "edi", "rdi"},
+    {"r8b", "r8w", "r8d", "r8"},
+    {"r9b", "r9w", "r9d", "r9"},
+    {"r10b", "r10w", "r10d", "r10"},
+    {"r11b", "r11w", "r11d", "r11"},
+    {"r12b", "r12w", "r12d", "r12"},
+    {"r13b", "r13w", "r13d", "r13"},
+    {"r14b", "r14w", "r14d", "r14"},
+    {"r15b", "r15w", "r15d", "r15"},
+};
+
+const char *const vector_reg_names[][2] = {
+    {"xmm0", "ymm0"}, {"xmm1", "ymm1"}, {"xmm2", "ymm2"}, {"xmm3", "ymm3"},
+    {"xmm4", "ymm4"}, {"xmm5", "ymm5"}, {"xmm6", "ymm6"}, {"xmm7", "ymm7"},
+    {"xmm8", "ymm8"}, {"xmm9", "ymm9"}, {"xmm10", "ymm10"},
+    {"xmm11", "ymm11"}, {"xmm12", "ymm12"}, {"xmm13", "ymm13"},
+    {"xmm14", "ymm14"}, {"xmm15", "ymm15"},
+};
+
+void mem_uses(const MOperand &o, std::vector<int> &regs) {
+    if (o.kind == MOperand::MEM) regs.push_back(o.reg);
+}
+
+}
+
+bool is_callee_saved(int reg) {
+    for (int r: callee_saved_regs) {
+        if (r == reg) return true;
+    }
+    return false;
+}
+
+bool is_vector_reg(int reg) {
+    return reg >= XMM0 && reg < NUM_REGS;
+}
+
+// Vector registers are named by the size of the vector
+const char *reg_name(int reg, int size) {
+    if (is_vector_reg(reg))
+        return vector_reg_names[reg - XMM0][size == 32];
+    switch (size) {
+    case 1:  return reg_names[reg][0];
+    case 2:  return reg_names[reg][1];
+    case 4:  return reg_names[reg][2];
+    default: return reg_names[reg][3];
+    }
+}
+
+CondCode invert_cc(CondCode cc) {
+    switch (cc) {
+    case CC_E:  return CC_NE;
+    case CC_NE: return CC_E;
+    case CC_L:  return CC_GE;
+    case CC_LE: return CC_G;
+    case CC_G:  return CC_LE;
+    case CC_GE: return CC_L;
+    case CC_B:  return CC_AE;
+    case CC_BE: return CC_A;
+    case CC_A:  return CC_BE;
+    default:    return CC_B;
+    }
+}
+
+void MInstr::uses(std::vector<int> &regs) const {
+    for (auto &o: ops) mem_uses(o, regs);
+    switch (op) {
+    case M_MOV:
+    case M_MOVSX:
+    case M_MOVZX:
+    case M_LEA:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        break;
+    case M_XOR:
+        // Zeroing idiom, the old value doesn't matter
+        if (ops[0].kind == MOperand::REG && ops[1].kind == MOperand::REG &&
+            ops[0].reg == ops[1].reg)
+            break;
+        // fallthrough
+    case M_ADD:
+    case M_SUB:
+    case M_AND:
+    case M_OR:
+    case M_SHL:
+    case M_SHR:
+    case M_SAR:
+    case M_CMP:
+    case M_TEST:
+    case M_CMOV:
+        for (auto &o: ops) {
+            if (o.kind == MOperand::REG) regs.push_back(o.reg);
+        }
+        break;
+    case M_IMUL:
+        // The three operand form only reads its middle operand
+        for (size_t i = ops.size() == 3 ? 1 : 0; i < 2; i++) {
+            if (ops[i].kind == MOperand::REG) regs.push_back(ops[i].reg);
+        }
+        break;
+    case M_NEG:
+    case M_NOT:
+    case M_PUSH:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        break;
+    case M_CQO:
+        regs.push_back(RAX);
+        break;
+    case M_IDIV:
+    case M_DIV:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        regs.push_back(RAX);
+        regs.push_back(RDX);
+        break;
+    case M_CALL:
+    case M_TAILCALL:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        for (int i = 0; i < nargs; i++) regs.push_back(arg_regs[i]);
+        if (is_variadic) regs.push_back(RAX);
+        break;
+    case M_RET:
+        if (nargs) regs.push_back(RAX);
+        break;
+    case M_VMOV:
+    case M_MOVQ:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        break;
+    case M_VXOR:
+        if (ops[0].kind == MOperand::REG && ops[1].kind == MOperand::REG &&
+            ops[0].reg == ops[1].reg)
+            break;
+        // fallthrough
+    case M_VADD:
+    case M_VSUB:
+    case M_VMUL:
+    case M_VAND:
+    case M_VOR:
+    case M_VBCAST:
+        for (auto &o: ops) {
+            if (o.kind == MOperand::REG) regs.push_back(o.reg);
+        }
+        break;
+    case M_SETCC:
+    case M_JMP:
+    case M_JCC:
+    case M_POP:
+    case M_VZEROUPPER:
+        break;
+    }
+}
+
+void MInstr::defs(std::vector<int> &regs) const {
+    switch (op) {
+    case M_MOV:
+    case M_MOVSX:
+    case M_MOVZX:
+    case M_LEA:
+    case M_ADD:
+    case M_SUB:
+    case M_IMUL:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+    case M_SHL:
+    case M_SHR:
+    case M_SAR:
+    case M_CMOV:
+    case M_VMOV:
+    case M_VADD:
+    case M_VSUB:
+    case M_VMUL:
+    case M_VAND:
+    case M_VOR:
+    case M_VXOR:
+    case M_MOVQ:
+    case M_VBCAST:
+        if (ops.back().kind == MOperand::REG) regs.push_back(ops.back().reg);
+        break;
+    case M_NEG:
+    case M_NOT:
+    case M_SETCC:
+    case M_POP:
+        if (ops[0].kind == MOperand::REG) regs.push_back(ops[0].reg);
+        break;
+    case M_CQO:
+        regs.push_back(RDX);
+        break;
+    case M_IDIV:
+    case M_DIV:
+        regs.push_back(RAX);
+        regs.push_back(RDX);
+        break;
+    case M_CALL:
+        // None of the vector registers are preserved across calls
+        for (int r: caller_saved_regs) regs.push_back(r);
+        for (int r = XMM0; r < NUM_REGS; r++) regs.push_back(r);
+        break;
+    case M_CMP:
+    case M_TEST:
+    case M_JMP:
+    case M_JCC:
+    case M_RET:
+    case M_TAILCALL:
+    case M_PUSH:
+    case M_VZEROUPPER:
+        break;
+    }
+}
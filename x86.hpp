@@ -0,0 +1,200 @@
+#ifndef X86_HPP
+#define X86_HPP
+#include <memory>
+#include <string>
+#include <vector>
+class MBlock;
+
+// Physical registers, numbered as in the instruction encoding, the vector
+// registers from XMM0 on. Register operands at or above FIRST_VREG are
+// virtual, and get replaced by physical registers or stack slots during
+// register allocation.
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NUM_GPRS,
+    XMM0 = NUM_GPRS,
+    XMM14 = XMM0 + 14,
+    XMM15 = XMM0 + 15,
+    NUM_REGS,
+    FIRST_VREG = NUM_REGS,
+};
+
+enum CondCode {
+    CC_E,
+    CC_NE,
+    CC_L,
+    CC_LE,
+    CC_G,
+    CC_GE,
+    CC_B,
+    CC_BE,
+    CC_A,
+    CC_AE,
+};
+
+enum MOpcode {
+    M_MOV,
+    M_MOVSX,   // sign extend from @src_size to 64 bits
+    M_MOVZX,   // zero extend from @src_size to 64 bits
+    M_LEA,
+    M_ADD,
+    M_SUB,
+    M_IMUL,
+    M_AND,
+    M_OR,
+    M_XOR,
+    M_SHL,
+    M_SHR,
+    M_SAR,
+    M_NEG,
+    M_NOT,
+    M_CMP,
+    M_TEST,
+    M_CQO,
+    M_IDIV,
+    M_DIV,
+    M_SETCC,
+    // Move if the condition @cc holds, leaving the flags alone. Always 8
+    // bytes: a 32-bit cmov clears the upper half even when it doesn't move.
+    M_CMOV,
+    M_JMP,
+    M_JCC,
+    M_CALL,
+    M_RET,
+    // Leave for a function to return to our caller: reads the argument
+    // registers like M_CALL and ends the block like M_RET. The frame is
+    // torn down before it.
+    M_TAILCALL,
+    M_PUSH,
+    M_POP,
+    // Vector instructions. @size is the size of the vectors, 16 for the
+    // SSE2 forms and 32 for the AVX2 ones, and @src_size that of the lanes.
+    // The arithmetic is two-operand like the rest, dst = dst op src.
+    M_VMOV,
+    M_VADD,
+    M_VSUB,
+    M_VMUL,
+    M_VAND,
+    M_VOR,
+    M_VXOR,
+    M_MOVQ,         // a general purpose register to the low lane
+    M_VBCAST,       // the low 8 bytes of the register to all of it
+    M_VZEROUPPER,   // before leaving code using AVX2
+};
+
+struct MOperand {
+    enum Kind {
+        NONE,
+        REG,    // @reg
+        IMM,    // $@imm
+        MEM,    // @imm(@reg)
+        SLOT,   // frame slot @reg, plus @imm bytes
+        ARG,    // incoming stack argument @reg, numbered from the 7th
+        RIP,    // @sym+@imm(%rip)
+        SYM,    // @sym as a call target
+        BLOCK,  // @block as a jump target
+    };
+    Kind kind = NONE;
+    int reg = 0;
+    long imm = 0;
+    std::string sym;
+    MBlock *block = NULL;
+
+    static MOperand make_reg(int r) { MOperand o; o.kind = REG; o.reg = r; return o; }
+    static MOperand make_imm(long v) { MOperand o; o.kind = IMM; o.imm = v; return o; }
+    static MOperand make_mem(int r, long disp) {
+        MOperand o; o.kind = MEM; o.reg = r; o.imm = disp; return o;
+    }
+    static MOperand make_slot(int slot, long disp = 0) {
+        MOperand o; o.kind = SLOT; o.reg = slot; o.imm = disp; return o;
+    }
+    static MOperand make_arg(int n) { MOperand o; o.kind = ARG; o.reg = n; return o; }
+    static MOperand make_rip(const std::string &s) {
+        MOperand o; o.kind = RIP; o.sym = s; return o;
+    }
+    static MOperand make_sym(const std::string &s) {
+        MOperand o; o.kind = SYM; o.sym = s; return o;
+    }
+    static MOperand make_block(MBlock *b) {
+        MOperand o; o.kind = BLOCK; o.block = b; return o;
+    }
+    bool is_reg() const { return kind == REG; }
+    bool is_vreg() const { return kind == REG && reg >= FIRST_VREG; }
+    bool is_mem() const {
+        return kind == MEM || kind == SLOT || kind == ARG || kind == RIP;
+    }
+    // Whether @reg names a register read by the operand
+    bool uses_reg() const { return kind == REG || kind == MEM; }
+};
+
+// Instructions use AT&T operand order, source first. @size is the operand
+// size in bytes; M_MOVSX and M_MOVZX also have the size of the source.
+struct MInstr {
+    MOpcode op;
+    int size = 8;
+    int src_size = 8;
+    CondCode cc = CC_E;
+    // Number of argument registers read by a M_CALL or M_TAILCALL, and
+    // whether M_RET returns a value in %rax. A variadic call also reads %al.
+    int nargs = 0;
+    bool is_variadic = false;
+    std::vector<MOperand> ops;
+
+    MInstr(MOpcode op, int size = 8) : op(op), size(size) {}
+    // Registers read and written by the instruction, including implicit
+    // ones. Both lists may contain virtual registers.
+    void uses(std::vector<int> &regs) const;
+    void defs(std::vector<int> &regs) const;
+    bool is_jump() const { return op == M_JMP || op == M_JCC; }
+};
+
+class MBlock {
+public:
+    int id;
+    int loop_depth = 0;
+    std::vector<MInstr> instrs;
+    std::vector<MBlock *> succs;
+    MBlock(int id) : id(id) {}
+};
+
+class MFunction {
+public:
+    std::string name;
+    bool is_global = true;
+    std::vector<std::unique_ptr<MBlock>> blocks;
+    // Sizes and alignments of frame slots, both the local variables of the
+    // IR and the spill slots added by register allocation.
+    std::vector<std::pair<long, int>> slots;
+    int nvregs = 0;
+    // The size of the vector each virtual register holds, 0 for integers
+    std::vector<int> widths;
+    bool has_calls = false;
+    // Filled in by the frame layout
+    std::vector<int> saved_regs;
+
+    MBlock *new_block() {
+        blocks.emplace_back(std::make_unique<MBlock>(blocks.size()));
+        return blocks.back().get();
+    }
+    int new_vreg(int width = 0) {
+        widths.push_back(width);
+        return FIRST_VREG + nvregs++;
+    }
+    int width(int vreg) const {
+        size_t k = vreg - FIRST_VREG;
+        return k < widths.size() ? widths[k] : 0;
+    }
+    int new_slot(long size, int align) {
+        slots.emplace_back(size, align);
+        return slots.size() - 1;
+    }
+};
+
+extern const int arg_regs[6];
+extern const int callee_saved_regs[5];
+bool is_callee_saved(int reg);
+bool is_vector_reg(int reg);
+const char *reg_name(int reg, int size);
+CondCode invert_cc(CondCode cc);
+#endif